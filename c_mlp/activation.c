@@ -1,14 +1,16 @@
 #include<math.h>
 #include<stdlib.h>
 #include"activation.h"
+#include"activation_kernels.h"
 
 float sigmoid(float x) {
-    return 1.0 / (1.0 + exp(-x));
+    return 1.0f / (1.0f + fast_expf(-x));
 }
 
 float sigmoid_prime(float x) {
-    return sigmoid(x) * (1 - sigmoid(x));
-} 
+    float s = sigmoid(x);
+    return s * (1 - s);
+}
 
 float relu(float x) {
     return x > 0 ? x : 0;
@@ -19,74 +21,178 @@ float relu_prime(float x) {
 }
 
 float leaky_relu(float x) {
-    return x > 0 ? x : 0.01 * x;
+    return x > 0 ? x : LEAKY_RELU_SLOPE * x;
 }
 
 float leaky_relu_prime(float x) {
-    return x > 0 ? 1 : 0.01;
+    return x > 0 ? 1 : LEAKY_RELU_SLOPE;
 }
 
 float tanh_float(float x) {
-    return (exp(x) - exp(-x)) / (exp(x) + exp(-x));
+    return fast_tanhf(x);
 }
 
 float tanh_prime(float x) {
-    return 1 - tanh(x) * tanh(x);
+    float t = fast_tanhf(x);
+    return 1 - t * t;
 }
 
+// the vector forms run the SIMD kernels picked for this CPU, see activation_kernels.h
+
 void sigmoid_vector(float *input, float *output, size_t len) {
-    for (int i = 0; i < len; i++) {
-        output[i] = sigmoid(input[i]);
-    }
+    activation_kernels()->sigmoid(input, output, len);
 }
 
 void sigmoid_prime_vector(float *input, float *output, size_t len) {
-    for (int i = 0; i < len; i++) {
-        output[i] = sigmoid_prime(input[i]);
-    }
+    activation_kernels()->sigmoid_prime(input, output, len);
 }
 
 void relu_vector(float *input, float *output, size_t len) {
-    for (int i = 0; i < len; i++) {
-        output[i] = relu(input[i]);
-    }
+    activation_kernels()->relu(input, output, len);
 }
 
 void relu_prime_vector(float *input, float *output, size_t len) {
-    for (int i = 0; i < len; i++) {
-        output[i] = relu_prime(input[i]);
-    }
+    activation_kernels()->relu_prime(input, output, len);
+}
+
+void leaky_relu_vector(float *input, float *output, size_t len) {
+    activation_kernels()->leaky_relu(input, output, len);
+}
+
+void leaky_relu_prime_vector(float *input, float *output, size_t len) {
+    activation_kernels()->leaky_relu_prime(input, output, len);
+}
+
+void tanh_vector(float *input, float *output, size_t len) {
+    activation_kernels()->tanh(input, output, len);
+}
+
+void tanh_prime_vector(float *input, float *output, size_t len) {
+    activation_kernels()->tanh_prime(input, output, len);
 }
 
 void softmax(float *input, float *output, size_t len) {
-    float max = input[0];
-    float sum = 0.0;
+    activation_kernels()->softmax(input, output, len);
+}
 
-    for (int i = 1; i < len; ++i) {
-        if (input[i] > max) {
-            max = input[i];
-        }
+/*
+    Diagonal of the softmax Jacobian at the pre-activations, s * (1 - s) with s = softmax(input)
+    Softmax mixes the whole row, so unlike the other derivatives this is not enough for backprop:
+    activation_backward applies the full Jacobian for it.
+*/
+void softmax_prime(float *input, float *output, size_t len) {
+    softmax(input, output, len);
+    for (size_t i = 0; i < len; i++) {
+        output[i] = output[i] * (1.0f - output[i]);
+    }
+}
+
+// deltas = J^T deltas = s * (deltas - dot(deltas, s)), s is recomputed from the pre-activations instead of stored
+static void softmax_backward(float *pre, float *deltas, size_t len) {
+    float max = pre[0];
+    for (size_t i = 1; i < len; i++) {
+        max = pre[i] > max ? pre[i] : max;
+    }
+    float sum = 0.0f, dot = 0.0f;
+    for (size_t i = 0; i < len; i++) {
+        float e = fast_expf(pre[i] - max);
+        sum += e;
+        dot += e * deltas[i];
     }
+    float inv_sum = 1.0f / sum;
+    dot *= inv_sum;
+    for (size_t i = 0; i < len; i++) {
+        deltas[i] = fast_expf(pre[i] - max) * inv_sum * (deltas[i] - dot);
+    }
+}
 
-    for (int i = 0; i < len; ++i) {
-        output[i] = exp(input[i] - max);
-        sum += output[i];
+#define BACKWARD_CHUNK 64
+
+/*
+    Chain rule through an activation: deltas (len) *= f'(pre), or the Jacobian product for softmax
+    The derivative goes through a stack buffer a chunk at a time, so the deltas are multiplied while
+    both are in L1 and nothing is allocated. pre is not modified.
+*/
+void activation_backward(void (*activation_prime)(float*, float*, size_t), float *pre, float *deltas, size_t len) {
+    if (activation_prime == softmax_prime) {
+        softmax_backward(pre, deltas, len);
+        return;
     }
-    for (int i = 0; i < len; ++i) {
-        output[i] /= sum;
+    float derivative[BACKWARD_CHUNK];
+    for (size_t start = 0; start < len; start += BACKWARD_CHUNK) {
+        size_t n = len - start < BACKWARD_CHUNK ? len - start : BACKWARD_CHUNK;
+        activation_prime(pre + start, derivative, n);
+        for (size_t i = 0; i < n; i++) {
+            deltas[start + i] *= derivative[i];
+        }
     }
 }
 
-void softmax_prime(float *input, float *output, size_t len) {
-    for (int i = 0; i < len; i++) {
-        output[i] = input[i] * (1 - input[i]);
+// returns 0 for functions without an id
+int activation_id(void (*activation)(float*, float*, size_t)) {
+    if (activation == sigmoid_vector) return ACTIVATION_SIGMOID;
+    if (activation == relu_vector) return ACTIVATION_RELU;
+    if (activation == softmax) return ACTIVATION_SOFTMAX;
+    if (activation == tanh_vector) return ACTIVATION_TANH;
+    if (activation == leaky_relu_vector) return ACTIVATION_LEAKY_RELU;
+    return 0;
+}
+
+// looks up the activation and its derivative, returns -1 for unknown ids
+int activation_from_id(int id, void (**activation)(float*, float*, size_t), void (**activation_prime)(float*, float*, size_t)) {
+    switch (id) {
+    case ACTIVATION_SIGMOID:
+        *activation = sigmoid_vector;
+        *activation_prime = sigmoid_prime_vector;
+        return 0;
+    case ACTIVATION_RELU:
+        *activation = relu_vector;
+        *activation_prime = relu_prime_vector;
+        return 0;
+    case ACTIVATION_SOFTMAX:
+        *activation = softmax;
+        *activation_prime = softmax_prime;
+        return 0;
+    case ACTIVATION_TANH:
+        *activation = tanh_vector;
+        *activation_prime = tanh_prime_vector;
+        return 0;
+    case ACTIVATION_LEAKY_RELU:
+        *activation = leaky_relu_vector;
+        *activation_prime = leaky_relu_prime_vector;
+        return 0;
     }
+    return -1;
 }
 
+// softmax needs the whole row at once, every other activation works on any slice of it
+int activation_is_rowwise(void (*activation)(float*, float*, size_t)) {
+    return activation == softmax;
+}
 
-float **matrix_activation(float **M, int n, int m, void (*activation)(float*, float*, size_t)) {
-    for (int i = 0; i < n; i++) {
-        activation(M[i], M[i], m); 
+// applies the activation in place to every row of M
+Matrix matrix_activation(Matrix M, void (*activation)(float*, float*, size_t)) {
+    for (int i = 0; i < M.rows; i++) {
+        activation(matrix_row(M, i), matrix_row(M, i), M.cols);
     }
     return M;
-}
\ No newline at end of file
+}
+
+typedef struct {
+    Matrix M;
+    void (*activation)(float*, float*, size_t);
+} ActivationJob;
+
+static void activation_rows(void *arg, int begin, int end) {
+    ActivationJob *job = arg;
+    for (int i = begin; i < end; i++) {
+        job->activation(matrix_row(job->M, i), matrix_row(job->M, i), job->M.cols);
+    }
+}
+
+// same as matrix_activation with the rows split across the pool
+Matrix matrix_activation_parallel(ThreadPool *pool, Matrix M, void (*activation)(float*, float*, size_t)) {
+    ActivationJob job = { M, activation };
+    threadpool_parallel_for(pool, M.rows, activation_rows, &job);
+    return M;
+}
@@ -1,5 +1,7 @@
 // this is just for linking the activation functions to the neural network
 #include<math.h>
+#include"matrix.h"
+#include"threadpool.h"
 
 float sigmoid(float x);
 float sigmoid_prime(float x);
@@ -13,7 +15,23 @@ void sigmoid_vector(float *input, float *output, size_t len);
 void sigmoid_prime_vector(float *input, float *output, size_t len);
 void relu_vector(float *input, float *output, size_t len);
 void relu_prime_vector(float *input, float *output, size_t len);
+void leaky_relu_vector(float *input, float *output, size_t len);
+void leaky_relu_prime_vector(float *input, float *output, size_t len);
+void tanh_vector(float *input, float *output, size_t len);
+void tanh_prime_vector(float *input, float *output, size_t len);
 void softmax(float *input, float *output, size_t len);
 void softmax_prime(float *input, float *output, size_t len);
-float **matrix_softmax_activation(float **M, int n, int m);
-float **matrix_activation(float **M, int m, int n, void (*activation)(float*, float*, size_t));
\ No newline at end of file
+void activation_backward(void (*activation_prime)(float*, float*, size_t), float *pre, float *deltas, size_t len);
+
+// stable ids for the vector activations, used by checkpoints in place of function pointers
+#define ACTIVATION_SIGMOID 1
+#define ACTIVATION_RELU 2
+#define ACTIVATION_SOFTMAX 3
+#define ACTIVATION_TANH 4
+#define ACTIVATION_LEAKY_RELU 5
+
+int activation_id(void (*activation)(float*, float*, size_t));
+int activation_from_id(int id, void (**activation)(float*, float*, size_t), void (**activation_prime)(float*, float*, size_t));
+int activation_is_rowwise(void (*activation)(float*, float*, size_t));
+Matrix matrix_activation(Matrix M, void (*activation)(float*, float*, size_t));
+Matrix matrix_activation_parallel(ThreadPool *pool, Matrix M, void (*activation)(float*, float*, size_t));
\ No newline at end of file
@@ -0,0 +1,299 @@
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include"activation_kernels.h"
+
+static void sigmoid_scalar(float *input, float *output, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        output[i] = 1.0f / (1.0f + fast_expf(-input[i]));
+    }
+}
+
+// s * (1 - s) cancels once s rounds to 1, e / (1 + e)^2 with e = exp(-|x|) stays accurate in the tails
+static void sigmoid_prime_scalar(float *input, float *output, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        float e = fast_expf(-fabsf(input[i]));
+        output[i] = e / ((1.0f + e) * (1.0f + e));
+    }
+}
+
+static void tanh_scalar(float *input, float *output, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        output[i] = fast_tanhf(input[i]);
+    }
+}
+
+// likewise 4e / (1 + e)^2 with e = exp(-2|x|) instead of 1 - tanh^2
+static void tanh_prime_scalar(float *input, float *output, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        float e = fast_expf(-2.0f * fabsf(input[i]));
+        output[i] = 4.0f * e / ((1.0f + e) * (1.0f + e));
+    }
+}
+
+static void relu_scalar(float *input, float *output, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        output[i] = input[i] > 0 ? input[i] : 0.0f;
+    }
+}
+
+static void relu_prime_scalar(float *input, float *output, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        output[i] = input[i] > 0 ? 1.0f : 0.0f;
+    }
+}
+
+static void leaky_relu_scalar(float *input, float *output, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        output[i] = input[i] > 0 ? input[i] : LEAKY_RELU_SLOPE * input[i];
+    }
+}
+
+static void leaky_relu_prime_scalar(float *input, float *output, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        output[i] = input[i] > 0 ? 1.0f : LEAKY_RELU_SLOPE;
+    }
+}
+
+static void softmax_scalar(float *input, float *output, size_t len) {
+    float max = input[0];
+    for (size_t i = 1; i < len; i++) {
+        if (input[i] > max) {
+            max = input[i];
+        }
+    }
+    float sum = 0.0f;
+    for (size_t i = 0; i < len; i++) {
+        output[i] = fast_expf(input[i] - max);
+        sum += output[i];
+    }
+    float inv_sum = 1.0f / sum;
+    for (size_t i = 0; i < len; i++) {
+        output[i] *= inv_sum;
+    }
+}
+
+const ActivationKernels activation_kernels_scalar = {
+    "scalar",
+    sigmoid_scalar, sigmoid_prime_scalar,
+    tanh_scalar, tanh_prime_scalar,
+    relu_scalar, relu_prime_scalar,
+    leaky_relu_scalar, leaky_relu_prime_scalar,
+    softmax_scalar
+};
+
+#ifdef ACTIVATION_HAVE_AVX2
+#include<immintrin.h>
+
+// the AVX2 kernels do 8 floats at a time and hand the remainder to the scalar kernel
+
+__attribute__((target("avx2,fma")))
+static inline __m256 exp_avx2(__m256 x) {
+    __m256 underflow = _mm256_cmp_ps(x, _mm256_set1_ps(EXP_MIN), _CMP_LT_OQ);
+    // the bound goes first so NaN, which min and max return from their second operand, passes through
+    x = _mm256_min_ps(_mm256_set1_ps(EXP_MAX), _mm256_max_ps(_mm256_set1_ps(EXP_MIN), x));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(EXP_LOG2E)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_LN2_HI), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(EXP_LN2_LO), r);
+    __m256 p = _mm256_set1_ps(EXP_P0);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(EXP_P5));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+    __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_andnot_ps(underflow, _mm256_mul_ps(p, _mm256_castsi256_ps(bits)));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 sigmoid_avx2_ps(__m256 x) {
+    __m256 one = _mm256_set1_ps(1.0f);
+    return _mm256_div_ps(one, _mm256_add_ps(one, exp_avx2(_mm256_sub_ps(_mm256_setzero_ps(), x))));
+}
+
+__attribute__((target("avx2,fma")))
+static inline __m256 tanh_avx2_ps(__m256 x) {
+    __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 a = _mm256_andnot_ps(sign, x);
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 p = _mm256_set1_ps(TANH_P0);
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(TANH_P1));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(TANH_P2));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(TANH_P3));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(TANH_P4));
+    __m256 small = _mm256_fmadd_ps(_mm256_mul_ps(x, z), p, x);
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 e = exp_avx2(_mm256_add_ps(a, a));
+    __m256 large = _mm256_sub_ps(one, _mm256_div_ps(_mm256_set1_ps(2.0f), _mm256_add_ps(e, one)));
+    large = _mm256_or_ps(large, _mm256_and_ps(sign, x));
+    return _mm256_blendv_ps(large, small, _mm256_cmp_ps(a, _mm256_set1_ps(TANH_SMALL), _CMP_LT_OQ));
+}
+
+__attribute__((target("avx2,fma")))
+static float hmax_avx2(__m256 v) {
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+__attribute__((target("avx2,fma")))
+static float hsum_avx2(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+static void sigmoid_avx2(float *input, float *output, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        _mm256_storeu_ps(output + i, sigmoid_avx2_ps(_mm256_loadu_ps(input + i)));
+    }
+    sigmoid_scalar(input + i, output + i, len - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void sigmoid_prime_avx2(float *input, float *output, size_t len) {
+    size_t i = 0;
+    __m256 one = _mm256_set1_ps(1.0f);
+    for (; i + 8 <= len; i += 8) {
+        __m256 e = exp_avx2(_mm256_or_ps(_mm256_loadu_ps(input + i), _mm256_set1_ps(-0.0f)));
+        __m256 d = _mm256_add_ps(one, e);
+        _mm256_storeu_ps(output + i, _mm256_div_ps(e, _mm256_mul_ps(d, d)));
+    }
+    sigmoid_prime_scalar(input + i, output + i, len - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void tanh_avx2(float *input, float *output, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        _mm256_storeu_ps(output + i, tanh_avx2_ps(_mm256_loadu_ps(input + i)));
+    }
+    tanh_scalar(input + i, output + i, len - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void tanh_prime_avx2(float *input, float *output, size_t len) {
+    size_t i = 0;
+    __m256 one = _mm256_set1_ps(1.0f);
+    for (; i + 8 <= len; i += 8) {
+        __m256 x = _mm256_or_ps(_mm256_loadu_ps(input + i), _mm256_set1_ps(-0.0f));
+        __m256 e = exp_avx2(_mm256_add_ps(x, x));
+        __m256 d = _mm256_add_ps(one, e);
+        _mm256_storeu_ps(output + i, _mm256_div_ps(_mm256_mul_ps(_mm256_set1_ps(4.0f), e), _mm256_mul_ps(d, d)));
+    }
+    tanh_prime_scalar(input + i, output + i, len - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void relu_avx2(float *input, float *output, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        // zero second, so NaN becomes 0 like in the scalar kernel
+        _mm256_storeu_ps(output + i, _mm256_max_ps(_mm256_loadu_ps(input + i), _mm256_setzero_ps()));
+    }
+    relu_scalar(input + i, output + i, len - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void relu_prime_avx2(float *input, float *output, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m256 positive = _mm256_cmp_ps(_mm256_loadu_ps(input + i), _mm256_setzero_ps(), _CMP_GT_OQ);
+        _mm256_storeu_ps(output + i, _mm256_and_ps(positive, _mm256_set1_ps(1.0f)));
+    }
+    relu_prime_scalar(input + i, output + i, len - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void leaky_relu_avx2(float *input, float *output, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m256 x = _mm256_loadu_ps(input + i);
+        __m256 positive = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GT_OQ);
+        _mm256_storeu_ps(output + i, _mm256_blendv_ps(_mm256_mul_ps(x, _mm256_set1_ps(LEAKY_RELU_SLOPE)), x, positive));
+    }
+    leaky_relu_scalar(input + i, output + i, len - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void leaky_relu_prime_avx2(float *input, float *output, size_t len) {
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        __m256 positive = _mm256_cmp_ps(_mm256_loadu_ps(input + i), _mm256_setzero_ps(), _CMP_GT_OQ);
+        _mm256_storeu_ps(output + i, _mm256_blendv_ps(_mm256_set1_ps(LEAKY_RELU_SLOPE), _mm256_set1_ps(1.0f), positive));
+    }
+    leaky_relu_prime_scalar(input + i, output + i, len - i);
+}
+
+__attribute__((target("avx2,fma")))
+static void softmax_avx2(float *input, float *output, size_t len) {
+    size_t i = 0;
+    float max = input[0];
+    if (len >= 8) {
+        __m256 vmax = _mm256_loadu_ps(input);
+        for (i = 8; i + 8 <= len; i += 8) {
+            vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(input + i));
+        }
+        max = hmax_avx2(vmax);
+    }
+    for (; i < len; i++) {
+        if (input[i] > max) {
+            max = input[i];
+        }
+    }
+
+    // subtract, exponentiate, store and sum in one pass
+    __m256 vmax = _mm256_set1_ps(max);
+    __m256 vsum = _mm256_setzero_ps();
+    for (i = 0; i + 8 <= len; i += 8) {
+        __m256 e = exp_avx2(_mm256_sub_ps(_mm256_loadu_ps(input + i), vmax));
+        _mm256_storeu_ps(output + i, e);
+        vsum = _mm256_add_ps(vsum, e);
+    }
+    float sum = hsum_avx2(vsum);
+    for (; i < len; i++) {
+        output[i] = fast_expf(input[i] - max);
+        sum += output[i];
+    }
+
+    __m256 inv_sum = _mm256_set1_ps(1.0f / sum);
+    for (i = 0; i + 8 <= len; i += 8) {
+        _mm256_storeu_ps(output + i, _mm256_mul_ps(_mm256_loadu_ps(output + i), inv_sum));
+    }
+    for (; i < len; i++) {
+        output[i] *= 1.0f / sum;
+    }
+}
+
+const ActivationKernels activation_kernels_avx2 = {
+    "avx2",
+    sigmoid_avx2, sigmoid_prime_avx2,
+    tanh_avx2, tanh_prime_avx2,
+    relu_avx2, relu_prime_avx2,
+    leaky_relu_avx2, leaky_relu_prime_avx2,
+    softmax_avx2
+};
+#endif
+
+static const ActivationKernels *active_kernels = NULL;
+
+// AVX2 when the CPU has it, MLP_ACTIVATION_KERNEL=scalar forces the portable kernels
+const ActivationKernels *activation_kernels() {
+    if (active_kernels == NULL) {
+        const ActivationKernels *kernels = &activation_kernels_scalar;
+#ifdef ACTIVATION_HAVE_AVX2
+        const char *name = getenv("MLP_ACTIVATION_KERNEL");
+        __builtin_cpu_init();
+        if ((name == NULL || strcmp(name, "scalar") != 0) && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            kernels = &activation_kernels_avx2;
+        }
+#endif
+        active_kernels = kernels;
+    }
+    return active_kernels;
+}
@@ -0,0 +1,57 @@
+#include<string.h>
+#include"allreduce.h"
+
+typedef struct {
+    float **buffers;
+    int num_buffers;
+    size_t n;
+    int step;
+} RingArgs;
+
+// chunk boundaries fall on 16 float (64 byte) boundaries, the last chunk takes the remainder
+static size_t chunk_start(const RingArgs *args, int chunk) {
+    if (chunk == args->num_buffers) {
+        return args->n;
+    }
+    return args->n / 16 * chunk / args->num_buffers * 16;
+}
+
+static int ring_index(int i, int num_buffers) {
+    return ((i % num_buffers) + num_buffers) % num_buffers;
+}
+
+// buffer r adds chunk r - step - 1 of its left neighbour
+static void reduce_scatter_step(void *arg, int begin, int end) {
+    RingArgs *args = arg;
+    for (int r = begin; r < end; r++) {
+        int chunk = ring_index(r - args->step - 1, args->num_buffers);
+        size_t start = chunk_start(args, chunk), stop = chunk_start(args, chunk + 1);
+        float *dst = args->buffers[r];
+        const float *src = args->buffers[ring_index(r - 1, args->num_buffers)];
+        for (size_t i = start; i < stop; i++) {
+            dst[i] += src[i];
+        }
+    }
+}
+
+// buffer r copies the complete chunk r - step from its left neighbour
+static void all_gather_step(void *arg, int begin, int end) {
+    RingArgs *args = arg;
+    for (int r = begin; r < end; r++) {
+        int chunk = ring_index(r - args->step, args->num_buffers);
+        size_t start = chunk_start(args, chunk), stop = chunk_start(args, chunk + 1);
+        const float *src = args->buffers[ring_index(r - 1, args->num_buffers)];
+        memcpy(args->buffers[r] + start, src + start, (stop - start) * sizeof(float));
+    }
+}
+
+void ring_allreduce(ThreadPool *pool, float **buffers, int num_buffers, size_t n) {
+    RingArgs args = { buffers, num_buffers, n, 0 };
+    // each parallel_for returns once every buffer is done, which is the barrier between steps
+    for (args.step = 0; args.step < num_buffers - 1; args.step++) {
+        threadpool_parallel_for(pool, num_buffers, reduce_scatter_step, &args);
+    }
+    for (args.step = 0; args.step < num_buffers - 1; args.step++) {
+        threadpool_parallel_for(pool, num_buffers, all_gather_step, &args);
+    }
+}
@@ -0,0 +1,17 @@
+#ifndef ALLREDUCE_H
+#define ALLREDUCE_H
+#include<stddef.h>
+#include"threadpool.h"
+
+/*
+    Sums num_buffers equally sized buffers in place, every buffer ends up holding the total
+    The buffers are split into num_buffers chunks and passed around a ring: in each of num_buffers - 1
+    reduce-scatter steps every buffer adds one chunk from its left neighbour, after which buffer r owns
+    the complete chunk r + 1; num_buffers - 1 all-gather steps then copy the complete chunks around.
+    Every step touches n / num_buffers floats per buffer, run one buffer per thread of the pool, and
+    the chunks written and read within a step never overlap.
+    Results only depend on num_buffers, not on the pool size.
+*/
+void ring_allreduce(ThreadPool *pool, float **buffers, int num_buffers, size_t n);
+
+#endif
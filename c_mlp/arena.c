@@ -0,0 +1,50 @@
+#include<stdlib.h>
+#include<stdio.h>
+#include"arena.h"
+#include"profile.h"
+
+static size_t align_up(size_t bytes) {
+    return (bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+void arena_init(Arena *arena, size_t capacity) {
+    arena->capacity = align_up(capacity > 0 ? capacity : 1);
+    arena->used = 0;
+    arena->base = aligned_alloc(MATRIX_ALIGNMENT, arena->capacity);
+    PROFILE_ALLOCATION(arena->capacity);
+    if (arena->base == NULL) {
+        fprintf(stderr, "Could not allocate %zu byte arena\n", arena->capacity);
+        exit(1);
+    }
+}
+
+void arena_free(Arena *arena) {
+    free(arena->base);
+    arena->base = NULL;
+    arena->capacity = arena->used = 0;
+}
+
+void arena_reset(Arena *arena) {
+    arena->used = 0;
+}
+
+// every block starts on a MATRIX_ALIGNMENT boundary
+void *arena_alloc(Arena *arena, size_t bytes) {
+    bytes = align_up(bytes);
+    if (arena->used + bytes > arena->capacity) {
+        fprintf(stderr, "Arena exhausted: %zu of %zu bytes used, %zu requested\n", arena->used, arena->capacity, bytes);
+        exit(1);
+    }
+    void *block = arena->base + arena->used;
+    arena->used += bytes;
+    return block;
+}
+
+// space an m x n matrix takes in an arena, for sizing one up front
+size_t arena_matrix_bytes(int m, int n) {
+    return align_up((size_t)m * n * sizeof(float));
+}
+
+Matrix arena_matrix(Arena *arena, int m, int n) {
+    return matrix_view(arena_alloc(arena, (size_t)m * n * sizeof(float)), m, n, n);
+}
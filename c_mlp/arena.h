@@ -0,0 +1,23 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include<stddef.h>
+#include"matrix.h"
+
+/*
+    Bump allocator over one aligned block
+    Everything carved out of it is freed at once by arena_free, or recycled by arena_reset.
+*/
+typedef struct {
+    char *base;
+    size_t capacity;
+    size_t used;
+} Arena;
+
+void arena_init(Arena *arena, size_t capacity);
+void arena_free(Arena *arena);
+void arena_reset(Arena *arena);
+void *arena_alloc(Arena *arena, size_t bytes);
+size_t arena_matrix_bytes(int m, int n);
+Matrix arena_matrix(Arena *arena, int m, int n);
+
+#endif
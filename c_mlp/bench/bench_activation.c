@@ -0,0 +1,200 @@
+/*
+    Elements per second of the activation kernels against the double precision exp() versions they
+    replaced, and their max error in ULP against a double precision reference
+    Build from c_mlp/:
+        gcc -O2 -I. bench/bench_activation.c activation.c activation_kernels.c matrix.c threadpool.c -o bench_activation -lm -lpthread
+    Usage: ./bench_activation [num_elements] [repeats]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<time.h>
+#include"activation.h"
+#include"activation_kernels.h"
+#include"bench_common.h"
+
+// the previous implementations, one double precision exp() (or four, for tanh) per element
+
+static float sigmoid_old(float x) {
+    return 1.0 / (1.0 + exp(-x));
+}
+
+static void sigmoid_vector_old(float *input, float *output, size_t len) {
+    for (int i = 0; i < len; i++) {
+        output[i] = sigmoid_old(input[i]);
+    }
+}
+
+static void sigmoid_prime_vector_old(float *input, float *output, size_t len) {
+    for (int i = 0; i < len; i++) {
+        output[i] = sigmoid_old(input[i]) * (1 - sigmoid_old(input[i]));
+    }
+}
+
+static void tanh_vector_old(float *input, float *output, size_t len) {
+    for (int i = 0; i < len; i++) {
+        float x = input[i];
+        output[i] = (exp(x) - exp(-x)) / (exp(x) + exp(-x));
+    }
+}
+
+static void tanh_prime_vector_old(float *input, float *output, size_t len) {
+    for (int i = 0; i < len; i++) {
+        output[i] = 1 - tanh(input[i]) * tanh(input[i]);
+    }
+}
+
+static void relu_vector_old(float *input, float *output, size_t len) {
+    for (int i = 0; i < len; i++) {
+        output[i] = input[i] > 0 ? input[i] : 0;
+    }
+}
+
+static void leaky_relu_vector_old(float *input, float *output, size_t len) {
+    for (int i = 0; i < len; i++) {
+        output[i] = input[i] > 0 ? input[i] : 0.01 * input[i];
+    }
+}
+
+static void softmax_old(float *input, float *output, size_t len) {
+    float max = input[0];
+    float sum = 0.0;
+    for (int i = 1; i < len; ++i) {
+        if (input[i] > max) {
+            max = input[i];
+        }
+    }
+    for (int i = 0; i < len; ++i) {
+        output[i] = exp(input[i] - max);
+        sum += output[i];
+    }
+    for (int i = 0; i < len; ++i) {
+        output[i] /= sum;
+    }
+}
+
+// double precision references for the error measurement
+
+static double sigmoid_ref(double x) { return 1.0 / (1.0 + exp(-x)); }
+static double sigmoid_prime_ref(double x) { double s = sigmoid_ref(x); return s * (1 - s); }
+static double tanh_prime_ref(double x) { return 1 - tanh(x) * tanh(x); }
+
+static void exp_kernel(float *input, float *output, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        output[i] = fast_expf(input[i]);
+    }
+}
+
+// distance in units in the last place between a result and the correctly rounded reference
+static double ulp_error(float value, double reference) {
+    float rounded = (float)reference;
+    if (value == rounded) {
+        return 0;
+    }
+    float ulp = nextafterf(fabsf(rounded), INFINITY) - fabsf(rounded);
+    return fabs(value - reference) / ulp;
+}
+
+static double max_ulp(activation_kernel kernel, double (*reference)(double), float lo, float hi, int n) {
+    float *x = malloc(n * sizeof(float));
+    float *y = malloc(n * sizeof(float));
+    for (int i = 0; i < n; i++) {
+        x[i] = lo + (hi - lo) * i / (n - 1);
+    }
+    kernel(x, y, n);
+    double worst = 0;
+    for (int i = 0; i < n; i++) {
+        double e = ulp_error(y[i], reference(x[i]));
+        if (e > worst) {
+            worst = e;
+        }
+    }
+    free(x);
+    free(y);
+    return worst;
+}
+
+// softmax is timed row by row, the shape it runs in on the output layer
+static void softmax_rows(activation_kernel softmax_row, float *input, float *output, size_t len, size_t row) {
+    for (size_t i = 0; i + row <= len; i += row) {
+        softmax_row(input + i, output + i, row);
+    }
+}
+
+static double elements_per_second(activation_kernel kernel, float *input, float *output, size_t len, int repeats, size_t softmax_row) {
+    double start = now_seconds();
+    for (int r = 0; r < repeats; r++) {
+        if (softmax_row > 0) {
+            softmax_rows(kernel, input, output, len, softmax_row);
+        } else {
+            kernel(input, output, len);
+        }
+    }
+    return (double)len * repeats / (now_seconds() - start);
+}
+
+typedef struct {
+    const char *name;
+    activation_kernel old, scalar;
+    activation_kernel avx2;
+    size_t softmax_row;
+} Case;
+
+int main(int argc, char **argv) {
+    size_t len = argc > 1 ? atol(argv[1]) : 1 << 16;
+    int repeats = argc > 2 ? atoi(argv[2]) : 200;
+
+    float *input = malloc(len * sizeof(float));
+    float *output = malloc(len * sizeof(float));
+    srand(42);
+    for (size_t i = 0; i < len; i++) {
+        input[i] = 8.0f * rand() / RAND_MAX - 4.0f;
+    }
+
+    const ActivationKernels *s = &activation_kernels_scalar;
+#ifdef ACTIVATION_HAVE_AVX2
+    const ActivationKernels *v = &activation_kernels_avx2;
+    int have_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+    const ActivationKernels *v = s;
+    int have_avx2 = 0;
+#endif
+    Case cases[] = {
+        { "sigmoid", sigmoid_vector_old, s->sigmoid, v->sigmoid, 0 },
+        { "sigmoid_prime", sigmoid_prime_vector_old, s->sigmoid_prime, v->sigmoid_prime, 0 },
+        { "tanh", tanh_vector_old, s->tanh, v->tanh, 0 },
+        { "tanh_prime", tanh_prime_vector_old, s->tanh_prime, v->tanh_prime, 0 },
+        { "relu", relu_vector_old, s->relu, v->relu, 0 },
+        { "leaky_relu", leaky_relu_vector_old, s->leaky_relu, v->leaky_relu, 0 },
+        { "softmax/10", softmax_old, s->softmax, v->softmax, 10 },
+        { "softmax/1024", softmax_old, s->softmax, v->softmax, 1024 },
+    };
+    int num_cases = sizeof(cases) / sizeof(cases[0]);
+
+    printf("%d elements x %d repeats, Melem/s\n", (int)len, repeats);
+    printf("%-14s %10s %10s %10s %9s\n", "activation", "old", "scalar", have_avx2 ? "avx2" : "-", "speedup");
+    for (int i = 0; i < num_cases; i++) {
+        double old = elements_per_second(cases[i].old, input, output, len, repeats, cases[i].softmax_row);
+        double scalar = elements_per_second(cases[i].scalar, input, output, len, repeats, cases[i].softmax_row);
+        double avx2 = have_avx2 ? elements_per_second(cases[i].avx2, input, output, len, repeats, cases[i].softmax_row) : 0;
+        double best = avx2 > scalar ? avx2 : scalar;
+        printf("%-14s %10.1f %10.1f %10.1f %8.1fx\n", cases[i].name, old / 1e6, scalar / 1e6, avx2 / 1e6, best / old);
+    }
+
+    int n = 1 << 22;
+    printf("\nmax error against double precision, ULP (scalar / %s)\n", have_avx2 ? "avx2" : "-");
+    printf("%-14s %8.2f\n", "exp", max_ulp(exp_kernel, exp, EXP_MIN, EXP_MAX - 0.01f, n));
+    printf("%-14s %8.2f / %.2f\n", "sigmoid", max_ulp(s->sigmoid, sigmoid_ref, -20, 20, n),
+           have_avx2 ? max_ulp(v->sigmoid, sigmoid_ref, -20, 20, n) : 0);
+    printf("%-14s %8.2f / %.2f\n", "sigmoid_prime", max_ulp(s->sigmoid_prime, sigmoid_prime_ref, -20, 20, n),
+           have_avx2 ? max_ulp(v->sigmoid_prime, sigmoid_prime_ref, -20, 20, n) : 0);
+    printf("%-14s %8.2f / %.2f\n", "tanh", max_ulp(s->tanh, tanh, -10, 10, n),
+           have_avx2 ? max_ulp(v->tanh, tanh, -10, 10, n) : 0);
+    printf("%-14s %8.2f / %.2f\n", "tanh_prime", max_ulp(s->tanh_prime, tanh_prime_ref, -10, 10, n),
+           have_avx2 ? max_ulp(v->tanh_prime, tanh_prime_ref, -10, 10, n) : 0);
+
+    free(input);
+    free(output);
+    return 0;
+}
@@ -0,0 +1,105 @@
+/*
+    Counts heap allocations made by steady-state training steps, validation passes and inference calls
+    malloc and friends are wrapped at link time, so every allocation in the process is seen,
+    including ones from libc. Exits non-zero if a steady-state step allocates.
+    Build from c_mlp/:
+        gcc -O2 -I. bench/bench_alloc.c allreduce.c inference.c evaluate.c mlp.c optimizer.c gemm.c gemm_kernels.c bf16.c sparse.c matrix.c arena.c dataset.c loader.c threadpool.c activation.c activation_kernels.c loss.c -o bench_alloc -lm -lpthread \
+            -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc,--wrap=aligned_alloc,--wrap=posix_memalign
+    Usage: ./bench_alloc [num_steps] [batch_size] [mixed_precision]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"gemm.h"
+#include"inference.h"
+#include"bench_common.h"
+
+static long allocations = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void *__real_aligned_alloc(size_t alignment, size_t size);
+int __real_posix_memalign(void **ptr, size_t alignment, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+void *__wrap_aligned_alloc(size_t alignment, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_aligned_alloc(alignment, size);
+}
+
+int __wrap_posix_memalign(void **ptr, size_t alignment, size_t size) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    return __real_posix_memalign(ptr, alignment, size);
+}
+
+int main(int argc, char **argv) {
+    int num_steps = argc > 1 ? atoi(argv[1]) : 100;
+    int batch_size = argc > 2 ? atoi(argv[2]) : 32;
+    int mixed_precision = argc > 3 ? atoi(argv[3]) : 0;
+    int num_samples = num_steps * batch_size;
+
+    Matrix inputs = allocate_matrix(num_samples, 784);
+    Matrix targets = allocate_matrix(num_samples, 10);
+    synthetic_mnist(inputs, targets, 42);
+    Dataset *dataset = dataset_from_matrices(inputs, targets);
+
+    int num_neurons[] = {64, 32, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+    mlp_set_mixed_precision(mlp, mixed_precision);
+
+    // warm-up: sizes the workspace, the GEMM packing buffers and stdout's buffer
+    batch_backward(mlp, matrix_row_view(inputs, 0, batch_size), matrix_row_view(targets, 0, batch_size));
+    validate(mlp, dataset, batch_size);
+    void *scratch = aligned_alloc(MATRIX_ALIGNMENT, mlp_inference_scratch_bytes(mlp, batch_size));
+    int *predictions = malloc(batch_size * sizeof(int));
+    mlp_infer(mlp, matrix_row_view(inputs, 0, batch_size), scratch, predictions);
+
+    long before = allocations;
+    for (int i = 0; i < num_steps; i++) {
+        batch_backward(mlp, matrix_row_view(inputs, i * batch_size, batch_size), matrix_row_view(targets, i * batch_size, batch_size));
+    }
+    long training = allocations - before;
+
+    before = allocations;
+    validate(mlp, dataset, batch_size);
+    long validation = allocations - before;
+
+    before = allocations;
+    for (int i = 0; i < num_steps; i++) {
+        mlp_infer(mlp, matrix_row_view(inputs, i, 1), scratch, predictions);
+        mlp_infer(mlp, matrix_row_view(inputs, i * batch_size, batch_size), scratch, predictions);
+    }
+    long inference = allocations - before;
+
+    printf("heap allocations in %d training steps: %ld\n", num_steps, training);
+    printf("heap allocations in a validation pass: %ld\n", validation);
+    printf("heap allocations in %d inference calls: %ld\n", 2 * num_steps, inference);
+
+    free(scratch);
+    free(predictions);
+    mlp_free(mlp);
+    dataset_close(dataset);
+    free_matrix(inputs);
+    free_matrix(targets);
+    return training != 0 || validation != 0 || inference != 0;
+}
@@ -0,0 +1,206 @@
+/*
+    Training step times with no checkpoints, with mlp_save inside the loop and with the background writer
+    Trains a 784-H-H-10 network with Adam on synthetic MNIST-like data three times from the same
+    initial weights, checkpointing every interval steps, and reports the distribution of step times:
+    the steps that checkpoint show the stall. Runs the loop train runs (checkpoint_writer_step after
+    every optimizer step) so each step can be timed. Checks that the background writer's last file is
+    byte for byte the one mlp_save wrote at the same step, that only keep_last files are left, and that
+    a corrupted file fails its checksum.
+    Build from c_mlp/:
+        make bench_async_checkpoint
+    Usage: ./bench_async_checkpoint [steps] [interval] [hidden] [directory]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<dirent.h>
+#include<unistd.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"checkpoint.h"
+#include"bench_common.h"
+
+#define SAMPLES 4096
+#define BATCH 64
+#define KEEP_LAST 3
+
+#define NONE 0
+#define SYNCHRONOUS 1
+#define BACKGROUND 2
+
+static MLP *create_model(int hidden) {
+    int num_neurons[] = {hidden, hidden, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.001, 784);
+    mlp_init_weights(mlp, 42);
+    mlp_set_optimizer(mlp, optimizer_adam(0.001, 0.9, 0.999, 1e-8));
+    return mlp;
+}
+
+// trains for steps optimizer steps, recording each step's time in milliseconds
+static void run(MLP *mlp, Dataset *dataset, int steps, int interval, int mode, const char *path, double *step_ms) {
+    DataLoader *loader = loader_create(dataset, BATCH, 1, 7);
+    mlp_reserve_workspace(mlp, BATCH);
+    Matrix inputs, targets;
+    for (int step = 0, epoch = 0; step < steps; epoch++) {
+        loader_start_epoch(loader, epoch);
+        while (step < steps && loader_next(loader, &inputs, &targets) > 0) {
+            double start = now_seconds();
+            mlp_compute_gradients_sparse(mlp, inputs, loader_sparse_inputs(loader), targets);
+            mlp_apply_gradients(mlp);
+            if (mode == SYNCHRONOUS && (step + 1) % interval == 0) {
+                mlp_save(mlp, path);
+            } else if (mode == BACKGROUND) {
+                checkpoint_writer_step(mlp->checkpoints, mlp);
+            }
+            step_ms[step++] = (now_seconds() - start) * 1e3;
+        }
+    }
+    loader_free(loader);
+}
+
+static void report(const char *label, double *step_ms, int steps, int interval) {
+    double total = 0, checkpoint_steps = 0;
+    for (int i = 0; i < steps; i++) {
+        total += step_ms[i];
+        checkpoint_steps += (i + 1) % interval == 0 ? step_ms[i] : 0;
+    }
+    int count = steps / interval;
+    BenchStats stats = bench_stats(step_ms, steps);
+    printf("%-24s %10.3f %10.3f %10.3f %10.3f %12.3f %10.3f\n", label, stats.mean, stats.median, percentile(step_ms, steps, 0.99),
+           stats.max, count > 0 ? checkpoint_steps / count : 0, total * 1e-3);
+}
+
+static long file_size(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+static int same_file(const char *a, const char *b) {
+    FILE *x = fopen(a, "rb"), *y = fopen(b, "rb");
+    int same = x != NULL && y != NULL;
+    char p[65536], q[65536];
+    while (same) {
+        size_t n = fread(p, 1, sizeof(p), x), m = fread(q, 1, sizeof(q), y);
+        same = n == m && memcmp(p, q, n) == 0;
+        if (n == 0) {
+            break;
+        }
+    }
+    if (x != NULL) {
+        fclose(x);
+    }
+    if (y != NULL) {
+        fclose(y);
+    }
+    return same;
+}
+
+int main(int argc, char **argv) {
+    int steps = argc > 1 ? atoi(argv[1]) : 600;
+    int interval = argc > 2 ? atoi(argv[2]) : 50;
+    int hidden = argc > 3 ? atoi(argv[3]) : 1024;
+    char directory[256];
+    snprintf(directory, sizeof(directory), "%s/bench_async_checkpoint_XXXXXX", argc > 4 ? argv[4] : "/tmp");
+    if (mkdtemp(directory) == NULL) {
+        fprintf(stderr, "Could not create a directory in %s\n", argc > 4 ? argv[4] : "/tmp");
+        return 1;
+    }
+    char sync_path[512], async_path[512], corrupt_path[512];
+    snprintf(sync_path, sizeof(sync_path), "%s/sync.ckpt", directory);
+    snprintf(async_path, sizeof(async_path), "%s/async.ckpt", directory);
+    snprintf(corrupt_path, sizeof(corrupt_path), "%s/corrupt.ckpt", directory);
+
+    Matrix inputs = allocate_matrix(SAMPLES, 784), targets = allocate_matrix(SAMPLES, 10);
+    synthetic_mnist(inputs, targets, 42);
+    Dataset *dataset = dataset_from_matrices(inputs, targets);
+    double *step_ms = malloc(steps * sizeof(double));
+
+    MLP *mlp = create_model(hidden);
+    run(mlp, dataset, steps, interval, NONE, NULL, step_ms);
+    mlp_save(mlp, sync_path);
+    long bytes = file_size(sync_path);
+    printf("784-%d-%d-10 with Adam, batch %d, %d steps, a checkpoint of %.1f MB every %d steps, in %s\n\n", hidden, hidden, BATCH,
+           steps, bytes / 1048576.0, interval, directory);
+    printf("%-24s %10s %10s %10s %10s %12s %10s\n", "step ms", "mean", "median", "p99", "max", "checkpoint", "total s");
+    report("no checkpoints", step_ms, steps, interval);
+    mlp_free(mlp);
+
+    mlp = create_model(hidden);
+    run(mlp, dataset, steps, interval, SYNCHRONOUS, sync_path, step_ms);
+    report("mlp_save in the loop", step_ms, steps, interval);
+    mlp_free(mlp);
+
+    mlp = create_model(hidden);
+    mlp_set_checkpointing(mlp, async_path, interval, 0, KEEP_LAST);
+    run(mlp, dataset, steps, interval, BACKGROUND, NULL, step_ms);
+    report("background writer", step_ms, steps, interval);
+    checkpoint_writer_flush(mlp->checkpoints);
+    CheckpointStats stats = checkpoint_writer_stats(mlp->checkpoints);
+    printf("\nbackground writer: %ld snapshots, %ld written, %ld dropped, %ld failed, %.2f ms per snapshot on the trainer, "
+           "%.1f ms per file on the writer thread\n", stats.snapshots, stats.written, stats.dropped, stats.failed,
+           stats.snapshots > 0 ? stats.snapshot_seconds * 1e3 / stats.snapshots : 0,
+           stats.written > 0 ? stats.write_seconds * 1e3 / stats.written : 0);
+    mlp_free(mlp);
+
+    // the last interval's file of each run, the same model at the same step; sized as the writer sizes its paths
+    char last_path[strlen(async_path) + 32];
+    snprintf(last_path, sizeof(last_path), "%s.%06d", async_path, steps / interval * interval);
+    int identical = same_file(sync_path, last_path);
+    int kept = 0;
+    DIR *dir = opendir(directory);
+    for (struct dirent *entry; dir != NULL && (entry = readdir(dir)) != NULL;) {
+        kept += strncmp(entry->d_name, "async.ckpt.", 11) == 0;
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    // flip one bit in the middle of a copy
+    FILE *in = fopen(last_path, "rb"), *out = fopen(corrupt_path, "wb");
+    for (long i = 0, c; in != NULL && out != NULL && (c = fgetc(in)) != EOF; i++) {
+        fputc(i == bytes / 2 ? c ^ 1 : c, out);
+    }
+    if (in != NULL) {
+        fclose(in);
+    }
+    if (out != NULL) {
+        fclose(out);
+    }
+    MLP *loaded = mlp_load(last_path);
+    MLP *corrupt = mlp_load(corrupt_path);
+    int detected = corrupt == NULL && checkpoint_verify(corrupt_path) != 0 && checkpoint_verify(last_path) == 0;
+    printf("last background checkpoint identical to mlp_save's: %s, loads: %s, files kept: %d of %d, corruption detected: %s\n",
+           identical ? "yes" : "NO", loaded != NULL ? "yes" : "NO", kept, KEEP_LAST, detected ? "yes" : "NO");
+
+    if (loaded != NULL) {
+        mlp_free(loaded);
+    }
+    if (corrupt != NULL) {
+        mlp_free(corrupt);
+    }
+    dir = opendir(directory);
+    for (struct dirent *entry; dir != NULL && (entry = readdir(dir)) != NULL;) {
+        char path[600];
+        snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+        if (entry->d_name[0] != '.') {
+            unlink(path);
+        }
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    rmdir(directory);
+    free(step_ms);
+    dataset_close(dataset);
+    free_matrix(inputs);
+    free_matrix(targets);
+    return !(identical && loaded != NULL && kept == KEEP_LAST && detected && stats.failed == 0);
+}
@@ -0,0 +1,100 @@
+/*
+    Autotuning of the training configuration against the fixed one main.c used to train with
+    Times training of a 784-H-H/2-10 network on synthetic MNIST-like data with the default kernel and
+    blocking, batch 32 and one thread, then runs tune_search under the memory budget and times what it
+    picked against the fixed configuration again, alternating the two. Checks that the pick fits the
+    budget, that half of its memory still leaves a configuration that fits, and that the tuning cache
+    hands the configuration back without measuring again.
+    Build from c_mlp/:
+        make bench_autotune
+    Usage: ./bench_autotune [budget_mb] [max_batch_size] [hidden]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"tune.h"
+#include"bench_common.h"
+
+#define SAMPLES 8192
+
+static void print_config(const char *label, const TuneConfig *config, size_t bytes) {
+    printf("%-22s %-7s %4d x %4d x %5d %6d %8d %10.1f %14.0f\n", label, config->kernel, config->blocking.mc, config->blocking.kc,
+           config->blocking.nc, config->batch_size, config->num_threads, bytes / 1048576.0, config->samples_per_second);
+}
+
+int main(int argc, char **argv) {
+    size_t budget = (size_t)(argc > 1 ? atof(argv[1]) : 256) * 1048576;
+    int max_batch_size = argc > 2 ? atoi(argv[2]) : 256;
+    int hidden = argc > 3 ? atoi(argv[3]) : 64;
+
+    Matrix inputs = allocate_matrix(SAMPLES, 784), targets = allocate_matrix(SAMPLES, 10);
+    synthetic_mnist(inputs, targets, 42);
+    Dataset *dataset = dataset_from_matrices(inputs, targets);
+    int num_neurons[] = {hidden, hidden / 2, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+
+    printf("784-%d-%d-10, %d synthetic samples, budget %.0f MB, batches up to %d, %d cores\n\n", hidden, hidden / 2, SAMPLES,
+           budget / 1048576.0, max_batch_size, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%-22s %-7s %20s %6s %8s %10s %14s\n", "", "kernel", "mc x kc x nc", "batch", "threads", "MB", "samples/s");
+    TuneConfig fixed = { "", gemm_blocking(), 32, 1, 0 };
+    snprintf(fixed.kernel, sizeof(fixed.kernel), "%s", gemm_kernel_name());
+    fixed.samples_per_second = tune_measure(mlp, dataset, &fixed);
+    print_config("fixed, as main.c was", &fixed, tune_memory_bytes(mlp, &fixed));
+
+    TuneConfig tuned;
+    double start = now_seconds();
+    if (tune_search(mlp, dataset, budget, max_batch_size, &tuned) != 0) {
+        fprintf(stderr, "Nothing fits in the budget\n");
+        return 1;
+    }
+    double search_seconds = now_seconds() - start;
+    size_t tuned_bytes = tune_memory_bytes(mlp, &tuned);
+    print_config("tuned", &tuned, tuned_bytes);
+    // the search reports the best of many noisy measurements, so compare against the fixed configuration
+    // afresh, alternating the two
+    TuneConfig remeasured = tuned, fixed_again = fixed;
+    remeasured.samples_per_second = fixed_again.samples_per_second = 0;
+    for (int round = 0; round < 3; round++) {
+        fixed_again.samples_per_second = fmax(fixed_again.samples_per_second, tune_measure(mlp, dataset, &fixed));
+        remeasured.samples_per_second = fmax(remeasured.samples_per_second, tune_measure(mlp, dataset, &tuned));
+    }
+    print_config("fixed, measured again", &fixed_again, tune_memory_bytes(mlp, &fixed));
+    print_config("tuned, measured again", &remeasured, tuned_bytes);
+
+    // half of what the pick needs forces smaller blocks, batches or fewer threads
+    size_t tight_budget = tuned_bytes / 2;
+    TuneConfig tight = fixed;
+    int tight_ok = tune_search(mlp, dataset, tight_budget, max_batch_size, &tight) == 0 && tune_memory_bytes(mlp, &tight) <= tight_budget;
+    print_config("tight budget", &tight, tune_memory_bytes(mlp, &tight));
+    printf("\nsearch took %.2f s, speedup over the fixed configuration %.2fx\n", search_seconds,
+           remeasured.samples_per_second / fixed_again.samples_per_second);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/bench_autotune_%d.cache", (int)getpid());
+    TuneConfig loaded;
+    int stored = tune_cache_store(path, mlp, budget, max_batch_size, &tuned) == 0 &&
+                 tune_cache_store(path, mlp, tight_budget, max_batch_size, &tight) == 0;
+    int found = tune_cache_load(path, mlp, budget, max_batch_size, &loaded) == 0;
+    int same = found && strcmp(loaded.kernel, tuned.kernel) == 0 && loaded.batch_size == tuned.batch_size &&
+               loaded.num_threads == tuned.num_threads && memcmp(&loaded.blocking, &tuned.blocking, sizeof(GemmBlocking)) == 0;
+    start = now_seconds();
+    int cached = mlp_autotune(mlp, dataset, budget, max_batch_size, path, &loaded);
+    double startup_seconds = now_seconds() - start;
+    int missing = tune_cache_load(path, mlp, budget, max_batch_size + 1, &loaded) != 0;
+    unlink(path);
+    printf("tuning cache: stored %s, loaded back identical %s, startup from the cache %s in %.4f s, other limits miss %s\n",
+           stored ? "yes" : "NO", same ? "yes" : "NO", cached == 1 ? "yes" : "NO", startup_seconds, missing ? "yes" : "NO");
+    printf("half the budget still finds a configuration within it: %s\n", tight_ok ? "yes" : "NO");
+
+    mlp_free(mlp);
+    dataset_close(dataset);
+    free_matrix(inputs);
+    free_matrix(targets);
+    return !(tuned_bytes <= budget && tight_ok && stored && same && cached == 1 && missing);
+}
@@ -0,0 +1,92 @@
+/*
+    Times saving a checkpoint, loading it back and loading it mapped, and checks the loaded models
+    produce the same outputs as the original
+    Build from c_mlp/:
+        gcc -O2 -I. bench/bench_checkpoint.c checkpoint.c allreduce.c inference.c evaluate.c mlp.c optimizer.c gemm.c gemm_kernels.c bf16.c sparse.c matrix.c arena.c dataset.c loader.c threadpool.c activation.c activation_kernels.c loss.c -o bench_checkpoint -lm -lpthread
+    Usage: ./bench_checkpoint [hidden_size] [path]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"checkpoint.h"
+#include"bench_common.h"
+
+// outputs of the model for the same fixed batch, copied out of the workspace
+static float *forward_outputs(MLP *mlp, Matrix inputs) {
+    Matrix **activations = batch_forward(mlp, inputs);
+    Matrix outputs = activations[1][mlp->num_layers];
+    float *copy = malloc((size_t)outputs.rows * outputs.cols * sizeof(float));
+    for (int i = 0; i < outputs.rows; i++) {
+        memcpy(copy + (size_t)i * outputs.cols, matrix_row(outputs, i), outputs.cols * sizeof(float));
+    }
+    return copy;
+}
+
+int main(int argc, char **argv) {
+    int hidden_size = argc > 1 ? atoi(argv[1]) : 1024;
+    const char *path = argc > 2 ? argv[2] : "bench_checkpoint.ckpt";
+
+    int num_neurons[] = {hidden_size, hidden_size, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+    size_t num_params = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        num_params += (size_t)(mlp->layers[i]->prev_num_neurons + 1) * mlp->layers[i]->num_neurons;
+    }
+
+    Matrix inputs = allocate_matrix(32, 784);
+    srand(42);
+    for (int i = 0; i < inputs.rows * inputs.cols; i++) {
+        inputs.data[i] = (rand() % 256) / 255.0f;
+    }
+    float *expected = forward_outputs(mlp, inputs);
+
+    double start = now_seconds();
+    if (mlp_save(mlp, path) != 0) {
+        return 1;
+    }
+    double save_seconds = now_seconds() - start;
+
+    start = now_seconds();
+    MLP *loaded = mlp_load(path);
+    double load_seconds = now_seconds() - start;
+
+    start = now_seconds();
+    MLP *mapped = mlp_load_mapped(path);
+    double map_seconds = now_seconds() - start;
+    if (loaded == NULL || mapped == NULL) {
+        return 1;
+    }
+
+    start = now_seconds();
+    float *loaded_outputs = forward_outputs(loaded, inputs);
+    double loaded_forward_seconds = now_seconds() - start;
+    start = now_seconds();
+    float *mapped_outputs = forward_outputs(mapped, inputs);
+    double mapped_forward_seconds = now_seconds() - start;
+
+    size_t num_outputs = (size_t)inputs.rows * 10;
+    int same = memcmp(expected, loaded_outputs, num_outputs * sizeof(float)) == 0
+        && memcmp(expected, mapped_outputs, num_outputs * sizeof(float)) == 0;
+
+    printf("parameters: %zu (%.1f MB)\n", num_params, num_params * sizeof(float) / 1e6);
+    printf("save:            %8.3f ms\n", save_seconds * 1e3);
+    printf("load:            %8.3f ms, first forward %8.3f ms\n", load_seconds * 1e3, loaded_forward_seconds * 1e3);
+    printf("load mapped:     %8.3f ms, first forward %8.3f ms\n", map_seconds * 1e3, mapped_forward_seconds * 1e3);
+    printf("outputs identical: %s\n", same ? "yes" : "no");
+
+    free(expected);
+    free(loaded_outputs);
+    free(mapped_outputs);
+    free_matrix(inputs);
+    mlp_free(mlp);
+    mlp_free(loaded);
+    mlp_free(mapped);
+    remove(path);
+    return same ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+#include<stdlib.h>
+#include<math.h>
+#include<time.h>
+#include"matrix.h"
+
+/*
+    Helpers shared by the benchmarks: a monotonic clock, seeded synthetic data and summary statistics
+    Everything is static so each benchmark still builds from its own source file plus the library.
+*/
+
+static inline double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// roughly MNIST-like: about a fifth of the pixels are non-zero
+static inline void synthetic_inputs(Matrix inputs, unsigned int seed) {
+    srand(seed);
+    for (int i = 0; i < inputs.rows; i++) {
+        for (int j = 0; j < inputs.cols; j++) {
+            MAT(inputs, i, j) = rand() % 5 == 0 ? (rand() % 256) / 255.0f : 0.0f;
+        }
+    }
+}
+
+// synthetic_inputs with a uniformly drawn one-hot label per sample
+static inline void synthetic_mnist(Matrix inputs, Matrix targets, unsigned int seed) {
+    srand(seed);
+    for (int i = 0; i < inputs.rows; i++) {
+        int label = rand() % targets.cols;
+        for (int j = 0; j < inputs.cols; j++) {
+            MAT(inputs, i, j) = rand() % 5 == 0 ? (rand() % 256) / 255.0f : 0.0f;
+        }
+        for (int j = 0; j < targets.cols; j++) {
+            MAT(targets, i, j) = j == label ? 1.0f : 0.0f;
+        }
+    }
+}
+
+// a fixed random linear map from the inputs to the classes, synthetic_inputs shifted down by 0.5
+static inline void synthetic_teacher(Matrix teacher, unsigned int seed) {
+    synthetic_inputs(teacher, seed);
+    for (int i = 0; i < teacher.rows; i++) {
+        for (int j = 0; j < teacher.cols; j++) {
+            MAT(teacher, i, j) -= 0.5f;
+        }
+    }
+}
+
+// synthetic_mnist inputs labelled by the argmax of the teacher's scores, so there is something to learn
+static inline void teacher_task(Matrix inputs, Matrix targets, Matrix teacher, unsigned int seed) {
+    synthetic_mnist(inputs, targets, seed);
+    for (int i = 0; i < inputs.rows; i++) {
+        int label = 0;
+        float best = -INFINITY;
+        for (int c = 0; c < targets.cols; c++) {
+            float score = 0;
+            for (int j = 0; j < inputs.cols; j++) {
+                score += MAT(inputs, i, j) * MAT(teacher, j, c);
+            }
+            label = score > best ? c : label;
+            best = score > best ? score : best;
+        }
+        for (int c = 0; c < targets.cols; c++) {
+            MAT(targets, i, c) = c == label;
+        }
+    }
+}
+
+static inline int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// nearest-rank percentile of an ascending array
+static inline double percentile(const double *sorted, int n, double p) {
+    int idx = (int)(p * (n - 1) + 0.5);
+    return sorted[idx];
+}
+
+typedef struct {
+    double median, mean, stddev, min, max;
+} BenchStats;
+
+// summary of n samples, sorts them in place
+static inline BenchStats bench_stats(double *samples, int n) {
+    BenchStats s = { 0 };
+    if (n <= 0) {
+        return s;
+    }
+    qsort(samples, n, sizeof(double), compare_doubles);
+    s.median = n % 2 ? samples[n / 2] : 0.5 * (samples[n / 2 - 1] + samples[n / 2]);
+    s.min = samples[0];
+    s.max = samples[n - 1];
+    for (int i = 0; i < n; i++) {
+        s.mean += samples[i] / n;
+    }
+    for (int i = 0; i < n; i++) {
+        s.stddev += (samples[i] - s.mean) * (samples[i] - s.mean);
+    }
+    s.stddev = n > 1 ? sqrt(s.stddev / (n - 1)) : 0;
+    return s;
+}
+
+#endif
@@ -0,0 +1,123 @@
+/*
+    Data-parallel training and gradient accumulation on MNIST-shaped synthetic data (784-64-32-10)
+    First checks that the gradients of a batch come out the same, up to float rounding, whether it is
+    run in one pass, split over data-parallel workers, or summed from micro-batches. Then times one
+    epoch for each worker count against the same number of threads inside the GEMMs.
+    Build from c_mlp/:
+        gcc -O2 -I. bench/bench_data_parallel.c allreduce.c inference.c evaluate.c mlp.c optimizer.c gemm.c gemm_kernels.c bf16.c sparse.c matrix.c arena.c dataset.c loader.c threadpool.c activation.c activation_kernels.c loss.c -o bench_data_parallel -lm -lpthread
+    Usage: ./bench_data_parallel [max_workers] [num_samples] [batch_size]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<time.h>
+#include<unistd.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"bench_common.h"
+
+// largest difference between the model's summed gradients and a reference, relative to the largest reference value
+static double gradient_error(MLP *mlp, const float *reference) {
+    double max_diff = 0, max_value = 0;
+    for (size_t i = 0; i < mlp->gradient_size; i++) {
+        max_diff = fmax(max_diff, fabs(mlp->gradients[i] - reference[i]));
+        max_value = fmax(max_value, fabs(reference[i]));
+    }
+    return max_diff / max_value;
+}
+
+int main(int argc, char **argv) {
+    int max_workers = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int num_samples = argc > 2 ? atoi(argv[2]) : 60000;
+    int batch_size = argc > 3 ? atoi(argv[3]) : 256;
+    if (max_workers > 64) {
+        max_workers = 64;
+    }
+
+    Matrix inputs = allocate_matrix(num_samples, 784);
+    Matrix targets = allocate_matrix(num_samples, 10);
+    synthetic_mnist(inputs, targets, 42);
+    Dataset *dataset = dataset_from_matrices(inputs, targets);
+    DataLoader *loader = loader_create(dataset, batch_size, 0, 0);
+
+    int num_neurons[] = {64, 32, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+
+    // gradients of one batch, without applying them
+    Matrix batch_inputs = matrix_row_view(inputs, 0, batch_size);
+    Matrix batch_targets = matrix_row_view(targets, 0, batch_size);
+    mlp_compute_gradients(mlp, batch_inputs, batch_targets);
+    float *reference = malloc(mlp->gradient_size * sizeof(float));
+    memcpy(reference, mlp->gradients, mlp->gradient_size * sizeof(float));
+    mlp->gradient_samples = 0;
+
+    printf("gradients of a %d sample batch against one pass, max relative difference\n", batch_size);
+    for (int i = 0; i < 8; i++) {
+        int start = batch_size * i / 8, count = batch_size * (i + 1) / 8 - start;
+        mlp_compute_gradients(mlp, matrix_row_view(inputs, start, count), matrix_row_view(targets, start, count));
+    }
+    printf("%-24s %10.2e\n", "8 micro-batches", gradient_error(mlp, reference));
+    mlp->gradient_samples = 0;
+    float learning_rate = mlp->optimizer.learning_rate;
+    for (int w = 2; w <= max_workers; w *= 2) {
+        mlp_set_data_parallel(mlp, w);
+        mlp_compute_gradients(mlp, batch_inputs, batch_targets);
+        // the all-reduce runs when the gradients are applied, so run it here by hand
+        mlp->optimizer.learning_rate = 0;
+        mlp->learning_rate = 0;
+        mlp_apply_gradients(mlp);
+        char name[32];
+        snprintf(name, sizeof(name), "%d workers", w);
+        printf("%-24s %10.2e\n", name, gradient_error(mlp, reference));
+    }
+    mlp->optimizer.learning_rate = learning_rate;
+
+    // same initial weights for every timed run
+    Matrix *initial_weights = malloc(mlp->num_layers * sizeof(Matrix));
+    for (int i = 0; i < mlp->num_layers; i++) {
+        initial_weights[i] = allocate_matrix(mlp->layers[i]->weights.rows, mlp->layers[i]->weights.cols);
+        matrix_copy(initial_weights[i], mlp->layers[i]->weights);
+    }
+
+    printf("\nsamples: %d, batch size: %d, seconds per epoch\n", num_samples, batch_size);
+    printf("%8s %14s %14s %10s\n", "threads", "gemm threads", "data parallel", "speedup");
+    double base = 0;
+    for (int t = 1; t <= max_workers; t *= 2) {
+        double seconds[2];
+        for (int mode = 0; mode < 2; mode++) {
+            for (int i = 0; i < mlp->num_layers; i++) {
+                matrix_copy(mlp->layers[i]->weights, initial_weights[i]);
+            }
+            mlp->epoch = 0;
+            mlp_set_data_parallel(mlp, 1);
+            if (mode == 0) {
+                mlp_set_num_threads(mlp, t);
+            } else {
+                mlp_set_data_parallel(mlp, t);
+            }
+            double start = now_seconds();
+            train(mlp, loader, 1);
+            seconds[mode] = now_seconds() - start;
+        }
+        if (t == 1) {
+            base = seconds[0];
+        }
+        printf("%8d %14.3f %14.3f %9.2fx\n", t, seconds[0], seconds[1], base / seconds[1]);
+    }
+
+    for (int i = 0; i < mlp->num_layers; i++) {
+        free_matrix(initial_weights[i]);
+    }
+    free(initial_weights);
+    free(reference);
+    mlp_free(mlp);
+    loader_free(loader);
+    dataset_close(dataset);
+    free_matrix(inputs);
+    free_matrix(targets);
+    return 0;
+}
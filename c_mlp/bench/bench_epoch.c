@@ -0,0 +1,45 @@
+/*
+    Times one MNIST-shaped training epoch (784-64-32-10, batch size 32) on synthetic data
+    Build from c_mlp/:
+        gcc -O2 -I. bench/bench_epoch.c allreduce.c inference.c evaluate.c mlp.c optimizer.c gemm.c gemm_kernels.c bf16.c sparse.c matrix.c arena.c dataset.c loader.c threadpool.c activation.c activation_kernels.c loss.c -o bench_epoch -lm -lpthread
+    Add -DMLP_PROFILE profile.c for per-layer timings, see profile.h
+    Usage: ./bench_epoch [num_samples] [num_epochs]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"gemm.h"
+#include"bench_common.h"
+
+int main(int argc, char **argv) {
+    int num_samples = argc > 1 ? atoi(argv[1]) : 60000;
+    int num_epochs = argc > 2 ? atoi(argv[2]) : 1;
+
+    Matrix inputs = allocate_matrix(num_samples, 784);
+    Matrix targets = allocate_matrix(num_samples, 10);
+    synthetic_mnist(inputs, targets, 42);
+    Dataset *dataset = dataset_from_matrices(inputs, targets);
+    DataLoader *loader = loader_create(dataset, 32, 0, 0);
+
+    int num_neurons[] = {64, 32, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+
+    double start = now_seconds();
+    train(mlp, loader, num_epochs);
+    double elapsed = now_seconds() - start;
+
+    printf("\nsamples: %d, epochs: %d, seconds/epoch: %.3f, samples/sec: %.0f\n",
+           num_samples, num_epochs, elapsed / num_epochs, (double)num_samples * num_epochs / elapsed);
+
+    mlp_free(mlp);
+    loader_free(loader);
+    dataset_close(dataset);
+    free_matrix(inputs);
+    free_matrix(targets);
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*
+    Validation pass over a 60k-sample MNIST-shaped set: the old validate() loop against mlp_evaluate
+    The old loop ran batch_forward in training-sized batches, stored pre-activations, scored every
+    output through the loss function pointer and dropped the last num_samples % batch_size samples.
+    mlp_evaluate is run at every thread count up to max_threads and checked to give the same loss and
+    accuracy at each one, and the same predictions as batch_forward.
+    Build from c_mlp/:
+        make bench_evaluate
+    Usage: ./bench_evaluate [max_threads] [num_samples] [hidden_size]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<unistd.h>
+#include"mlp.h"
+#include"evaluate.h"
+#include"activation.h"
+#include"loss.h"
+#include"bench_common.h"
+
+#define OLD_BATCH_SIZE 32
+
+// the loop validate() used to run, returns the number of correct predictions
+static int old_validate(MLP *mlp, Dataset *dataset, int batch_size, float *loss) {
+    int correct = 0;
+    int num_batches = dataset->num_samples / batch_size;
+    int output_size = mlp->layers[mlp->num_layers-1]->num_neurons;
+    *loss = 0;
+    for (int i = 0; i < num_batches; i++) {
+        Matrix batch_inputs, batch_targets;
+        dataset_batch(dataset, i * batch_size, batch_size, &batch_inputs, &batch_targets);
+        Matrix outputs = batch_forward(mlp, batch_inputs)[1][mlp->num_layers];
+        for (int j = 0; j < batch_size; j++) {
+            int max_idx = 0;
+            for (int k = 0; k < output_size; k++) {
+                *loss += mlp->loss(MAT(outputs, j, k), MAT(batch_targets, j, k));
+                max_idx = MAT(outputs, j, k) > MAT(outputs, j, max_idx) ? k : max_idx;
+            }
+            correct += MAT(batch_targets, j, max_idx) == 1.0f;
+        }
+    }
+    return correct;
+}
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int num_samples = argc > 2 ? atoi(argv[2]) : 60000;
+    int hidden_size = argc > 3 ? atoi(argv[3]) : 64;
+
+    // 60000 is not a multiple of the old batch size of 32 plus 1, so the old loop drops a tail
+    num_samples += num_samples % OLD_BATCH_SIZE == 0 ? 7 : 0;
+    Matrix inputs = allocate_matrix(num_samples, 784);
+    Matrix targets = allocate_matrix(num_samples, 10);
+    synthetic_mnist(inputs, targets, 42);
+    Dataset *dataset = dataset_from_matrices(inputs, targets);
+
+    int num_neurons[] = {hidden_size, hidden_size / 2, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+    mlp_init_weights(mlp, 42);
+
+    mlp_set_num_threads(mlp, 1);
+    float old_loss;
+    old_validate(mlp, dataset, OLD_BATCH_SIZE, &old_loss); // warm-up
+    double start = now_seconds();
+    int old_correct = old_validate(mlp, dataset, OLD_BATCH_SIZE, &old_loss);
+    double old_seconds = now_seconds() - start;
+
+    // reference predictions over every sample, from the training forward pass
+    int reference_correct = 0;
+    for (int i = 0; i < num_samples; i += 1000) {
+        int count = num_samples - i < 1000 ? num_samples - i : 1000;
+        Matrix outputs = batch_forward(mlp, matrix_row_view(inputs, i, count))[1][mlp->num_layers];
+        for (int r = 0; r < count; r++) {
+            int max_idx = 0;
+            for (int k = 1; k < outputs.cols; k++) {
+                max_idx = MAT(outputs, r, k) > MAT(outputs, r, max_idx) ? k : max_idx;
+            }
+            reference_correct += MAT(targets, i + r, max_idx) == 1.0f;
+        }
+    }
+
+    printf("784-%d-%d-10, %d samples\n", hidden_size, hidden_size / 2, num_samples);
+    printf("%-22s %10s %12s %10s %10s %10s\n", "", "seconds", "samples/sec", "speedup", "scored", "accuracy");
+    printf("%-22s %10.4f %12.0f %9.2fx %10d %10.4f\n", "old validate, 1 thread", old_seconds,
+           num_samples / old_seconds, 1.0, num_samples / OLD_BATCH_SIZE * OLD_BATCH_SIZE,
+           (double)old_correct / (num_samples / OLD_BATCH_SIZE * OLD_BATCH_SIZE));
+
+    int consistent = 1;
+    Evaluation first = { 0 };
+    for (int t = 1; t <= max_threads; t++) {
+        mlp_set_num_threads(mlp, t);
+        mlp_evaluate(mlp, dataset, 0, num_samples, EVALUATION_BATCH_SIZE); // warm-up, sizes the arena
+        start = now_seconds();
+        Evaluation evaluation = mlp_evaluate(mlp, dataset, 0, num_samples, EVALUATION_BATCH_SIZE);
+        double seconds = now_seconds() - start;
+        char label[48];
+        snprintf(label, sizeof(label), "mlp_evaluate, %d thread%s", t, t > 1 ? "s" : "");
+        printf("%-22s %10.4f %12.0f %9.2fx %10d %10.4f\n", label, seconds, num_samples / seconds,
+               old_seconds / seconds, evaluation.num_samples, evaluation.accuracy);
+        if (t == 1) {
+            first = evaluation;
+            consistent &= (long)(evaluation.accuracy * num_samples + 0.5) == reference_correct;
+        }
+        consistent &= evaluation.loss == first.loss && evaluation.accuracy == first.accuracy;
+    }
+    printf("mean loss: %f (categorical cross-entropy)\n", first.loss);
+    printf("matches batch_forward and identical across thread counts: %s\n\n", consistent ? "yes" : "NO");
+    mlp_set_num_threads(mlp, 1);
+    print_confusion_matrix(mlp_evaluate(mlp, dataset, 0, num_samples, EVALUATION_BATCH_SIZE));
+
+    mlp_free(mlp);
+    dataset_close(dataset);
+    free_matrix(inputs);
+    free_matrix(targets);
+    return !consistent;
+}
@@ -0,0 +1,115 @@
+/*
+    GFLOP/s of sgemm for the products a 784-64-32-10 network computes per training step
+    Build from c_mlp/:
+        gcc -O2 -I. bench/bench_gemm.c gemm.c gemm_kernels.c bf16.c matrix.c threadpool.c -o bench_gemm -lm -lpthread
+    Usage: ./bench_gemm [batch_size]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include<time.h>
+#include"gemm.h"
+#include"bench_common.h"
+
+typedef struct {
+    const char *name;
+    int trans_a, trans_b;
+    int m, n, k;
+} Shape;
+
+static void fill_random(Matrix M) {
+    for (int i = 0; i < M.rows; i++) {
+        for (int j = 0; j < M.cols; j++) {
+            MAT(M, i, j) = 2.0f * rand() / RAND_MAX - 1.0f;
+        }
+    }
+}
+
+// textbook triple loop used as the reference result
+static void naive_gemm(Shape s, Matrix A, Matrix B, Matrix C) {
+    for (int i = 0; i < s.m; i++) {
+        for (int j = 0; j < s.n; j++) {
+            float sum = 0;
+            for (int l = 0; l < s.k; l++) {
+                float a = s.trans_a ? MAT(A, l, i) : MAT(A, i, l);
+                float b = s.trans_b ? MAT(B, j, l) : MAT(B, l, j);
+                sum += a * b;
+            }
+            MAT(C, i, j) = sum;
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    int batch = argc > 1 ? atoi(argv[1]) : 32;
+    Shape shapes[] = {
+        {"forward   L1  X @ W1",     GEMM_N, GEMM_N, batch, 64, 784},
+        {"forward   L2  H1 @ W2",    GEMM_N, GEMM_N, batch, 32, 64},
+        {"forward   L3  H2 @ W3",    GEMM_N, GEMM_N, batch, 10, 32},
+        {"grad      W3  H2^T @ D3",  GEMM_T, GEMM_N, 32, 10, batch},
+        {"grad      W2  H1^T @ D2",  GEMM_T, GEMM_N, 64, 32, batch},
+        {"grad      W1  X^T @ D1",   GEMM_T, GEMM_N, 784, 64, batch},
+        {"backprop  D2  D3 @ W3^T",  GEMM_N, GEMM_T, batch, 32, 10},
+        {"backprop  D1  D2 @ W2^T",  GEMM_N, GEMM_T, batch, 64, 32},
+    };
+    const char *kernels[] = {"scalar", "avx2", "avx512"};
+    int num_shapes = sizeof(shapes) / sizeof(shapes[0]);
+    srand(42);
+
+    printf("batch size %d\n", batch);
+    printf("%-26s %6s %6s %6s %10s", "shape", "m", "n", "k", "naive");
+    for (int k = 0; k < 3; k++) {
+        printf(" %10s", kernels[k]);
+    }
+    printf("   (GFLOP/s)\n");
+
+    for (int s = 0; s < num_shapes; s++) {
+        Shape shape = shapes[s];
+        Matrix A = shape.trans_a ? allocate_matrix(shape.k, shape.m) : allocate_matrix(shape.m, shape.k);
+        Matrix B = shape.trans_b ? allocate_matrix(shape.n, shape.k) : allocate_matrix(shape.k, shape.n);
+        Matrix C = allocate_matrix(shape.m, shape.n);
+        Matrix ref = allocate_matrix(shape.m, shape.n);
+        fill_random(A);
+        fill_random(B);
+        double flops = 2.0 * shape.m * shape.n * shape.k;
+        // enough repetitions for roughly 0.2 GFLOP per measurement
+        int reps = (int)(2e8 / flops) + 1;
+
+        double start = now_seconds();
+        int naive_reps = reps / 20 + 1;
+        for (int r = 0; r < naive_reps; r++) {
+            naive_gemm(shape, A, B, ref);
+        }
+        printf("%-26s %6d %6d %6d %10.2f", shape.name, shape.m, shape.n, shape.k,
+               flops * naive_reps / (now_seconds() - start) * 1e-9);
+
+        for (int k = 0; k < 3; k++) {
+            if (gemm_select_kernel(kernels[k]) != 0) {
+                printf(" %10s", "n/a");
+                continue;
+            }
+            sgemm(shape.trans_a, shape.trans_b, 1.0f, A, B, 0.0f, C);
+            float max_err = 0;
+            for (int i = 0; i < shape.m; i++) {
+                for (int j = 0; j < shape.n; j++) {
+                    max_err = fmaxf(max_err, fabsf(MAT(C, i, j) - MAT(ref, i, j)));
+                }
+            }
+            if (max_err > 1e-3f) {
+                printf("\n%s kernel mismatch: max abs error %g\n", kernels[k], max_err);
+                return 1;
+            }
+            start = now_seconds();
+            for (int r = 0; r < reps; r++) {
+                sgemm(shape.trans_a, shape.trans_b, 1.0f, A, B, 0.0f, C);
+            }
+            printf(" %10.2f", flops * reps / (now_seconds() - start) * 1e-9);
+        }
+        printf("\n");
+        free_matrix(A);
+        free_matrix(B);
+        free_matrix(C);
+        free_matrix(ref);
+    }
+    return 0;
+}
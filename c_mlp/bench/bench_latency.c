@@ -0,0 +1,75 @@
+/*
+    Per-request inference latency for batch sizes 1, 8 and 64 on an MNIST-shaped model (784-64-32-10)
+    Compares mlp_infer against running batch_forward on the same batches.
+    Build from c_mlp/:
+        gcc -O2 -I. bench/bench_latency.c allreduce.c inference.c evaluate.c mlp.c optimizer.c gemm.c gemm_kernels.c bf16.c sparse.c matrix.c arena.c dataset.c loader.c threadpool.c activation.c activation_kernels.c loss.c -o bench_latency -lm -lpthread
+    Usage: ./bench_latency [num_requests] [hidden_size]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<time.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"gemm.h"
+#include"inference.h"
+#include"bench_common.h"
+
+#define WARMUP_REQUESTS 100
+
+// times num_requests batches taken round-robin from pool_inputs, returns p50 and p99 in microseconds
+static void run(MLP *mlp, Matrix pool_inputs, int batch_size, int num_requests, int use_infer, void *scratch, int *predictions,
+                double *times, double *p50, double *p99) {
+    int num_batches = pool_inputs.rows / batch_size;
+    for (int r = -WARMUP_REQUESTS; r < num_requests; r++) {
+        int b = (r + WARMUP_REQUESTS) % num_batches;
+        Matrix batch = matrix_row_view(pool_inputs, b * batch_size, batch_size);
+        double start = now_seconds();
+        if (use_infer) {
+            mlp_infer(mlp, batch, scratch, predictions);
+        } else {
+            batch_forward(mlp, batch);
+        }
+        double elapsed = now_seconds() - start;
+        if (r >= 0) {
+            times[r] = elapsed * 1e6;
+        }
+    }
+    qsort(times, num_requests, sizeof(double), compare_doubles);
+    *p50 = percentile(times, num_requests, 0.50);
+    *p99 = percentile(times, num_requests, 0.99);
+}
+
+int main(int argc, char **argv) {
+    int num_requests = argc > 1 ? atoi(argv[1]) : 5000;
+    int hidden_size = argc > 2 ? atoi(argv[2]) : 64;
+    int batch_sizes[] = {1, 8, 64};
+
+    int num_neurons[] = {hidden_size, hidden_size / 2, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+    // single-threaded like mlp_infer, so the comparison is kernel against kernel
+    mlp_set_num_threads(mlp, 1);
+
+    Matrix pool_inputs = allocate_matrix(4096, 784);
+    synthetic_inputs(pool_inputs, 42);
+    void *scratch = aligned_alloc(MATRIX_ALIGNMENT, mlp_inference_scratch_bytes(mlp, 64));
+    int predictions[64];
+    double *times = malloc(num_requests * sizeof(double));
+
+    printf("model 784-%d-%d-10, kernel %s, %d requests per batch size\n", hidden_size, hidden_size / 2, gemm_kernel_name(), num_requests);
+    printf("%6s  %12s %12s  %12s %12s\n", "batch", "infer p50", "infer p99", "forward p50", "forward p99");
+    for (int i = 0; i < 3; i++) {
+        double infer_p50, infer_p99, forward_p50, forward_p99;
+        run(mlp, pool_inputs, batch_sizes[i], num_requests, 1, scratch, predictions, times, &infer_p50, &infer_p99);
+        run(mlp, pool_inputs, batch_sizes[i], num_requests, 0, NULL, NULL, times, &forward_p50, &forward_p99);
+        printf("%6d  %10.2fus %10.2fus  %10.2fus %10.2fus\n", batch_sizes[i], infer_p50, infer_p99, forward_p50, forward_p99);
+    }
+
+    free(times);
+    free(scratch);
+    free_matrix(pool_inputs);
+    mlp_free(mlp);
+    return 0;
+}
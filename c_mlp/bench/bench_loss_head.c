@@ -0,0 +1,194 @@
+/*
+    The fused log-softmax + NLL output head and the corrected backward pass
+    Checks the gradients of a small network with every activation, a hidden softmax included, against
+    central finite differences of the loss, times the fused head against softmax + loss_prime + a
+    per-element cross_entropy loss on the same logits, checks it stays finite on saturated logits, then
+    counts the SGD steps a 784-64-32-10 network needs to reach a target held-out accuracy on a task
+    it can learn: labels are the argmax of a fixed random linear teacher of MNIST-shaped inputs.
+    Build from c_mlp/:
+        make bench_loss_head
+    Usage: ./bench_loss_head [target_accuracy] [max_steps]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include"mlp.h"
+#include"evaluate.h"
+#include"activation.h"
+#include"loss.h"
+#include"bench_common.h"
+
+#define BATCH 32
+#define CLASSES 10
+#define HELD_OUT 2048
+#define EVALUATE_EVERY 50
+#define MIN_SECONDS 0.2
+
+// summed cross-entropy of the batch, in double from the network's output probabilities
+static double batch_loss(MLP *mlp, Matrix inputs, Matrix targets) {
+    Matrix outputs = batch_forward(mlp, inputs)[1][mlp->num_layers];
+    double loss = 0;
+    for (int i = 0; i < outputs.rows; i++) {
+        for (int j = 0; j < outputs.cols; j++) {
+            loss -= MAT(targets, i, j) * log((double)MAT(outputs, i, j));
+        }
+    }
+    return loss;
+}
+
+// worst relative error of a sample of the analytic gradients against central differences
+static double gradient_check() {
+    int num_neurons[] = {16, 12, 12, 8, 5};
+    void (*activations[])(float*, float*, size_t) = {tanh_vector, sigmoid_vector, softmax, leaky_relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {tanh_prime_vector, sigmoid_prime_vector, softmax_prime,
+                                                          leaky_relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(5, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.1, 20);
+    mlp_init_weights(mlp, 7);
+    mlp_set_num_threads(mlp, 1);
+    Matrix inputs = allocate_matrix(8, 20), targets = allocate_matrix(8, 5);
+    synthetic_inputs(inputs, 3);
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < 5; j++) {
+            MAT(targets, i, j) = j == i % 5;
+        }
+    }
+    mlp_compute_gradients(mlp, inputs, targets);
+
+    double worst = 0;
+    // the loss comes from float32 forward passes, a smaller step drowns the difference in rounding
+    const float eps = 3e-2f;
+    float *gradients = mlp->gradients;
+    for (int l = 0; l < mlp->num_layers; l++) {
+        Layer *layer = mlp->layers[l];
+        float *grad_biases = gradients + arena_matrix_bytes(layer->prev_num_neurons, layer->num_neurons) / sizeof(float);
+        for (int s = 0; s < 8; s++) {
+            // alternate between a weight and a bias of the layer
+            int k = (s * 7) % layer->prev_num_neurons, j = (s * 3) % layer->num_neurons;
+            float *param = s % 2 == 0 ? &MAT(layer->weights, k, j) : &layer->biases[j];
+            float analytic = s % 2 == 0 ? gradients[k * layer->num_neurons + j] : grad_biases[j];
+            float saved = *param;
+            *param = saved + eps;
+            double up = batch_loss(mlp, inputs, targets);
+            *param = saved - eps;
+            double down = batch_loss(mlp, inputs, targets);
+            *param = saved;
+            double numeric = (up - down) / (2 * eps);
+            double error = fabs(numeric - analytic) / fmax(fabs(numeric) + fabs(analytic), 1e-3);
+            worst = error > worst ? error : worst;
+        }
+        gradients += layer_slot_floats(layer);
+    }
+    mlp_apply_gradients(mlp);
+    free_matrix(inputs);
+    free_matrix(targets);
+    mlp_free(mlp);
+    return worst;
+}
+
+// microseconds per call of the fused head, and of softmax, loss_prime and the per-element loss
+static void time_heads(int rows, double *fused_us, double *separate_us, double *difference) {
+    Matrix logits = allocate_matrix(rows, CLASSES), targets = allocate_matrix(rows, CLASSES);
+    Matrix fused_deltas = allocate_matrix(rows, CLASSES), probabilities = allocate_matrix(rows, CLASSES);
+    Matrix deltas = allocate_matrix(rows, CLASSES);
+    synthetic_mnist(logits, targets, 5);
+    synthetic_inputs(logits, 6);
+    volatile double sink = 0;
+
+    long calls = 0;
+    double start = now_seconds(), elapsed = 0;
+    while (elapsed < MIN_SECONDS) {
+        sink += softmax_cross_entropy(logits, targets, fused_deltas);
+        calls++;
+        elapsed = now_seconds() - start;
+    }
+    *fused_us = elapsed / calls * 1e6;
+
+    calls = 0;
+    start = now_seconds(), elapsed = 0;
+    while (elapsed < MIN_SECONDS) {
+        for (int i = 0; i < rows; i++) {
+            softmax(matrix_row(logits, i), matrix_row(probabilities, i), CLASSES);
+        }
+        softmax_ce_loss_prime(probabilities, targets, deltas);
+        double loss = 0;
+        for (int i = 0; i < rows; i++) {
+            for (int j = 0; j < CLASSES; j++) {
+                loss += cross_entropy(MAT(targets, i, j), MAT(probabilities, i, j));
+            }
+        }
+        sink += loss;
+        calls++;
+        elapsed = now_seconds() - start;
+    }
+    *separate_us = elapsed / calls * 1e6;
+
+    *difference = 0;
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < CLASSES; j++) {
+            *difference = fmax(*difference, fabsf(MAT(fused_deltas, i, j) - MAT(deltas, i, j)));
+        }
+    }
+    free_matrix(logits);
+    free_matrix(targets);
+    free_matrix(fused_deltas);
+    free_matrix(probabilities);
+    free_matrix(deltas);
+}
+
+int main(int argc, char **argv) {
+    double target_accuracy = argc > 1 ? atof(argv[1]) : 0.8;
+    int max_steps = argc > 2 ? atoi(argv[2]) : 20000;
+
+    double gradient_error = gradient_check();
+    printf("gradient check, 20-16-12-12-8-5 with tanh, sigmoid, softmax, leaky ReLU and softmax layers\n");
+    printf("worst relative error against central differences: %.2e\n\n", gradient_error);
+
+    double fused_us, separate_us, difference;
+    time_heads(256, &fused_us, &separate_us, &difference);
+    printf("output head, 256 x %d logits\n", CLASSES);
+    printf("%-36s %10.2f us\n", "fused softmax_cross_entropy", fused_us);
+    printf("%-36s %10.2f us   %.2fx\n", "softmax + loss_prime + cross_entropy", separate_us, separate_us / fused_us);
+    printf("max delta difference: %.2e\n", difference);
+
+    float saturated[] = {1000.0f, -1000.0f, 0.0f}, one_hot[] = {0.0f, 1.0f, 0.0f}, deltas[3];
+    double saturated_loss = softmax_cross_entropy(matrix_view(saturated, 1, 3, 3), matrix_view(one_hot, 1, 3, 3),
+                                                  matrix_view(deltas, 1, 3, 3));
+    printf("loss on logits (1000, -1000, 0) with target 1: %.1f (exact 2000)\n\n", saturated_loss);
+
+    int num_samples = max_steps * BATCH < 60000 ? max_steps * BATCH : 60000;
+    Matrix teacher = allocate_matrix(784, CLASSES);
+    synthetic_teacher(teacher, 9);
+    Matrix inputs = allocate_matrix(num_samples, 784), targets = allocate_matrix(num_samples, CLASSES);
+    Matrix held_inputs = allocate_matrix(HELD_OUT, 784), held_targets = allocate_matrix(HELD_OUT, CLASSES);
+    teacher_task(inputs, targets, teacher, 42);
+    teacher_task(held_inputs, held_targets, teacher, 43);
+    Dataset *held_out = dataset_from_matrices(held_inputs, held_targets);
+
+    int num_neurons[] = {64, 32, CLASSES};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.05, 784);
+    mlp_init_weights(mlp, 42);
+    mlp_set_num_threads(mlp, 1);
+    int steps = 0, batches = num_samples / BATCH;
+    double accuracy = 0, start = now_seconds();
+    while (steps < max_steps && accuracy < target_accuracy) {
+        int b = steps % batches;
+        batch_backward(mlp, matrix_row_view(inputs, b * BATCH, BATCH), matrix_row_view(targets, b * BATCH, BATCH));
+        if (++steps % EVALUATE_EVERY == 0) {
+            accuracy = mlp_evaluate(mlp, held_out, 0, HELD_OUT, EVALUATION_BATCH_SIZE).accuracy;
+        }
+    }
+    printf("784-64-32-10 on a linear teacher, batch size %d, SGD at 0.05\n", BATCH);
+    printf("held-out accuracy %.3f after %d steps (%.2f s), mean training loss %.4f\n", accuracy, steps, now_seconds() - start,
+           mlp_take_training_loss(mlp, (long)steps * BATCH));
+
+    dataset_close(held_out);
+    free_matrix(teacher);
+    free_matrix(inputs);
+    free_matrix(targets);
+    free_matrix(held_inputs);
+    free_matrix(held_targets);
+    mlp_free(mlp);
+    return gradient_error > 2e-2 || difference > 1e-5 || !isfinite(saturated_loss);
+}
@@ -0,0 +1,130 @@
+/*
+    float32 against bf16 mixed-precision training on synthetic MNIST-shaped data
+    Both runs start from the same weights and see the same batches. Reports the workspace size, the
+    time per training step, the loss on a held-out batch and how far the bf16 weights drift from the
+    float32 ones.
+    Build from c_mlp/:
+        gcc -O2 -I. bench/bench_mixed_precision.c allreduce.c inference.c evaluate.c mlp.c optimizer.c gemm.c gemm_kernels.c bf16.c sparse.c matrix.c arena.c dataset.c loader.c threadpool.c activation.c activation_kernels.c loss.c -o bench_mixed_precision -lm -lpthread
+    Usage: ./bench_mixed_precision [batch_size] [num_steps] [hidden1] [hidden2]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<time.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"gemm.h"
+#include"bench_common.h"
+
+// mean cross-entropy of the softmax outputs
+static double held_out_loss(MLP *mlp, Matrix inputs, Matrix targets) {
+    Matrix outputs = batch_forward(mlp, inputs)[1][mlp->num_layers];
+    double loss = 0;
+    for (int i = 0; i < outputs.rows; i++) {
+        for (int j = 0; j < outputs.cols; j++) {
+            if (MAT(targets, i, j) > 0) {
+                loss -= log(MAT(outputs, i, j) + 1e-12);
+            }
+        }
+    }
+    return loss / outputs.rows;
+}
+
+typedef struct {
+    size_t workspace_bytes;
+    double seconds_per_step;
+    double loss;
+} Result;
+
+static Result run(MLP *mlp, Matrix *initial_weights, float **initial_biases, int mixed_precision,
+                  Matrix inputs, Matrix targets, int batch_size, int num_steps) {
+    for (int i = 0; i < mlp->num_layers; i++) {
+        matrix_copy(mlp->layers[i]->weights, initial_weights[i]);
+        memcpy(mlp->layers[i]->biases, initial_biases[i], mlp->layers[i]->num_neurons * sizeof(float));
+    }
+    mlp_set_mixed_precision(mlp, mixed_precision);
+    mlp_reserve_workspace(mlp, batch_size);
+
+    // the last batch is held out for the loss
+    Matrix held_inputs = matrix_row_view(inputs, num_steps * batch_size, batch_size);
+    Matrix held_targets = matrix_row_view(targets, num_steps * batch_size, batch_size);
+    batch_forward(mlp, held_inputs); // warm-up
+
+    double start = now_seconds();
+    for (int i = 0; i < num_steps; i++) {
+        batch_backward(mlp, matrix_row_view(inputs, i * batch_size, batch_size), matrix_row_view(targets, i * batch_size, batch_size));
+    }
+    Result result = { mlp->workspace.arena.capacity, (now_seconds() - start) / num_steps, 0 };
+    result.loss = held_out_loss(mlp, held_inputs, held_targets);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    int batch_size = argc > 1 ? atoi(argv[1]) : 256;
+    int num_steps = argc > 2 ? atoi(argv[2]) : 50;
+    int hidden1 = argc > 3 ? atoi(argv[3]) : 1024;
+    int hidden2 = argc > 4 ? atoi(argv[4]) : 1024;
+    int num_samples = (num_steps + 1) * batch_size;
+
+    Matrix inputs = allocate_matrix(num_samples, 784);
+    Matrix targets = allocate_matrix(num_samples, 10);
+    synthetic_mnist(inputs, targets, 42);
+
+    int num_neurons[] = {hidden1, hidden2, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+
+    Matrix *initial_weights = malloc(mlp->num_layers * sizeof(Matrix));
+    float **initial_biases = malloc(mlp->num_layers * sizeof(float *));
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        initial_weights[i] = allocate_matrix(layer->weights.rows, layer->weights.cols);
+        matrix_copy(initial_weights[i], layer->weights);
+        initial_biases[i] = malloc(layer->num_neurons * sizeof(float));
+        memcpy(initial_biases[i], layer->biases, layer->num_neurons * sizeof(float));
+    }
+
+    Result fp32 = run(mlp, initial_weights, initial_biases, 0, inputs, targets, batch_size, num_steps);
+    Matrix *fp32_weights = malloc(mlp->num_layers * sizeof(Matrix));
+    for (int i = 0; i < mlp->num_layers; i++) {
+        fp32_weights[i] = allocate_matrix(mlp->layers[i]->weights.rows, mlp->layers[i]->weights.cols);
+        matrix_copy(fp32_weights[i], mlp->layers[i]->weights);
+    }
+    Result mixed = run(mlp, initial_weights, initial_biases, 1, inputs, targets, batch_size, num_steps);
+
+    // largest weight difference relative to the largest weight update of the float32 run
+    double max_update = 0, max_diff = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Matrix W = mlp->layers[i]->weights;
+        for (int r = 0; r < W.rows; r++) {
+            for (int c = 0; c < W.cols; c++) {
+                max_update = fmax(max_update, fabs(MAT(fp32_weights[i], r, c) - MAT(initial_weights[i], r, c)));
+                max_diff = fmax(max_diff, fabs(MAT(W, r, c) - MAT(fp32_weights[i], r, c)));
+            }
+        }
+    }
+
+    printf("784-%d-%d-10, batch size %d, %d steps, gemm kernel: %s\n", hidden1, hidden2, batch_size, num_steps, gemm_kernel_name());
+    printf("%-10s %16s %12s %12s\n", "precision", "workspace bytes", "ms/step", "loss");
+    printf("%-10s %16zu %12.3f %12.5f\n", "float32", fp32.workspace_bytes, fp32.seconds_per_step * 1e3, fp32.loss);
+    printf("%-10s %16zu %12.3f %12.5f\n", "bf16", mixed.workspace_bytes, mixed.seconds_per_step * 1e3, mixed.loss);
+    printf("workspace: %.2fx smaller, step time: %.2fx, max weight difference: %.3g (%.2f%% of the largest update)\n",
+           (double)fp32.workspace_bytes / mixed.workspace_bytes, fp32.seconds_per_step / mixed.seconds_per_step,
+           max_diff, max_update > 0 ? 100 * max_diff / max_update : 0);
+
+    for (int i = 0; i < mlp->num_layers; i++) {
+        free_matrix(initial_weights[i]);
+        free_matrix(fp32_weights[i]);
+        free(initial_biases[i]);
+    }
+    free(initial_weights);
+    free(fp32_weights);
+    free(initial_biases);
+    mlp_free(mlp);
+    free_matrix(inputs);
+    free_matrix(targets);
+    return 0;
+}
@@ -0,0 +1,143 @@
+/*
+    Magnitude pruning: one-shot against gradual during train, and the sparse inference kernels
+    Trains a 784-H-H/2-10 network on a linear teacher task (see teacher_task) three times from the
+    same seed: dense, with gradual global pruning of single weights to the target sparsity, and with
+    gradual pruning of blocks of 8. validate_pruning then reports the dense model pruned one-shot at
+    rising sparsities, of single weights and in blocks of 8, and the gradually pruned models are
+    exported and timed. Checks that pruned_infer predicts what mlp_infer does on the same pruned
+    weights and that a saved pruned model loads back identical.
+    Build from c_mlp/:
+        make bench_pruning
+    Usage: ./bench_pruning [target_sparsity] [epochs] [hidden]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include"mlp.h"
+#include"evaluate.h"
+#include"inference.h"
+#include"activation.h"
+#include"loss.h"
+#include"prune.h"
+#include"bench_common.h"
+
+#define CLASSES 10
+#define TRAIN_SAMPLES 32768
+#define HELD_OUT 2048
+#define BATCH 32
+
+static MLP *create_model(int hidden) {
+    int num_neurons[] = {hidden, hidden / 2, CLASSES};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.05, 784);
+    mlp_init_weights(mlp, 42);
+    mlp->optimizer.schedule = lr_constant();
+    return mlp;
+}
+
+// trains quietly apart from train's own progress output, returns the held-out accuracy
+static double train_model(MLP *mlp, Dataset *train_set, Dataset *held_out, int epochs) {
+    DataLoader *loader = loader_create(train_set, BATCH, 1, 7);
+    mlp_set_validation(mlp, held_out, 0, epochs);
+    train(mlp, loader, epochs);
+    loader_free(loader);
+    return mlp_evaluate(mlp, held_out, 0, held_out->num_samples, EVALUATION_BATCH_SIZE).accuracy;
+}
+
+// samples whose pruned_infer prediction differs from mlp_infer's, and whether a save / load round trip gives identical logits
+static int check_export(MLP *mlp, const PrunedMLP *pmlp, Matrix inputs, int *identical_reload) {
+    int predictions[HELD_OUT], pruned_predictions[HELD_OUT];
+    void *scratch = aligned_alloc(MATRIX_ALIGNMENT, mlp_inference_scratch_bytes(mlp, inputs.rows));
+    mlp_infer(mlp, inputs, scratch, predictions);
+    free(scratch);
+    scratch = aligned_alloc(MATRIX_ALIGNMENT, pruned_scratch_bytes(pmlp, inputs.rows));
+    Matrix logits = pruned_infer(pmlp, inputs, scratch, pruned_predictions);
+    Matrix expected = allocate_matrix(logits.rows, logits.cols);
+    matrix_copy(expected, logits);
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/bench_pruning_%d.sparse", (int)getpid());
+    PrunedMLP *loaded = pruned_save(pmlp, path) == 0 ? pruned_load(path) : NULL;
+    unlink(path);
+    *identical_reload = loaded != NULL;
+    if (loaded != NULL) {
+        logits = pruned_infer(loaded, inputs, scratch, NULL);
+        for (int i = 0; i < logits.rows; i++) {
+            *identical_reload &= memcmp(matrix_row(logits, i), matrix_row(expected, i), logits.cols * sizeof(float)) == 0;
+        }
+        pruned_free(loaded);
+    }
+    free_matrix(expected);
+    free(scratch);
+    int mismatches = 0;
+    for (int i = 0; i < inputs.rows; i++) {
+        mismatches += predictions[i] != pruned_predictions[i];
+    }
+    return mismatches;
+}
+
+int main(int argc, char **argv) {
+    float target = argc > 1 ? atof(argv[1]) : 0.9f;
+    int epochs = argc > 2 ? atoi(argv[2]) : 6;
+    int hidden = argc > 3 ? atoi(argv[3]) : 256;
+
+    Matrix teacher = allocate_matrix(784, CLASSES);
+    synthetic_teacher(teacher, 9);
+    Matrix inputs = allocate_matrix(TRAIN_SAMPLES, 784), targets = allocate_matrix(TRAIN_SAMPLES, CLASSES);
+    Matrix held_inputs = allocate_matrix(HELD_OUT, 784), held_targets = allocate_matrix(HELD_OUT, CLASSES);
+    teacher_task(inputs, targets, teacher, 42);
+    teacher_task(held_inputs, held_targets, teacher, 43);
+    Dataset *train_set = dataset_from_matrices(inputs, targets);
+    Dataset *held_out = dataset_from_matrices(held_inputs, held_targets);
+
+    // the schedule ramps up over the first two thirds of training and holds the target for the rest
+    PruneSchedule schedule = { target, PRUNE_GLOBAL, 1, 0, epochs * 2 / 3 };
+    MLP *dense = create_model(hidden);
+    MLP *gradual = create_model(hidden);
+    MLP *blocks = create_model(hidden);
+    mlp_set_pruning(gradual, schedule);
+    schedule.block_width = SPARSE_BLOCK_WIDTH;
+    mlp_set_pruning(blocks, schedule);
+    double dense_accuracy = train_model(dense, train_set, held_out, epochs);
+    double gradual_accuracy = train_model(gradual, train_set, held_out, epochs);
+    double blocks_accuracy = train_model(blocks, train_set, held_out, epochs);
+
+    printf("\n784-%d-%d-10 on a linear teacher, %d epochs of %d samples, batch %d, SGD at 0.05\n\n", hidden, hidden / 2, epochs,
+           TRAIN_SAMPLES, BATCH);
+    float levels[] = {0.0f, 0.5f, 0.7f, 0.8f, 0.9f, 0.95f};
+    int num_levels = sizeof(levels) / sizeof(levels[0]);
+    validate_pruning(dense, held_out, levels, num_levels, PRUNE_GLOBAL, 1);
+    printf("\n");
+    validate_pruning(dense, held_out, levels, num_levels, PRUNE_GLOBAL, SPARSE_BLOCK_WIDTH);
+
+    printf("\nheld-out accuracy: dense %.4f, gradual %.3f sparse %.4f, gradual %.3f sparse in blocks of 8 %.4f\n\n",
+           dense_accuracy, mlp_sparsity(gradual), gradual_accuracy, mlp_sparsity(blocks), blocks_accuracy);
+    mlp_set_pruning(gradual, (PruneSchedule){ 0 });
+    mlp_set_pruning(blocks, (PruneSchedule){ 0 });
+    float final_level[] = {0.0f};
+    validate_pruning(gradual, held_out, final_level, 1, PRUNE_GLOBAL, 1);
+    printf("\n");
+    validate_pruning(blocks, held_out, final_level, 1, PRUNE_GLOBAL, SPARSE_BLOCK_WIDTH);
+
+    int identical_csr, identical_blocks;
+    PrunedMLP *csr = prune_export(gradual, 1), *blocked = prune_export(blocks, SPARSE_BLOCK_WIDTH);
+    int mismatches = check_export(gradual, csr, held_inputs, &identical_csr) + check_export(blocks, blocked, held_inputs, &identical_blocks);
+    printf("\npruned_infer predictions differing from mlp_infer: %d of %d, save / load round trip identical: %s\n", mismatches,
+           2 * HELD_OUT, identical_csr && identical_blocks ? "yes" : "NO");
+
+    pruned_free(csr);
+    pruned_free(blocked);
+    mlp_free(dense);
+    mlp_free(gradual);
+    mlp_free(blocks);
+    dataset_close(train_set);
+    dataset_close(held_out);
+    free_matrix(teacher);
+    free_matrix(inputs);
+    free_matrix(targets);
+    free_matrix(held_inputs);
+    free_matrix(held_targets);
+    return mismatches > 0 || !identical_csr || !identical_blocks;
+}
@@ -0,0 +1,126 @@
+/*
+    INT8 inference against float32 on an MNIST-shaped model (784-hidden-hidden-10, ReLU)
+    Quantizes a model calibrated on 2048 synthetic samples, then reports how often the int8 argmax
+    agrees with the float one on held-out samples, the largest logit error, whether every integer
+    kernel gives bitwise identical logits, and the throughput of both paths at batch sizes 1, 32 and 256.
+    Build from c_mlp/:
+        gcc -O2 -I. bench/bench_quantized.c quantize.c quantize_kernels.c allreduce.c inference.c evaluate.c mlp.c optimizer.c gemm.c gemm_kernels.c bf16.c sparse.c matrix.c arena.c dataset.c loader.c threadpool.c activation.c activation_kernels.c loss.c -o bench_quantized -lm -lpthread
+    Usage: ./bench_quantized [hidden_size] [num_samples]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<time.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"gemm.h"
+#include"inference.h"
+#include"quantize.h"
+#include"bench_common.h"
+
+// samples per second over all of inputs in batches of batch_size
+static double throughput(MLP *mlp, QuantizedMLP *qmlp, Matrix inputs, int batch_size, void *scratch, int *predictions) {
+    int num_batches = inputs.rows / batch_size;
+    double start = now_seconds();
+    for (int b = 0; b < num_batches; b++) {
+        Matrix batch = matrix_row_view(inputs, b * batch_size, batch_size);
+        if (qmlp != NULL) {
+            quantized_infer(qmlp, batch, scratch, predictions);
+        } else {
+            mlp_infer(mlp, batch, scratch, predictions);
+        }
+    }
+    return num_batches * batch_size / (now_seconds() - start);
+}
+
+int main(int argc, char **argv) {
+    int hidden = argc > 1 ? atoi(argv[1]) : 1024;
+    int num_samples = argc > 2 ? atoi(argv[2]) : 4096;
+    int num_calibration = 2048;
+
+    int num_neurons[] = {hidden, hidden, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+
+    Matrix calibration = allocate_matrix(num_calibration, 784);
+    synthetic_inputs(calibration, 7);
+    Matrix inputs = allocate_matrix(num_samples, 784);
+    synthetic_inputs(inputs, 42);
+
+    double start = now_seconds();
+    QuantizedMLP *qmlp = quantize_mlp(mlp, calibration);
+    double quantize_seconds = now_seconds() - start;
+
+    size_t float_bytes = 0, int8_bytes = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        float_bytes += (size_t)mlp->layers[i]->prev_num_neurons * mlp->layers[i]->num_neurons * sizeof(float);
+        int8_bytes += (size_t)qmlp->layers[i].n8 * qmlp->layers[i].k4 * 32;
+    }
+    printf("784-%d-%d-10, weights %.1f MB float32, %.1f MB int8, quantized in %.1f ms\n", hidden, hidden,
+           float_bytes / 1e6, int8_bytes / 1e6, quantize_seconds * 1e3);
+
+    size_t scratch_bytes = mlp_inference_scratch_bytes(mlp, num_samples);
+    if (quantized_scratch_bytes(qmlp, num_samples) > scratch_bytes) {
+        scratch_bytes = quantized_scratch_bytes(qmlp, num_samples);
+    }
+    void *scratch = aligned_alloc(MATRIX_ALIGNMENT, scratch_bytes);
+    Matrix float_logits = allocate_matrix(num_samples, 10);
+    Matrix int8_logits = allocate_matrix(num_samples, 10);
+    int *float_predictions = malloc(num_samples * sizeof(int));
+    int *int8_predictions = malloc(num_samples * sizeof(int));
+
+    matrix_copy(float_logits, mlp_infer(mlp, inputs, scratch, float_predictions));
+    matrix_copy(int8_logits, quantized_infer(qmlp, inputs, scratch, int8_predictions));
+    int agree = 0;
+    double max_error = 0, max_logit = 0;
+    for (int i = 0; i < num_samples; i++) {
+        agree += float_predictions[i] == int8_predictions[i];
+        for (int j = 0; j < 10; j++) {
+            max_error = fmax(max_error, fabs(MAT(float_logits, i, j) - MAT(int8_logits, i, j)));
+            max_logit = fmax(max_logit, fabs(MAT(float_logits, i, j)));
+        }
+    }
+    printf("argmax agreement with float32: %.2f%%, max logit error %.4f (largest logit %.2f)\n",
+           100.0 * agree / num_samples, max_error, max_logit);
+
+    const char *kernels[] = {"scalar", "avx2", "avxvnni", "avx512vnni"};
+    int identical = 1;
+    printf("integer kernels:");
+    for (int k = 0; k < 4; k++) {
+        if (quantize_select_kernel(kernels[k]) != 0) {
+            continue;
+        }
+        Matrix logits = quantized_infer(qmlp, inputs, scratch, NULL);
+        for (int i = 0; i < num_samples; i++) {
+            identical &= memcmp(matrix_row(logits, i), matrix_row(int8_logits, i), 10 * sizeof(float)) == 0;
+        }
+        printf(" %s", kernels[k]);
+    }
+    quantize_select_kernel("auto");
+    printf(", bitwise identical: %s\n", identical ? "yes" : "NO");
+
+    printf("\ngemm kernel: %s, integer kernel: %s, samples/sec\n", gemm_kernel_name(), quantize_kernel_name());
+    printf("%8s %12s %12s %9s\n", "batch", "float32", "int8", "speedup");
+    int batch_sizes[] = {1, 32, 256};
+    for (int b = 0; b < 3; b++) {
+        // a first pass grows the GEMM packing buffers
+        throughput(mlp, NULL, inputs, batch_sizes[b], scratch, float_predictions);
+        double f = throughput(mlp, NULL, inputs, batch_sizes[b], scratch, float_predictions);
+        double q = throughput(mlp, qmlp, inputs, batch_sizes[b], scratch, int8_predictions);
+        printf("%8d %12.0f %12.0f %8.2fx\n", batch_sizes[b], f, q, q / f);
+    }
+
+    free(scratch);
+    free(float_predictions);
+    free(int8_predictions);
+    free_matrix(float_logits);
+    free_matrix(int8_logits);
+    free_matrix(calibration);
+    free_matrix(inputs);
+    quantized_free(qmlp);
+    mlp_free(mlp);
+    return !identical;
+}
@@ -0,0 +1,190 @@
+/*
+    Load generator for the inference server: throughput against p50 / p99 latency as concurrency grows
+    Each client is a thread with its own connection that sends one request, waits for the reply and
+    sends the next (closed loop). By default it serves a seeded 784-64-32-10 model in-process, once
+    with batching off (batches of 1) and once with the default dynamic batching, and checks every
+    reply's prediction against mlp_infer. With --socket it drives a running serve_model instead.
+    Build from c_mlp/:
+        make bench_server
+    Usage: ./bench_server [seconds_per_level] [max_clients] [--hidden N] [--socket path --features N]
+        --hidden N serves 784-N-N-10 instead, batching pays off more the larger the model
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<pthread.h>
+#include<unistd.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"inference.h"
+#include"server.h"
+#include"bench_common.h"
+
+#define POOL_SAMPLES 1024
+#define MAX_OUTPUTS 1024
+#define MAX_LATENCIES (1 << 16)
+
+typedef struct {
+    const char *socket_path;
+    const Matrix *inputs;
+    const int *expected; // predictions to check the replies against, or NULL
+    double deadline;
+    int first_sample;
+    double *latencies;   // microseconds
+    int count;
+    int mismatches;
+    int failed;
+} Client;
+
+static void *client_main(void *arg) {
+    Client *client = arg;
+    float outputs[MAX_OUTPUTS];
+    int fd = server_connect(client->socket_path);
+    if (fd < 0) {
+        client->failed = 1;
+        return NULL;
+    }
+    int sample = client->first_sample;
+    while (client->count < MAX_LATENCIES && now_seconds() < client->deadline) {
+        ServerReply reply;
+        double start = now_seconds();
+        if (server_send_request(fd, client->count, matrix_row(*client->inputs, sample), client->inputs->cols) != 0
+            || server_receive_reply(fd, &reply, outputs, MAX_OUTPUTS) != 0 || reply.status != SERVER_OK
+            || reply.id != (uint32_t)client->count) {
+            client->failed = 1;
+            break;
+        }
+        client->latencies[client->count++] = (now_seconds() - start) * 1e6;
+        client->mismatches += client->expected != NULL && reply.prediction != client->expected[sample];
+        sample = (sample + 1) % client->inputs->rows;
+    }
+    close(fd);
+    return NULL;
+}
+
+// one closed-loop run of num_clients clients, prints a row of the curve; returns 0 if every reply was right
+static int run_level(const char *socket_path, InferenceServer *server, const Matrix *inputs, const int *expected,
+                     int num_clients, double seconds, double *all_latencies) {
+    Client clients[num_clients];
+    pthread_t threads[num_clients];
+    long requests_before = 0, batches_before = 0;
+    if (server != NULL) {
+        server_stats(server, &requests_before, &batches_before);
+    }
+    double start = now_seconds();
+    for (int c = 0; c < num_clients; c++) {
+        clients[c] = (Client){ socket_path, inputs, expected, start + seconds, (c * 97) % inputs->rows,
+                               malloc(MAX_LATENCIES * sizeof(double)), 0, 0, 0 };
+        pthread_create(&threads[c], NULL, client_main, &clients[c]);
+    }
+    int total = 0, mismatches = 0, failed = 0;
+    for (int c = 0; c < num_clients; c++) {
+        pthread_join(threads[c], NULL);
+        memcpy(all_latencies + total, clients[c].latencies, clients[c].count * sizeof(double));
+        total += clients[c].count;
+        mismatches += clients[c].mismatches;
+        failed |= clients[c].failed;
+        free(clients[c].latencies);
+    }
+    double elapsed = now_seconds() - start;
+    qsort(all_latencies, total, sizeof(double), compare_doubles);
+
+    printf("%8d %14.0f %10.1f %10.1f", num_clients, total / elapsed, total > 0 ? percentile(all_latencies, total, 0.50) : 0.0,
+           total > 0 ? percentile(all_latencies, total, 0.99) : 0.0);
+    if (server != NULL) {
+        long requests, batches;
+        server_stats(server, &requests, &batches);
+        printf(" %12.1f", batches > batches_before ? (double)(requests - requests_before) / (batches - batches_before) : 0.0);
+    }
+    printf("%s\n", failed ? "   request failed" : mismatches > 0 ? "   wrong predictions" : "");
+    return failed || mismatches > 0;
+}
+
+typedef struct {
+    InferenceServer *server;
+} ServerThread;
+
+static void *server_main(void *arg) {
+    server_run(((ServerThread *)arg)->server);
+    return NULL;
+}
+
+static int sweep(const char *socket_path, InferenceServer *server, const Matrix *inputs, const int *expected, int max_clients,
+                 double seconds) {
+    double *latencies = malloc((size_t)max_clients * MAX_LATENCIES * sizeof(double));
+    printf("%8s %14s %10s %10s%s\n", "clients", "requests/sec", "p50 us", "p99 us", server != NULL ? "   mean batch" : "");
+    int failed = 0;
+    for (int clients = 1; clients <= max_clients; clients *= 2) {
+        failed |= run_level(socket_path, server, inputs, expected, clients, seconds, latencies);
+    }
+    free(latencies);
+    return failed;
+}
+
+int main(int argc, char **argv) {
+    double seconds = 0.5;
+    int max_clients = 64, num_features = 784, hidden = 0;
+    const char *external = NULL;
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--socket") == 0) {
+            external = argv[++i];
+        } else if (i + 1 < argc && strcmp(argv[i], "--hidden") == 0) {
+            hidden = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--features") == 0) {
+            num_features = atoi(argv[++i]);
+        } else if (positional++ == 0) {
+            seconds = atof(argv[i]);
+        } else {
+            max_clients = atoi(argv[i]);
+        }
+    }
+
+    Matrix inputs = allocate_matrix(POOL_SAMPLES, num_features);
+    synthetic_inputs(inputs, 7);
+    if (external != NULL) {
+        printf("serve_model on %s, %d features, %.1f s per level\n", external, num_features, seconds);
+        int failed = sweep(external, NULL, &inputs, NULL, max_clients, seconds);
+        free_matrix(inputs);
+        return failed;
+    }
+
+    int num_neurons[] = {hidden > 0 ? hidden : 64, hidden > 0 ? hidden : 32, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, num_features);
+    mlp_init_weights(mlp, 42);
+    int expected[POOL_SAMPLES];
+    void *scratch = aligned_alloc(MATRIX_ALIGNMENT, mlp_inference_scratch_bytes(mlp, POOL_SAMPLES));
+    mlp_infer(mlp, inputs, scratch, expected);
+    free(scratch);
+
+    char socket_path[64];
+    snprintf(socket_path, sizeof(socket_path), "/tmp/bench_server_%d.sock", (int)getpid());
+    ServerConfig configs[2] = { server_default_config(), server_default_config() };
+    configs[0].max_batch_size = 1;
+    const char *names[2] = { "batching off", "dynamic batching" };
+    int failed = 0;
+    for (int s = 0; s < 2; s++) {
+        InferenceServer *server = server_create(mlp, socket_path, configs[s]);
+        if (server == NULL) {
+            return 1;
+        }
+        ServerThread args = { server };
+        pthread_t thread;
+        pthread_create(&thread, NULL, server_main, &args);
+        printf("%s%d-%d-%d-%d, %s: batches of up to %d, %.0f us delay, %d workers, %.1f s per level\n", s > 0 ? "\n" : "", num_features, num_neurons[0],
+               num_neurons[1], num_neurons[2], names[s],
+               configs[s].max_batch_size, configs[s].max_delay * 1e6, configs[s].num_workers, seconds);
+        failed |= sweep(socket_path, server, &inputs, expected, max_clients, seconds);
+        server_stop(server);
+        pthread_join(thread, NULL);
+        server_free(server);
+    }
+    printf("every reply matches mlp_infer: %s\n", failed ? "NO" : "yes");
+
+    free_matrix(inputs);
+    mlp_free(mlp);
+    return failed;
+}
@@ -0,0 +1,145 @@
+/*
+    First layer of a 784-64 MLP with sparse inputs: dense GEMMs against the CSR kernels, then a whole
+    epoch of 784-64-32-10 training with the loader's CSR batches off and on
+    The kernel part times the forward product with its bias + ReLU epilogue and the weight gradient
+    (inputs^T @ deltas) at several input densities and checks the CSR results against the dense ones.
+    Build from c_mlp/:
+        make bench_sparse
+    Usage: ./bench_sparse [batch_size] [num_samples]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include"mlp.h"
+#include"evaluate.h"
+#include"activation.h"
+#include"loss.h"
+#include"gemm.h"
+#include"bench_common.h"
+
+#define INPUTS 784
+#define NEURONS 64
+#define MIN_SECONDS 0.2
+
+static void inputs_with_density(Matrix inputs, double density, unsigned int seed) {
+    srand(seed);
+    for (int i = 0; i < inputs.rows; i++) {
+        for (int j = 0; j < inputs.cols; j++) {
+            MAT(inputs, i, j) = rand() < density * RAND_MAX ? (rand() % 255 + 1) / 255.0f : 0.0f;
+        }
+    }
+}
+
+static float max_difference(Matrix A, Matrix B) {
+    float max = 0;
+    for (int i = 0; i < A.rows; i++) {
+        for (int j = 0; j < A.cols; j++) {
+            float d = fabsf(MAT(A, i, j) - MAT(B, i, j));
+            max = d > max ? d : max;
+        }
+    }
+    return max;
+}
+
+// microseconds per forward + weight gradient of one batch
+static double time_layer(Matrix inputs, const SparseMatrix *sparse, Matrix weights, float *biases, Matrix deltas,
+                         Matrix outputs, Matrix grad_weights) {
+    GemmEpilogue epilogue = { biases, { NULL }, relu_vector, 0 };
+    long calls = 0;
+    double start = now_seconds(), elapsed = 0;
+    while (elapsed < MIN_SECONDS) {
+        if (sparse != NULL) {
+            spmm_fused(NULL, *sparse, weights, 0.0f, outputs, &epilogue);
+            spmm_tn(NULL, *sparse, deltas, 0.0f, grad_weights);
+        } else {
+            sgemm_fused(NULL, GEMM_N, GEMM_N, 1.0f, inputs, weights, 0.0f, outputs, &epilogue);
+            sgemm(GEMM_T, GEMM_N, 1.0f, inputs, deltas, 0.0f, grad_weights);
+        }
+        calls++;
+        elapsed = now_seconds() - start;
+    }
+    return elapsed / calls * 1e6;
+}
+
+static double time_epoch(Dataset *dataset, int batch_size, float max_density, float *loss) {
+    int num_neurons[] = {NEURONS, 32, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, INPUTS);
+    mlp_init_weights(mlp, 42);
+    mlp_set_num_threads(mlp, 1);
+    mlp_set_validation(mlp, NULL, 0, 0);
+    DataLoader *loader = loader_create(dataset, batch_size, 1, 42);
+    loader_set_sparse(loader, max_density);
+
+    double start = now_seconds();
+    train(mlp, loader, 1);
+    double seconds = now_seconds() - start;
+    *loss = mlp_evaluate(mlp, dataset, 0, dataset->num_samples, EVALUATION_BATCH_SIZE).loss;
+    loader_free(loader);
+    mlp_free(mlp);
+    return seconds;
+}
+
+int main(int argc, char **argv) {
+    int batch_size = argc > 1 ? atoi(argv[1]) : 32;
+    int num_samples = argc > 2 ? atoi(argv[2]) : 60000;
+    double densities[] = {0.02, 0.05, 0.1, 0.2, 0.3, 0.5};
+    int num_densities = sizeof(densities) / sizeof(densities[0]);
+
+    Matrix inputs = allocate_matrix(batch_size, INPUTS);
+    Matrix weights = allocate_matrix(INPUTS, NEURONS);
+    Matrix deltas = allocate_matrix(batch_size, NEURONS);
+    Matrix dense_out = allocate_matrix(batch_size, NEURONS), sparse_out = allocate_matrix(batch_size, NEURONS);
+    Matrix dense_grad = allocate_matrix(INPUTS, NEURONS), sparse_grad = allocate_matrix(INPUTS, NEURONS);
+    float biases[NEURONS];
+    synthetic_inputs(weights, 1);
+    synthetic_inputs(deltas, 2);
+    for (int j = 0; j < NEURONS; j++) {
+        biases[j] = 0.01f * j - 0.3f;
+    }
+    SparseMatrix sparse = sparse_allocate(batch_size, INPUTS, batch_size * INPUTS);
+
+    printf("first layer, %d x %d inputs, %d neurons, %s kernels, forward + weight gradient\n", batch_size, INPUTS, NEURONS,
+           gemm_kernel_name());
+    printf("%8s %12s %12s %9s %12s\n", "density", "dense us", "sparse us", "speedup", "max diff");
+    int correct = 1;
+    for (int d = 0; d < num_densities; d++) {
+        inputs_with_density(inputs, densities[d], 3);
+        sparse_from_dense(inputs, &sparse);
+        double dense_us = time_layer(inputs, NULL, weights, biases, deltas, dense_out, dense_grad);
+        double sparse_us = time_layer(inputs, &sparse, weights, biases, deltas, sparse_out, sparse_grad);
+        float diff = fmaxf(max_difference(dense_out, sparse_out), max_difference(dense_grad, sparse_grad));
+        correct &= diff < 1e-3f;
+        printf("%8.2f %12.2f %12.2f %8.2fx %12.2e\n", (double)sparse_nnz(sparse) / (batch_size * INPUTS), dense_us, sparse_us,
+               dense_us / sparse_us, diff);
+    }
+
+    // synthetic_mnist is about 20% non-zero, like MNIST itself
+    Matrix train_inputs = allocate_matrix(num_samples, INPUTS);
+    Matrix train_targets = allocate_matrix(num_samples, 10);
+    synthetic_mnist(train_inputs, train_targets, 42);
+    Dataset *dataset = dataset_from_matrices(train_inputs, train_targets);
+    float dense_loss, sparse_loss;
+    double dense_seconds = time_epoch(dataset, batch_size, 0, &dense_loss);
+    double sparse_seconds = time_epoch(dataset, batch_size, SPARSE_MAX_DENSITY, &sparse_loss);
+    printf("\none epoch of %d samples, batch size %d\n", num_samples, batch_size);
+    printf("%-14s %10s %12s %10s\n", "", "seconds", "samples/sec", "loss");
+    printf("%-14s %10.3f %12.0f %10.5f\n", "dense", dense_seconds, num_samples / dense_seconds, dense_loss);
+    printf("%-14s %10.3f %12.0f %10.5f   %.2fx\n", "sparse inputs", sparse_seconds, num_samples / sparse_seconds, sparse_loss,
+           dense_seconds / sparse_seconds);
+    printf("CSR results match dense: %s\n", correct && fabsf(dense_loss - sparse_loss) < 1e-3f ? "yes" : "NO");
+
+    sparse_free(sparse);
+    dataset_close(dataset);
+    free_matrix(train_inputs);
+    free_matrix(train_targets);
+    free_matrix(inputs);
+    free_matrix(weights);
+    free_matrix(deltas);
+    free_matrix(dense_out);
+    free_matrix(sparse_out);
+    free_matrix(dense_grad);
+    free_matrix(sparse_grad);
+    return !correct;
+}
@@ -0,0 +1,96 @@
+/*
+    The forward pass specialize_model generates for a seeded 784-64-32-10 model against mlp_infer
+    Checks that the generated code gives the same outputs and predictions as the library on the same
+    weights, then compares per-request latency at batch size 1 (p50 / p99) and throughput over batches
+    of 256.
+    Build from c_mlp/:
+        make bench_specialized, which first generates build/specialized_mnist.{c,h} with
+        build/specialize_model --spec 784-64:relu-32:relu-10:softmax --seed 42 specialized_mnist build
+    Usage: ./bench_specialized [num_requests]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"inference.h"
+#include"bench_common.h"
+#include"specialized_mnist.h"
+
+#define SEED 42
+#define POOL_SAMPLES 4096
+#define BATCH 256
+
+int main(int argc, char **argv) {
+    int num_requests = argc > 1 ? atoi(argv[1]) : 20000;
+
+    int num_neurons[] = {64, 32, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+    mlp_init_weights(mlp, SEED);
+
+    Matrix inputs = allocate_matrix(POOL_SAMPLES, SPECIALIZED_MNIST_INPUT_SIZE);
+    Matrix outputs = allocate_matrix(POOL_SAMPLES, SPECIALIZED_MNIST_OUTPUT_SIZE);
+    synthetic_inputs(inputs, SEED);
+    void *scratch = aligned_alloc(MATRIX_ALIGNMENT, mlp_inference_scratch_bytes(mlp, BATCH));
+    int predictions[BATCH];
+
+    // same outputs and predictions as mlp_infer
+    float max_diff = 0;
+    int mismatches = 0;
+    for (int i = 0; i < POOL_SAMPLES; i++) {
+        const float *x = matrix_row(inputs, i);
+        Matrix probabilities = matrix_activation(mlp_infer(mlp, matrix_row_view(inputs, i, 1), scratch, predictions), softmax);
+        specialized_mnist_forward(x, matrix_row(outputs, i));
+        for (int j = 0; j < SPECIALIZED_MNIST_OUTPUT_SIZE; j++) {
+            float d = fabsf(MAT(probabilities, 0, j) - MAT(outputs, i, j));
+            max_diff = d > max_diff ? d : max_diff;
+        }
+        mismatches += specialized_mnist_predict(x) != predictions[0];
+    }
+
+    // batch size 1 latency, requests taken round-robin from the pool
+    double *library_times = malloc(num_requests * sizeof(double));
+    double *specialized_times = malloc(num_requests * sizeof(double));
+    volatile int sink = 0;
+    for (int r = 0; r < num_requests; r++) {
+        Matrix x = matrix_row_view(inputs, r % POOL_SAMPLES, 1);
+        double start = now_seconds();
+        mlp_infer(mlp, x, scratch, predictions);
+        double middle = now_seconds();
+        sink += specialized_mnist_predict(x.data);
+        double end = now_seconds();
+        library_times[r] = (middle - start) * 1e6;
+        specialized_times[r] = (end - middle) * 1e6;
+    }
+    qsort(library_times, num_requests, sizeof(double), compare_doubles);
+    qsort(specialized_times, num_requests, sizeof(double), compare_doubles);
+
+    // throughput over the whole pool in batches
+    double start = now_seconds();
+    for (int b = 0; b < POOL_SAMPLES; b += BATCH) {
+        mlp_infer(mlp, matrix_row_view(inputs, b, BATCH), scratch, predictions);
+    }
+    double library_seconds = now_seconds() - start;
+    start = now_seconds();
+    specialized_mnist_forward_batch(inputs.data, POOL_SAMPLES, outputs.data);
+    double specialized_seconds = now_seconds() - start;
+
+    printf("784-64-32-10, %d requests of one sample, %d samples in batches of %d\n", num_requests, POOL_SAMPLES, BATCH);
+    printf("%-12s %10s %10s %14s\n", "", "p50 us", "p99 us", "samples/sec");
+    printf("%-12s %10.2f %10.2f %14.0f\n", "mlp_infer", percentile(library_times, num_requests, 0.50),
+           percentile(library_times, num_requests, 0.99), POOL_SAMPLES / library_seconds);
+    printf("%-12s %10.2f %10.2f %14.0f\n", "specialized", percentile(specialized_times, num_requests, 0.50),
+           percentile(specialized_times, num_requests, 0.99), POOL_SAMPLES / specialized_seconds);
+    printf("max output difference: %.2e, prediction mismatches: %d of %d\n", max_diff, mismatches, POOL_SAMPLES);
+
+    free(library_times);
+    free(specialized_times);
+    free(scratch);
+    free_matrix(inputs);
+    free_matrix(outputs);
+    mlp_free(mlp);
+    return max_diff > 1e-4f || mismatches > 0;
+}
@@ -0,0 +1,301 @@
+/*
+    Regression suite: GEMM shapes, activations, one training step, epoch throughput and inference latency
+    Every case runs on seeded synthetic data and a seeded model, single-threaded, repeats its work for
+    at least MIN_SECONDS per repetition and reports the median, mean, standard deviation and coefficient
+    of variation across repetitions. Results can be written as JSON lines and compared against an earlier run, the
+    exit status is non-zero when a median got more than REGRESSION_THRESHOLD worse.
+    Build from c_mlp/:
+        make bench_suite, or make bench to build and run it
+    Usage: ./bench_suite [repetitions] [results.jsonl | -] [baseline.jsonl]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"gemm.h"
+#include"inference.h"
+#include"loader.h"
+#include"bench_common.h"
+
+#define SEED 42
+#define MAX_REPETITIONS 101
+#define REGRESSION_THRESHOLD 0.10
+#define MIN_SECONDS 0.05 // every repetition runs at least this long
+
+typedef struct {
+    const char *name;
+    const char *unit;
+    int higher_is_better;
+    void (*setup)(void *state);
+    // runs the case once, returns the work done in the unit's numerator for rates, or the factor from
+    // seconds to the unit for latencies
+    double (*run)(void *state);
+    void (*teardown)(void *state);
+    void *state;
+} BenchCase;
+
+// ---- GEMM ----
+
+typedef struct {
+    int trans_a, trans_b, m, n, k;
+    Matrix A, B, C;
+} GemmState;
+
+static void gemm_setup(void *arg) {
+    GemmState *s = arg;
+    s->A = s->trans_a ? allocate_matrix(s->k, s->m) : allocate_matrix(s->m, s->k);
+    s->B = s->trans_b ? allocate_matrix(s->n, s->k) : allocate_matrix(s->k, s->n);
+    s->C = allocate_matrix(s->m, s->n);
+    synthetic_inputs(s->A, SEED);
+    synthetic_inputs(s->B, SEED + 1);
+}
+
+static double gemm_run(void *arg) {
+    GemmState *s = arg;
+    sgemm_parallel(NULL, s->trans_a, s->trans_b, 1.0f, s->A, s->B, 0.0f, s->C);
+    return 2e-9 * s->m * s->n * s->k;
+}
+
+static void gemm_teardown(void *arg) {
+    GemmState *s = arg;
+    free_matrix(s->A);
+    free_matrix(s->B);
+    free_matrix(s->C);
+}
+
+// ---- activations ----
+
+#define ACTIVATION_ELEMENTS (1 << 16)
+
+typedef struct {
+    void (*activation)(float*, float*, size_t);
+    int row; // softmax row length, 0 for elementwise activations
+    float *input, *output;
+} ActivationState;
+
+static void activation_setup(void *arg) {
+    ActivationState *s = arg;
+    s->input = malloc(ACTIVATION_ELEMENTS * sizeof(float));
+    s->output = malloc(ACTIVATION_ELEMENTS * sizeof(float));
+    srand(SEED);
+    for (int i = 0; i < ACTIVATION_ELEMENTS; i++) {
+        s->input[i] = 8.0f * rand() / RAND_MAX - 4.0f;
+    }
+}
+
+static double activation_run(void *arg) {
+    ActivationState *s = arg;
+    if (s->row > 0) {
+        for (int i = 0; i + s->row <= ACTIVATION_ELEMENTS; i += s->row) {
+            s->activation(s->input + i, s->output + i, s->row);
+        }
+    } else {
+        s->activation(s->input, s->output, ACTIVATION_ELEMENTS);
+    }
+    return ACTIVATION_ELEMENTS * 1e-6;
+}
+
+static void activation_teardown(void *arg) {
+    ActivationState *s = arg;
+    free(s->input);
+    free(s->output);
+}
+
+// ---- training and inference on an MNIST-shaped model ----
+
+typedef struct {
+    int hidden1, hidden2, batch_size, num_samples;
+    MLP *mlp;
+    Matrix inputs, targets;
+    Dataset *dataset;
+    DataLoader *loader;
+    void *scratch;
+    int *predictions;
+    int next;
+} ModelState;
+
+static void model_setup(void *arg) {
+    ModelState *s = arg;
+    int num_neurons[] = {s->hidden1, s->hidden2, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    s->mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+    mlp_init_weights(s->mlp, SEED);
+    mlp_set_num_threads(s->mlp, 1);
+    s->inputs = allocate_matrix(s->num_samples, 784);
+    s->targets = allocate_matrix(s->num_samples, 10);
+    synthetic_mnist(s->inputs, s->targets, SEED);
+    s->dataset = dataset_from_matrices(s->inputs, s->targets);
+    s->loader = loader_create(s->dataset, s->batch_size, 1, SEED);
+    mlp_reserve_workspace(s->mlp, s->batch_size);
+    s->scratch = aligned_alloc(MATRIX_ALIGNMENT, mlp_inference_scratch_bytes(s->mlp, s->batch_size));
+    s->predictions = malloc(s->batch_size * sizeof(int));
+    s->next = 0;
+}
+
+static void model_teardown(void *arg) {
+    ModelState *s = arg;
+    free(s->scratch);
+    free(s->predictions);
+    loader_free(s->loader);
+    dataset_close(s->dataset);
+    free_matrix(s->inputs);
+    free_matrix(s->targets);
+    mlp_free(s->mlp);
+}
+
+// next batch of the synthetic set, round-robin
+static int next_batch(ModelState *s) {
+    int start = s->next;
+    s->next = s->next + 2 * s->batch_size <= s->num_samples ? s->next + s->batch_size : 0;
+    return start;
+}
+
+static double train_step_run(void *arg) {
+    ModelState *s = arg;
+    int start = next_batch(s);
+    batch_backward(s->mlp, matrix_row_view(s->inputs, start, s->batch_size), matrix_row_view(s->targets, start, s->batch_size));
+    return 1e3; // ms per step
+}
+
+// the loop train() runs, without its progress bar and validation
+static double epoch_run(void *arg) {
+    ModelState *s = arg;
+    Matrix batch_inputs, batch_targets;
+    loader_start_epoch(s->loader, s->next++);
+    while (loader_next(s->loader, &batch_inputs, &batch_targets) > 0) {
+        mlp_compute_gradients(s->mlp, batch_inputs, batch_targets);
+        mlp_apply_gradients(s->mlp);
+    }
+    return s->loader->num_batches * s->batch_size * 1e-3;
+}
+
+static double infer_run(void *arg) {
+    ModelState *s = arg;
+    int start = next_batch(s);
+    mlp_infer(s->mlp, matrix_row_view(s->inputs, start, s->batch_size), s->scratch, s->predictions);
+    return 1e6; // us per call
+}
+
+// ---- driver ----
+
+// median of a previous run's case, or 0 if the baseline does not have it
+static double baseline_median(const char *path, const char *name) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char line[512], case_name[128];
+    double median = 0, value;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "{\"case\":\"%127[^\"]\",\"unit\":\"%*[^\"]\",\"median\":%lf", case_name, &value) == 2
+            && strcmp(case_name, name) == 0) {
+            median = value;
+        }
+    }
+    fclose(f);
+    return median;
+}
+
+/*
+    Times repetitions of a case and summarizes its metric
+    For rates (higher_is_better) a repetition's metric is work / seconds, for latencies it is the mean
+    time of the calls made in that repetition, converted to the unit.
+*/
+static BenchStats run_case(BenchCase *c, int repetitions) {
+    double samples[MAX_REPETITIONS];
+    c->setup(c->state);
+    c->run(c->state); // warm-up: workspaces, packing buffers, page faults
+    for (int r = 0; r < repetitions; r++) {
+        double work = 0, elapsed = 0;
+        long calls = 0;
+        double start = now_seconds();
+        while (elapsed < MIN_SECONDS) {
+            work += c->run(c->state);
+            calls++;
+            elapsed = now_seconds() - start;
+        }
+        samples[r] = c->higher_is_better ? work / elapsed : elapsed / calls * (work / calls);
+    }
+    c->teardown(c->state);
+    return bench_stats(samples, repetitions);
+}
+
+int main(int argc, char **argv) {
+    int repetitions = argc > 1 ? atoi(argv[1]) : 11;
+    const char *results_path = argc > 2 ? argv[2] : NULL;
+    const char *baseline_path = argc > 3 ? argv[3] : NULL;
+    if (repetitions < 1 || repetitions > MAX_REPETITIONS) {
+        fprintf(stderr, "repetitions must be between 1 and %d\n", MAX_REPETITIONS);
+        return 1;
+    }
+
+    GemmState gemm_l1 = { GEMM_N, GEMM_N, 32, 64, 784 };
+    GemmState gemm_grad = { GEMM_T, GEMM_N, 784, 64, 32 };
+    GemmState gemm_backprop = { GEMM_N, GEMM_T, 32, 64, 32 };
+    GemmState gemm_wide = { GEMM_N, GEMM_N, 256, 1024, 1024 };
+    ActivationState relu = { relu_vector, 0 };
+    ActivationState sigmoid = { sigmoid_vector, 0 };
+    ActivationState tanh_act = { tanh_vector, 0 };
+    ActivationState softmax10 = { softmax, 10 };
+    ModelState small_step = { 64, 32, 32, 4096 };
+    ModelState wide_step = { 1024, 1024, 256, 4096 };
+    ModelState epoch = { 64, 32, 32, 10000 };
+    ModelState infer1 = { 64, 32, 1, 4096 };
+    ModelState infer64 = { 64, 32, 64, 4096 };
+    BenchCase cases[] = {
+        { "gemm 32x64x784 NN", "GFLOP/s", 1, gemm_setup, gemm_run, gemm_teardown, &gemm_l1 },
+        { "gemm 784x64x32 TN", "GFLOP/s", 1, gemm_setup, gemm_run, gemm_teardown, &gemm_grad },
+        { "gemm 32x64x32 NT", "GFLOP/s", 1, gemm_setup, gemm_run, gemm_teardown, &gemm_backprop },
+        { "gemm 256x1024x1024 NN", "GFLOP/s", 1, gemm_setup, gemm_run, gemm_teardown, &gemm_wide },
+        { "relu", "Melem/s", 1, activation_setup, activation_run, activation_teardown, &relu },
+        { "sigmoid", "Melem/s", 1, activation_setup, activation_run, activation_teardown, &sigmoid },
+        { "tanh", "Melem/s", 1, activation_setup, activation_run, activation_teardown, &tanh_act },
+        { "softmax rows of 10", "Melem/s", 1, activation_setup, activation_run, activation_teardown, &softmax10 },
+        { "train step 784-64-32-10 b32", "ms", 0, model_setup, train_step_run, model_teardown, &small_step },
+        { "train step 784-1024-1024-10 b256", "ms", 0, model_setup, train_step_run, model_teardown, &wide_step },
+        { "epoch 784-64-32-10 b32", "ksamples/s", 1, model_setup, epoch_run, model_teardown, &epoch },
+        { "infer 784-64-32-10 b1", "us", 0, model_setup, infer_run, model_teardown, &infer1 },
+        { "infer 784-64-32-10 b64", "us", 0, model_setup, infer_run, model_teardown, &infer64 },
+    };
+    int num_cases = sizeof(cases) / sizeof(cases[0]);
+
+    FILE *results = NULL;
+    if (results_path != NULL && strcmp(results_path, "-") != 0 && (results = fopen(results_path, "w")) == NULL) {
+        fprintf(stderr, "Could not open %s\n", results_path);
+        return 1;
+    }
+
+    printf("gemm kernel: %s, %d repetitions of at least %.0f ms, 1 thread\n", gemm_kernel_name(), repetitions, MIN_SECONDS * 1e3);
+    printf("%-34s %12s %12s %10s %7s %10s\n", "case", "median", "mean", "stddev", "cv", baseline_path ? "vs base" : "");
+    int regressions = 0;
+    for (int i = 0; i < num_cases; i++) {
+        BenchCase *c = &cases[i];
+        BenchStats s = run_case(c, repetitions);
+        char change[32] = "";
+        double base = baseline_path ? baseline_median(baseline_path, c->name) : 0;
+        if (base > 0) {
+            // positive is better, whichever direction the unit goes
+            double delta = c->higher_is_better ? s.median / base - 1 : base / s.median - 1;
+            int regressed = delta < -REGRESSION_THRESHOLD;
+            regressions += regressed;
+            snprintf(change, sizeof(change), "%+.1f%%%s", 100 * delta, regressed ? " !" : "");
+        }
+        printf("%-34s %12.3f %12.3f %10.3f %6.1f%% %10s  %s\n", c->name, s.median, s.mean, s.stddev,
+               s.mean > 0 ? 100 * s.stddev / s.mean : 0, change, c->unit);
+        if (results != NULL) {
+            fprintf(results, "{\"case\":\"%s\",\"unit\":\"%s\",\"median\":%.6f,\"mean\":%.6f,\"stddev\":%.6f,\"min\":%.6f,"
+                    "\"max\":%.6f,\"repetitions\":%d,\"higher_is_better\":%d,\"gemm_kernel\":\"%s\"}\n",
+                    c->name, c->unit, s.median, s.mean, s.stddev, s.min, s.max, repetitions, c->higher_is_better, gemm_kernel_name());
+        }
+    }
+    if (results != NULL) {
+        fclose(results);
+    }
+    if (baseline_path != NULL) {
+        printf("%d case(s) more than %.0f%% worse than %s\n", regressions, REGRESSION_THRESHOLD * 100, baseline_path);
+    }
+    return regressions > 0;
+}
@@ -0,0 +1,128 @@
+/*
+    Training a hyperparameter sweep in lockstep against training its models one after the other
+    num_models 784-64-32-10 networks, each with its own seed and a learning rate spaced geometrically
+    from 0.005 to 0.2, take the same SGD steps on a linear teacher task (see teacher_task): once as
+    separate models with batch_backward, once stacked in a ModelSweep. Reports both times, checks the
+    exported sweep models against the separately trained ones and prints each model's held-out loss
+    and accuracy.
+    Build from c_mlp/:
+        make bench_sweep
+    Usage: ./bench_sweep [num_models] [steps] [batch_size] [threads]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<math.h>
+#include"mlp.h"
+#include"evaluate.h"
+#include"activation.h"
+#include"loss.h"
+#include"sweep.h"
+#include"bench_common.h"
+
+#define CLASSES 10
+#define HELD_OUT 2048
+
+// largest absolute difference between the parameters of two models of the same topology
+static double max_difference(MLP *a, MLP *b) {
+    double difference = 0;
+    for (int l = 0; l < a->num_layers; l++) {
+        Layer *x = a->layers[l], *y = b->layers[l];
+        for (int i = 0; i < x->prev_num_neurons; i++) {
+            for (int j = 0; j < x->num_neurons; j++) {
+                difference = fmax(difference, fabsf(MAT(x->weights, i, j) - MAT(y->weights, i, j)));
+            }
+        }
+        for (int j = 0; j < x->num_neurons; j++) {
+            difference = fmax(difference, fabsf(x->biases[j] - y->biases[j]));
+        }
+    }
+    return difference;
+}
+
+int main(int argc, char **argv) {
+    int num_models = argc > 1 ? atoi(argv[1]) : 16;
+    int steps = argc > 2 ? atoi(argv[2]) : 300;
+    int batch_size = argc > 3 ? atoi(argv[3]) : 32;
+    int num_threads = argc > 4 ? atoi(argv[4]) : default_num_threads();
+
+    int num_samples = steps * batch_size < 60000 ? steps * batch_size : 60000;
+    int batches = num_samples / batch_size;
+    Matrix teacher = allocate_matrix(784, CLASSES);
+    synthetic_teacher(teacher, 9);
+    Matrix inputs = allocate_matrix(num_samples, 784), targets = allocate_matrix(num_samples, CLASSES);
+    Matrix held_inputs = allocate_matrix(HELD_OUT, 784), held_targets = allocate_matrix(HELD_OUT, CLASSES);
+    teacher_task(inputs, targets, teacher, 42);
+    teacher_task(held_inputs, held_targets, teacher, 43);
+    Dataset *held_out = dataset_from_matrices(held_inputs, held_targets);
+
+    int num_neurons[] = {64, 32, CLASSES};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    float learning_rates[num_models];
+    unsigned int seeds[num_models];
+    MLP *models[num_models];
+    for (int k = 0; k < num_models; k++) {
+        learning_rates[k] = 0.005f * powf(40.0f, num_models > 1 ? (float)k / (num_models - 1) : 0.0f);
+        seeds[k] = 100 + k;
+        models[k] = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, learning_rates[k], 784);
+        mlp_init_weights(models[k], seeds[k]);
+        mlp_set_num_threads(models[k], num_threads);
+    }
+    ModelSweep *sweep = sweep_create(models[0], num_models, learning_rates, seeds);
+    if (sweep == NULL) {
+        return 1;
+    }
+    sweep_set_num_threads(sweep, num_threads);
+
+    double start = now_seconds();
+    for (int k = 0; k < num_models; k++) {
+        for (int s = 0; s < steps; s++) {
+            int b = s % batches;
+            batch_backward(models[k], matrix_row_view(inputs, b * batch_size, batch_size), matrix_row_view(targets, b * batch_size, batch_size));
+        }
+    }
+    double separate_seconds = now_seconds() - start;
+
+    start = now_seconds();
+    for (int s = 0; s < steps; s++) {
+        int b = s % batches;
+        sweep_step(sweep, matrix_row_view(inputs, b * batch_size, batch_size), matrix_row_view(targets, b * batch_size, batch_size));
+    }
+    double sweep_seconds = now_seconds() - start;
+
+    printf("%d models 784-64-32-10, %d SGD steps of batch %d on a linear teacher, %d threads\n", num_models, steps, batch_size, num_threads);
+    printf("%-32s %10.3f s\n", "separate models, batch_backward", separate_seconds);
+    printf("%-32s %10.3f s   %.2fx\n\n", "stacked sweep, sweep_step", sweep_seconds, separate_seconds / sweep_seconds);
+
+    double training_loss[num_models], training_accuracy[num_models], loss[num_models], accuracy[num_models];
+    sweep_take_stats(sweep, training_loss, training_accuracy);
+    sweep_evaluate(sweep, held_out, 0, HELD_OUT, loss, accuracy);
+    MLP *exported = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.0f, 784);
+    double worst_difference = 0, worst_loss_difference = 0;
+    printf("%6s %14s %14s %10s %14s %10s %12s\n", "model", "learning rate", "training loss", "accuracy", "held-out loss", "accuracy",
+           "max |dw|");
+    for (int k = 0; k < num_models; k++) {
+        sweep_export(sweep, k, exported);
+        double difference = max_difference(exported, models[k]);
+        Evaluation evaluation = mlp_evaluate(models[k], held_out, 0, HELD_OUT, EVALUATION_BATCH_SIZE);
+        worst_difference = fmax(worst_difference, difference);
+        worst_loss_difference = fmax(worst_loss_difference, fabs(evaluation.loss - loss[k]));
+        printf("%6d %14.4f %14.4f %10.3f %14.4f %10.3f %12.2e\n", k, learning_rates[k], training_loss[k], training_accuracy[k], loss[k],
+               accuracy[k], difference);
+    }
+    printf("\nagainst the separately trained models: max weight difference %.2e, max held-out loss difference %.2e\n",
+           worst_difference, worst_loss_difference);
+
+    mlp_free(exported);
+    sweep_free(sweep);
+    for (int k = 0; k < num_models; k++) {
+        mlp_free(models[k]);
+    }
+    dataset_close(held_out);
+    free_matrix(teacher);
+    free_matrix(inputs);
+    free_matrix(targets);
+    free_matrix(held_inputs);
+    free_matrix(held_targets);
+    return worst_difference > 1e-3 || worst_loss_difference > 1e-3;
+}
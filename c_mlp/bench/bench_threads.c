@@ -0,0 +1,106 @@
+/*
+    Thread scaling of MNIST-shaped training (784-64-32-10, batch size 32) on synthetic data
+    Every thread count trains from the same initial weights, and the final weights are hashed to
+    check that the result is bitwise identical across thread counts.
+    Build from c_mlp/:
+        gcc -O2 -I. bench/bench_threads.c allreduce.c inference.c evaluate.c mlp.c optimizer.c gemm.c gemm_kernels.c bf16.c sparse.c matrix.c arena.c dataset.c loader.c threadpool.c activation.c activation_kernels.c loss.c -o bench_threads -lm -lpthread
+    Usage: ./bench_threads [max_threads] [num_samples] [batch_size]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include"mlp.h"
+#include"activation.h"
+#include"loss.h"
+#include"gemm.h"
+#include"bench_common.h"
+
+// FNV-1a over the bytes of every weight and bias
+static unsigned long long hash_weights(MLP *mlp) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        unsigned char *bytes = (unsigned char *)layer->weights.data;
+        size_t size = (size_t)layer->weights.rows * layer->weights.cols * sizeof(float);
+        for (size_t b = 0; b < size; b++) {
+            hash = (hash ^ bytes[b]) * 1099511628211ULL;
+        }
+        bytes = (unsigned char *)layer->biases;
+        for (size_t b = 0; b < layer->num_neurons * sizeof(float); b++) {
+            hash = (hash ^ bytes[b]) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int num_samples = argc > 2 ? atoi(argv[2]) : 60000;
+    int batch_size = argc > 3 ? atoi(argv[3]) : 32;
+
+    Matrix inputs = allocate_matrix(num_samples, 784);
+    Matrix targets = allocate_matrix(num_samples, 10);
+    synthetic_mnist(inputs, targets, 42);
+    Dataset *dataset = dataset_from_matrices(inputs, targets);
+    DataLoader *loader = loader_create(dataset, batch_size, 0, 0);
+
+    int num_neurons[] = {64, 32, 10};
+    void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
+    void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
+    MLP *mlp = mlp_init(3, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+
+    // snapshot the initial parameters so every run starts from the same point
+    Matrix *initial_weights = malloc(mlp->num_layers * sizeof(Matrix));
+    float **initial_biases = malloc(mlp->num_layers * sizeof(float *));
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        initial_weights[i] = allocate_matrix(layer->weights.rows, layer->weights.cols);
+        matrix_copy(initial_weights[i], layer->weights);
+        initial_biases[i] = malloc(layer->num_neurons * sizeof(float));
+        memcpy(initial_biases[i], layer->biases, layer->num_neurons * sizeof(float));
+    }
+
+    double results[256];
+    unsigned long long hashes[256];
+    if (max_threads > 256) {
+        max_threads = 256;
+    }
+    for (int t = 1; t <= max_threads; t++) {
+        for (int i = 0; i < mlp->num_layers; i++) {
+            matrix_copy(mlp->layers[i]->weights, initial_weights[i]);
+            memcpy(mlp->layers[i]->biases, initial_biases[i], mlp->layers[i]->num_neurons * sizeof(float));
+        }
+        mlp->epoch = 0; // train continues from mlp->epoch, which picks the learning rate
+        mlp_set_num_threads(mlp, t);
+
+        double start = now_seconds();
+        train(mlp, loader, 1);
+        results[t - 1] = now_seconds() - start;
+        hashes[t - 1] = hash_weights(mlp);
+    }
+
+    printf("\ngemm kernel: %s, samples: %d, batch size: %d\n", gemm_kernel_name(), num_samples, batch_size);
+    printf("%8s %12s %12s %10s %18s\n", "threads", "seconds", "samples/sec", "speedup", "weights hash");
+    int deterministic = 1;
+    for (int t = 1; t <= max_threads; t++) {
+        printf("%8d %12.3f %12.0f %9.2fx %18llx\n", t, results[t - 1], num_samples / results[t - 1],
+               results[0] / results[t - 1], hashes[t - 1]);
+        deterministic &= hashes[t - 1] == hashes[0];
+    }
+    printf("deterministic across thread counts: %s\n", deterministic ? "yes" : "NO");
+
+    for (int i = 0; i < mlp->num_layers; i++) {
+        free_matrix(initial_weights[i]);
+        free(initial_biases[i]);
+    }
+    free(initial_weights);
+    free(initial_biases);
+    mlp_free(mlp);
+    loader_free(loader);
+    dataset_close(dataset);
+    free_matrix(inputs);
+    free_matrix(targets);
+    return !deterministic;
+}
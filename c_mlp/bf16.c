@@ -0,0 +1,85 @@
+#include"bf16.h"
+
+static void floats_to_bf16_scalar(const float *src, bf16 *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = float_to_bf16(src[i]);
+    }
+}
+
+static void bf16_to_floats_scalar(const bf16 *src, float *dst, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        dst[i] = bf16_to_float(src[i]);
+    }
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BF16_HAVE_AVX2 1
+#include<immintrin.h>
+
+// 16 floats per step: round both halves to nearest even, narrow to 16 bits, undo packus' lane interleave
+__attribute__((target("avx2")))
+static void floats_to_bf16_avx2(const float *src, bf16 *dst, size_t n) {
+    const __m256i bias = _mm256_set1_epi32(0x7fff);
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i abs_mask = _mm256_set1_epi32(0x7fffffff);
+    const __m256i infinity = _mm256_set1_epi32(0x7f800000);
+    const __m256i quiet = _mm256_set1_epi32(0x400000);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i half[2];
+        for (int h = 0; h < 2; h++) {
+            __m256i bits = _mm256_loadu_si256((const __m256i *)(src + i + 8 * h));
+            __m256i rounded = _mm256_add_epi32(bits, _mm256_add_epi32(bias, _mm256_and_si256(_mm256_srli_epi32(bits, 16), one)));
+            __m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(bits, abs_mask), infinity);
+            rounded = _mm256_blendv_epi8(rounded, _mm256_or_si256(bits, quiet), nan);
+            half[h] = _mm256_srli_epi32(rounded, 16);
+        }
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(half[0], half[1]), 0xd8);
+        _mm256_storeu_si256((__m256i *)(dst + i), packed);
+    }
+    floats_to_bf16_scalar(src + i, dst + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void bf16_to_floats_avx2(const bf16 *src, float *dst, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_slli_epi32(wide, 16));
+    }
+    bf16_to_floats_scalar(src + i, dst + i, n - i);
+}
+#endif
+
+static int use_avx2() {
+#ifdef BF16_HAVE_AVX2
+    static int supported = -1;
+    if (supported < 0) {
+        __builtin_cpu_init();
+        supported = __builtin_cpu_supports("avx2");
+    }
+    return supported;
+#else
+    return 0;
+#endif
+}
+
+void floats_to_bf16(const float *src, bf16 *dst, size_t n) {
+#ifdef BF16_HAVE_AVX2
+    if (use_avx2()) {
+        floats_to_bf16_avx2(src, dst, n);
+        return;
+    }
+#endif
+    floats_to_bf16_scalar(src, dst, n);
+}
+
+void bf16_to_floats(const bf16 *src, float *dst, size_t n) {
+#ifdef BF16_HAVE_AVX2
+    if (use_avx2()) {
+        bf16_to_floats_avx2(src, dst, n);
+        return;
+    }
+#endif
+    bf16_to_floats_scalar(src, dst, n);
+}
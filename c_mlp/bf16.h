@@ -0,0 +1,46 @@
+#ifndef BF16_H
+#define BF16_H
+#include<stddef.h>
+#include<stdint.h>
+#include<string.h>
+
+/*
+    bfloat16: the top 16 bits of a float32, so the same exponent range with 8 bits of mantissa
+    Conversion is plain integer arithmetic and needs no hardware support. Rounding is to nearest even,
+    NaNs stay NaN.
+*/
+typedef uint16_t bf16;
+
+// row-major bf16 matrix, ld in elements like Matrix
+typedef struct {
+    bf16 *data;
+    int rows;
+    int cols;
+    int ld;
+} MatrixBF16;
+
+static inline bf16 *matrix_bf16_row(MatrixBF16 M, int i) {
+    return M.data + (size_t)i * M.ld;
+}
+
+static inline bf16 float_to_bf16(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        return (bf16)((bits >> 16) | 0x40); // keep NaNs quiet, rounding could carry them into infinity
+    }
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return (bf16)(bits >> 16);
+}
+
+static inline float bf16_to_float(bf16 h) {
+    uint32_t bits = (uint32_t)h << 16;
+    float x;
+    memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+void floats_to_bf16(const float *src, bf16 *dst, size_t n);
+void bf16_to_floats(const bf16 *src, float *dst, size_t n);
+
+#endif
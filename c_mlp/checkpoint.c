@@ -0,0 +1,707 @@
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<stddef.h>
+#include<limits.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<pthread.h>
+#include<time.h>
+#include"checkpoint.h"
+#include"activation.h"
+#include"loss.h"
+#include"profile.h"
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+static uint64_t weights_bytes(const CheckpointLayer *layer) {
+    return align_offset((uint64_t)layer->prev_num_neurons * layer->num_neurons * sizeof(float));
+}
+
+static uint64_t biases_bytes(const CheckpointLayer *layer) {
+    return align_offset((uint64_t)layer->num_neurons * sizeof(float));
+}
+
+// fills in the offsets of the layer table and returns the size of the file
+static uint64_t layout(CheckpointLayer *table, int num_layers, int optimizer_slots) {
+    uint64_t offset = align_offset(sizeof(CheckpointHeader) + num_layers * sizeof(CheckpointLayer));
+    for (int i = 0; i < num_layers; i++) {
+        table[i].weights_offset = offset;
+        offset += weights_bytes(&table[i]);
+        table[i].biases_offset = offset;
+        offset += biases_bytes(&table[i]);
+    }
+    for (int i = 0; i < num_layers; i++) {
+        table[i].state_offset = optimizer_slots > 0 ? offset : 0;
+        offset += optimizer_slots * (weights_bytes(&table[i]) + biases_bytes(&table[i]));
+    }
+    return offset;
+}
+
+// FNV-1a over the file's little-endian 64-bit words, the header counted with its checksum zeroed
+#define CHECKSUM_BASIS 14695981039346656037ULL
+#define CHECKSUM_PRIME 1099511628211ULL
+
+static uint64_t checksum_words(uint64_t checksum, const void *data, size_t words) {
+    const char *bytes = data;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word;
+        memcpy(&word, bytes + i * sizeof(word), sizeof(word));
+        checksum = (checksum ^ word) * CHECKSUM_PRIME;
+    }
+    return checksum;
+}
+
+// a checkpoint being written front to back, checksummed on the way
+typedef struct {
+    FILE *file;
+    uint64_t offset;
+    uint64_t checksum;
+    unsigned char partial[8]; // bytes of a word that is not complete yet
+    int partial_bytes;
+} CheckpointOut;
+
+static int put(CheckpointOut *out, const void *data, size_t bytes) {
+    if (fwrite(data, 1, bytes, out->file) != bytes) {
+        return -1;
+    }
+    out->offset += bytes;
+    const unsigned char *p = data;
+    while (bytes > 0 && (out->partial_bytes > 0 || bytes < 8)) {
+        out->partial[out->partial_bytes++] = *p++;
+        bytes--;
+        if (out->partial_bytes == 8) {
+            out->checksum = checksum_words(out->checksum, out->partial, 1);
+            out->partial_bytes = 0;
+        }
+    }
+    out->checksum = checksum_words(out->checksum, p, bytes / 8);
+    p += bytes / 8 * 8;
+    for (size_t i = 0; i < bytes % 8; i++) {
+        out->partial[out->partial_bytes++] = p[i];
+    }
+    return 0;
+}
+
+// zero fill up to offset, the blobs are written in file order so this only ever pads
+static int seek_to(CheckpointOut *out, uint64_t offset) {
+    static const char zeros[MATRIX_ALIGNMENT];
+    if (out->offset > offset) {
+        return -1;
+    }
+    while (out->offset < offset) {
+        uint64_t bytes = offset - out->offset < MATRIX_ALIGNMENT ? offset - out->offset : MATRIX_ALIGNMENT;
+        if (put(out, zeros, bytes) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int write_matrix(CheckpointOut *out, Matrix M) {
+    for (int i = 0; i < M.rows; i++) {
+        if (put(out, matrix_row(M, i), M.cols * sizeof(float)) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// the header of the model as it is now, all but file_size
+static void describe_header(const MLP *mlp, CheckpointHeader *header) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, CHECKPOINT_MAGIC, 8);
+    header->version = CHECKPOINT_VERSION;
+    header->num_layers = mlp->num_layers;
+    header->input_size = mlp->input_size;
+    header->loss_id = loss_id(mlp->loss);
+    header->epoch = mlp->epoch;
+    const Optimizer *optimizer = &mlp->optimizer;
+    header->optimizer_id = optimizer->type;
+    // a mapped model has no state to save
+    header->optimizer_slots = optimizer->state != NULL ? optimizer->num_slots : 0;
+    header->optimizer_step = optimizer->step;
+    header->learning_rate = optimizer->learning_rate;
+    header->momentum = optimizer->momentum;
+    header->beta1 = optimizer->beta1;
+    header->beta2 = optimizer->beta2;
+    header->epsilon = optimizer->epsilon;
+    header->weight_decay = optimizer->weight_decay;
+    header->schedule_id = optimizer->schedule.type;
+    header->schedule_gamma = optimizer->schedule.gamma;
+    header->schedule_min_lr = optimizer->schedule.min_lr;
+    header->schedule_step_size = optimizer->schedule.step_size;
+    header->schedule_total_epochs = optimizer->schedule.total_epochs;
+}
+
+// header and layer table of the model as it is now, returns -1 if a layer's activation can not be saved
+static int describe(const MLP *mlp, CheckpointHeader *header, CheckpointLayer *table) {
+    describe_header(mlp, header);
+    memset(table, 0, mlp->num_layers * sizeof(CheckpointLayer));
+    for (int i = 0; i < mlp->num_layers; i++) {
+        table[i].num_neurons = mlp->layers[i]->num_neurons;
+        table[i].prev_num_neurons = mlp->layers[i]->prev_num_neurons;
+        table[i].activation_id = activation_id(mlp->layers[i]->activation);
+        if (table[i].activation_id == 0) {
+            fprintf(stderr, "Layer %d has an activation that can not be saved\n", i);
+            return -1;
+        }
+    }
+    header->file_size = layout(table, mlp->num_layers, header->optimizer_slots);
+    return 0;
+}
+
+/*
+    Writes a described checkpoint to path, returns 0 on success
+    weights, biases and state hold each layer's tensors, state is only read when the header has
+    optimizer slots. The file is written next to path, synced and renamed over it once complete, so a
+    crash never leaves a truncated checkpoint behind.
+*/
+static int write_checkpoint(CheckpointHeader *header, const CheckpointLayer *table, const Matrix *weights, float *const *biases,
+                            float *const *state, const char *path) {
+    char *tmp_path = malloc(strlen(path) + 5);
+    sprintf(tmp_path, "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file %s\n", tmp_path);
+        free(tmp_path);
+        return -1;
+    }
+    CheckpointOut out = { file, 0, CHECKSUM_BASIS };
+    header->checksum = 0;
+    int error = put(&out, header, sizeof(*header)) || put(&out, table, header->num_layers * sizeof(CheckpointLayer));
+    for (uint32_t i = 0; i < header->num_layers && !error; i++) {
+        error = seek_to(&out, table[i].weights_offset) || write_matrix(&out, weights[i])
+            || seek_to(&out, table[i].biases_offset) || put(&out, biases[i], table[i].num_neurons * sizeof(float));
+    }
+    for (uint32_t i = 0; i < header->num_layers && !error && header->optimizer_slots > 0; i++) {
+        uint64_t state_bytes = header->optimizer_slots * (weights_bytes(&table[i]) + biases_bytes(&table[i]));
+        error = seek_to(&out, table[i].state_offset) || put(&out, state[i], state_bytes);
+    }
+    // the file size is a multiple of MATRIX_ALIGNMENT, so no partial word is left over
+    error = error || seek_to(&out, header->file_size);
+    header->checksum = out.checksum;
+    error = error || fseek(file, offsetof(CheckpointHeader, checksum), SEEK_SET) != 0
+        || fwrite(&header->checksum, sizeof(header->checksum), 1, file) != 1;
+    error = error || fflush(file) != 0 || fsync(fileno(file)) != 0;
+    error = fclose(file) != 0 || error;
+    if (!error && rename(tmp_path, path) != 0) {
+        error = 1;
+    }
+    if (error) {
+        fprintf(stderr, "Could not write checkpoint %s\n", path);
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    return error ? -1 : 0;
+}
+
+// writes the model to path, returns 0 on success
+int mlp_save(MLP *mlp, const char *path) {
+    CheckpointHeader header;
+    CheckpointLayer *table = calloc(mlp->num_layers, sizeof(CheckpointLayer));
+    Matrix *weights = malloc(mlp->num_layers * sizeof(Matrix));
+    float **biases = malloc(mlp->num_layers * sizeof(float *));
+    float **state = malloc(mlp->num_layers * sizeof(float *));
+    for (int i = 0; i < mlp->num_layers; i++) {
+        weights[i] = mlp->layers[i]->weights;
+        biases[i] = mlp->layers[i]->biases;
+        state[i] = mlp->layers[i]->optimizer_state;
+    }
+    int error = describe(mlp, &header, table) != 0 || write_checkpoint(&header, table, weights, biases, state, path) != 0;
+    free(table);
+    free(weights);
+    free(biases);
+    free(state);
+    return error ? -1 : 0;
+}
+
+// bytes from offset lie inside the file, in a form that cannot wrap around
+static int blob_fits(uint64_t offset, uint64_t bytes, uint64_t file_size) {
+    return offset <= file_size && bytes <= file_size - offset;
+}
+
+// maps the file read-only and checks every size and offset, returns NULL if it is missing or malformed
+static void *map_checkpoint(const char *path, size_t *map_size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open file %s\n", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CheckpointHeader)) {
+        fprintf(stderr, "%s is not a checkpoint file\n", path);
+        close(fd);
+        return NULL;
+    }
+    // shared, so every process serving the same checkpoint uses the same page cache pages
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Could not map %s\n", path);
+        return NULL;
+    }
+
+    const CheckpointHeader *header = map;
+    const CheckpointLayer *table = (const CheckpointLayer *)(header + 1);
+    float (*loss)(float, float);
+    void (*loss_prime)(Matrix, Matrix, Matrix);
+    int valid = memcmp(header->magic, CHECKPOINT_MAGIC, 8) == 0 && header->version == CHECKPOINT_VERSION
+        && header->file_size == (uint64_t)st.st_size && header->num_layers > 0 && header->num_layers <= INT_MAX
+        && sizeof(CheckpointHeader) + header->num_layers * sizeof(CheckpointLayer) <= (uint64_t)st.st_size
+        && optimizer_num_slots(header->optimizer_id) >= 0
+        && (header->optimizer_slots == 0 || (int)header->optimizer_slots == optimizer_num_slots(header->optimizer_id))
+        && loss_from_id(header->loss_id, &loss, &loss_prime) == 0;
+    for (uint32_t i = 0; valid && i < header->num_layers; i++) {
+        void (*activation)(float*, float*, size_t);
+        void (*activation_prime)(float*, float*, size_t);
+        const CheckpointLayer *layer = &table[i];
+        // sizes up to INT_MAX fit Layer's fields and keep weights_bytes below 2^64
+        valid = layer->num_neurons > 0 && layer->num_neurons <= INT_MAX && layer->prev_num_neurons <= INT_MAX
+            && layer->prev_num_neurons == (i == 0 ? header->input_size : table[i-1].num_neurons)
+            && activation_from_id(layer->activation_id, &activation, &activation_prime) == 0
+            && layer->weights_offset % MATRIX_ALIGNMENT == 0 && layer->biases_offset % MATRIX_ALIGNMENT == 0
+            && blob_fits(layer->weights_offset, weights_bytes(layer), st.st_size)
+            && blob_fits(layer->biases_offset, biases_bytes(layer), st.st_size)
+            && (header->optimizer_slots == 0 || (layer->state_offset % MATRIX_ALIGNMENT == 0
+                && blob_fits(layer->state_offset, header->optimizer_slots * (weights_bytes(layer) + biases_bytes(layer)), st.st_size)));
+    }
+    if (!valid) {
+        fprintf(stderr, "%s is not a valid version %d checkpoint file\n", path, CHECKPOINT_VERSION);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    *map_size = st.st_size;
+    return map;
+}
+
+// checksum of a mapped checkpoint, computed as write_checkpoint does
+static uint64_t mapped_checksum(const char *map, size_t map_size) {
+    CheckpointHeader header;
+    memcpy(&header, map, sizeof(header));
+    header.checksum = 0;
+    uint64_t checksum = checksum_words(CHECKSUM_BASIS, &header, sizeof(header) / 8);
+    return checksum_words(checksum, map + sizeof(header), (map_size - sizeof(header)) / 8);
+}
+
+// returns 0 if path is a well-formed checkpoint whose contents match its checksum, -1 otherwise
+int checkpoint_verify(const char *path) {
+    size_t map_size;
+    char *map = map_checkpoint(path, &map_size);
+    if (map == NULL) {
+        return -1;
+    }
+    int valid = mapped_checksum(map, map_size) == ((const CheckpointHeader *)map)->checksum;
+    if (!valid) {
+        fprintf(stderr, "%s is corrupt, its checksum does not match\n", path);
+    }
+    munmap(map, map_size);
+    return valid ? 0 : -1;
+}
+
+// the model without weights, layer->weights and layer->biases are left for the caller
+static MLP *mlp_from_header(const CheckpointHeader *header) {
+    const CheckpointLayer *table = (const CheckpointLayer *)(header + 1);
+    MLP *mlp = calloc(1, sizeof(MLP));
+    mlp->num_layers = header->num_layers;
+    mlp->input_size = header->input_size;
+    mlp->epoch = header->epoch;
+    loss_from_id(header->loss_id, &mlp->loss, &mlp->loss_prime);
+    mlp->layers = malloc(mlp->num_layers * sizeof(Layer *));
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = calloc(1, sizeof(Layer));
+        layer->num_neurons = table[i].num_neurons;
+        layer->prev_num_neurons = table[i].prev_num_neurons;
+        activation_from_id(table[i].activation_id, &layer->activation, &layer->activation_prime);
+        mlp->layers[i] = layer;
+    }
+    mlp->pool = threadpool_create(default_num_threads());
+    mlp_set_validation(mlp, NULL, 0, 1);
+    return mlp;
+}
+
+static Optimizer optimizer_from_header(const CheckpointHeader *header) {
+    Optimizer optimizer = optimizer_sgd(header->learning_rate);
+    optimizer.type = header->optimizer_id;
+    optimizer.num_slots = optimizer_num_slots(header->optimizer_id);
+    optimizer.momentum = header->momentum;
+    optimizer.beta1 = header->beta1;
+    optimizer.beta2 = header->beta2;
+    optimizer.epsilon = header->epsilon;
+    optimizer.weight_decay = header->weight_decay;
+    optimizer.schedule.type = header->schedule_id;
+    optimizer.schedule.gamma = header->schedule_gamma;
+    optimizer.schedule.min_lr = header->schedule_min_lr;
+    optimizer.schedule.step_size = header->schedule_step_size;
+    optimizer.schedule.total_epochs = header->schedule_total_epochs;
+    optimizer.step = header->optimizer_step;
+    return optimizer;
+}
+
+// loads a model that owns its weights and can keep training, returns NULL on error or a checksum mismatch
+MLP *mlp_load(const char *path) {
+    size_t map_size;
+    char *map = map_checkpoint(path, &map_size);
+    if (map == NULL) {
+        return NULL;
+    }
+    // every byte is read anyway, so the checksum costs one more pass
+    if (mapped_checksum(map, map_size) != ((const CheckpointHeader *)map)->checksum) {
+        fprintf(stderr, "%s is corrupt, its checksum does not match\n", path);
+        munmap(map, map_size);
+        return NULL;
+    }
+    const CheckpointHeader *header = (const CheckpointHeader *)map;
+    const CheckpointLayer *table = (const CheckpointLayer *)(header + 1);
+    MLP *mlp = mlp_from_header(header);
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        layer->weights = allocate_matrix(layer->prev_num_neurons, layer->num_neurons);
+        memcpy(layer->weights.data, map + table[i].weights_offset, (size_t)layer->prev_num_neurons * layer->num_neurons * sizeof(float));
+        layer->biases = malloc(layer->num_neurons * sizeof(float));
+        memcpy(layer->biases, map + table[i].biases_offset, layer->num_neurons * sizeof(float));
+    }
+    // the state starts zeroed, which is also what a checkpoint saved without state resumes from
+    mlp_set_optimizer(mlp, optimizer_from_header(header));
+    for (int i = 0; i < mlp->num_layers && header->optimizer_slots > 0; i++) {
+        memcpy(mlp->layers[i]->optimizer_state, map + table[i].state_offset, header->optimizer_slots * layer_slot_floats(mlp->layers[i]) * sizeof(float));
+    }
+    munmap(map, map_size);
+    return mlp;
+}
+
+/*
+    Loads a model for inference only, returns NULL on error
+    The weights are used in place from a read-only shared mapping: nothing is read until the first
+    forward pass touches it, and processes serving the same file share its pages. That also means the
+    checksum is not checked, see checkpoint_verify. The weights can not be written: train,
+    mlp_compute_gradients and mlp_apply_gradients refuse the model.
+*/
+MLP *mlp_load_mapped(const char *path) {
+    size_t map_size;
+    char *map = map_checkpoint(path, &map_size);
+    if (map == NULL) {
+        return NULL;
+    }
+    const CheckpointHeader *header = (const CheckpointHeader *)map;
+    const CheckpointLayer *table = (const CheckpointLayer *)(header + 1);
+    MLP *mlp = mlp_from_header(header);
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        layer->weights = matrix_view((float *)(map + table[i].weights_offset), layer->prev_num_neurons, layer->num_neurons, layer->num_neurons);
+        layer->biases = (float *)(map + table[i].biases_offset);
+    }
+    // settings only, a model that can not train needs no optimizer state
+    Optimizer optimizer = optimizer_from_header(header);
+    optimizer.num_slots = 0;
+    mlp->optimizer = optimizer;
+    mlp->learning_rate = lr_schedule_rate(optimizer.schedule, optimizer.learning_rate, mlp->epoch);
+    mlp->map = map;
+    mlp->map_size = map_size;
+    return mlp;
+}
+
+// states of a staging buffer, changed under the writer's lock
+#define STAGING_FREE 0
+#define STAGING_FILLING 1 // the trainer is copying into it
+#define STAGING_STAGED 2  // complete, waiting for the writer thread
+#define STAGING_WRITING 3
+
+// one snapshot of the model: its header and copies of every tensor a checkpoint holds
+typedef struct {
+    int status;
+    CheckpointHeader header;
+    float *block; // each layer's weights and biases laid out like an optimizer state slot, then the state
+    Matrix *weights;
+    float **biases;
+    float **state;
+} Staging;
+
+struct CheckpointWriter {
+    char *path;
+    int num_layers;
+    CheckpointLayer *table;
+    uint64_t file_size;
+    size_t param_floats; // weights and biases in a staging block
+    size_t state_floats; // optimizer state in a staging block
+    int optimizer_slots;
+    Staging staging[2];
+    int every_steps;
+    double every_seconds;
+    long last_step;             // optimizer step of the last snapshot
+    struct timespec last_time;  // and when it was taken
+    int keep_last;
+    char **kept;                // ring of the files written, the oldest at kept_start
+    int num_kept, kept_start;
+    char *write_path;           // the file being written
+    CheckpointStats stats;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    int stop;
+};
+
+static double seconds_since(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+// remembers a written file and deletes the oldest once more than keep_last are kept
+static void keep_file(CheckpointWriter *writer, const char *path) {
+    if (writer->keep_last <= 0) {
+        return;
+    }
+    int slot = (writer->kept_start + writer->num_kept) % writer->keep_last;
+    if (writer->num_kept == writer->keep_last) {
+        unlink(writer->kept[slot]);
+        writer->kept_start = (writer->kept_start + 1) % writer->keep_last;
+    } else {
+        writer->num_kept++;
+    }
+    strcpy(writer->kept[slot], path);
+}
+
+static Staging *find_staging(CheckpointWriter *writer, int status) {
+    for (int i = 0; i < 2; i++) {
+        if (writer->staging[i].status == status) {
+            return &writer->staging[i];
+        }
+    }
+    return NULL;
+}
+
+// writes staged snapshots until told to stop, then exits once nothing is left staged
+static void *writer_main(void *arg) {
+    CheckpointWriter *writer = arg;
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        Staging *staging = find_staging(writer, STAGING_STAGED);
+        if (staging == NULL) {
+            if (writer->stop) {
+                break;
+            }
+            pthread_cond_wait(&writer->changed, &writer->lock);
+            continue;
+        }
+        staging->status = STAGING_WRITING;
+        pthread_mutex_unlock(&writer->lock);
+
+        // timed into the stats, not the profiler, whose trace the trainer flushes without a lock
+        struct timespec begin;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        sprintf(writer->write_path, "%s.%06llu", writer->path, (unsigned long long)staging->header.optimizer_step);
+        int error = write_checkpoint(&staging->header, writer->table, staging->weights, staging->biases, staging->state,
+                                     writer->write_path);
+        if (!error) {
+            keep_file(writer, writer->write_path);
+        }
+        double seconds = seconds_since(begin);
+
+        pthread_mutex_lock(&writer->lock);
+        writer->stats.written += !error;
+        writer->stats.failed += error != 0;
+        writer->stats.write_seconds += seconds;
+        staging->status = STAGING_FREE;
+        pthread_cond_broadcast(&writer->changed);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+/*
+    Starts a background checkpoint writer for the model, returns NULL if it can not be checkpointed
+    Parameters:
+    path: files are named path.<optimizer step>, e.g. mnist.ckpt.001200
+    every_steps, every_seconds: checkpoint_writer_step snapshots once either many optimizer steps or
+    seconds have passed since the last snapshot, 0 disables that trigger
+    keep_last: files this writer keeps, older ones are deleted as new ones complete, 0 keeps every one
+    Two staging buffers the size of the weights, biases and optimizer state are allocated up front, so
+    snapshots do not allocate. The optimizer must be set (mlp_set_optimizer) before the writer is made.
+*/
+CheckpointWriter *checkpoint_writer_create(MLP *mlp, const char *path, int every_steps, double every_seconds, int keep_last) {
+    if (mlp->map != NULL) {
+        fprintf(stderr, "A mapped model can not be checkpointed\n");
+        return NULL;
+    }
+    CheckpointWriter *writer = calloc(1, sizeof(CheckpointWriter));
+    writer->num_layers = mlp->num_layers;
+    writer->table = calloc(mlp->num_layers, sizeof(CheckpointLayer));
+    CheckpointHeader header;
+    if (describe(mlp, &header, writer->table) != 0) {
+        free(writer->table);
+        free(writer);
+        return NULL;
+    }
+    writer->file_size = header.file_size;
+    writer->optimizer_slots = header.optimizer_slots;
+    writer->path = strdup(path);
+    writer->write_path = malloc(strlen(path) + 32);
+    writer->every_steps = every_steps;
+    writer->every_seconds = every_seconds;
+    writer->last_step = mlp->optimizer.step;
+    clock_gettime(CLOCK_MONOTONIC, &writer->last_time);
+    writer->keep_last = keep_last;
+    if (keep_last > 0) {
+        writer->kept = malloc(keep_last * sizeof(char *));
+        for (int i = 0; i < keep_last; i++) {
+            writer->kept[i] = malloc(strlen(path) + 32);
+        }
+    }
+
+    for (int i = 0; i < mlp->num_layers; i++) {
+        writer->param_floats += layer_slot_floats(mlp->layers[i]);
+    }
+    writer->state_floats = writer->optimizer_slots > 0 ? mlp->optimizer.state_size : 0;
+    for (int b = 0; b < 2; b++) {
+        Staging *staging = &writer->staging[b];
+        staging->block = aligned_alloc(MATRIX_ALIGNMENT, (writer->param_floats + writer->state_floats) * sizeof(float));
+        staging->weights = malloc(mlp->num_layers * sizeof(Matrix));
+        staging->biases = malloc(mlp->num_layers * sizeof(float *));
+        staging->state = calloc(mlp->num_layers, sizeof(float *));
+        if (staging->block == NULL) {
+            fprintf(stderr, "Could not allocate checkpoint staging buffers\n");
+            exit(1);
+        }
+        // fault the pages in now rather than during the first snapshots
+        memset(staging->block, 0, (writer->param_floats + writer->state_floats) * sizeof(float));
+        float *params = staging->block;
+        for (int i = 0; i < mlp->num_layers; i++) {
+            Layer *layer = mlp->layers[i];
+            staging->weights[i] = matrix_view(params, layer->prev_num_neurons, layer->num_neurons, layer->num_neurons);
+            staging->biases[i] = params + arena_matrix_bytes(layer->prev_num_neurons, layer->num_neurons) / sizeof(float);
+            if (writer->optimizer_slots > 0) {
+                staging->state[i] = staging->block + writer->param_floats + (layer->optimizer_state - mlp->optimizer.state);
+            }
+            params += layer_slot_floats(layer);
+        }
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->changed, NULL);
+    if (pthread_create(&writer->thread, NULL, writer_main, writer) != 0) {
+        fprintf(stderr, "Could not start the checkpoint writer thread\n");
+        exit(1);
+    }
+    return writer;
+}
+
+/*
+    Copies the model into a staging buffer for the writer thread and returns without waiting for disk
+    The copy is the only time training is held up. A snapshot still waiting for the writer is replaced
+    by the new one (counted as dropped), so a slow disk costs checkpoints, never training time.
+    Call between optimizer steps, from the thread that trains the model. Returns -1 if the optimizer
+    changed shape since checkpoint_writer_create.
+*/
+int checkpoint_writer_snapshot(CheckpointWriter *writer, MLP *mlp) {
+    int slots = mlp->optimizer.state != NULL ? mlp->optimizer.num_slots : 0;
+    if (slots != writer->optimizer_slots || (slots > 0 && mlp->optimizer.state_size != writer->state_floats)) {
+        fprintf(stderr, "The optimizer changed since the checkpoint writer was created\n");
+        return -1;
+    }
+    PROFILE_START(start);
+    struct timespec begin;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    // at most one buffer is being written, so the other one is free or holds an unwritten snapshot
+    pthread_mutex_lock(&writer->lock);
+    Staging *staging = find_staging(writer, STAGING_STAGED);
+    writer->stats.dropped += staging != NULL;
+    if (staging == NULL) {
+        staging = find_staging(writer, STAGING_FREE);
+    }
+    staging->status = STAGING_FILLING;
+    pthread_mutex_unlock(&writer->lock);
+
+    describe_header(mlp, &staging->header);
+    staging->header.file_size = writer->file_size;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        matrix_copy(staging->weights[i], mlp->layers[i]->weights);
+        memcpy(staging->biases[i], mlp->layers[i]->biases, mlp->layers[i]->num_neurons * sizeof(float));
+    }
+    if (writer->state_floats > 0) {
+        memcpy(staging->block + writer->param_floats, mlp->optimizer.state, writer->state_floats * sizeof(float));
+    }
+    writer->last_step = mlp->optimizer.step;
+    clock_gettime(CLOCK_MONOTONIC, &writer->last_time);
+    double seconds = seconds_since(begin);
+    PROFILE_RECORD(PROFILE_SNAPSHOT, PROFILE_NO_LAYER, start, 0, 8.0 * (writer->param_floats + writer->state_floats));
+
+    pthread_mutex_lock(&writer->lock);
+    staging->status = STAGING_STAGED;
+    writer->stats.snapshots++;
+    writer->stats.snapshot_seconds += seconds;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    return 0;
+}
+
+// snapshots if an interval has passed since the last snapshot, train calls it after every optimizer step
+int checkpoint_writer_step(CheckpointWriter *writer, MLP *mlp) {
+    long steps = mlp->optimizer.step - writer->last_step;
+    int due = (writer->every_steps > 0 && steps >= writer->every_steps)
+        || (writer->every_seconds > 0 && steps > 0 && seconds_since(writer->last_time) >= writer->every_seconds);
+    return due ? checkpoint_writer_snapshot(writer, mlp) : 0;
+}
+
+// waits until every snapshot taken so far is on disk (or has failed)
+void checkpoint_writer_flush(CheckpointWriter *writer) {
+    pthread_mutex_lock(&writer->lock);
+    while (writer->staging[0].status != STAGING_FREE || writer->staging[1].status != STAGING_FREE) {
+        pthread_cond_wait(&writer->changed, &writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+}
+
+CheckpointStats checkpoint_writer_stats(CheckpointWriter *writer) {
+    pthread_mutex_lock(&writer->lock);
+    CheckpointStats stats = writer->stats;
+    pthread_mutex_unlock(&writer->lock);
+    return stats;
+}
+
+// writes what is staged, stops the thread and frees the writer
+void checkpoint_writer_free(CheckpointWriter *writer) {
+    if (writer == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&writer->lock);
+    writer->stop = 1;
+    pthread_cond_broadcast(&writer->changed);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->changed);
+    for (int b = 0; b < 2; b++) {
+        free(writer->staging[b].block);
+        free(writer->staging[b].weights);
+        free(writer->staging[b].biases);
+        free(writer->staging[b].state);
+    }
+    for (int i = 0; i < writer->keep_last; i++) {
+        free(writer->kept[i]);
+    }
+    free(writer->kept);
+    free(writer->table);
+    free(writer->path);
+    free(writer->write_path);
+    free(writer);
+}
+
+/*
+    Checkpoints the model in the background while train runs, see checkpoint_writer_create for the
+    parameters; a NULL path turns it off. Replaces an earlier writer after flushing it.
+    A snapshot taken mid-epoch records the epochs completed so far, resuming from it repeats the rest
+    of that epoch's batches from the start of the epoch. Returns -1 if the model can not be checkpointed.
+*/
+int mlp_set_checkpointing(MLP *mlp, const char *path, int every_steps, double every_seconds, int keep_last) {
+    checkpoint_writer_free(mlp->checkpoints);
+    mlp->checkpoints = NULL;
+    if (path == NULL) {
+        return 0;
+    }
+    mlp->checkpoints = checkpoint_writer_create(mlp, path, every_steps, every_seconds, keep_last);
+    return mlp->checkpoints != NULL ? 0 : -1;
+}
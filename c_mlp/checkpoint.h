@@ -0,0 +1,78 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include<stdint.h>
+#include"mlp.h"
+
+/*
+    Binary checkpoint file (little-endian):
+    CheckpointHeader, one CheckpointLayer per layer, then each layer's weights (prev_num_neurons x
+    num_neurons, row-major) and biases. Every blob starts on a 64-byte boundary so a read-only mapping
+    of the file can be used for inference directly.
+    Activations and the loss are stored as ids (see activation.h and loss.h), not function pointers.
+    The optimizer is stored as its id (see optimizer.h), settings and learning rate schedule. Its state
+    follows the weights: optimizer_slots tensors shaped like the weights and biases of each layer,
+    starting at the layer's state_offset, the same layout as in memory.
+    checksum is FNV-1a over the file's little-endian 64-bit words with the checksum field zeroed.
+    Version 2 added the optimizer settings and schedule, version 3 the checksum.
+*/
+#define CHECKPOINT_MAGIC "MLPCKPT1"
+#define CHECKPOINT_VERSION 3
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_layers;
+    uint32_t input_size;
+    uint32_t loss_id;
+    uint32_t epoch;
+    uint32_t optimizer_id;
+    uint32_t optimizer_slots;
+    uint32_t schedule_id;
+    uint64_t optimizer_step;
+    float learning_rate; // base rate of the schedule
+    float momentum, beta1, beta2, epsilon, weight_decay;
+    float schedule_gamma, schedule_min_lr;
+    uint32_t schedule_step_size;
+    uint32_t schedule_total_epochs;
+    uint64_t file_size;
+    uint64_t checksum;
+} CheckpointHeader;
+
+typedef struct {
+    uint32_t num_neurons;
+    uint32_t prev_num_neurons;
+    uint32_t activation_id;
+    uint32_t reserved;
+    uint64_t weights_offset;
+    uint64_t biases_offset;
+    uint64_t state_offset; // 0 when there is no optimizer state
+} CheckpointLayer;
+
+int mlp_save(MLP *mlp, const char *path);
+MLP *mlp_load(const char *path);
+MLP *mlp_load_mapped(const char *path);
+int checkpoint_verify(const char *path);
+
+/*
+    Checkpointing in the background, see checkpoint_writer_create
+    The trainer copies the model into one of two staging buffers between steps and a writer thread
+    serializes, checksums, syncs and renames the file while training goes on.
+*/
+typedef struct {
+    long snapshots;          // taken by the trainer
+    long written;            // files completed
+    long dropped;            // snapshots replaced by a newer one before the writer got to them
+    long failed;             // writes that failed
+    double snapshot_seconds; // trainer time spent copying into the staging buffers
+    double write_seconds;    // writer thread time spent serializing and syncing
+} CheckpointStats;
+
+CheckpointWriter *checkpoint_writer_create(MLP *mlp, const char *path, int every_steps, double every_seconds, int keep_last);
+int checkpoint_writer_snapshot(CheckpointWriter *writer, MLP *mlp);
+int checkpoint_writer_step(CheckpointWriter *writer, MLP *mlp);
+void checkpoint_writer_flush(CheckpointWriter *writer);
+CheckpointStats checkpoint_writer_stats(CheckpointWriter *writer);
+void checkpoint_writer_free(CheckpointWriter *writer);
+int mlp_set_checkpointing(MLP *mlp, const char *path, int every_steps, double every_seconds, int keep_last);
+
+#endif
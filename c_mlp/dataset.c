@@ -0,0 +1,300 @@
+#include<stdlib.h>
+#include<limits.h>
+#include<stdio.h>
+#include<string.h>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include"dataset.h"
+
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+static size_t dtype_size(int dtype) {
+    return dtype == DATASET_FLOAT32 ? sizeof(float) : sizeof(uint8_t);
+}
+
+// whether count rows of row_bytes each starting at offset lie within a file of file_size bytes, without overflowing
+static int section_fits(uint64_t offset, uint64_t count, uint64_t row_bytes, uint64_t file_size) {
+    return offset <= file_size && count <= (file_size - offset) / row_bytes;
+}
+
+// maps a file written by DatasetWriter or the converters, returns NULL if it is missing or malformed
+Dataset *dataset_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open file %s\n", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(DatasetHeader)) {
+        fprintf(stderr, "%s is not a dataset file\n", path);
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Could not map %s\n", path);
+        return NULL;
+    }
+
+    const DatasetHeader *header = map;
+    int valid = memcmp(header->magic, DATASET_MAGIC, 8) == 0 && header->version == DATASET_VERSION
+        && (header->feature_dtype == DATASET_UINT8 || header->feature_dtype == DATASET_FLOAT32)
+        && (header->label_dtype == DATASET_UINT8 || header->label_dtype == DATASET_FLOAT32)
+        && header->num_samples <= INT_MAX && header->feature_dim > 0 && header->feature_dim <= INT_MAX
+        && header->label_dim > 0 && header->label_dim <= INT_MAX
+        && header->features_offset % MATRIX_ALIGNMENT == 0 && header->labels_offset % MATRIX_ALIGNMENT == 0
+        && section_fits(header->features_offset, header->num_samples, header->feature_dim * dtype_size(header->feature_dtype), st.st_size)
+        && section_fits(header->labels_offset, header->num_samples,
+                        header->label_dtype == DATASET_FLOAT32 ? header->label_dim * sizeof(float) : 1, st.st_size);
+    // class indices are one-hot encoded into label_dim columns, so every one has to be below it
+    if (valid && header->label_dtype == DATASET_UINT8) {
+        const uint8_t *labels = (const uint8_t *)map + header->labels_offset;
+        for (uint64_t i = 0; i < header->num_samples && valid; i++) {
+            valid = labels[i] < header->label_dim;
+        }
+    }
+    if (!valid) {
+        fprintf(stderr, "%s is not a valid version %d dataset file\n", path, DATASET_VERSION);
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    // the training loop reads front to back
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    Dataset *dataset = calloc(1, sizeof(Dataset));
+    dataset->num_samples = header->num_samples;
+    dataset->feature_dim = header->feature_dim;
+    dataset->label_dim = header->label_dim;
+    dataset->feature_dtype = header->feature_dtype;
+    dataset->label_dtype = header->label_dtype;
+    dataset->feature_scale = header->feature_scale;
+    dataset->features = (const char *)map + header->features_offset;
+    dataset->labels = (const char *)map + header->labels_offset;
+    dataset->feature_stride = header->feature_dim;
+    dataset->label_stride = header->label_dtype == DATASET_FLOAT32 ? header->label_dim : 1;
+    dataset->map = map;
+    dataset->map_size = st.st_size;
+    return dataset;
+}
+
+// wraps matrices already in memory, batches are views into them
+Dataset *dataset_from_matrices(Matrix inputs, Matrix targets) {
+    Dataset *dataset = calloc(1, sizeof(Dataset));
+    dataset->num_samples = inputs.rows;
+    dataset->feature_dim = inputs.cols;
+    dataset->label_dim = targets.cols;
+    dataset->feature_dtype = DATASET_FLOAT32;
+    dataset->label_dtype = DATASET_FLOAT32;
+    dataset->feature_scale = 1.0f;
+    dataset->features = inputs.data;
+    dataset->labels = targets.data;
+    dataset->feature_stride = inputs.ld;
+    dataset->label_stride = targets.ld;
+    return dataset;
+}
+
+void dataset_close(Dataset *dataset) {
+    if (dataset == NULL) {
+        return;
+    }
+    if (dataset->map != NULL) {
+        munmap(dataset->map, dataset->map_size);
+    }
+    free_matrix(dataset->batch_inputs);
+    free_matrix(dataset->batch_targets);
+    free(dataset);
+}
+
+static void reserve_batch(Matrix *M, int rows, int cols) {
+    if (M->data == NULL || M->rows < rows) {
+        free_matrix(*M);
+        *M = allocate_matrix(rows, cols);
+    }
+}
+
+/*
+    Rows [start, start + count) of the dataset as an input and a target matrix
+    float32 sections are returned as views into the mapping (or the wrapped matrices). uint8 features
+    are scaled and class indices one-hot encoded into the first count rows of input_buffer and
+    target_buffer. Nothing in the dataset is written, so threads with their own buffers can read
+    concurrently.
+*/
+void dataset_read(const Dataset *dataset, int start, int count, Matrix input_buffer, Matrix target_buffer,
+                  Matrix *inputs, Matrix *targets) {
+    if (dataset->feature_dtype == DATASET_FLOAT32) {
+        *inputs = matrix_view((float *)dataset->features + start * dataset->feature_stride,
+                              count, dataset->feature_dim, dataset->feature_stride);
+    } else {
+        *inputs = matrix_row_view(input_buffer, 0, count);
+        const uint8_t *src = (const uint8_t *)dataset->features + start * dataset->feature_stride;
+        for (int i = 0; i < count; i++) {
+            float *row = matrix_row(*inputs, i);
+            for (int j = 0; j < dataset->feature_dim; j++) {
+                row[j] = src[j] * dataset->feature_scale;
+            }
+            src += dataset->feature_stride;
+        }
+    }
+
+    if (dataset->label_dtype == DATASET_FLOAT32) {
+        *targets = matrix_view((float *)dataset->labels + start * dataset->label_stride,
+                               count, dataset->label_dim, dataset->label_stride);
+    } else {
+        *targets = matrix_row_view(target_buffer, 0, count);
+        const uint8_t *labels = (const uint8_t *)dataset->labels + start;
+        for (int i = 0; i < count; i++) {
+            float *row = matrix_row(*targets, i);
+            for (int j = 0; j < dataset->label_dim; j++) {
+                row[j] = j == labels[i] ? 1.0f : 0.0f;
+            }
+        }
+    }
+}
+
+// dataset_read into buffers owned by the dataset, which are reused by the next call
+void dataset_batch(Dataset *dataset, int start, int count, Matrix *inputs, Matrix *targets) {
+    if (dataset->feature_dtype != DATASET_FLOAT32) {
+        reserve_batch(&dataset->batch_inputs, count, dataset->feature_dim);
+    }
+    if (dataset->label_dtype != DATASET_FLOAT32) {
+        reserve_batch(&dataset->batch_targets, count, dataset->label_dim);
+    }
+    dataset_read(dataset, start, count, dataset->batch_inputs, dataset->batch_targets, inputs, targets);
+}
+
+// copies the given samples into the first count rows of inputs and targets, normalizing as dataset_batch does
+void dataset_gather(Dataset *dataset, const int *indices, int count, Matrix inputs, Matrix targets) {
+    for (int i = 0; i < count; i++) {
+        size_t sample = indices[i];
+        float *input = matrix_row(inputs, i);
+        if (dataset->feature_dtype == DATASET_FLOAT32) {
+            memcpy(input, (const float *)dataset->features + sample * dataset->feature_stride, dataset->feature_dim * sizeof(float));
+        } else {
+            const uint8_t *src = (const uint8_t *)dataset->features + sample * dataset->feature_stride;
+            for (int j = 0; j < dataset->feature_dim; j++) {
+                input[j] = src[j] * dataset->feature_scale;
+            }
+        }
+
+        float *target = matrix_row(targets, i);
+        if (dataset->label_dtype == DATASET_FLOAT32) {
+            memcpy(target, (const float *)dataset->labels + sample * dataset->label_stride, dataset->label_dim * sizeof(float));
+        } else {
+            int label = ((const uint8_t *)dataset->labels)[sample];
+            for (int j = 0; j < dataset->label_dim; j++) {
+                target[j] = j == label ? 1.0f : 0.0f;
+            }
+        }
+    }
+}
+
+// applies advice to the pages holding the features of samples [start, start + count) of a mapped dataset
+static void advise_samples(Dataset *dataset, int start, int count, int advice) {
+    if (start + count > dataset->num_samples) {
+        count = dataset->num_samples - start;
+    }
+    if (dataset->map == NULL || count <= 0) {
+        return;
+    }
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t element = dtype_size(dataset->feature_dtype);
+    uintptr_t begin = (uintptr_t)dataset->features + (size_t)start * dataset->feature_stride * element;
+    uintptr_t end = begin + (size_t)count * dataset->feature_stride * element;
+    begin -= begin % page;
+    madvise((void *)begin, end - begin, advice);
+}
+
+// asks the kernel to start reading these samples from disk
+void dataset_prefetch(Dataset *dataset, int start, int count) {
+    advise_samples(dataset, start, count, MADV_WILLNEED);
+}
+
+// drops these samples from memory, a mapped file is read back from disk if they are touched again
+void dataset_evict(Dataset *dataset, int start, int count) {
+    advise_samples(dataset, start, count, MADV_DONTNEED);
+}
+
+static int write_padding(FILE *file, uint64_t offset) {
+    static const char zeros[MATRIX_ALIGNMENT] = {0};
+    uint64_t padding = align_offset(offset) - offset;
+    return fwrite(zeros, 1, padding, file) == padding ? 0 : -1;
+}
+
+DatasetWriter *dataset_writer_open(const char *path, int feature_dim, int feature_dtype, float feature_scale) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file %s\n", path);
+        return NULL;
+    }
+    DatasetWriter *writer = calloc(1, sizeof(DatasetWriter));
+    writer->file = file;
+    memcpy(writer->header.magic, DATASET_MAGIC, 8);
+    writer->header.version = DATASET_VERSION;
+    writer->header.feature_dtype = feature_dtype;
+    writer->header.feature_dim = feature_dim;
+    writer->header.label_dtype = DATASET_UINT8;
+    writer->header.feature_scale = feature_scale;
+    writer->header.features_offset = align_offset(sizeof(DatasetHeader));
+    writer->max_label = -1;
+    // the header is rewritten with the final counts on close
+    fwrite(&writer->header, sizeof(DatasetHeader), 1, file);
+    write_padding(file, sizeof(DatasetHeader));
+    return writer;
+}
+
+// features must hold feature_dim values of the writer's dtype
+int dataset_writer_append(DatasetWriter *writer, const void *features, int label) {
+    if (label < 0 || label > 255) {
+        fprintf(stderr, "Label %d does not fit in a uint8 class index\n", label);
+        return -1;
+    }
+    size_t size = writer->header.feature_dim * dtype_size(writer->header.feature_dtype);
+    if (fwrite(features, 1, size, writer->file) != size) {
+        return -1;
+    }
+    if (writer->header.num_samples == writer->labels_capacity) {
+        size_t capacity = writer->labels_capacity == 0 ? 4096 : 2 * writer->labels_capacity;
+        unsigned char *labels = realloc(writer->labels, capacity);
+        if (labels == NULL) {
+            fprintf(stderr, "Could not grow the label buffer to %zu samples\n", capacity);
+            return -1;
+        }
+        writer->labels = labels;
+        writer->labels_capacity = capacity;
+    }
+    writer->labels[writer->header.num_samples++] = label;
+    if (label > writer->max_label) {
+        writer->max_label = label;
+    }
+    return 0;
+}
+
+// writes the labels and the final header, num_classes <= 0 uses the largest label seen + 1
+int dataset_writer_close(DatasetWriter *writer, int num_classes) {
+    DatasetHeader *header = &writer->header;
+    uint64_t features_end = header->features_offset + header->num_samples * header->feature_dim * dtype_size(header->feature_dtype);
+    header->labels_offset = align_offset(features_end);
+    header->label_dim = num_classes > 0 ? num_classes : writer->max_label + 1;
+    int status = 0;
+    if (writer->max_label >= (int)header->label_dim) {
+        fprintf(stderr, "Label %d is out of range for %u classes\n", writer->max_label, header->label_dim);
+        status = -1;
+    }
+    status |= write_padding(writer->file, features_end);
+    if (fwrite(writer->labels, 1, header->num_samples, writer->file) != header->num_samples) {
+        status = -1;
+    }
+    status |= fseek(writer->file, 0, SEEK_SET);
+    if (fwrite(header, sizeof(DatasetHeader), 1, writer->file) != 1) {
+        status = -1;
+    }
+    status |= fclose(writer->file);
+    free(writer->labels);
+    free(writer);
+    return status;
+}
@@ -0,0 +1,74 @@
+#ifndef DATASET_H
+#define DATASET_H
+#include<stdint.h>
+#include<stdio.h>
+#include"matrix.h"
+
+/*
+    Binary dataset file (little-endian):
+    DatasetHeader, then num_samples x feature_dim features and the labels, each section starting on a
+    64-byte boundary so float32 data can be used in place from the mapping.
+    Features are uint8 (multiplied by feature_scale when a batch is read) or float32.
+    Labels are either one uint8 class index per sample (label_dim is the number of classes, one-hot
+    encoded when a batch is read) or label_dim float32 targets per sample.
+*/
+#define DATASET_MAGIC "MLPDSET1"
+#define DATASET_VERSION 1
+
+#define DATASET_UINT8 1
+#define DATASET_FLOAT32 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t feature_dtype;
+    uint64_t num_samples;
+    uint32_t feature_dim;
+    uint32_t label_dim;
+    uint32_t label_dtype;
+    float feature_scale;
+    uint64_t features_offset;
+    uint64_t labels_offset;
+} DatasetHeader;
+
+typedef struct {
+    int num_samples;
+    int feature_dim;
+    int label_dim;
+    int feature_dtype;
+    int label_dtype;
+    float feature_scale;
+    const void *features;
+    const void *labels;
+    size_t feature_stride; // elements between consecutive samples
+    size_t label_stride;
+    void *map;             // file mapping, NULL for in-memory datasets
+    size_t map_size;
+    Matrix batch_inputs;   // conversion buffers for uint8 data, grown on demand
+    Matrix batch_targets;
+} Dataset;
+
+Dataset *dataset_open(const char *path);
+Dataset *dataset_from_matrices(Matrix inputs, Matrix targets);
+void dataset_close(Dataset *dataset);
+void dataset_read(const Dataset *dataset, int start, int count, Matrix input_buffer, Matrix target_buffer,
+                  Matrix *inputs, Matrix *targets);
+void dataset_batch(Dataset *dataset, int start, int count, Matrix *inputs, Matrix *targets);
+void dataset_gather(Dataset *dataset, const int *indices, int count, Matrix inputs, Matrix targets);
+void dataset_prefetch(Dataset *dataset, int start, int count);
+void dataset_evict(Dataset *dataset, int start, int count);
+
+// streaming writer used by the converters, labels are uint8 class indices
+typedef struct {
+    FILE *file;
+    DatasetHeader header;
+    unsigned char *labels;
+    size_t labels_capacity;
+    int max_label;
+} DatasetWriter;
+
+DatasetWriter *dataset_writer_open(const char *path, int feature_dim, int feature_dtype, float feature_scale);
+int dataset_writer_append(DatasetWriter *writer, const void *features, int label);
+int dataset_writer_close(DatasetWriter *writer, int num_classes);
+
+#endif
@@ -0,0 +1,195 @@
+#include<stdio.h>
+#include<string.h>
+#include<math.h>
+#include"evaluate.h"
+#include"inference.h"
+#include"activation.h"
+#include"activation_kernels.h"
+#include"loss.h"
+
+typedef struct {
+    MLP *mlp;
+    const Dataset *dataset;
+    int start, count, batch_size;
+    int num_batches, num_shards;
+    char *scratch;       // num_shards blocks of shard_bytes
+    size_t shard_bytes;
+    double *batch_loss;  // per batch, summed in batch order so results do not depend on the thread count
+    long *batch_correct;
+    long *confusion;     // num_shards x num_classes x num_classes
+} EvaluationArgs;
+
+static size_t align_up(size_t bytes) {
+    return (bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+// inference scratch, then the uint8 conversion buffers of one shard
+static size_t shard_bytes(const MLP *mlp, const Dataset *dataset, int batch_size) {
+    return align_up(mlp_inference_scratch_bytes(mlp, batch_size)) + arena_matrix_bytes(batch_size, dataset->feature_dim)
+           + arena_matrix_bytes(batch_size, dataset->label_dim);
+}
+
+static int argmax(const float *x, int n) {
+    int max_idx = 0;
+    for (int i = 1; i < n; i++) {
+        if (x[i] > x[max_idx]) {
+            max_idx = i;
+        }
+    }
+    return max_idx;
+}
+
+// loss of one sample from its logits, which may be overwritten
+static double sample_loss(const MLP *mlp, float *logits, const float *target, int n) {
+    Layer *output = mlp->layers[mlp->num_layers - 1];
+    if (output->activation == softmax && mlp->loss == cross_entropy) {
+        float max = logits[argmax(logits, n)];
+        float sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum += fast_expf(logits[i] - max);
+        }
+        double logsumexp = max + log(sum);
+        double loss = 0;
+        for (int i = 0; i < n; i++) {
+            if (target[i] != 0) {
+                loss += target[i] * (logsumexp - logits[i]);
+            }
+        }
+        return loss;
+    }
+    output->activation(logits, logits, n);
+    double loss = 0;
+    for (int i = 0; i < n; i++) {
+        loss += mlp->loss(target[i], logits[i]);
+    }
+    return loss;
+}
+
+static void evaluate_shards(void *arg, int begin, int end) {
+    EvaluationArgs *args = arg;
+    const MLP *mlp = args->mlp;
+    const Dataset *dataset = args->dataset;
+    int num_classes = mlp->layers[mlp->num_layers - 1]->num_neurons;
+    for (int shard = begin; shard < end; shard++) {
+        char *scratch = args->scratch + shard * args->shard_bytes;
+        char *buffers = scratch + align_up(mlp_inference_scratch_bytes(mlp, args->batch_size));
+        Matrix input_buffer = matrix_view((float *)buffers, args->batch_size, dataset->feature_dim, dataset->feature_dim);
+        Matrix target_buffer = matrix_view((float *)(buffers + arena_matrix_bytes(args->batch_size, dataset->feature_dim)),
+                                           args->batch_size, dataset->label_dim, dataset->label_dim);
+        long *confusion = args->confusion + (size_t)shard * num_classes * num_classes;
+        memset(confusion, 0, (size_t)num_classes * num_classes * sizeof(long));
+
+        int first = (long)shard * args->num_batches / args->num_shards;
+        int last = (long)(shard + 1) * args->num_batches / args->num_shards;
+        for (int b = first; b < last; b++) {
+            int offset = b * args->batch_size;
+            int rows = args->count - offset < args->batch_size ? args->count - offset : args->batch_size;
+            Matrix inputs, targets;
+            dataset_read(dataset, args->start + offset, rows, input_buffer, target_buffer, &inputs, &targets);
+            Matrix logits = mlp_infer(mlp, inputs, scratch, NULL);
+
+            double loss = 0;
+            long correct = 0;
+            for (int r = 0; r < rows; r++) {
+                float *z = matrix_row(logits, r);
+                const float *t = matrix_row(targets, r);
+                int predicted = argmax(z, num_classes);
+                int target = argmax(t, num_classes);
+                correct += predicted == target;
+                confusion[target * num_classes + predicted]++;
+                loss += sample_loss(mlp, z, t, num_classes);
+            }
+            args->batch_loss[b] = loss;
+            args->batch_correct[b] = correct;
+        }
+    }
+}
+
+/*
+    Forward-only evaluation of rows [start, start + count) of the dataset
+    Parameters:
+    batch_size: rows per inference call; every sample is scored, the last batch may be short
+    The batches are split into one contiguous shard per thread of the model's pool. Each shard runs
+    mlp_infer on views of the dataset (uint8 data is converted into the shard's own buffers), so no
+    pre-activations are stored and the training workspace is left alone. Scratch comes from the model's
+    evaluation arena, which only allocates when it has to grow.
+*/
+Evaluation mlp_evaluate(MLP *mlp, const Dataset *dataset, int start, int count, int batch_size) {
+    int num_classes = mlp->layers[mlp->num_layers - 1]->num_neurons;
+    Evaluation evaluation = { count, num_classes, 0, 0, NULL };
+    if (count <= 0 || batch_size <= 0) {
+        return evaluation;
+    }
+    EvaluationArgs args = { mlp, dataset, start, count, batch_size };
+    args.num_batches = (count + batch_size - 1) / batch_size;
+    args.num_shards = threadpool_size(mlp->pool) < args.num_batches ? threadpool_size(mlp->pool) : args.num_batches;
+    args.shard_bytes = shard_bytes(mlp, dataset, batch_size);
+
+    size_t confusion_bytes = align_up((size_t)num_classes * num_classes * sizeof(long));
+    size_t bytes = args.num_shards * args.shard_bytes + align_up(args.num_batches * sizeof(double))
+                   + align_up(args.num_batches * sizeof(long)) + (args.num_shards + 1) * confusion_bytes;
+    Arena *arena = &mlp->evaluation_arena;
+    if (bytes > arena->capacity) {
+        arena_free(arena);
+        arena_init(arena, bytes);
+    }
+    arena_reset(arena);
+    args.scratch = arena_alloc(arena, args.num_shards * args.shard_bytes);
+    args.batch_loss = arena_alloc(arena, args.num_batches * sizeof(double));
+    args.batch_correct = arena_alloc(arena, args.num_batches * sizeof(long));
+    args.confusion = arena_alloc(arena, args.num_shards * confusion_bytes);
+    long *confusion = arena_alloc(arena, confusion_bytes);
+
+    threadpool_parallel_for(mlp->pool, args.num_shards, evaluate_shards, &args);
+
+    double loss = 0;
+    long correct = 0;
+    for (int b = 0; b < args.num_batches; b++) {
+        loss += args.batch_loss[b];
+        correct += args.batch_correct[b];
+    }
+    memset(confusion, 0, (size_t)num_classes * num_classes * sizeof(long));
+    for (int s = 0; s < args.num_shards; s++) {
+        for (int i = 0; i < num_classes * num_classes; i++) {
+            confusion[i] += args.confusion[(size_t)s * num_classes * num_classes + i];
+        }
+    }
+    evaluation.loss = loss / count;
+    evaluation.accuracy = (double)correct / count;
+    evaluation.confusion = confusion;
+    return evaluation;
+}
+
+// counts with the targets down the side, followed by each class's recall and precision
+void print_confusion_matrix(Evaluation evaluation) {
+    int n = evaluation.num_classes;
+    const long *confusion = evaluation.confusion;
+    if (confusion == NULL) {
+        return;
+    }
+    printf("target\\predicted");
+    for (int j = 0; j < n; j++) {
+        printf(" %6d", j);
+    }
+    printf("  recall\n");
+    for (int i = 0; i < n; i++) {
+        long total = 0;
+        for (int j = 0; j < n; j++) {
+            total += confusion[i * n + j];
+        }
+        printf("%16d", i);
+        for (int j = 0; j < n; j++) {
+            printf(" %6ld", confusion[i * n + j]);
+        }
+        printf("  %6.3f\n", total > 0 ? (double)confusion[i * n + i] / total : 0.0);
+    }
+    printf("%16s", "precision");
+    for (int j = 0; j < n; j++) {
+        long total = 0;
+        for (int i = 0; i < n; i++) {
+            total += confusion[i * n + j];
+        }
+        printf(" %6.3f", total > 0 ? (double)confusion[j * n + j] / total : 0.0);
+    }
+    printf("\n");
+}
@@ -0,0 +1,28 @@
+#ifndef EVALUATE_H
+#define EVALUATE_H
+#include"mlp.h"
+
+// rows per inference call when train validates, large enough to keep the GEMMs efficient
+#define EVALUATION_BATCH_SIZE 256
+
+/*
+    Loss, accuracy and confusion matrix of a model over a range of a dataset
+    loss: mean per sample. Softmax outputs trained with cross_entropy are scored with the categorical
+    cross-entropy, computed from the logits as logsumexp(z) - sum(t * z); any other output goes through
+    its activation and the model's elementwise loss, summed over the outputs.
+    confusion: num_classes x num_classes counts, row = target class, column = predicted class, where the
+    predicted class is the argmax of the output and the target class the argmax of the target row.
+    It lives in the model's evaluation arena and is overwritten by the next evaluation.
+*/
+typedef struct {
+    int num_samples;
+    int num_classes;
+    double loss;
+    double accuracy;
+    const long *confusion;
+} Evaluation;
+
+Evaluation mlp_evaluate(MLP *mlp, const Dataset *dataset, int start, int count, int batch_size);
+void print_confusion_matrix(Evaluation evaluation);
+
+#endif
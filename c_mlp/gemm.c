@@ -1,73 +1,706 @@
 #include<stdlib.h>
 #include<stdio.h>
+#include<string.h>
+#include<pthread.h>
+#include<time.h>
 #include"gemm.h"
+#include"gemm_kernels.h"
+#include"profile.h"
+
+// m * n * k below which sgemm_parallel runs on the calling thread only
+#define GEMM_PARALLEL_MIN_MNK (64 * 64 * 64)
+
+// columns of C per work item of spmm_tn, a multiple of every kernel's vector width
+#define SPARSE_COLUMN_BLOCK 16
+
+// largest mr x nr register tile of any kernel, used to stage partial edge tiles
+#define GEMM_MAX_TILE (8 * 32)
+
+static const GemmKernel *active_kernel = NULL;
+
+// cache blocking set by gemm_set_blocking, zero fields fall back to the kernel's own
+static GemmBlocking active_blocking = { 0, 0, 0 };
+
+// packing buffers are per thread and only grow, so steady-state calls do not allocate
+static _Thread_local float *pack_a_buffer = NULL;
+static _Thread_local float *pack_b_buffer = NULL;
+static _Thread_local size_t pack_a_capacity = 0;
+static _Thread_local size_t pack_b_capacity = 0;
+
+static int kernel_supported(const GemmKernel *kernel) {
+#ifdef GEMM_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (kernel == &gemm_kernel_avx512) {
+        return __builtin_cpu_supports("avx512f");
+    }
+    if (kernel == &gemm_kernel_avx2) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+#endif
+    return kernel == &gemm_kernel_scalar;
+}
+
+static const GemmKernel *find_kernel(const char *name) {
+    const GemmKernel *kernels[] = {
+#ifdef GEMM_HAVE_X86_KERNELS
+        &gemm_kernel_avx512, &gemm_kernel_avx2,
+#endif
+        &gemm_kernel_scalar
+    };
+    int num_kernels = sizeof(kernels) / sizeof(kernels[0]);
+    for (int i = 0; i < num_kernels; i++) {
+        int matches = name == NULL || strcmp(name, "auto") == 0 || strcmp(name, kernels[i]->name) == 0;
+        if (matches && kernel_supported(kernels[i])) {
+            return kernels[i];
+        }
+    }
+    return NULL;
+}
+
+static const GemmKernel *current_kernel() {
+    if (active_kernel == NULL) {
+        // MLP_GEMM_KERNEL=scalar|avx2|avx512 overrides the CPUID choice
+        const char *name = getenv("MLP_GEMM_KERNEL");
+        active_kernel = name != NULL ? find_kernel(name) : NULL;
+        if (active_kernel == NULL) {
+            active_kernel = find_kernel("auto");
+        }
+    }
+    return active_kernel;
+}
+
+// selects a micro-kernel by name ("auto" picks the widest one the CPU supports), returns -1 if unavailable
+int gemm_select_kernel(const char *name) {
+    const GemmKernel *kernel = find_kernel(name);
+    if (kernel == NULL) {
+        return -1;
+    }
+    active_kernel = kernel;
+    return 0;
+}
+
+const char *gemm_kernel_name() {
+    return current_kernel()->name;
+}
+
 /*
-    Computes A @ B
-    Parameters:
-    A: m x k matrix
-    B: k x n matrix
-    m: number of rows of A
-    n: number of columns of B
-    k: number of columns of A and rows of B
+    Overrides the cache blocking of sgemm for every kernel, see GemmKernel for what mc, kc and nc bound
+    Zero fields keep the selected kernel's default; mc and nc are rounded up to whole register tiles
+    when used. Blocking changes the order of the sums over k, so results can differ in the last bits.
+    Returns -1 for negative sizes.
 */
-float **gemm(float **A, float **B, int m, int n, int k) {
-    float **C = allocate_matrix(m, n);
-    for (int i = 0; i < m; i++) {
-        for (int j = 0; j < n; j++) {
-            C[i][j] = 0;
-            for (int l = 0; l < k; l++) {
-                C[i][j] += A[i][l] * B[l][j];
+int gemm_set_blocking(GemmBlocking blocking) {
+    if (blocking.mc < 0 || blocking.kc < 0 || blocking.nc < 0) {
+        return -1;
+    }
+    active_blocking = blocking;
+    return 0;
+}
+
+static int round_up(int x, int multiple) {
+    return (x + multiple - 1) / multiple * multiple;
+}
+
+// the blocking sgemm runs with: the override where set, else the kernel's defaults
+GemmBlocking gemm_blocking() {
+    const GemmKernel *kernel = current_kernel();
+    GemmBlocking blocking = {
+        active_blocking.mc > 0 ? round_up(active_blocking.mc, kernel->mr) : kernel->mc,
+        active_blocking.kc > 0 ? active_blocking.kc : kernel->kc,
+        active_blocking.nc > 0 ? round_up(active_blocking.nc, kernel->nr) : kernel->nc
+    };
+    return blocking;
+}
+
+/*
+    GFLOP/s of the selected micro-kernel on one thread, with its A and B panels resident in L1
+    This is the ceiling sgemm can approach per core; it is measured once, on the first call.
+*/
+double gemm_peak_gflops() {
+    static double peak = 0;
+    if (peak == 0) {
+        const GemmKernel *kernel = current_kernel();
+        int kc = 128;
+        float *a = aligned_alloc(MATRIX_ALIGNMENT, kc * 32 * sizeof(float));
+        float *b = aligned_alloc(MATRIX_ALIGNMENT, kc * 32 * sizeof(float));
+        float c[GEMM_MAX_TILE] __attribute__((aligned(MATRIX_ALIGNMENT)));
+        for (int i = 0; i < kc * 32; i++) {
+            a[i] = b[i] = 1e-3f;
+        }
+        struct timespec start, end;
+        long calls = 0;
+        double seconds = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (seconds < 0.02) {
+            for (int r = 0; r < 1000; r++) {
+                kernel->kernel(kc, a, b, c, kernel->nr, 1.0f, 0.0f, NULL);
             }
+            calls += 1000;
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
         }
+        peak = 2.0 * kernel->mr * kernel->nr * kc * calls / seconds * 1e-9;
+        free(a);
+        free(b);
     }
-    return C;
+    return peak;
 }
 
-// computes C = AB + x
-float **gemm_add(float **A, float **B, int m, int n, int k, float *x) {
-    float **C = gemm(A, B, m, n, k);
-    for (int i = 0; i < m; i++) {
-        for (int j = 0; j < n; j++) {
-            C[i][j] += x[j];
+static pthread_key_t pack_buffers_key;
+static pthread_once_t pack_buffers_once = PTHREAD_ONCE_INIT;
+
+// frees the packing buffers of a thread when it exits, e.g. the workers of a destroyed pool
+static void free_pack_buffers(void *unused) {
+    (void)unused;
+    free(pack_a_buffer);
+    free(pack_b_buffer);
+    pack_a_buffer = pack_b_buffer = NULL;
+    pack_a_capacity = pack_b_capacity = 0;
+}
+
+static void create_pack_buffers_key() {
+    pthread_key_create(&pack_buffers_key, free_pack_buffers);
+}
+
+static float *grow_buffer(float **buffer, size_t *capacity, size_t n) {
+    if (n > *capacity) {
+        if (*capacity == 0) {
+            pthread_once(&pack_buffers_once, create_pack_buffers_key);
+            pthread_setspecific(pack_buffers_key, buffer);
+        }
+        free(*buffer);
+        size_t bytes = (n * sizeof(float) + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+        *buffer = aligned_alloc(MATRIX_ALIGNMENT, bytes);
+        PROFILE_ALLOCATION(bytes);
+        if (*buffer == NULL) {
+            fprintf(stderr, "Could not allocate GEMM packing buffer\n");
+            exit(1);
         }
+        *capacity = n;
     }
-    return C;
+    return *buffer;
 }
 
-float **transpose(float **M, int m, int n) {
-    float **T = allocate_matrix(n, m);
-    for (int i = 0; i < m; i++) {
-        for (int j = 0; j < n; j++) {
-            T[j][i] = M[i][j];
+// element (i, j) of op(M), where op transposes when trans is set
+static inline float op_element(Matrix M, int trans, int i, int j) {
+    return trans ? MAT(M, j, i) : MAT(M, i, j);
+}
+
+// packs op(A)[ic:ic+mc, pc:pc+kc] into mr-row panels, zero-padding the last one
+static void pack_a(Matrix A, int trans_a, int ic, int pc, int mc, int kc, int mr, float *dst) {
+    for (int ir = 0; ir < mc; ir += mr) {
+        int rows = mc - ir < mr ? mc - ir : mr;
+        for (int l = 0; l < kc; l++) {
+            for (int r = 0; r < mr; r++) {
+                *dst++ = r < rows ? op_element(A, trans_a, ic + ir + r, pc + l) : 0.0f;
+            }
+        }
+    }
+}
+
+// pack_a for a bf16 A, widened to float as it is copied so the kernels never see bf16
+static void pack_a_bf16(MatrixBF16 A, int trans_a, int ic, int pc, int mc, int kc, int mr, float *dst) {
+    for (int ir = 0; ir < mc; ir += mr) {
+        int rows = mc - ir < mr ? mc - ir : mr;
+        for (int l = 0; l < kc; l++) {
+            for (int r = 0; r < mr; r++) {
+                int i = ic + ir + r, j = pc + l;
+                *dst++ = r < rows ? bf16_to_float(trans_a ? matrix_bf16_row(A, j)[i] : matrix_bf16_row(A, i)[j]) : 0.0f;
+            }
+        }
+    }
+}
+
+// packs nr-column panels [panel_begin, panel_end) of op(B)[pc:pc+kc, jc:jc+nc], zero-padding the last one
+static void pack_b(Matrix B, int trans_b, int pc, int jc, int kc, int nc, int nr, int panel_begin, int panel_end, float *dst) {
+    dst += (size_t)panel_begin * nr * kc;
+    for (int jr = panel_begin * nr; jr < panel_end * nr; jr += nr) {
+        int cols = nc - jr < nr ? nc - jr : nr;
+        for (int l = 0; l < kc; l++) {
+            if (!trans_b && cols == nr) {
+                memcpy(dst, &MAT(B, pc + l, jc + jr), nr * sizeof(float));
+                dst += nr;
+                continue;
+            }
+            for (int c = 0; c < nr; c++) {
+                *dst++ = c < cols ? op_element(B, trans_b, pc + l, jc + jr + c) : 0.0f;
+            }
+        }
+    }
+}
+
+// one kc x nc panel of op(B) against every mc block of op(A), shared with the worker threads
+typedef struct {
+    const GemmKernel *kernel;
+    int trans_a, trans_b;
+    float alpha, beta;
+    Matrix A, B, C;
+    MatrixBF16 A_bf16; // used instead of A when its data is set
+    GemmBlocking blocking;
+    int m, n, jc, nc, pc, kc;
+    int num_panels; // nr-wide panels in the nc block
+    float *pb;
+    const GemmEpilogue *epilogue; // only set while computing the last k block
+    int tile_activation;          // the activation can be applied tile by tile
+} GemmJob;
+
+// bias is already in the tile; store the pre-activation and activate while the tile is hot in L1
+static void tile_epilogue(const GemmJob *job, float *c_tile, int ldc, int row, int col, int rows, int cols) {
+    const GemmEpilogue *epilogue = job->epilogue;
+    for (int i = 0; i < rows; i++) {
+        float *c = c_tile + (size_t)i * ldc;
+        if (epilogue->pre.data != NULL) {
+            memcpy(&MAT(epilogue->pre, row + i, col), c, cols * sizeof(float));
+        }
+        if (epilogue->pre_bf16.data != NULL) {
+            floats_to_bf16(c, matrix_bf16_row(epilogue->pre_bf16, row + i) + col, cols);
+        }
+        if (job->tile_activation) {
+            epilogue->activation(c, c, cols);
+        }
+        // a row-wise activation that did not fit the tile converts in the final pass instead
+        if ((job->tile_activation || epilogue->activation == NULL) && epilogue->out_bf16.data != NULL) {
+            floats_to_bf16(c, matrix_bf16_row(epilogue->out_bf16, row + i) + col, cols);
         }
     }
-    return T;
 }
 
-float **allocate_matrix(int m, int n) {
-    float **M = (float **)malloc(m * sizeof(float *));
-    for (int i = 0; i < m; i++) {
-        M[i] = (float *)malloc(n * sizeof(float));
+// runs the micro-kernel over the tiles of columns [jr_begin, jr_end) of the mc block starting at row ic
+static void macro_kernel(const GemmJob *job, int ic, int mc, int jr_begin, int jr_end, const float *pa) {
+    _Alignas(MATRIX_ALIGNMENT) float tile[GEMM_MAX_TILE];
+    const GemmKernel *kernel = job->kernel;
+    const float *bias = job->epilogue != NULL && job->epilogue->bias != NULL ? job->epilogue->bias + job->jc : NULL;
+    int kc = job->kc, ldc = job->C.ld;
+    float alpha = job->alpha, beta = job->beta;
+    for (int jr = jr_begin; jr < jr_end; jr += kernel->nr) {
+        int cols = job->nc - jr < kernel->nr ? job->nc - jr : kernel->nr;
+        const float *bias_tile = bias != NULL ? bias + jr : NULL;
+        for (int ir = 0; ir < mc; ir += kernel->mr) {
+            int rows = mc - ir < kernel->mr ? mc - ir : kernel->mr;
+            float *c_tile = &MAT(job->C, ic + ir, job->jc + jr);
+            if (rows == kernel->mr && cols == kernel->nr) {
+                kernel->kernel(kc, pa + (size_t)ir * kc, job->pb + (size_t)jr * kc, c_tile, ldc, alpha, beta, bias_tile);
+            } else {
+                // edge tile: compute the full register tile into scratch and merge the valid part
+                kernel->kernel(kc, pa + (size_t)ir * kc, job->pb + (size_t)jr * kc, tile, kernel->nr, 1.0f, 0.0f, NULL);
+                for (int i = 0; i < rows; i++) {
+                    for (int j = 0; j < cols; j++) {
+                        float *dst = &c_tile[(size_t)i * ldc + j];
+                        float r = beta == 0 ? alpha * tile[i * kernel->nr + j] : alpha * tile[i * kernel->nr + j] + beta * *dst;
+                        *dst = bias_tile != NULL ? r + bias_tile[j] : r;
+                    }
+                }
+            }
+            if (job->epilogue != NULL) {
+                tile_epilogue(job, c_tile, ldc, ic + ir, job->jc + jr, rows, cols);
+            }
+        }
     }
-    return M;
 }
 
-void free_matrix(float **M, int m) {
-    for (int i = 0; i < m; i++) {
-        free(M[i]);
+static void pack_b_job(void *arg, int begin, int end) {
+    GemmJob *job = arg;
+    pack_b(job->B, job->trans_b, job->pc, job->jc, job->kc, job->nc, job->kernel->nr, begin, end, job->pb);
+}
+
+// work item i is panel (i % num_panels) of mc block (i / num_panels); each C tile belongs to exactly one item
+static void compute_job(void *arg, int begin, int end) {
+    GemmJob *job = arg;
+    const GemmKernel *kernel = job->kernel;
+    int block_rows = job->blocking.mc;
+    float *pa = grow_buffer(&pack_a_buffer, &pack_a_capacity, (size_t)(block_rows + kernel->mr) * job->blocking.kc);
+    int item = begin;
+    while (item < end) {
+        int block = item / job->num_panels;
+        int panel_begin = item % job->num_panels;
+        int panel_end = panel_begin + (end - item);
+        if (panel_end > job->num_panels) {
+            panel_end = job->num_panels;
+        }
+        int ic = block * block_rows;
+        int mc = job->m - ic < block_rows ? job->m - ic : block_rows;
+        if (job->A_bf16.data != NULL) {
+            pack_a_bf16(job->A_bf16, job->trans_a, ic, job->pc, mc, job->kc, kernel->mr, pa);
+        } else {
+            pack_a(job->A, job->trans_a, ic, job->pc, mc, job->kc, kernel->mr, pa);
+        }
+        macro_kernel(job, ic, mc, panel_begin * kernel->nr, panel_end * kernel->nr, pa);
+        item += panel_end - panel_begin;
     }
-    free(M);
 }
 
-void print_matrix(float **M, int m, int n) {
-    for (int i = 0; i < m; i++) {
+// row-by-row epilogue for the cases the tiles cannot handle
+typedef struct {
+    Matrix C;
+    const GemmEpilogue *epilogue;
+    int add_bias;      // bias and pre-activation have not been applied yet
+    int activate;
+} EpilogueRowsJob;
+
+// row i of C, held in c
+static void epilogue_row(const GemmEpilogue *epilogue, float *c, int i, int n, int add_bias, int activate) {
+    if (add_bias && epilogue->bias != NULL) {
         for (int j = 0; j < n; j++) {
-            printf("i = %d, j = %d, M[i][j] = %f\n", i, j, M[i][j]);
+            c[j] += epilogue->bias[j];
+        }
+    }
+    if (add_bias && epilogue->pre.data != NULL) {
+        memcpy(matrix_row(epilogue->pre, i), c, n * sizeof(float));
+    }
+    if (add_bias && epilogue->pre_bf16.data != NULL) {
+        floats_to_bf16(c, matrix_bf16_row(epilogue->pre_bf16, i), n);
+    }
+    if (activate) {
+        epilogue->activation(c, c, n);
+    }
+    if ((activate || epilogue->activation == NULL) && epilogue->out_bf16.data != NULL) {
+        floats_to_bf16(c, matrix_bf16_row(epilogue->out_bf16, i), n);
+    }
+}
+
+static void epilogue_rows_job(void *arg, int begin, int end) {
+    EpilogueRowsJob *job = arg;
+    for (int i = begin; i < end; i++) {
+        epilogue_row(job->epilogue, matrix_row(job->C, i), i, job->C.cols, job->add_bias, job->activate);
+    }
+}
+
+static void scale_matrix(Matrix C, float beta) {
+    for (int i = 0; i < C.rows; i++) {
+        float *c = matrix_row(C, i);
+        for (int j = 0; j < C.cols; j++) {
+            c[j] = beta == 0 ? 0.0f : beta * c[j];
         }
-        printf("\n");
     }
 }
 
+// A_bf16 replaces A when its data is set
+static void gemm_driver(ThreadPool *pool, int trans_a, int trans_b, float alpha, Matrix A, MatrixBF16 A_bf16, Matrix B, float beta, Matrix C,
+                        const GemmEpilogue *epilogue) {
+    int a_rows = A_bf16.data != NULL ? A_bf16.rows : A.rows;
+    int a_cols = A_bf16.data != NULL ? A_bf16.cols : A.cols;
+    int m = trans_a ? a_cols : a_rows;
+    int k = trans_a ? a_rows : a_cols;
+    int n = trans_b ? B.rows : B.cols;
+    int k_b = trans_b ? B.cols : B.rows;
+    if (k != k_b || C.rows != m || C.cols != n) {
+        fprintf(stderr, "sgemm: shape mismatch (%d x %d) @ (%d x %d) -> (%d x %d)\n", m, k, k_b, n, C.rows, C.cols);
+        exit(1);
+    }
+    if (m == 0 || n == 0) {
+        return;
+    }
+    if (k == 0 || alpha == 0) {
+        scale_matrix(C, beta);
+        if (epilogue != NULL) {
+            EpilogueRowsJob rows_job = { C, epilogue, 1, epilogue->activation != NULL };
+            threadpool_parallel_for(pool, m, epilogue_rows_job, &rows_job);
+        }
+        return;
+    }
+
+    const GemmKernel *kernel = current_kernel();
+    // below this much work, waking the workers costs more than it saves
+    if ((double)m * n * k < GEMM_PARALLEL_MIN_MNK) {
+        pool = NULL;
+    }
+    GemmBlocking blocking = gemm_blocking();
+    GemmJob job = { kernel, trans_a, trans_b, alpha, beta, A, B, C, A_bf16, blocking, m, n };
+    job.pb = grow_buffer(&pack_b_buffer, &pack_b_capacity, (size_t)(blocking.nc + kernel->nr) * blocking.kc);
+    int activation = epilogue != NULL && epilogue->activation != NULL;
+    job.tile_activation = activation && (!epilogue->rowwise || n <= kernel->nr);
+    int num_blocks = (m + blocking.mc - 1) / blocking.mc;
+
+    for (job.jc = 0; job.jc < n; job.jc += blocking.nc) {
+        job.nc = n - job.jc < blocking.nc ? n - job.jc : blocking.nc;
+        job.num_panels = (job.nc + kernel->nr - 1) / kernel->nr;
+        for (job.pc = 0; job.pc < k; job.pc += blocking.kc) {
+            job.kc = k - job.pc < blocking.kc ? k - job.pc : blocking.kc;
+            // later k blocks accumulate onto the partial sums of the earlier ones
+            job.beta = job.pc == 0 ? beta : 1.0f;
+            job.epilogue = job.pc + job.kc == k ? epilogue : NULL;
+            threadpool_parallel_for(pool, job.num_panels, pack_b_job, &job);
+            threadpool_parallel_for(pool, num_blocks * job.num_panels, compute_job, &job);
+        }
+    }
+
+    if (activation && !job.tile_activation) {
+        EpilogueRowsJob rows_job = { C, epilogue, 0, 1 };
+        threadpool_parallel_for(pool, m, epilogue_rows_job, &rows_job);
+    }
+}
+
+/*
+    Computes C = activation(alpha * op(A) @ op(B) + beta * C + bias)
+    Parameters:
+    trans_a, trans_b: GEMM_T to use the transpose of A or B, GEMM_N otherwise
+    op(A): m x k matrix
+    op(B): k x n matrix
+    C: m x n matrix, not read when beta == 0
+    epilogue: optional bias, pre-activation output and activation, NULL for a plain GEMM
+    The product is cache blocked (nc columns of B in L3, a kc x nc packed panel of B and an mc x kc
+    packed block of A in L2) and computed by an mr x nr register-tiled micro-kernel chosen by CPUID.
+    With a pool, packing and the (mc block, nr panel) tiles are split across its threads. Every tile
+    is still reduced over k in the same order, so the result does not depend on the thread count.
+    The bias is added in registers by the micro-kernel on the last k block, and the pre-activation copy
+    and elementwise activations run on each tile right after it is stored. Row-wise activations (softmax)
+    run on the tile when a whole row fits in one, otherwise in a final pass over the rows.
+*/
+void sgemm_fused(ThreadPool *pool, int trans_a, int trans_b, float alpha, Matrix A, Matrix B, float beta, Matrix C,
+                 const GemmEpilogue *epilogue) {
+    MatrixBF16 no_bf16 = { NULL };
+    gemm_driver(pool, trans_a, trans_b, alpha, A, no_bf16, B, beta, C, epilogue);
+}
+
+typedef struct {
+    int trans_a, trans_b;
+    float alpha, beta;
+    Matrix A, B, C;
+    const GemmEpilogue *epilogue;
+    GemmStrides strides;
+} BatchedJob;
+
+static void batched_products(void *arg, int begin, int end) {
+    BatchedJob *job = arg;
+    for (int k = begin; k < end; k++) {
+        Matrix A = job->A, B = job->B, C = job->C;
+        A.data += k * job->strides.a;
+        B.data += k * job->strides.b;
+        C.data += k * job->strides.c;
+        GemmEpilogue epilogue;
+        if (job->epilogue != NULL) {
+            epilogue = *job->epilogue;
+            epilogue.bias = epilogue.bias != NULL ? epilogue.bias + k * job->strides.bias : NULL;
+            epilogue.pre.data = epilogue.pre.data != NULL ? epilogue.pre.data + k * job->strides.c : NULL;
+            epilogue.pre_bf16.data = epilogue.pre_bf16.data != NULL ? epilogue.pre_bf16.data + k * job->strides.c : NULL;
+            epilogue.out_bf16.data = epilogue.out_bf16.data != NULL ? epilogue.out_bf16.data + k * job->strides.c : NULL;
+        }
+        sgemm_fused(NULL, job->trans_a, job->trans_b, job->alpha, A, B, job->beta, C, job->epilogue != NULL ? &epilogue : NULL);
+    }
+}
+
+/*
+    batch_count independent sgemm_fused products of the same shape
+    Product k uses A, B and C with their data moved k * strides.a, strides.b and strides.c floats
+    along; the epilogue's pre-activations and bf16 copies move with C, element for element, and its
+    bias by strides.bias. For models stacked
+    side by side A can be an activation matrix holding each model's columns in turn and B the
+    models' weights one after the other.
+    Each product runs single-threaded on one thread of the pool, so many GEMMs too small to split fill
+    the pool together, and the results do not depend on the thread count.
+*/
+void sgemm_batched(ThreadPool *pool, int batch_count, int trans_a, int trans_b, float alpha, Matrix A, Matrix B, float beta,
+                   Matrix C, const GemmEpilogue *epilogue, GemmStrides strides) {
+    BatchedJob job = { trans_a, trans_b, alpha, beta, A, B, C, epilogue, strides };
+    threadpool_parallel_for(pool, batch_count, batched_products, &job);
+}
+
+/*
+    sgemm_fused with a bf16 A, for mixed-precision training
+    A is widened to float while it is packed, so the product and accumulation are float32 and the
+    only difference to sgemm_fused on the widened A is the bandwidth saved reading it.
+*/
+void sgemm_fused_bf16(ThreadPool *pool, int trans_a, int trans_b, float alpha, MatrixBF16 A, Matrix B, float beta, Matrix C,
+                      const GemmEpilogue *epilogue) {
+    Matrix no_float = { NULL };
+    gemm_driver(pool, trans_a, trans_b, alpha, no_float, A, B, beta, C, epilogue);
+}
+
+/*
+    y = x @ A + bias for a single row x, then the rest of the epilogue
+    The GEMV kernel that goes with the selected micro-kernel reads A in place, so nothing is packed and
+    nothing is allocated.
+    Parameters:
+    x: k values
+    A: k x n matrix
+    y: n values, must not overlap x
+*/
+void sgemv_fused(const float *x, Matrix A, float *y, const GemmEpilogue *epilogue) {
+    const float *bias = epilogue != NULL ? epilogue->bias : NULL;
+    current_kernel()->gemv(A.rows, A.cols, x, A.data, A.ld, bias, y);
+    if (epilogue == NULL) {
+        return;
+    }
+    if (epilogue->pre.data != NULL) {
+        memcpy(epilogue->pre.data, y, A.cols * sizeof(float));
+    }
+    if (epilogue->pre_bf16.data != NULL) {
+        floats_to_bf16(y, epilogue->pre_bf16.data, A.cols);
+    }
+    if (epilogue->activation != NULL) {
+        epilogue->activation(y, y, A.cols);
+    }
+    if (epilogue->out_bf16.data != NULL) {
+        floats_to_bf16(y, epilogue->out_bf16.data, A.cols);
+    }
+}
+
+/*
+    sgemm_fused with sparse weights, for pruned layers: Y = X @ W + bias, then the activation
+    W is stored by output, see PrunedLayer. block_width 1: W is the CSR form of the n x k transpose and
+    each value of Y is one dot product gathering the X values its weights select. block_width
+    SPARSE_BLOCK_WIDTH: W is in block-sparse form by strips of n, and every strip of Y stays in
+    registers while its runs are added, see block_sparse_kernel. Y's leading dimension must leave room
+    for the last strip reaching past column n.
+    Only the bias and the activation of the epilogue are used, the activation must not be rowwise.
+*/
+void sgemm_sparse_fused(Matrix X, SparseMatrix W, int block_width, Matrix Y, const GemmEpilogue *epilogue) {
+    const GemmKernel *kernel = current_kernel();
+    const float *bias = epilogue != NULL ? epilogue->bias : NULL;
+    int width = block_width == 1 ? Y.cols : W.rows * SPARSE_BLOCK_WIDTH;
+    for (int i = 0; i < X.rows; i++) {
+        float *y = matrix_row(Y, i);
+        for (int j = 0; j < width; j++) {
+            y[j] = bias != NULL && j < Y.cols ? bias[j] : 0.0f;
+        }
+        if (block_width == 1) {
+            kernel->sparse_dot(W.rows, W.row_start, W.indices, W.values, matrix_row(X, i), y);
+        }
+    }
+    if (block_width != 1) {
+        kernel->block_sparse(X.rows, W.rows, W.row_start, W.indices, W.values, X.data, X.ld, Y.data, Y.ld);
+    }
+    if (epilogue != NULL && epilogue->activation != NULL) {
+        for (int i = 0; i < X.rows; i++) {
+            epilogue->activation(matrix_row(Y, i), matrix_row(Y, i), Y.cols);
+        }
+    }
+}
+
+static void scale_row(float *c, int n, float beta) {
+    if (beta == 0) {
+        memset(c, 0, n * sizeof(float));
+        return;
+    }
+    for (int j = 0; j < n; j++) {
+        c[j] *= beta;
+    }
+}
+
+// rows of A (and C) are split between threads
+typedef struct {
+    const GemmKernel *kernel;
+    SparseMatrix A;
+    Matrix B, C;
+    float beta;
+    const GemmEpilogue *epilogue;
+} SparseJob;
+
+static void sparse_rows_job(void *arg, int begin, int end) {
+    SparseJob *job = arg;
+    SparseMatrix A = job->A;
+    for (int i = begin; i < end; i++) {
+        float *c = matrix_row(job->C, i);
+        scale_row(c, job->C.cols, job->beta);
+        int first = A.row_start[i];
+        job->kernel->sparse_gather(A.row_start[i+1] - first, A.indices + first, A.values + first, job->B.data, job->B.ld,
+                                   job->B.cols, c);
+        if (job->epilogue != NULL) {
+            epilogue_row(job->epilogue, c, i, job->C.cols, 1, job->epilogue->activation != NULL);
+        }
+    }
+}
+
+/*
+    Computes C = activation(A @ B + beta * C + bias) for a sparse A, then the rest of the epilogue
+    Parameters:
+    A: m x k CSR matrix
+    B: k x n matrix, read in place
+    C: m x n matrix, not read when beta == 0
+    Each row of C is summed from the rows of B its non-zeros select, 2 * nnz(A) * n FLOPs instead of
+    2 * m * k * n. Rows are split between the threads of the pool and each is reduced in the same order
+    whatever the thread count.
+*/
+void spmm_fused(ThreadPool *pool, SparseMatrix A, Matrix B, float beta, Matrix C, const GemmEpilogue *epilogue) {
+    if (A.cols != B.rows || C.rows != A.rows || C.cols != B.cols) {
+        fprintf(stderr, "spmm: shape mismatch (%d x %d) @ (%d x %d) -> (%d x %d)\n", A.rows, A.cols, B.rows, B.cols, C.rows, C.cols);
+        exit(1);
+    }
+    if ((double)sparse_nnz(A) * B.cols < GEMM_PARALLEL_MIN_MNK) {
+        pool = NULL;
+    }
+    SparseJob job = { current_kernel(), A, B, C, beta, epilogue };
+    threadpool_parallel_for(pool, A.rows, sparse_rows_job, &job);
+}
+
+// blocks of SPARSE_COLUMN_BLOCK columns of C are split between threads
+static void sparse_columns_job(void *arg, int begin, int end) {
+    SparseJob *job = arg;
+    SparseMatrix A = job->A;
+    Matrix C = job->C;
+    int col = begin * SPARSE_COLUMN_BLOCK;
+    int cols = (end * SPARSE_COLUMN_BLOCK < C.cols ? end * SPARSE_COLUMN_BLOCK : C.cols) - col;
+    for (int i = 0; i < C.rows && job->beta != 1.0f; i++) {
+        scale_row(matrix_row(C, i) + col, cols, job->beta);
+    }
+    for (int r = 0; r < A.rows; r++) {
+        int first = A.row_start[r];
+        job->kernel->sparse_scatter(A.row_start[r+1] - first, A.indices + first, A.values + first, matrix_row(job->B, r) + col,
+                                    cols, C.data + col, C.ld);
+    }
+}
+
+/*
+    Computes C = A^T @ B + beta * C for a sparse A, the weight gradient of a layer with sparse inputs
+    Parameters:
+    A: m x k CSR matrix
+    B: m x n matrix
+    C: k x n matrix, not read when beta == 0
+    Every non-zero A[r, i] adds A[r, i] * B[r, :] to row i of C. The columns of C are split between the
+    threads, so each element is still summed over r in order and the result does not depend on the
+    thread count.
+*/
+void spmm_tn(ThreadPool *pool, SparseMatrix A, Matrix B, float beta, Matrix C) {
+    if (A.rows != B.rows || C.rows != A.cols || C.cols != B.cols) {
+        fprintf(stderr, "spmm_tn: shape mismatch (%d x %d)^T @ (%d x %d) -> (%d x %d)\n", A.rows, A.cols, B.rows, B.cols, C.rows, C.cols);
+        exit(1);
+    }
+    if ((double)sparse_nnz(A) * B.cols < GEMM_PARALLEL_MIN_MNK) {
+        pool = NULL;
+    }
+    SparseJob job = { current_kernel(), A, B, C, beta, NULL };
+    threadpool_parallel_for(pool, (C.cols + SPARSE_COLUMN_BLOCK - 1) / SPARSE_COLUMN_BLOCK, sparse_columns_job, &job);
+}
+
+void sgemm_parallel(ThreadPool *pool, int trans_a, int trans_b, float alpha, Matrix A, Matrix B, float beta, Matrix C) {
+    sgemm_fused(pool, trans_a, trans_b, alpha, A, B, beta, C, NULL);
+}
+
+void sgemm(int trans_a, int trans_b, float alpha, Matrix A, Matrix B, float beta, Matrix C) {
+    sgemm_parallel(NULL, trans_a, trans_b, alpha, A, B, beta, C);
+}
+
+/*
+    Computes A @ B
+    Parameters:
+    A: m x k matrix
+    B: k x n matrix
+    Returns a newly allocated m x n matrix
+*/
+Matrix gemm(Matrix A, Matrix B) {
+    Matrix C = allocate_matrix(A.rows, B.cols);
+    sgemm(GEMM_N, GEMM_N, 1.0f, A, B, 0.0f, C);
+    return C;
+}
+
+// computes C = AB + x
+Matrix gemm_add(Matrix A, Matrix B, float *x) {
+    Matrix C = allocate_matrix(A.rows, B.cols);
+    GemmEpilogue epilogue = { x, { NULL }, NULL, 0 };
+    sgemm_fused(NULL, GEMM_N, GEMM_N, 1.0f, A, B, 0.0f, C, &epilogue);
+    return C;
+}
+
+Matrix transpose(Matrix M) {
+    Matrix T = allocate_matrix(M.cols, M.rows);
+    for (int i = 0; i < M.rows; i++) {
+        for (int j = 0; j < M.cols; j++) {
+            MAT(T, j, i) = MAT(M, i, j);
+        }
+    }
+    return T;
+}
+
 // take the max value of the vector and set it to 1, all others to 0
 void one_hot_vector(float *v, int n) {
     float max_val = v[0];
@@ -81,4 +714,4 @@ void one_hot_vector(float *v, int n) {
     for (int i = 0; i < n; i++) {
         v[i] = i == max_index ? 1 : 0;
     }
-}
\ No newline at end of file
+}
@@ -1,7 +1,56 @@
-float **gemm(float **A, float **B, int m, int n, int k);
-float **gemm_add(float **A, float **B, int m, int n, int k, float *x);
-float **transpose(float **M, int m, int n);
-float **allocate_matrix(int m, int n);
-void free_matrix(float **M, int m);
-void print_matrix(float **M, int m, int n);
-void one_hot_vector(float *v, int n);   
\ No newline at end of file
+#ifndef GEMM_H
+#define GEMM_H
+#include"matrix.h"
+#include"threadpool.h"
+#include"bf16.h"
+#include"sparse.h"
+
+// transpose flags for sgemm
+#define GEMM_N 0
+#define GEMM_T 1
+
+// work done on C after the product, see sgemm_fused
+typedef struct {
+    const float *bias;                          // n values added to every row of C, or NULL
+    Matrix pre;                                 // receives C + bias before the activation if pre.data is not NULL
+    void (*activation)(float*, float*, size_t); // applied in place to the rows of C, or NULL
+    int rowwise;                                // the activation needs whole rows (softmax)
+    MatrixBF16 pre_bf16;                        // receives C + bias rounded to bf16 if pre_bf16.data is not NULL
+    MatrixBF16 out_bf16;                        // receives the activated C rounded to bf16 if out_bf16.data is not NULL
+} GemmEpilogue;
+
+void sgemm_fused(ThreadPool *pool, int trans_a, int trans_b, float alpha, Matrix A, Matrix B, float beta, Matrix C,
+                 const GemmEpilogue *epilogue);
+void sgemm_fused_bf16(ThreadPool *pool, int trans_a, int trans_b, float alpha, MatrixBF16 A, Matrix B, float beta, Matrix C,
+                      const GemmEpilogue *epilogue);
+void sgemv_fused(const float *x, Matrix A, float *y, const GemmEpilogue *epilogue);
+void sgemm_sparse_fused(Matrix X, SparseMatrix W, int block_width, Matrix Y, const GemmEpilogue *epilogue);
+void spmm_fused(ThreadPool *pool, SparseMatrix A, Matrix B, float beta, Matrix C, const GemmEpilogue *epilogue);
+void spmm_tn(ThreadPool *pool, SparseMatrix A, Matrix B, float beta, Matrix C);
+void sgemm_parallel(ThreadPool *pool, int trans_a, int trans_b, float alpha, Matrix A, Matrix B, float beta, Matrix C);
+void sgemm(int trans_a, int trans_b, float alpha, Matrix A, Matrix B, float beta, Matrix C);
+
+// floats between consecutive operands of sgemm_batched
+typedef struct {
+    long a, b, c, bias;
+} GemmStrides;
+
+void sgemm_batched(ThreadPool *pool, int batch_count, int trans_a, int trans_b, float alpha, Matrix A, Matrix B, float beta,
+                   Matrix C, const GemmEpilogue *epilogue, GemmStrides strides);
+
+// cache blocking of sgemm, see GemmKernel; a zero field keeps the kernel's default
+typedef struct {
+    int mc, kc, nc;
+} GemmBlocking;
+
+int gemm_select_kernel(const char *name);
+int gemm_set_blocking(GemmBlocking blocking);
+GemmBlocking gemm_blocking();
+const char *gemm_kernel_name();
+double gemm_peak_gflops();
+Matrix gemm(Matrix A, Matrix B);
+Matrix gemm_add(Matrix A, Matrix B, float *x);
+Matrix transpose(Matrix M);
+void one_hot_vector(float *v, int n);
+
+#endif
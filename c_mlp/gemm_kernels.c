@@ -0,0 +1,425 @@
+#include<stddef.h>
+#include"gemm_kernels.h"
+
+#define SCALAR_MR 4
+#define SCALAR_NR 4
+
+static void kernel_scalar_4x4(int kc, const float *a, const float *b, float *c, int ldc, float alpha, float beta, const float *bias) {
+    float acc[SCALAR_MR][SCALAR_NR] = {{0}};
+    for (int l = 0; l < kc; l++) {
+        for (int i = 0; i < SCALAR_MR; i++) {
+            for (int j = 0; j < SCALAR_NR; j++) {
+                acc[i][j] += a[i] * b[j];
+            }
+        }
+        a += SCALAR_MR;
+        b += SCALAR_NR;
+    }
+    for (int i = 0; i < SCALAR_MR; i++) {
+        for (int j = 0; j < SCALAR_NR; j++) {
+            float *dst = &c[i * ldc + j];
+            float r = beta == 0 ? alpha * acc[i][j] : alpha * acc[i][j] + beta * *dst;
+            *dst = bias != NULL ? r + bias[j] : r;
+        }
+    }
+}
+
+static void gemv_scalar(int k, int n, const float *x, const float *a, int lda, const float *bias, float *y) {
+    for (int j = 0; j < n; j++) {
+        y[j] = bias != NULL ? bias[j] : 0.0f;
+    }
+    for (int p = 0; p < k; p++) {
+        if (x[p] == 0.0f) {
+            continue;
+        }
+        const float *row = a + (size_t)p * lda;
+        for (int j = 0; j < n; j++) {
+            y[j] += x[p] * row[j];
+        }
+    }
+}
+
+static void sparse_gather_scalar(int nnz, const int *indices, const float *values, const float *b, int ldb, int n, float *y) {
+    for (int p = 0; p < nnz; p++) {
+        const float *row = b + (size_t)indices[p] * ldb;
+        for (int j = 0; j < n; j++) {
+            y[j] += values[p] * row[j];
+        }
+    }
+}
+
+static void sparse_scatter_scalar(int nnz, const int *indices, const float *values, const float *x, int n, float *c, int ldc) {
+    for (int p = 0; p < nnz; p++) {
+        float *row = c + (size_t)indices[p] * ldc;
+        for (int j = 0; j < n; j++) {
+            row[j] += values[p] * x[j];
+        }
+    }
+}
+
+static void block_sparse_scalar(int m, int strips, const int *row_start, const int *indices, const float *values,
+                                const float *x, int ldx, float *y, int ldy) {
+    for (int i = 0; i < m; i++) {
+        const float *xi = x + (size_t)i * ldx;
+        for (int s = 0; s < strips; s++) {
+            float *out = y + (size_t)i * ldy + s * SPARSE_BLOCK_WIDTH;
+            for (int q = row_start[s]; q < row_start[s+1]; q++) {
+                const float *run = values + (size_t)q * SPARSE_BLOCK_WIDTH;
+                for (int j = 0; j < SPARSE_BLOCK_WIDTH; j++) {
+                    out[j] += xi[indices[q]] * run[j];
+                }
+            }
+        }
+    }
+}
+
+static void sparse_dot_scalar(int rows, const int *row_start, const int *indices, const float *values, const float *x, float *y) {
+    for (int i = 0; i < rows; i++) {
+        float sum = 0.0f;
+        for (int p = row_start[i]; p < row_start[i+1]; p++) {
+            sum += values[p] * x[indices[p]];
+        }
+        y[i] += sum;
+    }
+}
+
+const GemmKernel gemm_kernel_scalar = { "scalar", SCALAR_MR, SCALAR_NR, 64, 256, 1024, kernel_scalar_4x4, gemv_scalar,
+                                        sparse_gather_scalar, sparse_scatter_scalar, block_sparse_scalar, sparse_dot_scalar };
+
+#ifdef GEMM_HAVE_X86_KERNELS
+#include<immintrin.h>
+
+// 6 x 16 tile: 12 ymm accumulators, two B vectors and one broadcast A value
+__attribute__((target("avx2,fma")))
+static void kernel_avx2_6x16(int kc, const float *a, const float *b, float *c, int ldc, float alpha, float beta, const float *bias) {
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    for (int l = 0; l < kc; l++) {
+        __m256 b0 = _mm256_load_ps(b);
+        __m256 b1 = _mm256_load_ps(b + 8);
+        __m256 a_i;
+        a_i = _mm256_broadcast_ss(a + 0); c00 = _mm256_fmadd_ps(a_i, b0, c00); c01 = _mm256_fmadd_ps(a_i, b1, c01);
+        a_i = _mm256_broadcast_ss(a + 1); c10 = _mm256_fmadd_ps(a_i, b0, c10); c11 = _mm256_fmadd_ps(a_i, b1, c11);
+        a_i = _mm256_broadcast_ss(a + 2); c20 = _mm256_fmadd_ps(a_i, b0, c20); c21 = _mm256_fmadd_ps(a_i, b1, c21);
+        a_i = _mm256_broadcast_ss(a + 3); c30 = _mm256_fmadd_ps(a_i, b0, c30); c31 = _mm256_fmadd_ps(a_i, b1, c31);
+        a_i = _mm256_broadcast_ss(a + 4); c40 = _mm256_fmadd_ps(a_i, b0, c40); c41 = _mm256_fmadd_ps(a_i, b1, c41);
+        a_i = _mm256_broadcast_ss(a + 5); c50 = _mm256_fmadd_ps(a_i, b0, c50); c51 = _mm256_fmadd_ps(a_i, b1, c51);
+        a += 6;
+        b += 16;
+    }
+    __m256 acc[6][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}};
+    __m256 va = _mm256_set1_ps(alpha);
+    __m256 vb = _mm256_set1_ps(beta);
+    __m256 bias0 = bias != NULL ? _mm256_loadu_ps(bias) : _mm256_setzero_ps();
+    __m256 bias1 = bias != NULL ? _mm256_loadu_ps(bias + 8) : _mm256_setzero_ps();
+    for (int i = 0; i < 6; i++) {
+        float *row = c + i * ldc;
+        for (int h = 0; h < 2; h++) {
+            __m256 r = _mm256_fmadd_ps(va, acc[i][h], h == 0 ? bias0 : bias1);
+            if (beta != 0) {
+                r = _mm256_fmadd_ps(vb, _mm256_loadu_ps(row + 8 * h), r);
+            }
+            _mm256_storeu_ps(row + 8 * h, r);
+        }
+    }
+}
+
+// y in blocks of 32 columns (4 ymm accumulators) walked down all of A, then single vectors and a scalar tail
+__attribute__((target("avx2,fma")))
+static void gemv_avx2(int k, int n, const float *x, const float *a, int lda, const float *bias, float *y) {
+    int j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m256 c0 = bias != NULL ? _mm256_loadu_ps(bias + j) : _mm256_setzero_ps();
+        __m256 c1 = bias != NULL ? _mm256_loadu_ps(bias + j + 8) : _mm256_setzero_ps();
+        __m256 c2 = bias != NULL ? _mm256_loadu_ps(bias + j + 16) : _mm256_setzero_ps();
+        __m256 c3 = bias != NULL ? _mm256_loadu_ps(bias + j + 24) : _mm256_setzero_ps();
+        const float *row = a + j;
+        for (int p = 0; p < k; p++, row += lda) {
+            if (x[p] == 0.0f) {
+                continue;
+            }
+            __m256 xp = _mm256_broadcast_ss(x + p);
+            c0 = _mm256_fmadd_ps(xp, _mm256_loadu_ps(row), c0);
+            c1 = _mm256_fmadd_ps(xp, _mm256_loadu_ps(row + 8), c1);
+            c2 = _mm256_fmadd_ps(xp, _mm256_loadu_ps(row + 16), c2);
+            c3 = _mm256_fmadd_ps(xp, _mm256_loadu_ps(row + 24), c3);
+        }
+        _mm256_storeu_ps(y + j, c0);
+        _mm256_storeu_ps(y + j + 8, c1);
+        _mm256_storeu_ps(y + j + 16, c2);
+        _mm256_storeu_ps(y + j + 24, c3);
+    }
+    for (; j + 8 <= n; j += 8) {
+        __m256 c0 = bias != NULL ? _mm256_loadu_ps(bias + j) : _mm256_setzero_ps();
+        const float *row = a + j;
+        for (int p = 0; p < k; p++, row += lda) {
+            if (x[p] != 0.0f) {
+                c0 = _mm256_fmadd_ps(_mm256_broadcast_ss(x + p), _mm256_loadu_ps(row), c0);
+            }
+        }
+        _mm256_storeu_ps(y + j, c0);
+    }
+    for (; j < n; j++) {
+        float sum = bias != NULL ? bias[j] : 0.0f;
+        for (int p = 0; p < k; p++) {
+            sum += x[p] * a[(size_t)p * lda + j];
+        }
+        y[j] = sum;
+    }
+}
+
+// y in blocks of 32 columns kept in registers over all the non-zeros, then single vectors and a scalar tail
+__attribute__((target("avx2,fma")))
+static void sparse_gather_avx2(int nnz, const int *indices, const float *values, const float *b, int ldb, int n, float *y) {
+    int j = 0;
+    for (; j + 32 <= n; j += 32) {
+        __m256 c0 = _mm256_loadu_ps(y + j), c1 = _mm256_loadu_ps(y + j + 8);
+        __m256 c2 = _mm256_loadu_ps(y + j + 16), c3 = _mm256_loadu_ps(y + j + 24);
+        for (int p = 0; p < nnz; p++) {
+            const float *row = b + (size_t)indices[p] * ldb + j;
+            __m256 v = _mm256_broadcast_ss(values + p);
+            c0 = _mm256_fmadd_ps(v, _mm256_loadu_ps(row), c0);
+            c1 = _mm256_fmadd_ps(v, _mm256_loadu_ps(row + 8), c1);
+            c2 = _mm256_fmadd_ps(v, _mm256_loadu_ps(row + 16), c2);
+            c3 = _mm256_fmadd_ps(v, _mm256_loadu_ps(row + 24), c3);
+        }
+        _mm256_storeu_ps(y + j, c0);
+        _mm256_storeu_ps(y + j + 8, c1);
+        _mm256_storeu_ps(y + j + 16, c2);
+        _mm256_storeu_ps(y + j + 24, c3);
+    }
+    for (; j + 8 <= n; j += 8) {
+        __m256 c0 = _mm256_loadu_ps(y + j);
+        for (int p = 0; p < nnz; p++) {
+            c0 = _mm256_fmadd_ps(_mm256_broadcast_ss(values + p), _mm256_loadu_ps(b + (size_t)indices[p] * ldb + j), c0);
+        }
+        _mm256_storeu_ps(y + j, c0);
+    }
+    for (; j < n; j++) {
+        float sum = y[j];
+        for (int p = 0; p < nnz; p++) {
+            sum += values[p] * b[(size_t)indices[p] * ldb + j];
+        }
+        y[j] = sum;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void sparse_scatter_avx2(int nnz, const int *indices, const float *values, const float *x, int n, float *c, int ldc) {
+    for (int p = 0; p < nnz; p++) {
+        float *row = c + (size_t)indices[p] * ldc;
+        __m256 v = _mm256_broadcast_ss(values + p);
+        int j = 0;
+        for (; j + 8 <= n; j += 8) {
+            _mm256_storeu_ps(row + j, _mm256_fmadd_ps(v, _mm256_loadu_ps(x + j), _mm256_loadu_ps(row + j)));
+        }
+        for (; j < n; j++) {
+            row[j] += values[p] * x[j];
+        }
+    }
+}
+
+/*
+    One ymm per run, the strip's outputs stay in registers: four rows at a time share every run load,
+    a single row splits its runs over four accumulators to hide the FMA latency. The avx512 kernels
+    use it too, a run is only half a zmm.
+*/
+__attribute__((target("avx2,fma")))
+static void block_sparse_avx2(int m, int strips, const int *row_start, const int *indices, const float *values,
+                              const float *x, int ldx, float *y, int ldy) {
+    int i = 0;
+    for (; i + 4 <= m; i += 4) {
+        const float *x0 = x + (size_t)i * ldx, *x1 = x0 + ldx, *x2 = x1 + ldx, *x3 = x2 + ldx;
+        for (int s = 0; s < strips; s++) {
+            float *out = y + (size_t)i * ldy + s * SPARSE_BLOCK_WIDTH;
+            __m256 c0 = _mm256_loadu_ps(out), c1 = _mm256_loadu_ps(out + ldy);
+            __m256 c2 = _mm256_loadu_ps(out + 2 * ldy), c3 = _mm256_loadu_ps(out + 3 * ldy);
+            for (int q = row_start[s]; q < row_start[s+1]; q++) {
+                __m256 run = _mm256_loadu_ps(values + (size_t)q * SPARSE_BLOCK_WIDTH);
+                int k = indices[q];
+                c0 = _mm256_fmadd_ps(_mm256_broadcast_ss(x0 + k), run, c0);
+                c1 = _mm256_fmadd_ps(_mm256_broadcast_ss(x1 + k), run, c1);
+                c2 = _mm256_fmadd_ps(_mm256_broadcast_ss(x2 + k), run, c2);
+                c3 = _mm256_fmadd_ps(_mm256_broadcast_ss(x3 + k), run, c3);
+            }
+            _mm256_storeu_ps(out, c0);
+            _mm256_storeu_ps(out + ldy, c1);
+            _mm256_storeu_ps(out + 2 * ldy, c2);
+            _mm256_storeu_ps(out + 3 * ldy, c3);
+        }
+    }
+    for (; i < m; i++) {
+        const float *xi = x + (size_t)i * ldx;
+        for (int s = 0; s < strips; s++) {
+            float *out = y + (size_t)i * ldy + s * SPARSE_BLOCK_WIDTH;
+            __m256 c0 = _mm256_loadu_ps(out), c1 = _mm256_setzero_ps(), c2 = c1, c3 = c1;
+            int q = row_start[s], end = row_start[s+1];
+            const float *run = values + (size_t)q * SPARSE_BLOCK_WIDTH;
+            for (; q + 4 <= end; q += 4, run += 4 * SPARSE_BLOCK_WIDTH) {
+                c0 = _mm256_fmadd_ps(_mm256_broadcast_ss(xi + indices[q]), _mm256_loadu_ps(run), c0);
+                c1 = _mm256_fmadd_ps(_mm256_broadcast_ss(xi + indices[q+1]), _mm256_loadu_ps(run + 8), c1);
+                c2 = _mm256_fmadd_ps(_mm256_broadcast_ss(xi + indices[q+2]), _mm256_loadu_ps(run + 16), c2);
+                c3 = _mm256_fmadd_ps(_mm256_broadcast_ss(xi + indices[q+3]), _mm256_loadu_ps(run + 24), c3);
+            }
+            for (; q < end; q++, run += SPARSE_BLOCK_WIDTH) {
+                c0 = _mm256_fmadd_ps(_mm256_broadcast_ss(xi + indices[q]), _mm256_loadu_ps(run), c0);
+            }
+            _mm256_storeu_ps(out, _mm256_add_ps(_mm256_add_ps(c0, c1), _mm256_add_ps(c2, c3)));
+        }
+    }
+}
+
+// eight gathered inputs per step; the avx512 kernels use it too, 16-wide gathers are no faster
+__attribute__((target("avx2,fma")))
+static void sparse_dot_avx2(int rows, const int *row_start, const int *indices, const float *values, const float *x, float *y) {
+    for (int i = 0; i < rows; i++) {
+        int p = row_start[i], end = row_start[i+1];
+        __m256 sum = _mm256_setzero_ps();
+        for (; p + 8 <= end; p += 8) {
+            __m256 gathered = _mm256_i32gather_ps(x, _mm256_loadu_si256((const __m256i *)(indices + p)), sizeof(float));
+            sum = _mm256_fmadd_ps(_mm256_loadu_ps(values + p), gathered, sum);
+        }
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        float tail = _mm_cvtss_f32(_mm_add_ss(half, _mm_movehdup_ps(half)));
+        for (; p < end; p++) {
+            tail += values[p] * x[indices[p]];
+        }
+        y[i] += tail;
+    }
+}
+
+const GemmKernel gemm_kernel_avx2 = { "avx2", 6, 16, 72, 256, 1024, kernel_avx2_6x16, gemv_avx2, sparse_gather_avx2, sparse_scatter_avx2,
+                                      block_sparse_avx2, sparse_dot_avx2 };
+
+// 8 x 32 tile: two zmm per row of C, 16 accumulators fed by a broadcast from the packed A panel
+__attribute__((target("avx512f")))
+static void kernel_avx512_8x32(int kc, const float *a, const float *b, float *c, int ldc, float alpha, float beta, const float *bias) {
+    __m512 c00 = _mm512_setzero_ps(), c01 = _mm512_setzero_ps();
+    __m512 c10 = _mm512_setzero_ps(), c11 = _mm512_setzero_ps();
+    __m512 c20 = _mm512_setzero_ps(), c21 = _mm512_setzero_ps();
+    __m512 c30 = _mm512_setzero_ps(), c31 = _mm512_setzero_ps();
+    __m512 c40 = _mm512_setzero_ps(), c41 = _mm512_setzero_ps();
+    __m512 c50 = _mm512_setzero_ps(), c51 = _mm512_setzero_ps();
+    __m512 c60 = _mm512_setzero_ps(), c61 = _mm512_setzero_ps();
+    __m512 c70 = _mm512_setzero_ps(), c71 = _mm512_setzero_ps();
+    for (int l = 0; l < kc; l++) {
+        __m512 b0 = _mm512_load_ps(b);
+        __m512 b1 = _mm512_load_ps(b + 16);
+        __m512 a_i;
+        a_i = _mm512_set1_ps(a[0]); c00 = _mm512_fmadd_ps(a_i, b0, c00); c01 = _mm512_fmadd_ps(a_i, b1, c01);
+        a_i = _mm512_set1_ps(a[1]); c10 = _mm512_fmadd_ps(a_i, b0, c10); c11 = _mm512_fmadd_ps(a_i, b1, c11);
+        a_i = _mm512_set1_ps(a[2]); c20 = _mm512_fmadd_ps(a_i, b0, c20); c21 = _mm512_fmadd_ps(a_i, b1, c21);
+        a_i = _mm512_set1_ps(a[3]); c30 = _mm512_fmadd_ps(a_i, b0, c30); c31 = _mm512_fmadd_ps(a_i, b1, c31);
+        a_i = _mm512_set1_ps(a[4]); c40 = _mm512_fmadd_ps(a_i, b0, c40); c41 = _mm512_fmadd_ps(a_i, b1, c41);
+        a_i = _mm512_set1_ps(a[5]); c50 = _mm512_fmadd_ps(a_i, b0, c50); c51 = _mm512_fmadd_ps(a_i, b1, c51);
+        a_i = _mm512_set1_ps(a[6]); c60 = _mm512_fmadd_ps(a_i, b0, c60); c61 = _mm512_fmadd_ps(a_i, b1, c61);
+        a_i = _mm512_set1_ps(a[7]); c70 = _mm512_fmadd_ps(a_i, b0, c70); c71 = _mm512_fmadd_ps(a_i, b1, c71);
+        a += 8;
+        b += 32;
+    }
+    __m512 acc[8][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}, {c40, c41}, {c50, c51}, {c60, c61}, {c70, c71}};
+    __m512 va = _mm512_set1_ps(alpha);
+    __m512 vb = _mm512_set1_ps(beta);
+    __m512 bias0 = bias != NULL ? _mm512_loadu_ps(bias) : _mm512_setzero_ps();
+    __m512 bias1 = bias != NULL ? _mm512_loadu_ps(bias + 16) : _mm512_setzero_ps();
+    for (int i = 0; i < 8; i++) {
+        float *row = c + i * ldc;
+        for (int h = 0; h < 2; h++) {
+            __m512 r = _mm512_fmadd_ps(va, acc[i][h], h == 0 ? bias0 : bias1);
+            if (beta != 0) {
+                r = _mm512_fmadd_ps(vb, _mm512_loadu_ps(row + 16 * h), r);
+            }
+            _mm512_storeu_ps(row + 16 * h, r);
+        }
+    }
+}
+
+// y in blocks of 64 columns (4 zmm accumulators), then single vectors with a masked last one
+__attribute__((target("avx512f")))
+static void gemv_avx512(int k, int n, const float *x, const float *a, int lda, const float *bias, float *y) {
+    int j = 0;
+    for (; j + 64 <= n; j += 64) {
+        __m512 c0 = bias != NULL ? _mm512_loadu_ps(bias + j) : _mm512_setzero_ps();
+        __m512 c1 = bias != NULL ? _mm512_loadu_ps(bias + j + 16) : _mm512_setzero_ps();
+        __m512 c2 = bias != NULL ? _mm512_loadu_ps(bias + j + 32) : _mm512_setzero_ps();
+        __m512 c3 = bias != NULL ? _mm512_loadu_ps(bias + j + 48) : _mm512_setzero_ps();
+        const float *row = a + j;
+        for (int p = 0; p < k; p++, row += lda) {
+            if (x[p] == 0.0f) {
+                continue;
+            }
+            __m512 xp = _mm512_set1_ps(x[p]);
+            c0 = _mm512_fmadd_ps(xp, _mm512_loadu_ps(row), c0);
+            c1 = _mm512_fmadd_ps(xp, _mm512_loadu_ps(row + 16), c1);
+            c2 = _mm512_fmadd_ps(xp, _mm512_loadu_ps(row + 32), c2);
+            c3 = _mm512_fmadd_ps(xp, _mm512_loadu_ps(row + 48), c3);
+        }
+        _mm512_storeu_ps(y + j, c0);
+        _mm512_storeu_ps(y + j + 16, c1);
+        _mm512_storeu_ps(y + j + 32, c2);
+        _mm512_storeu_ps(y + j + 48, c3);
+    }
+    for (; j < n; j += 16) {
+        __mmask16 mask = n - j >= 16 ? 0xffff : (__mmask16)((1u << (n - j)) - 1);
+        __m512 c0 = bias != NULL ? _mm512_maskz_loadu_ps(mask, bias + j) : _mm512_setzero_ps();
+        const float *row = a + j;
+        for (int p = 0; p < k; p++, row += lda) {
+            if (x[p] != 0.0f) {
+                c0 = _mm512_fmadd_ps(_mm512_set1_ps(x[p]), _mm512_maskz_loadu_ps(mask, row), c0);
+            }
+        }
+        _mm512_mask_storeu_ps(y + j, mask, c0);
+    }
+}
+
+// y in blocks of 64 columns kept in registers over all the non-zeros, then single vectors with a masked last one
+__attribute__((target("avx512f")))
+static void sparse_gather_avx512(int nnz, const int *indices, const float *values, const float *b, int ldb, int n, float *y) {
+    int j = 0;
+    for (; j + 64 <= n; j += 64) {
+        __m512 c0 = _mm512_loadu_ps(y + j), c1 = _mm512_loadu_ps(y + j + 16);
+        __m512 c2 = _mm512_loadu_ps(y + j + 32), c3 = _mm512_loadu_ps(y + j + 48);
+        for (int p = 0; p < nnz; p++) {
+            const float *row = b + (size_t)indices[p] * ldb + j;
+            __m512 v = _mm512_set1_ps(values[p]);
+            c0 = _mm512_fmadd_ps(v, _mm512_loadu_ps(row), c0);
+            c1 = _mm512_fmadd_ps(v, _mm512_loadu_ps(row + 16), c1);
+            c2 = _mm512_fmadd_ps(v, _mm512_loadu_ps(row + 32), c2);
+            c3 = _mm512_fmadd_ps(v, _mm512_loadu_ps(row + 48), c3);
+        }
+        _mm512_storeu_ps(y + j, c0);
+        _mm512_storeu_ps(y + j + 16, c1);
+        _mm512_storeu_ps(y + j + 32, c2);
+        _mm512_storeu_ps(y + j + 48, c3);
+    }
+    for (; j < n; j += 16) {
+        __mmask16 mask = n - j >= 16 ? 0xffff : (__mmask16)((1u << (n - j)) - 1);
+        __m512 c0 = _mm512_maskz_loadu_ps(mask, y + j);
+        for (int p = 0; p < nnz; p++) {
+            c0 = _mm512_fmadd_ps(_mm512_set1_ps(values[p]), _mm512_maskz_loadu_ps(mask, b + (size_t)indices[p] * ldb + j), c0);
+        }
+        _mm512_mask_storeu_ps(y + j, mask, c0);
+    }
+}
+
+__attribute__((target("avx512f")))
+static void sparse_scatter_avx512(int nnz, const int *indices, const float *values, const float *x, int n, float *c, int ldc) {
+    for (int p = 0; p < nnz; p++) {
+        float *row = c + (size_t)indices[p] * ldc;
+        __m512 v = _mm512_set1_ps(values[p]);
+        for (int j = 0; j < n; j += 16) {
+            __mmask16 mask = n - j >= 16 ? 0xffff : (__mmask16)((1u << (n - j)) - 1);
+            __m512 r = _mm512_fmadd_ps(v, _mm512_maskz_loadu_ps(mask, x + j), _mm512_maskz_loadu_ps(mask, row + j));
+            _mm512_mask_storeu_ps(row + j, mask, r);
+        }
+    }
+}
+
+const GemmKernel gemm_kernel_avx512 = { "avx512", 8, 32, 128, 256, 1024, kernel_avx512_8x32, gemv_avx512,
+                                        sparse_gather_avx512, sparse_scatter_avx512, block_sparse_avx2, sparse_dot_avx2 };
+#endif
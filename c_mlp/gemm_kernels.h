@@ -0,0 +1,70 @@
+#ifndef GEMM_KERNELS_H
+#define GEMM_KERNELS_H
+#include"sparse.h"
+
+/*
+    Register-tiled micro-kernel: C (mr x nr) = alpha * A_panel @ B_panel + beta * C + bias
+    a: packed kc x mr panel of A, stored column by column (mr floats per step of k)
+    b: packed kc x nr panel of B, stored row by row (nr floats per step of k)
+    c: top-left corner of the tile in C, ldc its leading dimension
+    bias: nr values added to every row of the tile while it is still in registers, or NULL
+    C is not read when beta == 0.
+*/
+typedef void (*gemm_micro_kernel)(int kc, const float *a, const float *b, float *c, int ldc, float alpha, float beta, const float *bias);
+
+/*
+    Row vector times matrix for batches of one: y (n) = x (k) @ A (k x n) + bias
+    A is read in place (row-major, leading dimension lda), nothing is packed. Rows of A whose x value
+    is zero are skipped, which pays off on sparse inputs such as MNIST pixels.
+*/
+typedef void (*gemv_kernel)(int k, int n, const float *x, const float *a, int lda, const float *bias, float *y);
+
+/*
+    Sparse row times matrix: y (n) += sum over p < nnz of values[p] * B[indices[p], :]
+    B is read in place (row-major, leading dimension ldb). Used for CSR inputs in the forward pass.
+*/
+typedef void (*sparse_gather_kernel)(int nnz, const int *indices, const float *values, const float *b, int ldb, int n, float *y);
+
+/*
+    Sparse column times row: C[indices[p], :] (n) += values[p] * x for every p < nnz
+    C is row-major with leading dimension ldc. Used for the weight gradient of CSR inputs.
+*/
+typedef void (*sparse_scatter_kernel)(int nnz, const int *indices, const float *values, const float *x, int n, float *c, int ldc);
+
+/*
+    Rows times block-sparse matrix: Y (m x n) += X (m x k) @ W, see SparseMatrix for the block-sparse form
+    Strip s of W holds entries row_start[s] to row_start[s+1] - 1 and adds into columns
+    SPARSE_BLOCK_WIDTH * s onwards of Y, which must have room for the last strip reaching past column n.
+    X and Y are row-major with leading dimensions ldx and ldy. Each run is loaded once for several rows.
+*/
+typedef void (*block_sparse_kernel)(int m, int strips, const int *row_start, const int *indices, const float *values,
+                                    const float *x, int ldx, float *y, int ldy);
+
+/*
+    Sparse matrix times vector, one dot product per row: y[i] += sum over row i's entries of
+    values[p] * x[indices[p]], for rows 0 to rows - 1 (row i holds entries row_start[i] to
+    row_start[i+1] - 1). The x values are gathered, so each row vectorizes. Used for pruned layers
+    of single weights, which are stored by output.
+*/
+typedef void (*sparse_dot_kernel)(int rows, const int *row_start, const int *indices, const float *values, const float *x, float *y);
+
+typedef struct {
+    const char *name;
+    int mr, nr;     // register tile
+    int mc, kc, nc; // cache blocking: A block is mc x kc (L2), B panel is kc x nc (L3)
+    gemm_micro_kernel kernel;
+    gemv_kernel gemv;
+    sparse_gather_kernel sparse_gather;
+    sparse_scatter_kernel sparse_scatter;
+    block_sparse_kernel block_sparse;
+    sparse_dot_kernel sparse_dot;
+} GemmKernel;
+
+extern const GemmKernel gemm_kernel_scalar;
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define GEMM_HAVE_X86_KERNELS 1
+extern const GemmKernel gemm_kernel_avx2;
+extern const GemmKernel gemm_kernel_avx512;
+#endif
+
+#endif
@@ -0,0 +1,73 @@
+#include"inference.h"
+#include"activation.h"
+#include"gemm.h"
+#include"profile.h"
+
+// batches below this many rows run one GEMV per row: packing the weights for the GEMM costs more than
+// reading them in place a few times (784-512-512-10 measured even at 8 rows with dense inputs, and
+// at about 32 with MNIST-like sparse ones, which the GEMV skips the zeros of)
+#define INFERENCE_GEMV_ROWS 8
+
+static int max_width(const MLP *mlp) {
+    int width = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        if (mlp->layers[i]->num_neurons > width) {
+            width = mlp->layers[i]->num_neurons;
+        }
+    }
+    return width;
+}
+
+// two ping-pong buffers wide enough for the widest layer
+size_t mlp_inference_scratch_bytes(const MLP *mlp, int max_batch_size) {
+    return 2 * arena_matrix_bytes(max_batch_size, max_width(mlp));
+}
+
+/*
+    Runs a batch through the network and returns the logits of the output layer
+    Parameters:
+    inputs: batch_size x input_size
+    scratch: at least mlp_inference_scratch_bytes(mlp, batch_size) bytes, aligned to MATRIX_ALIGNMENT
+    predictions: receives the argmax of every row, or NULL
+    The logits are the output layer before its activation (apply it with matrix_activation for
+    probabilities). They live in scratch and are overwritten by the next call with the same scratch.
+    Small batches go through the GEMV kernels a row at a time, larger ones through the packed GEMM.
+*/
+Matrix mlp_infer(const MLP *mlp, Matrix inputs, void *scratch, int *predictions) {
+    int batch_size = inputs.rows;
+    float *buffers[2] = { scratch, (float *)((char *)scratch + arena_matrix_bytes(batch_size, max_width(mlp))) };
+
+    Matrix x = inputs;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        Matrix y = matrix_view(buffers[i % 2], batch_size, layer->num_neurons, layer->num_neurons);
+        // the argmax of the logits is the argmax of softmax, so the output layer skips its activation
+        void (*activation)(float*, float*, size_t) = i < mlp->num_layers - 1 ? layer->activation : NULL;
+        GemmEpilogue epilogue = { layer->biases, { NULL }, activation, activation_is_rowwise(activation) };
+        PROFILE_START(start);
+        if (batch_size < INFERENCE_GEMV_ROWS) {
+            for (int r = 0; r < batch_size; r++) {
+                sgemv_fused(matrix_row(x, r), layer->weights, matrix_row(y, r), &epilogue);
+            }
+        } else {
+            sgemm_fused(NULL, GEMM_N, GEMM_N, 1.0f, x, layer->weights, 0.0f, y, &epilogue);
+        }
+        PROFILE_RECORD(PROFILE_INFERENCE, i, start, GEMM_FLOPS(batch_size, layer->num_neurons, layer->prev_num_neurons),
+                       GEMM_BYTES(batch_size, layer->num_neurons, layer->prev_num_neurons, 0));
+        x = y;
+    }
+
+    if (predictions != NULL) {
+        for (int i = 0; i < batch_size; i++) {
+            const float *row = matrix_row(x, i);
+            int max_idx = 0;
+            for (int j = 1; j < x.cols; j++) {
+                if (row[j] > row[max_idx]) {
+                    max_idx = j;
+                }
+            }
+            predictions[i] = max_idx;
+        }
+    }
+    return x;
+}
@@ -0,0 +1,14 @@
+#ifndef INFERENCE_H
+#define INFERENCE_H
+#include"mlp.h"
+
+/*
+    Forward-only path for serving
+    Unlike batch_forward it does not use the model's workspace or thread pool and keeps no
+    pre-activations, so any number of threads can run it on the same model at once, each with its own
+    scratch. Nothing is allocated once the GEMM packing buffers of the calling thread have grown.
+*/
+size_t mlp_inference_scratch_bytes(const MLP *mlp, int max_batch_size);
+Matrix mlp_infer(const MLP *mlp, Matrix inputs, void *scratch, int *predictions);
+
+#endif
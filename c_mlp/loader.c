@@ -0,0 +1,240 @@
+#include<stdlib.h>
+#include<stdio.h>
+#include"loader.h"
+
+// splitmix64, so the order only depends on the seed and the epoch
+static uint64_t next_random(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static void shuffle_indices(int *indices, int n, uint64_t *state) {
+    for (int i = n - 1; i > 0; i--) {
+        int j = next_random(state) % (i + 1);
+        int tmp = indices[i];
+        indices[i] = indices[j];
+        indices[j] = tmp;
+    }
+}
+
+static int zero_copy(DataLoader *loader) {
+    Dataset *dataset = loader->dataset;
+    return !loader->shuffle && dataset->feature_dtype == DATASET_FLOAT32 && dataset->label_dtype == DATASET_FLOAT32;
+}
+
+DataLoader *loader_create(Dataset *dataset, int batch_size, int shuffle, uint64_t seed) {
+    DataLoader *loader = calloc(1, sizeof(DataLoader));
+    loader->dataset = dataset;
+    loader->batch_size = batch_size;
+    loader->shuffle = shuffle;
+    loader->seed = seed;
+    loader->chunk_size = LOADER_CHUNK_SAMPLES;
+    loader->num_batches = (dataset->num_samples + batch_size - 1) / batch_size;
+    loader->held = -1;
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->changed, NULL);
+    if (!zero_copy(loader)) {
+        for (int i = 0; i < 2; i++) {
+            loader->slots[i].inputs = allocate_matrix(batch_size, dataset->feature_dim);
+            loader->slots[i].targets = allocate_matrix(batch_size, dataset->label_dim);
+        }
+        loader->batch = malloc(batch_size * sizeof(int));
+    }
+    loader_set_sparse(loader, SPARSE_MAX_DENSITY);
+    return loader;
+}
+
+// fills the slots batch by batch in the epoch's order, waiting whenever both are full
+static void *producer_main(void *arg) {
+    DataLoader *loader = arg;
+    Dataset *dataset = loader->dataset;
+    int num_samples = dataset->num_samples;
+    int chunk_size = loader->chunk_size;
+    int num_chunks = (num_samples + chunk_size - 1) / chunk_size;
+    uint64_t state = loader->seed ^ (0x5851F42D4C957F2DULL * (uint64_t)(loader->epoch + 1));
+
+    int *chunk_order = loader->chunk_order;
+    int *order = loader->order;
+    int *batch = loader->batch;
+    for (int c = 0; c < num_chunks; c++) {
+        chunk_order[c] = c;
+    }
+    if (loader->shuffle) {
+        shuffle_indices(chunk_order, num_chunks, &state);
+    }
+
+    int batch_rows = 0, slot = 0, seen = 0;
+    for (int c = 0; c < num_chunks; c++) {
+        int start = chunk_order[c] * chunk_size;
+        int count = num_samples - start < chunk_size ? num_samples - start : chunk_size;
+        if (c + 1 < num_chunks) {
+            dataset_prefetch(dataset, chunk_order[c+1] * chunk_size, chunk_size);
+        }
+        for (int i = 0; i < count; i++) {
+            order[i] = start + i;
+        }
+        if (loader->shuffle) {
+            shuffle_indices(order, count, &state);
+        }
+
+        for (int i = 0; i < count; i++) {
+            batch[batch_rows++] = order[i];
+            seen++;
+            if (batch_rows < loader->batch_size && seen < num_samples) {
+                continue;
+            }
+            pthread_mutex_lock(&loader->lock);
+            while (loader->slots[slot].ready && !loader->stop) {
+                pthread_cond_wait(&loader->changed, &loader->lock);
+            }
+            int stop = loader->stop;
+            pthread_mutex_unlock(&loader->lock);
+            if (stop) {
+                return NULL;
+            }
+
+            LoaderSlot *target = &loader->slots[slot];
+            dataset_gather(dataset, batch, batch_rows, target->inputs, target->targets);
+            target->rows = batch_rows;
+            target->sparse = loader->max_density > 0
+                             && sparse_from_dense(matrix_row_view(target->inputs, 0, batch_rows), &target->sparse_inputs) == 0;
+
+            pthread_mutex_lock(&loader->lock);
+            target->ready = 1;
+            pthread_cond_broadcast(&loader->changed);
+            pthread_mutex_unlock(&loader->lock);
+            slot ^= 1;
+            batch_rows = 0;
+        }
+        // a chunk is only visited once per epoch
+        dataset_evict(dataset, start, count);
+    }
+    return NULL;
+}
+
+static void stop_producer(DataLoader *loader) {
+    if (!loader->running) {
+        return;
+    }
+    pthread_mutex_lock(&loader->lock);
+    loader->stop = 1;
+    pthread_cond_broadcast(&loader->changed);
+    pthread_mutex_unlock(&loader->lock);
+    pthread_join(loader->producer, NULL);
+    loader->running = 0;
+}
+
+// starts producing the batches of an epoch, abandoning whatever is left of the previous one
+void loader_start_epoch(DataLoader *loader, int epoch) {
+    stop_producer(loader);
+    loader->epoch = epoch;
+    loader->next_batch = 0;
+    loader->stop = 0;
+    loader->held = -1;
+    loader->slots[0].ready = loader->slots[1].ready = 0;
+    loader->sparse_batch = NULL;
+    if (zero_copy(loader)) {
+        return;
+    }
+    // chunk_size may have been changed since the last epoch
+    int num_chunks = (loader->dataset->num_samples + loader->chunk_size - 1) / loader->chunk_size;
+    loader->chunk_order = realloc(loader->chunk_order, num_chunks * sizeof(int));
+    loader->order = realloc(loader->order, loader->chunk_size * sizeof(int));
+    if (pthread_create(&loader->producer, NULL, producer_main, loader) != 0) {
+        fprintf(stderr, "Could not start the data loader thread\n");
+        exit(1);
+    }
+    loader->running = 1;
+}
+
+/*
+    Hands out the next batch of the epoch, returns its number of rows or 0 once the epoch is done
+    The matrices stay valid until the next call.
+*/
+int loader_next(DataLoader *loader, Matrix *inputs, Matrix *targets) {
+    if (loader->next_batch == loader->num_batches) {
+        return 0;
+    }
+    int start = loader->next_batch * loader->batch_size;
+    int rows = loader->dataset->num_samples - start < loader->batch_size ? loader->dataset->num_samples - start : loader->batch_size;
+    if (zero_copy(loader)) {
+        dataset_batch(loader->dataset, start, rows, inputs, targets);
+        LoaderSlot *slot = &loader->slots[0];
+        slot->sparse = loader->max_density > 0 && sparse_from_dense(*inputs, &slot->sparse_inputs) == 0;
+        loader->sparse_batch = slot->sparse ? &slot->sparse_inputs : NULL;
+        loader->next_batch++;
+        return rows;
+    }
+
+    int slot = loader->next_batch % 2;
+    pthread_mutex_lock(&loader->lock);
+    // give the previous batch's slot back to the producer
+    if (loader->held >= 0) {
+        loader->slots[loader->held].ready = 0;
+        pthread_cond_broadcast(&loader->changed);
+    }
+    while (!loader->slots[slot].ready) {
+        pthread_cond_wait(&loader->changed, &loader->lock);
+    }
+    loader->held = slot;
+    pthread_mutex_unlock(&loader->lock);
+
+    *inputs = matrix_row_view(loader->slots[slot].inputs, 0, loader->slots[slot].rows);
+    *targets = matrix_row_view(loader->slots[slot].targets, 0, loader->slots[slot].rows);
+    loader->sparse_batch = loader->slots[slot].sparse ? &loader->slots[slot].sparse_inputs : NULL;
+    loader->next_batch++;
+    if (loader->next_batch == loader->num_batches) {
+        // the producer has nothing left to fill
+        pthread_join(loader->producer, NULL);
+        loader->running = 0;
+    }
+    return loader->slots[slot].rows;
+}
+
+/*
+    Compresses the inputs of every batch with at most max_density non-zeros to CSR, 0 turns it off
+    Denser batches are only handed out dense, so the model falls back to its dense GEMMs for them.
+    Call it between epochs.
+*/
+void loader_set_sparse(DataLoader *loader, float max_density) {
+    for (int i = 0; i < 2; i++) {
+        sparse_free(loader->slots[i].sparse_inputs);
+        loader->slots[i].sparse_inputs = (SparseMatrix){ NULL };
+        loader->slots[i].sparse = 0;
+    }
+    loader->max_density = max_density > 0 ? max_density : 0;
+    loader->sparse_batch = NULL;
+    if (loader->max_density == 0) {
+        return;
+    }
+    int capacity = (int)((double)loader->batch_size * loader->dataset->feature_dim * loader->max_density);
+    // without a producer every batch is compressed into the first slot
+    for (int i = 0; i < (zero_copy(loader) ? 1 : 2); i++) {
+        loader->slots[i].sparse_inputs = sparse_allocate(loader->batch_size, loader->dataset->feature_dim, capacity);
+    }
+}
+
+// the CSR form of the inputs loader_next handed out last, NULL if they were too dense or compression is off
+const SparseMatrix *loader_sparse_inputs(DataLoader *loader) {
+    return loader->sparse_batch;
+}
+
+void loader_free(DataLoader *loader) {
+    if (loader == NULL) {
+        return;
+    }
+    stop_producer(loader);
+    pthread_mutex_destroy(&loader->lock);
+    pthread_cond_destroy(&loader->changed);
+    for (int i = 0; i < 2; i++) {
+        free_matrix(loader->slots[i].inputs);
+        free_matrix(loader->slots[i].targets);
+        sparse_free(loader->slots[i].sparse_inputs);
+    }
+    free(loader->chunk_order);
+    free(loader->order);
+    free(loader->batch);
+    free(loader);
+}
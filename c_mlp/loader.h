@@ -0,0 +1,61 @@
+#ifndef LOADER_H
+#define LOADER_H
+#include<stdint.h>
+#include<pthread.h>
+#include"dataset.h"
+#include"sparse.h"
+
+// samples are shuffled within chunks of this size and the chunks are visited in a shuffled order,
+// so a mapped dataset is still read from disk in large contiguous pieces
+#define LOADER_CHUNK_SAMPLES 4096
+
+typedef struct {
+    Matrix inputs;
+    Matrix targets;
+    int rows;
+    int ready; // filled by the producer and not yet handed back by the consumer
+    SparseMatrix sparse_inputs;
+    int sparse;   // sparse_inputs holds this batch, it was sparse enough
+} LoaderSlot;
+
+/*
+    Streams minibatches of a dataset, one epoch at a time
+    With shuffling (or uint8 data to normalize) a background thread gathers each batch into one of two
+    slots while the previous batch trains. Unshuffled float32 data is served as views into the dataset.
+    The last batch of an epoch holds the remaining num_samples % batch_size samples.
+    Batches whose inputs are at most max_density non-zero are also compressed to CSR, on the producer
+    thread when there is one, see loader_sparse_inputs.
+*/
+typedef struct {
+    Dataset *dataset;
+    int batch_size;
+    int shuffle;
+    uint64_t seed;
+    int chunk_size;
+    int num_batches;
+    float max_density; // 0 when batches are not compressed
+
+    // epoch state
+    int epoch;
+    int next_batch; // batches handed out this epoch
+    int running;    // the producer thread is alive
+    int stop;
+    int held;       // slot currently lent to the caller, -1 if none
+    const SparseMatrix *sparse_batch; // CSR form of the batch last handed out, NULL if it was too dense
+    LoaderSlot slots[2];
+    int *chunk_order; // producer scratch, sized at the start of each epoch
+    int *order;
+    int *batch;
+    pthread_t producer;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} DataLoader;
+
+DataLoader *loader_create(Dataset *dataset, int batch_size, int shuffle, uint64_t seed);
+void loader_free(DataLoader *loader);
+void loader_start_epoch(DataLoader *loader, int epoch);
+int loader_next(DataLoader *loader, Matrix *inputs, Matrix *targets);
+void loader_set_sparse(DataLoader *loader, float max_density);
+const SparseMatrix *loader_sparse_inputs(DataLoader *loader);
+
+#endif
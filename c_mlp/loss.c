@@ -1,9 +1,58 @@
 #include"loss.h"
+#include"activation_kernels.h"
 
-void softmax_ce_loss_prime(float **outputs, float **targets, float **deltas, int batch_size, int num_neurons) {
-    for (int i = 0; i < batch_size; i++) {
-        for (int j = 0; j < num_neurons; j++) {
-            deltas[i][j] = outputs[i][j] - targets[i][j];
+/*
+    Fused log-softmax + negative log-likelihood head, from the output layer's logits
+    Each row is one pass of the vectorized softmax kernel into deltas, which subtracts the row max
+    before exponentiating, then one pass that turns it into the gradient and sums the loss:
+        loss = sum_i t_i * (logsumexp(z) - z_i),  deltas_i = p_i * sum(t) - t_i
+    logsumexp comes from the max element, whose probability 1 / sum is never small enough to lose
+    precision in the log, so nothing is clamped and saturated logits still give a finite loss.
+    Returns the loss summed over the rows.
+*/
+double softmax_cross_entropy(Matrix logits, Matrix targets, Matrix deltas) {
+    const ActivationKernels *kernels = activation_kernels();
+    int n = logits.cols;
+    double loss = 0;
+    for (int r = 0; r < logits.rows; r++) {
+        float *z = matrix_row(logits, r), *t = matrix_row(targets, r), *d = matrix_row(deltas, r);
+        kernels->softmax(z, d, n);
+        int max_idx = 0;
+        for (int i = 1; i < n; i++) {
+            max_idx = z[i] > z[max_idx] ? i : max_idx;
+        }
+        float logsumexp = z[max_idx] - logf(d[max_idx]);
+        float target_sum = 0.0f, row_loss = 0.0f;
+        for (int i = 0; i < n; i++) {
+            target_sum += t[i];
+            row_loss += t[i] * (logsumexp - z[i]);
+        }
+        for (int i = 0; i < n; i++) {
+            d[i] = d[i] * target_sum - t[i];
+        }
+        loss += row_loss;
+    }
+    return loss;
+}
+
+void softmax_ce_loss_prime(Matrix outputs, Matrix targets, Matrix deltas) {
+    for (int i = 0; i < outputs.rows; i++) {
+        for (int j = 0; j < outputs.cols; j++) {
+            MAT(deltas, i, j) = MAT(outputs, i, j) - MAT(targets, i, j);
+        }
+    }
+}
+
+/*
+    Gradient of mse with respect to the outputs, outputs - targets
+    Unlike softmax_ce_loss_prime these are not yet the deltas at the pre-activations, backward_pass
+    carries them back through the output layer's activation.
+*/
+void mse_loss_prime(Matrix outputs, Matrix targets, Matrix deltas) {
+    for (int i = 0; i < outputs.rows; i++) {
+        float *y = matrix_row(outputs, i), *t = matrix_row(targets, i), *d = matrix_row(deltas, i);
+        for (int j = 0; j < outputs.cols; j++) {
+            d[j] = y[j] - t[j];
         }
     }
 }
@@ -22,3 +71,25 @@ float cross_entropy(float y, float y_hat) {
     float loss = -1.0 * (y * log(y_hat) + (1.0 - y) * log(1.0 - y_hat));
     return loss;
 }
+
+// returns 0 for functions without an id
+int loss_id(float (*loss)(float, float)) {
+    if (loss == cross_entropy) return LOSS_CROSS_ENTROPY;
+    if (loss == mse) return LOSS_MSE;
+    return 0;
+}
+
+// looks up the loss and its batched gradient, returns -1 for unknown ids
+int loss_from_id(int id, float (**loss)(float, float), void (**loss_prime)(Matrix, Matrix, Matrix)) {
+    switch (id) {
+    case LOSS_CROSS_ENTROPY:
+        *loss = cross_entropy;
+        *loss_prime = softmax_ce_loss_prime;
+        return 0;
+    case LOSS_MSE:
+        *loss = mse;
+        *loss_prime = mse_loss_prime;
+        return 0;
+    }
+    return -1;
+}
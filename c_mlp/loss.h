@@ -1,5 +1,15 @@
 #include<math.h>
+#include"matrix.h"
 
-void softmax_ce_loss_prime(float **outputs, float **targets, float **deltas, int batch_size, int num_neurons);
+void softmax_ce_loss_prime(Matrix outputs, Matrix targets, Matrix deltas);
+void mse_loss_prime(Matrix outputs, Matrix targets, Matrix deltas);
+double softmax_cross_entropy(Matrix logits, Matrix targets, Matrix deltas);
 float mse(float y, float y_hat);
 float cross_entropy(float y, float y_hat);
+
+// stable ids for the losses, used by checkpoints in place of function pointers
+#define LOSS_CROSS_ENTROPY 1
+#define LOSS_MSE 2
+
+int loss_id(float (*loss)(float, float));
+int loss_from_id(int id, float (**loss)(float, float), void (**loss_prime)(Matrix, Matrix, Matrix));
@@ -8,57 +8,19 @@
 #include"activation.h"
 #include"loss.h"
 #include"gemm.h"
+#include"checkpoint.h"
+#include"tune.h"
 
-#define TRAINING_SAMPLES 60000
-#define TEST_SAMPLES 10000
-
-// for first number is the target, the rest are the input
-// params: filename, pointer to matrix of input, pointer to matrix of target, number of samples
-void read_mnist(char *filename, float ***input_ptr, float ***target_ptr, int num_samples) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        fprintf(stderr, "Could not open file %s\n", filename);
-        return;
-    }
-
-    char line[2048]; // Assuming each line of the CSV does not exceed 2048 characters
-    int sample_idx = 0;
-
-    // Assuming the first line is not a header. If it is, uncomment the next line to skip it.
-    // fgets(line, sizeof(line), file);
-
-    while (fgets(line, sizeof(line), file) && sample_idx < num_samples) {
-        char *token = strtok(line, ",");
-        int target = atoi(token); // Convert first token to int for target
-        
-        // One-hot encode the target
-        for (int i = 0; i < 10; i++) {
-            (*target_ptr)[sample_idx][i] = (i == target) ? 1.0f : 0.0f;
-        }
-
-        // Process the rest of the tokens for the input
-        for (int i = 0; i < 784; i++) {
-            token = strtok(NULL, ",");
-            if (token != NULL) {
-                (*input_ptr)[sample_idx][i] = atoi(token) / 255.0f;
-            }
-        }
-        sample_idx++;
-    }
-
-    fclose(file);
-}
-
-void view_mnist(float ***input_ptr, float ***target_ptr, int num_samples) {
-    for (int i = 0; i < num_samples; i++) {
+void view_mnist(Matrix inputs, Matrix targets) {
+    for (int i = 0; i < inputs.rows; i++) {
         printf("Target: ");
-        for (int j = 0; j < 10; j++) {
-            printf("%.0f ", (*target_ptr)[i][j]);
+        for (int j = 0; j < targets.cols; j++) {
+            printf("%.0f ", MAT(targets, i, j));
         }
         printf("\n");
         for (int j = 0; j < 28; j++) {
             for (int k = 0; k < 28; k++) {
-                printf("%f ", (*input_ptr)[i][j*28 + k]);
+                printf("%f ", MAT(inputs, i, j*28 + k));
             }
             printf("\n");
         }
@@ -68,46 +30,56 @@ void view_mnist(float ***input_ptr, float ***target_ptr, int num_samples) {
 
 int main() {
 
-    float **input_ptr = malloc(TRAINING_SAMPLES * sizeof(float *));
-    for (int i = 0; i < TRAINING_SAMPLES; i++) {
-        input_ptr[i] = malloc(784 * sizeof(float));
+    // binary datasets are made once from the MNIST CSV or IDX files with tools/convert_dataset
+    Dataset *train_set = dataset_open("mnist_train.bin");
+    if (train_set == NULL) {
+        fprintf(stderr, "Convert the training set first: convert_dataset csv mnist_train.csv mnist_train.bin\n");
+        return 1;
     }
-    float **target_ptr = malloc(TRAINING_SAMPLES * sizeof(float *));
-    for (int i = 0; i < TRAINING_SAMPLES; i++) {
-        target_ptr[i] = malloc(10 * sizeof(float));
-    }
-    read_mnist("mnist_train.csv", &input_ptr, &target_ptr, TRAINING_SAMPLES);
 
     int num_layers = 3;
-    int num_neurons[] = {64, 32, 10};
+    int num_neurons[] = {64, 32, train_set->label_dim};
     void (*activations[])(float*, float*, size_t) = {relu_vector, relu_vector, softmax};
     void (*activation_primes[])(float*, float*, size_t) = {relu_prime_vector, relu_prime_vector, softmax_prime};
 
-    MLP *mlp = mlp_init(num_layers, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, 784);
+    MLP *mlp = mlp_init(num_layers, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.005, train_set->feature_dim);
 
-    printf("Training...\n");
     int num_epochs = 10;
-    train(mlp, input_ptr, target_ptr, num_epochs, TRAINING_SAMPLES, 32);
-    print_mlp(mlp);
-
-    free_matrix(input_ptr, TRAINING_SAMPLES);
-    free_matrix(target_ptr, TRAINING_SAMPLES);
-    input_ptr = malloc(TEST_SAMPLES * sizeof(float *));
-    for (int i = 0; i < TEST_SAMPLES; i++) {
-        input_ptr[i] = malloc(784 * sizeof(float));
+    Optimizer adam = optimizer_adam(0.001, 0.9, 0.999, 1e-8);
+    adam.schedule = lr_cosine(num_epochs, 0.00001);
+    mlp_set_optimizer(mlp, adam);
+
+    // the kernel, blocking, batch size and threads are measured on the first run and cached for this host
+    TuneConfig config;
+    int cached = mlp_autotune(mlp, train_set, 256 << 20, 128, NULL, &config);
+    if (cached < 0) {
+        config.batch_size = 32;
+    } else {
+        printf("%s configuration: %s kernel, blocking %d x %d x %d, batch size %d, %d threads, %.0f samples/s\n",
+               cached ? "Cached" : "Tuned", config.kernel, config.blocking.mc, config.blocking.kc, config.blocking.nc,
+               config.batch_size, config.num_threads, config.samples_per_second);
     }
-    target_ptr = malloc(TEST_SAMPLES * sizeof(float *));
-    for (int i = 0; i < TEST_SAMPLES; i++) {
-        target_ptr[i] = malloc(10 * sizeof(float));
+
+    // mnist.ckpt.<step> every minute in the background, the last three are kept
+    mlp_set_checkpointing(mlp, "mnist.ckpt", 0, 60, 3);
+
+    printf("Training...\n");
+    DataLoader *loader = loader_create(train_set, config.batch_size, 1, 42);
+    train(mlp, loader, num_epochs);
+    // inference processes can pick this up with mlp_load_mapped, training resumes with mlp_load
+    mlp_save(mlp, "mnist.ckpt");
+    loader_free(loader);
+    dataset_close(train_set);
+
+    Dataset *test_set = dataset_open("mnist_test.bin");
+    if (test_set != NULL) {
+        validate(mlp, test_set, 32);
+        dataset_close(test_set);
     }
-    read_mnist("mnist_test.csv", &input_ptr, &target_ptr, TEST_SAMPLES);
-    validate(mlp, input_ptr, target_ptr, TEST_SAMPLES, 32);
 
     //printf("Final weights and biases:\n");
     //print_mlp(mlp);
 
-    free(input_ptr);
-    free(target_ptr);
     mlp_free(mlp);
 
     return 0;
@@ -0,0 +1,52 @@
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include"matrix.h"
+#include"profile.h"
+
+Matrix allocate_matrix(int m, int n) {
+    Matrix M = { NULL, m, n, n };
+    size_t bytes = (size_t)m * n * sizeof(float);
+    // aligned_alloc requires the size to be a multiple of the alignment
+    bytes = (bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    M.data = aligned_alloc(MATRIX_ALIGNMENT, bytes > 0 ? bytes : MATRIX_ALIGNMENT);
+    PROFILE_ALLOCATION(bytes);
+    if (M.data == NULL) {
+        fprintf(stderr, "Could not allocate %d x %d matrix\n", m, n);
+        exit(1);
+    }
+    return M;
+}
+
+void free_matrix(Matrix M) {
+    free(M.data);
+}
+
+Matrix matrix_view(float *data, int m, int n, int ld) {
+    Matrix M = { data, m, n, ld };
+    return M;
+}
+
+// rows [start, start + count) of M, sharing its storage
+Matrix matrix_row_view(Matrix M, int start, int count) {
+    return matrix_view(matrix_row(M, start), count, M.cols, M.ld);
+}
+
+void matrix_copy(Matrix dst, Matrix src) {
+    if (dst.ld == dst.cols && src.ld == src.cols) {
+        memcpy(dst.data, src.data, (size_t)src.rows * src.cols * sizeof(float));
+        return;
+    }
+    for (int i = 0; i < src.rows; i++) {
+        memcpy(matrix_row(dst, i), matrix_row(src, i), src.cols * sizeof(float));
+    }
+}
+
+void print_matrix(Matrix M) {
+    for (int i = 0; i < M.rows; i++) {
+        for (int j = 0; j < M.cols; j++) {
+            printf("i = %d, j = %d, M[i][j] = %f\n", i, j, MAT(M, i, j));
+        }
+        printf("\n");
+    }
+}
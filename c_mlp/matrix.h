@@ -0,0 +1,35 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+#include<stddef.h>
+
+// every matrix allocation is aligned to a cache line so rows can be loaded with aligned SIMD
+#define MATRIX_ALIGNMENT 64
+
+/*
+    Row-major matrix backed by one contiguous allocation
+    data: pointer to element (0, 0)
+    rows, cols: shape
+    ld: leading dimension, the stride in floats between the start of two consecutive rows (ld >= cols)
+    Views into other matrices share data and must not be freed.
+*/
+typedef struct {
+    float *data;
+    int rows;
+    int cols;
+    int ld;
+} Matrix;
+
+#define MAT(M, i, j) ((M).data[(size_t)(i) * (M).ld + (j)])
+
+static inline float *matrix_row(Matrix M, int i) {
+    return M.data + (size_t)i * M.ld;
+}
+
+Matrix allocate_matrix(int m, int n);
+void free_matrix(Matrix M);
+Matrix matrix_view(float *data, int m, int n, int ld);
+Matrix matrix_row_view(Matrix M, int start, int count);
+void matrix_copy(Matrix dst, Matrix src);
+void print_matrix(Matrix M);
+
+#endif
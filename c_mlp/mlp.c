@@ -7,265 +7,782 @@ from scratch, in C
 #include<stdlib.h>
 #include<string.h>
 #include<time.h>
+#include<sys/mman.h>
 #include"mlp.h"
 #include"activation.h"
 #include"loss.h"
 #include"gemm.h"
+#include"inference.h"
+#include"allreduce.h"
+#include"profile.h"
+#include"evaluate.h"
+#include"checkpoint.h"
 
 
 
+// draws fresh weights and biases from the given seed, the same seed always gives the same model
+void mlp_init_weights(MLP *mlp, unsigned int seed) {
+    srand(seed);
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        for (int j = 0; j < layer->num_neurons; j++) {
+            for (int k = 0; k < layer->prev_num_neurons; k++) {
+                MAT(layer->weights, k, j) = sqrt(2.0 / layer->prev_num_neurons) * (2.0 * rand() / RAND_MAX - 1.0);
+            }
+            layer->biases[j] = (float)rand() / (float)RAND_MAX;
+        }
+    }
+}
+
 MLP *mlp_init(int num_layers, int *num_neurons, void (*activations[])(float*, float*, size_t), void (*activations_prime[])(float*, float*, size_t),
-            float (*loss)(float, float), void (*loss_prime)(float**, float**, float**, int, int), float learning_rate, int input_size) {
-    srand(time(NULL));
+            float (*loss)(float, float), void (*loss_prime)(Matrix, Matrix, Matrix), float learning_rate, int input_size) {
     MLP *mlp = malloc(sizeof(MLP));
     mlp->layers = malloc(num_layers * sizeof(Layer));   
     for (int i = 0; i < num_layers; i++) {
         Layer *layer = malloc(sizeof(Layer));
         layer->num_neurons = num_neurons[i];
         layer->prev_num_neurons = i == 0 ? input_size : num_neurons[i - 1];
-        layer->weights = malloc(layer->num_neurons * sizeof(float *));
+        layer->weights = allocate_matrix(layer->prev_num_neurons, layer->num_neurons);
         layer->biases = malloc(layer->num_neurons * sizeof(float));
         layer->activation = activations[i];
         layer->activation_prime = activations_prime[i];
-        for (int j = 0; j < num_neurons[i]; j++) {
-            layer->weights[j] = malloc(layer->prev_num_neurons * sizeof(float));
-            for (int k = 0; k < layer->prev_num_neurons; k++) {
-                layer->weights[j][k] = sqrt(2.0 / layer->prev_num_neurons) * (2.0 * rand() / RAND_MAX - 1.0);
-            }
-            layer->biases[j] = (float)rand() / (float)RAND_MAX;
-        }
+        layer->optimizer_state = NULL;
+        layer->mask = NULL;
         mlp->layers[i] = layer;
     }
     mlp->num_layers = num_layers;
+    mlp_init_weights(mlp, time(NULL));
     mlp->loss = loss;
     mlp->loss_prime = loss_prime;
-    mlp->learning_rate = learning_rate;
     mlp->input_size = input_size;
+    mlp->epoch = 0;
+    // plain SGD decayed by 0.95 every epoch until mlp_set_optimizer says otherwise
+    mlp->optimizer = optimizer_sgd(learning_rate);
+    mlp->optimizer.schedule = lr_exponential(0.95);
+    mlp->learning_rate = learning_rate;
+    mlp->pool = threadpool_create(default_num_threads());
+    mlp->workspace.max_batch_size = 0;
+    mlp->map = NULL;
+    mlp->map_size = 0;
+    mlp->gradients = NULL;
+    mlp->gradient_size = 0;
+    mlp->gradient_samples = 0;
+    mlp->loss_sum = 0;
+    mlp->accumulation_steps = 1;
+    mlp->replicas = NULL;
+    mlp->num_replicas = 0;
+    mlp->mixed_precision = 0;
+    mlp->evaluation_arena = (Arena){ NULL, 0, 0 };
+    mlp_set_validation(mlp, NULL, 0, 1);
+    mlp->pruning = (PruneSchedule){ 0 };
+    mlp->checkpoints = NULL;
     return mlp;
 }
 
+static void workspace_free(Workspace *workspace) {
+    if (workspace->max_batch_size == 0) {
+        return;
+    }
+    arena_free(&workspace->arena);
+    free(workspace->activations[0]);
+    free(workspace->activations[1]);
+    free(workspace->deltas);
+    free(workspace->activations_bf16[0]);
+    free(workspace->activations_bf16[1]);
+    workspace->max_batch_size = 0;
+}
+
+// replicas share the layers with their model, replica 0 also shares its gradients
+static void replicas_free(MLP *mlp) {
+    for (int i = 0; i < mlp->num_replicas; i++) {
+        MLP *replica = mlp->replicas[i];
+        workspace_free(&replica->workspace);
+        if (i > 0) {
+            free(replica->gradients);
+        }
+        free(replica);
+    }
+    free(mlp->replicas);
+    mlp->replicas = NULL;
+    mlp->num_replicas = 0;
+}
+
 void mlp_free(MLP *mlp) {
+    checkpoint_writer_free(mlp->checkpoints);
     for (int i = 0; i < mlp->num_layers; i++) {
         Layer *layer = mlp->layers[i];
-        free_matrix(layer->weights, layer->num_neurons);
-        free(layer->biases);
+        if (mlp->map == NULL) {
+            free_matrix(layer->weights);
+            free(layer->biases);
+        }
+        free(layer->mask);
         free(layer);
     }
     free(mlp->layers);
+    if (mlp->map != NULL) {
+        munmap(mlp->map, mlp->map_size);
+    }
+    free(mlp->optimizer.state);
+    threadpool_free(mlp->pool);
+    workspace_free(&mlp->workspace);
+    replicas_free(mlp);
+    free(mlp->gradients);
+    arena_free(&mlp->evaluation_arena);
     free(mlp);
 }
 
-float ****batch_forward(MLP *mlp, float **inputs, int batch_size) {
-    float ****activations = malloc(2 * sizeof(float ***));
-    activations[0] = malloc((mlp->num_layers + 1) * sizeof(float **));
-    activations[1] = malloc((mlp->num_layers + 1) * sizeof(float **));
+// replaces the worker pool, num_threads counts the calling thread
+void mlp_set_num_threads(MLP *mlp, int num_threads) {
+    threadpool_free(mlp->pool);
+    mlp->pool = threadpool_create(num_threads);
+}
+
+/*
+    Floats in one optimizer state slot of the layer: a copy of the weights followed by one of the biases,
+    each padded to MATRIX_ALIGNMENT like they are in a checkpoint
+*/
+size_t layer_slot_floats(Layer *layer) {
+    return (arena_matrix_bytes(layer->prev_num_neurons, layer->num_neurons) + arena_matrix_bytes(1, layer->num_neurons)) / sizeof(float);
+}
+
+/*
+    Replaces the optimizer and allocates its state, zeroed
+    The state is one block holding, for each layer in turn, the optimizer's slots one after the other.
+    The learning rate is set for the current epoch from the optimizer's schedule.
+*/
+void mlp_set_optimizer(MLP *mlp, Optimizer optimizer) {
+    free(mlp->optimizer.state);
+    optimizer.state_size = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        optimizer.state_size += optimizer.num_slots * layer_slot_floats(mlp->layers[i]);
+    }
+    optimizer.state = NULL;
+    if (optimizer.state_size > 0) {
+        optimizer.state = aligned_alloc(MATRIX_ALIGNMENT, optimizer.state_size * sizeof(float));
+        PROFILE_ALLOCATION(optimizer.state_size * sizeof(float));
+        if (optimizer.state == NULL) {
+            fprintf(stderr, "Could not allocate optimizer state\n");
+            exit(1);
+        }
+        memset(optimizer.state, 0, optimizer.state_size * sizeof(float));
+    }
+    float *state = optimizer.state;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        mlp->layers[i]->optimizer_state = state;
+        if (state != NULL) {
+            state += optimizer.num_slots * layer_slot_floats(mlp->layers[i]);
+        }
+    }
+    mlp->optimizer = optimizer;
+    mlp->learning_rate = lr_schedule_rate(optimizer.schedule, optimizer.learning_rate, mlp->epoch);
+}
+
+// allocates the gradient block the first time gradients are computed, it does not depend on the batch size
+static void reserve_gradients(MLP *mlp) {
+    if (mlp->gradients != NULL) {
+        return;
+    }
+    mlp->gradient_size = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        mlp->gradient_size += layer_slot_floats(mlp->layers[i]);
+    }
+    mlp->gradients = aligned_alloc(MATRIX_ALIGNMENT, mlp->gradient_size * sizeof(float));
+    PROFILE_ALLOCATION(mlp->gradient_size * sizeof(float));
+    if (mlp->gradients == NULL) {
+        fprintf(stderr, "Could not allocate gradients\n");
+        exit(1);
+    }
+    mlp->gradient_samples = 0;
+}
+
+/*
+    Splits every batch over num_workers threads, each running the forward and backward pass of its
+    shard on a replica of the model with its own workspace and gradients
+    The replicas' gradients are summed with a ring all-reduce before each optimizer step. The pool is
+    replaced by one with num_workers threads, the GEMMs inside a replica run on its worker's thread.
+    num_workers <= 1 turns data parallelism off and keeps the current pool.
+*/
+void mlp_set_data_parallel(MLP *mlp, int num_workers) {
+    replicas_free(mlp);
+    if (num_workers <= 1) {
+        return;
+    }
+    mlp_set_num_threads(mlp, num_workers);
+    reserve_gradients(mlp);
+    mlp->replicas = malloc(num_workers * sizeof(MLP *));
+    for (int i = 0; i < num_workers; i++) {
+        MLP *replica = malloc(sizeof(MLP));
+        *replica = *mlp;
+        replica->pool = NULL;
+        replica->workspace.max_batch_size = 0;
+        replica->replicas = NULL;
+        replica->num_replicas = 0;
+        replica->loss_sum = 0;
+        replica->evaluation_arena = (Arena){ NULL, 0, 0 };
+        replica->checkpoints = NULL;
+        // replica 0 sums straight into the model's gradients, which is where the all-reduce leaves the total
+        if (i > 0) {
+            replica->gradients = aligned_alloc(MATRIX_ALIGNMENT, mlp->gradient_size * sizeof(float));
+            PROFILE_ALLOCATION(mlp->gradient_size * sizeof(float));
+            if (replica->gradients == NULL) {
+                fprintf(stderr, "Could not allocate gradients\n");
+                exit(1);
+            }
+        }
+        mlp->replicas[i] = replica;
+    }
+    mlp->num_replicas = num_workers;
+    if (mlp->workspace.max_batch_size > 0) {
+        mlp_reserve_workspace(mlp, mlp->workspace.max_batch_size);
+    }
+}
+
+/*
+    Chooses what train validates on after its epochs
+    Parameters:
+    dataset: held-out set, or NULL for the training set itself
+    num_samples: how many samples from the start of it to score, 0 for all of them
+    every_epochs: validate after every every_epochs-th epoch and after the last one, 0 never validates
+*/
+void mlp_set_validation(MLP *mlp, Dataset *dataset, int num_samples, int every_epochs) {
+    mlp->validation_set = dataset;
+    mlp->validation_samples = num_samples;
+    mlp->validation_every = every_epochs;
+}
+
+/*
+    Turns mixed-precision training on or off
+    With it on, batch_forward keeps the pre-activations and outputs of the hidden layers in bf16, which
+    halves the memory of the activation caches and the bandwidth the backward pass spends reading them.
+    The weights, deltas, gradients and optimizer state stay float32, every GEMM accumulates in float32
+    (bf16 operands are widened while they are packed) and the output layer stays float32 for the loss.
+    bf16 has the exponent range of float32, so gradients need no loss scaling.
+*/
+void mlp_set_mixed_precision(MLP *mlp, int enabled) {
+    int max_batch_size = mlp->workspace.max_batch_size;
+    mlp->mixed_precision = enabled;
+    workspace_free(&mlp->workspace);
+    for (int i = 0; i < mlp->num_replicas; i++) {
+        mlp->replicas[i]->mixed_precision = enabled;
+        workspace_free(&mlp->replicas[i]->workspace);
+    }
+    if (max_batch_size > 0) {
+        mlp_reserve_workspace(mlp, max_batch_size);
+    }
+}
+
+static size_t bf16_matrix_bytes(int m, int n) {
+    size_t bytes = (size_t)m * n * sizeof(bf16);
+    return (bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+static MatrixBF16 arena_bf16_matrix(Arena *arena, int m, int n) {
+    MatrixBF16 M = { arena_alloc(arena, (size_t)m * n * sizeof(bf16)), m, n, n };
+    return M;
+}
+
+// bytes of the workspace arena of the model itself for batches of up to max_batch_size samples, replicas not included
+size_t mlp_workspace_bytes(const MLP *mlp, int max_batch_size) {
+    // in mixed precision the hidden layers' caches are bf16 and only the output layer's are float32
+    size_t bytes = 0;
+    int max_width = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        int hidden_bf16 = mlp->mixed_precision && i < mlp->num_layers - 1;
+        if (hidden_bf16) {
+            bytes += 2 * bf16_matrix_bytes(max_batch_size, layer->num_neurons);
+        } else {
+            bytes += 2 * arena_matrix_bytes(max_batch_size, layer->num_neurons);
+        }
+        bytes += arena_matrix_bytes(max_batch_size, layer->num_neurons);
+        max_width = layer->num_neurons > max_width ? layer->num_neurons : max_width;
+    }
+    if (mlp->mixed_precision) {
+        bytes += arena_matrix_bytes(1, max_width);
+    }
+    return bytes;
+}
+
+// sizes the workspace for batches of up to max_batch_size samples, only allocates when it has to grow
+void mlp_reserve_workspace(MLP *mlp, int max_batch_size) {
+    // every replica gets a shard of at most max_batch_size / num_replicas samples, rounded up
+    for (int i = 0; i < mlp->num_replicas; i++) {
+        mlp_reserve_workspace(mlp->replicas[i], (max_batch_size + mlp->num_replicas - 1) / mlp->num_replicas);
+    }
+    Workspace *workspace = &mlp->workspace;
+    if (max_batch_size <= workspace->max_batch_size) {
+        return;
+    }
+    workspace_free(workspace);
+
+    int max_width = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        max_width = mlp->layers[i]->num_neurons > max_width ? mlp->layers[i]->num_neurons : max_width;
+    }
+    arena_init(&workspace->arena, mlp_workspace_bytes(mlp, max_batch_size));
+    workspace->max_batch_size = max_batch_size;
+    workspace->activations[0] = calloc(mlp->num_layers + 1, sizeof(Matrix));
+    workspace->activations[1] = calloc(mlp->num_layers + 1, sizeof(Matrix));
+    workspace->activations_bf16[0] = calloc(mlp->num_layers + 1, sizeof(MatrixBF16));
+    workspace->activations_bf16[1] = calloc(mlp->num_layers + 1, sizeof(MatrixBF16));
+    workspace->deltas = malloc(mlp->num_layers * sizeof(Matrix));
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        if (mlp->mixed_precision && i < mlp->num_layers - 1) {
+            workspace->activations_bf16[0][i+1] = arena_bf16_matrix(&workspace->arena, max_batch_size, layer->num_neurons);
+            workspace->activations_bf16[1][i+1] = arena_bf16_matrix(&workspace->arena, max_batch_size, layer->num_neurons);
+        } else {
+            workspace->activations[0][i+1] = arena_matrix(&workspace->arena, max_batch_size, layer->num_neurons);
+            workspace->activations[1][i+1] = arena_matrix(&workspace->arena, max_batch_size, layer->num_neurons);
+        }
+        workspace->deltas[i] = arena_matrix(&workspace->arena, max_batch_size, layer->num_neurons);
+    }
+    workspace->row_buffer = NULL;
+    if (mlp->mixed_precision) {
+        workspace->row_buffer = arena_alloc(&workspace->arena, max_width * sizeof(float));
+    }
+}
+
+#ifdef MLP_PROFILE
+// FLOPs of a layer's forward or weight gradient GEMM, or of the sparse product that replaces it in the first layer
+static double layer_flops(Layer *layer, int batch_size, const SparseMatrix *sparse_inputs) {
+    return sparse_inputs != NULL ? 2.0 * sparse_nnz(*sparse_inputs) * layer->num_neurons
+                                 : GEMM_FLOPS(batch_size, layer->num_neurons, layer->prev_num_neurons);
+}
+#endif
+
+/*
+    Training with a softmax output layer and cross-entropy loss uses the fused head of
+    softmax_cross_entropy: the forward pass stops at the logits and the loss and output deltas come
+    from them in one pass.
+*/
+static int fused_output_head(const MLP *mlp) {
+    return mlp->layers[mlp->num_layers - 1]->activation == softmax && mlp->loss == cross_entropy;
+}
 
-    activations[0][0] = allocate_matrix(batch_size, mlp->input_size);
-    activations[1][0] = allocate_matrix(batch_size, mlp->input_size);
-    for (int i = 0; i < batch_size; i++) {
-        for (int j = 0; j < mlp->input_size; j++) {
-            activations[1][0][i][j] = inputs[i][j];
+// hidden layers accumulate into their float32 deltas and their epilogue stores the bf16 caches
+static Matrix **mixed_precision_forward(MLP *mlp, Matrix inputs, const SparseMatrix *sparse_inputs, int output_logits) {
+    int batch_size = inputs.rows;
+    Workspace *ws = &mlp->workspace;
+    int last = mlp->num_layers - 1;
+    ws->activations[1][last+1].rows = batch_size;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        GemmEpilogue epilogue = { layer->biases, { NULL }, layer->activation, activation_is_rowwise(layer->activation) };
+        if (i == last && output_logits) {
+            epilogue.activation = NULL;
         }
+        Matrix C = ws->activations[1][last+1];
+        if (i == last) {
+            // float32 like the outputs, for losses whose gradient goes back through the output activation
+            epilogue.pre = ws->activations[0][last+1];
+            epilogue.pre.rows = batch_size;
+        } else {
+            C = ws->deltas[i];
+            C.rows = batch_size;
+            epilogue.pre_bf16 = ws->activations_bf16[0][i+1];
+            epilogue.out_bf16 = ws->activations_bf16[1][i+1];
+            epilogue.pre_bf16.rows = epilogue.out_bf16.rows = batch_size;
+        }
+        PROFILE_START(start);
+        if (i == 0 && sparse_inputs != NULL) {
+            spmm_fused(mlp->pool, *sparse_inputs, layer->weights, 0.0f, C, &epilogue);
+        } else if (i == 0) {
+            sgemm_fused(mlp->pool, GEMM_N, GEMM_N, 1.0f, inputs, layer->weights, 0.0f, C, &epilogue);
+        } else {
+            MatrixBF16 A = ws->activations_bf16[1][i];
+            A.rows = batch_size;
+            sgemm_fused_bf16(mlp->pool, GEMM_N, GEMM_N, 1.0f, A, layer->weights, 0.0f, C, &epilogue);
+        }
+        PROFILE_RECORD(PROFILE_FORWARD_GEMM, i, start, layer_flops(layer, batch_size, i == 0 ? sparse_inputs : NULL),
+                       GEMM_BYTES(batch_size, layer->num_neurons, layer->prev_num_neurons, 0));
     }
+    return ws->activations;
+}
+
+// output_logits leaves the output layer's activation out, its outputs are then the logits
+static Matrix **forward(MLP *mlp, Matrix inputs, const SparseMatrix *sparse_inputs, int output_logits) {
+    int batch_size = inputs.rows;
+    mlp_reserve_workspace(mlp, batch_size);
+    Matrix **activations = mlp->workspace.activations;
 
+    activations[0][0] = inputs;
+    activations[1][0] = inputs;
+    mlp->workspace.sparse_inputs = sparse_inputs != NULL ? *sparse_inputs : (SparseMatrix){ NULL };
+    if (mlp->mixed_precision) {
+        return mixed_precision_forward(mlp, inputs, sparse_inputs, output_logits);
+    }
     for (int i = 0; i < mlp->num_layers; i++) {
         Layer *layer = mlp->layers[i];
-        activations[0][i+1] = allocate_matrix(batch_size, layer->num_neurons);
-        activations[1][i+1] = allocate_matrix(batch_size, layer->num_neurons);
+        activations[0][i+1].rows = batch_size;
+        activations[1][i+1].rows = batch_size;
 
-        float **pre_activation = gemm_add(activations[1][i], layer->weights, batch_size, layer->prev_num_neurons, layer->num_neurons, layer->biases);
-        for (int b = 0; b < batch_size; b++) {
-            memcpy(activations[0][i+1][b], pre_activation[b], layer->num_neurons * sizeof(float));
+        // one pass: bias, pre-activation store and activation all happen in the GEMM epilogue
+        GemmEpilogue epilogue = { layer->biases, activations[0][i+1], layer->activation, activation_is_rowwise(layer->activation) };
+        if (i == mlp->num_layers - 1 && output_logits) {
+            epilogue.activation = NULL;
         }
-        matrix_activation(pre_activation, batch_size, layer->num_neurons, layer->activation);
-        for (int b = 0; b < batch_size; b++) {
-            memcpy(activations[1][i+1][b], pre_activation[b], layer->num_neurons * sizeof(float));
+        PROFILE_START(start);
+        if (i == 0 && sparse_inputs != NULL) {
+            spmm_fused(mlp->pool, *sparse_inputs, layer->weights, 0.0f, activations[1][1], &epilogue);
+        } else {
+            sgemm_fused(mlp->pool, GEMM_N, GEMM_N, 1.0f, activations[1][i], layer->weights, 0.0f, activations[1][i+1], &epilogue);
         }
-        free_matrix(pre_activation, batch_size);
+        PROFILE_RECORD(PROFILE_FORWARD_GEMM, i, start, layer_flops(layer, batch_size, i == 0 ? sparse_inputs : NULL),
+                       GEMM_BYTES(batch_size, layer->num_neurons, layer->prev_num_neurons, 0));
     }
 
     return activations;
 }
 
+/*
+    Runs the batch through the network using the model's workspace, no memory is allocated
+    once the workspace is large enough for the batch.
+    Returns activations, where activations[0][i] holds the pre-activations and activations[1][i] the
+    outputs of layer i-1, and index 0 is the input itself. The matrices are only valid until the next
+    call that uses the workspace.
+    In mixed precision only the input and the output layer's pre-activations and outputs are float32;
+    the hidden layers' caches are in workspace.activations_bf16 instead.
+*/
+Matrix **batch_forward(MLP *mlp, Matrix inputs) {
+    return forward(mlp, inputs, NULL, 0);
+}
 
-void calculate_gradient_and_update(MLP *mlp, float **deltas, float **prev_activations, int batch_size, int layer_idx) {
-    int num_neurons = mlp->layers[layer_idx]->num_neurons;
-    int prev_num_neurons = mlp->layers[layer_idx]->prev_num_neurons;
 
-    float **prev_activations_T = transpose(prev_activations, batch_size, prev_num_neurons);
-    float **grad_weights = gemm(prev_activations_T, deltas, prev_num_neurons, num_neurons, batch_size);
+// the layer's part of the gradient block: weight gradients, then bias gradients, like an optimizer state slot
+static float *layer_gradients(MLP *mlp, int layer_idx) {
+    float *gradients = mlp->gradients;
+    for (int i = 0; i < layer_idx; i++) {
+        gradients += layer_slot_floats(mlp->layers[i]);
+    }
+    return gradients;
+}
 
-    float *grad_biases = malloc(num_neurons * sizeof(float));
-    for (int i = 0; i < num_neurons; i++) {
-        grad_biases[i] = 0;
-        for (int j = 0; j < batch_size; j++) {
-            grad_biases[i] += deltas[j][i];
-        }
+// sums the gradients of one layer over the batch, into the gradient block or on top of what is there
+void calculate_gradient(MLP *mlp, Matrix deltas, int layer_idx, int accumulate) {
+    Layer *layer = mlp->layers[layer_idx];
+    int batch_size = deltas.rows;
+    float *gradients = layer_gradients(mlp, layer_idx);
+
+    // grad_weights = prev_activations^T @ deltas, the transpose is folded into the GEMM packing.
+    // It has the same contiguous prev_num_neurons x num_neurons layout as the weights.
+    Matrix grad_weights = matrix_view(gradients, layer->prev_num_neurons, layer->num_neurons, layer->num_neurons);
+    float beta = accumulate ? 1.0f : 0.0f;
+    const SparseMatrix *sparse_inputs = layer_idx == 0 && mlp->workspace.sparse_inputs.values != NULL ? &mlp->workspace.sparse_inputs : NULL;
+    PROFILE_START(start);
+    if (sparse_inputs != NULL) {
+        spmm_tn(mlp->pool, *sparse_inputs, deltas, beta, grad_weights);
+    } else if (mlp->mixed_precision && layer_idx > 0) {
+        MatrixBF16 prev_activations = mlp->workspace.activations_bf16[1][layer_idx];
+        prev_activations.rows = batch_size;
+        sgemm_fused_bf16(mlp->pool, GEMM_T, GEMM_N, 1.0f, prev_activations, deltas, beta, grad_weights, NULL);
+    } else {
+        Matrix prev_activations = mlp->workspace.activations[1][layer_idx];
+        prev_activations.rows = batch_size;
+        sgemm_parallel(mlp->pool, GEMM_T, GEMM_N, 1.0f, prev_activations, deltas, beta, grad_weights);
     }
 
-    for (int i = 0; i < num_neurons; i++) {
-        for (int j = 0; j < prev_num_neurons; j++) {
-            mlp->layers[layer_idx]->weights[i][j] -= mlp->learning_rate * grad_weights[j][i] / (float)batch_size;
+    // grad_biases is the column sum of the deltas, summed row by row to stay contiguous
+    float *grad_biases = gradients + arena_matrix_bytes(layer->prev_num_neurons, layer->num_neurons) / sizeof(float);
+    if (!accumulate) {
+        memset(grad_biases, 0, layer->num_neurons * sizeof(float));
+    }
+    for (int j = 0; j < batch_size; j++) {
+        float *row = matrix_row(deltas, j);
+        for (int i = 0; i < layer->num_neurons; i++) {
+            grad_biases[i] += row[i];
         }
-        mlp->layers[layer_idx]->biases[i] -= mlp->learning_rate * grad_biases[i] / (float)batch_size;
     }
-
-    free_matrix(grad_weights, num_neurons);
-    free(grad_biases);
+    PROFILE_RECORD(PROFILE_BACKWARD_GEMM, layer_idx, start, layer_flops(layer, batch_size, sparse_inputs),
+                   GEMM_BYTES(layer->prev_num_neurons, layer->num_neurons, batch_size, accumulate));
 }
 
-void batch_backward(MLP *mlp, float **inputs, float **targets, int batch_size) {
-    float ****activations = batch_forward(mlp, inputs, batch_size);
-    float **deltas = NULL;
+static void backward_pass(MLP *mlp, Matrix inputs, const SparseMatrix *sparse_inputs, Matrix targets, int accumulate) {
+    int batch_size = inputs.rows;
+    if (batch_size == 0) {
+        // a replica whose shard of a short last batch came out empty
+        if (!accumulate) {
+            memset(mlp->gradients, 0, mlp->gradient_size * sizeof(float));
+        }
+        return;
+    }
+    int fused = fused_output_head(mlp);
+    Matrix **activations = forward(mlp, inputs, sparse_inputs, fused);
 
     for (int layer_idx = mlp->num_layers - 1; layer_idx >= 0; layer_idx--) {
         Layer *layer = mlp->layers[layer_idx];
+        Matrix deltas = mlp->workspace.deltas[layer_idx];
+        deltas.rows = batch_size;
 
         if (layer_idx == mlp->num_layers - 1) {
-            deltas = allocate_matrix(batch_size, layer->num_neurons);
-            mlp->loss_prime(activations[1][mlp->num_layers], targets, deltas, batch_size, layer->num_neurons);
+            PROFILE_START(start);
+            if (fused) {
+                mlp->loss_sum += softmax_cross_entropy(activations[1][mlp->num_layers], targets, deltas);
+            } else {
+                mlp->loss_prime(activations[1][mlp->num_layers], targets, deltas);
+            }
+            // mse_loss_prime leaves the gradient at the outputs, take it through the output activation
+            if (mlp->loss_prime == mse_loss_prime) {
+                for (int i = 0; i < batch_size; i++) {
+                    activation_backward(layer->activation_prime, matrix_row(activations[0][mlp->num_layers], i),
+                                        matrix_row(deltas, i), layer->num_neurons);
+                }
+            }
+            PROFILE_RECORD(PROFILE_LOSS, layer_idx, start, 0, 12.0 * batch_size * layer->num_neurons);
         } else {
-            float **weights_T = transpose(layer->weights, layer->num_neurons, layer->prev_num_neurons);
-            float **propagated_deltas = gemm(deltas, weights_T, batch_size, layer->prev_num_neurons, layer->num_neurons);
+            // propagate the deltas of the layer above back through its weights, then through this
+            // layer's activation at its own cached pre-activations
+            Layer *next = mlp->layers[layer_idx+1];
+            Matrix next_deltas = mlp->workspace.deltas[layer_idx+1];
+            next_deltas.rows = batch_size;
+            PROFILE_START(start);
+            sgemm_parallel(mlp->pool, GEMM_N, GEMM_T, 1.0f, next_deltas, next->weights, 0.0f, deltas);
+            PROFILE_RECORD(PROFILE_BACKWARD_GEMM, layer_idx + 1, start, GEMM_FLOPS(batch_size, layer->num_neurons, next->num_neurons),
+                           GEMM_BYTES(batch_size, layer->num_neurons, next->num_neurons, 0));
+            PROFILE_START(activation_start);
             for (int i = 0; i < batch_size; i++) {
-                layer->activation_prime(activations[0][layer_idx+1][i], propagated_deltas[i], layer->prev_num_neurons);
+                float *pre = mlp->mixed_precision ? mlp->workspace.row_buffer : matrix_row(activations[0][layer_idx+1], i);
+                if (mlp->mixed_precision) {
+                    bf16_to_floats(matrix_bf16_row(mlp->workspace.activations_bf16[0][layer_idx+1], i), pre, layer->num_neurons);
+                }
+                activation_backward(layer->activation_prime, pre, matrix_row(deltas, i), layer->num_neurons);
             }
-
-            free_matrix(deltas, batch_size);
-            free_matrix(weights_T, layer->prev_num_neurons);
-            deltas = propagated_deltas;
+            PROFILE_RECORD(PROFILE_ACTIVATION, layer_idx, activation_start, 0, 8.0 * batch_size * layer->num_neurons);
         }
 
-        calculate_gradient_and_update(mlp, deltas, activations[1][layer_idx], batch_size, layer_idx);
+        calculate_gradient(mlp, deltas, layer_idx, accumulate);
     }
+}
+
+typedef struct {
+    MLP *mlp;
+    Matrix inputs, targets;
+    const SparseMatrix *sparse_inputs;
+    int accumulate;
+} ShardArgs;
 
-    for (int i = 0; i <= mlp->num_layers; i++) {
-        free_matrix(activations[0][i], batch_size);
-        free_matrix(activations[1][i], batch_size);
+// replica r takes rows [rows * r / num_replicas, rows * (r + 1) / num_replicas) of the batch
+static void shard_backward(void *arg, int begin, int end) {
+    ShardArgs *args = arg;
+    int rows = args->inputs.rows, num_replicas = args->mlp->num_replicas;
+    for (int r = begin; r < end; r++) {
+        int start = (int)((long)rows * r / num_replicas);
+        int count = (int)((long)rows * (r + 1) / num_replicas) - start;
+        SparseMatrix sparse_shard = args->sparse_inputs != NULL ? sparse_row_view(*args->sparse_inputs, start, count) : (SparseMatrix){ NULL };
+        backward_pass(args->mlp->replicas[r], matrix_row_view(args->inputs, start, count),
+                      args->sparse_inputs != NULL ? &sparse_shard : NULL, matrix_row_view(args->targets, start, count), args->accumulate);
     }
-    free(activations[0]);
-    free(activations[1]);
-    free(activations);
-    free_matrix(deltas, batch_size);
 }
 
+/*
+    Forward and backward pass over the batch, summing its gradients into mlp->gradients
+    The first call after mlp_apply_gradients starts a new sum, later calls add micro-batches to it.
+    With data parallelism each replica sums the gradients of its shard, they are combined when the
+    gradients are applied. The weights are not touched. A mapped model (mlp_load_mapped) is refused.
+*/
+void mlp_compute_gradients(MLP *mlp, Matrix inputs, Matrix targets) {
+    mlp_compute_gradients_sparse(mlp, inputs, NULL, targets);
+}
 
-void train(MLP *mlp, float **inputs, float **targets, int num_epochs, int num_samples, int batch_size) {
-    int num_batches = num_samples / batch_size;
-    int output_size = mlp->layers[mlp->num_layers-1]->num_neurons;
-    for (int epoch = 0; epoch < num_epochs; epoch++) {
-        printf("\nEpoch %d\n", epoch+1);
-        for (int i = 0; i < num_batches; i++) {
-            print_progress(i, num_batches);
-            float **batch_inputs = malloc(batch_size * sizeof(float *));
-            float **batch_targets = malloc(batch_size * sizeof(float *));
-            for (int j = 0; j < batch_size; j++) {
-                batch_inputs[j] = malloc(mlp->input_size * sizeof(float));
-                batch_targets[j] = malloc(output_size * sizeof(float));
-                for (int k = 0; k < mlp->input_size; k++) {
-                    batch_inputs[j][k] = inputs[i * batch_size + j][k];
-                }
-                for (int k = 0; k < output_size; k++) {
-                    batch_targets[j][k] = targets[i * batch_size + j][k];
-                }
-            }
-            batch_backward(mlp, batch_inputs, batch_targets, batch_size); 
-            //check_nan(mlp);
-            free_matrix(batch_inputs, batch_size);
-            free_matrix(batch_targets, batch_size);
-        }
-        print_progress(num_batches, num_batches);
-        mlp->learning_rate *= 0.95;
-        printf("\n");
-        validate(mlp, inputs, targets, num_samples, batch_size);
+/*
+    mlp_compute_gradients with the CSR form of the inputs, such as loader_sparse_inputs gives
+    The first layer's forward product and weight gradient then only touch the non-zero inputs, the
+    result is the same up to rounding. sparse_inputs NULL is the dense path.
+*/
+void mlp_compute_gradients_sparse(MLP *mlp, Matrix inputs, const SparseMatrix *sparse_inputs, Matrix targets) {
+    if (mlp->map != NULL) {
+        fprintf(stderr, "A mapped model can not be trained\n");
+        return;
+    }
+    reserve_gradients(mlp);
+    int accumulate = mlp->gradient_samples > 0;
+    if (mlp->num_replicas > 0) {
+        mlp_reserve_workspace(mlp, inputs.rows);
+        ShardArgs args = { mlp, inputs, targets, sparse_inputs, accumulate };
+        threadpool_parallel_for(mlp->pool, mlp->num_replicas, shard_backward, &args);
+    } else {
+        backward_pass(mlp, inputs, sparse_inputs, targets, accumulate);
     }
+    mlp->gradient_samples += inputs.rows;
 }
 
-void mnist_predict(MLP *mlp, float *input, int target) {
-    float **inputs = malloc(sizeof(float *));
-    inputs[0] = input;
-    float ****activations = batch_forward(mlp, inputs, 1);
-    float **outputs = activations[1][mlp->num_layers];
-    float max_val = outputs[0][0];
-    int max_idx = 0;
-    for (int i = 1; i < mlp->layers[mlp->num_layers-1]->num_neurons; i++) {
-        if (outputs[0][i] > max_val) {
-            max_val = outputs[0][i];
-            max_idx = i;
-        }
+// pruned weights stay at zero whatever the optimizer did to them
+static void apply_mask(Layer *layer) {
+    float *weights = layer->weights.data;
+    size_t n = (size_t)layer->prev_num_neurons * layer->num_neurons;
+    for (size_t i = 0; i < n; i++) {
+        weights[i] = layer->mask[i] ? weights[i] : 0.0f;
     }
-    // print the softmax output
-    for (int i = 0; i < mlp->layers[mlp->num_layers-1]->num_neurons; i++) {
-        printf("%f ", outputs[0][i]);
-    }
-    printf("Predicted: %d, Actual: %d\n", max_idx, target);
-    for (int i = 0; i <= mlp->num_layers; i++) {
-        free_matrix(activations[0][i], 1);
-        free_matrix(activations[1][i], 1);
-    }
-    free(activations[0]);
-    free(activations[1]);
-    free(activations);
-    free(inputs);
-}
-
-void validate(MLP *mlp, float **inputs, float **targets, int num_samples, int batch_size) {
-    float loss = 0;
-    int correct = 0;
-    int num_batches = num_samples / batch_size;
-    int output_size = mlp->layers[mlp->num_layers-1]->num_neurons;
-    for (int i = 0; i < num_batches; i++) {
-        float **batch_inputs = malloc(batch_size * sizeof(float *));
-        float **batch_targets = malloc(batch_size * sizeof(float *));
-        for (int j = 0; j < batch_size; j++) {
-            batch_inputs[j] = malloc(mlp->input_size * sizeof(float));
-            batch_targets[j] = malloc(output_size * sizeof(float));
-            for (int k = 0; k < mlp->input_size; k++) {
-                batch_inputs[j][k] = inputs[i * batch_size + j][k];
-            }
-            for (int k = 0; k < output_size; k++) {
-                batch_targets[j][k] = targets[i * batch_size + j][k];
-            }
+}
+
+/*
+    One optimizer step with the mean of the gradients summed since the last step, does nothing if
+    there are none
+    The weights of pruned layers are masked after the step. A mapped model is refused, its weights
+    are read-only.
+*/
+void mlp_apply_gradients(MLP *mlp) {
+    if (mlp->map != NULL) {
+        fprintf(stderr, "A mapped model can not be trained\n");
+        return;
+    }
+    if (mlp->gradient_samples == 0) {
+        return;
+    }
+    if (mlp->num_replicas > 0) {
+        float *buffers[mlp->num_replicas];
+        for (int i = 0; i < mlp->num_replicas; i++) {
+            buffers[i] = mlp->replicas[i]->gradients;
         }
+        PROFILE_START(start);
+        ring_allreduce(mlp->pool, buffers, mlp->num_replicas, mlp->gradient_size);
+        PROFILE_RECORD(PROFILE_ALLREDUCE, PROFILE_NO_LAYER, start, (double)(mlp->num_replicas - 1) * mlp->gradient_size,
+                       8.0 * mlp->num_replicas * mlp->gradient_size);
+    }
+    mlp->optimizer.step++;
 
-        float ****activations = batch_forward(mlp, batch_inputs, batch_size);
-        float **outputs = activations[1][mlp->num_layers];
-        for (int j = 0; j < batch_size; j++) {
-            for (int k = 0; k < output_size; k++) {
-                loss += mlp->loss(outputs[j][k], batch_targets[j][k]);
-            }
+    // the optimizer takes the mean by scaling with 1 / samples, each tensor is updated in one flat pass
+    float grad_scale = 1.0f / mlp->gradient_samples;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        size_t weights_floats = arena_matrix_bytes(layer->prev_num_neurons, layer->num_neurons) / sizeof(float);
+        float *gradients = layer_gradients(mlp, i);
+        float *state = layer->optimizer_state;
+        PROFILE_START(start);
+        optimizer_update(&mlp->optimizer, mlp->learning_rate, grad_scale, 1, (size_t)layer->prev_num_neurons * layer->num_neurons,
+                         layer->weights.data, gradients, state, layer_slot_floats(layer));
+        if (layer->mask != NULL) {
+            apply_mask(layer);
         }
-        for (int j = 0; j < batch_size; j++) {
-            float max_val = outputs[j][0];
-            int max_idx = 0;
-            for (int k = 1; k < output_size; k++) {
-                if (outputs[j][k] > max_val) {
-                    max_val = outputs[j][k];
-                    max_idx = k;
-                }
+        optimizer_update(&mlp->optimizer, mlp->learning_rate, grad_scale, 0, layer->num_neurons,
+                         layer->biases, gradients + weights_floats, state != NULL ? state + weights_floats : NULL, layer_slot_floats(layer));
+        // weights and gradients are read, weights written, every state slot read and written
+        PROFILE_RECORD(PROFILE_UPDATE, i, start, 0, 4.0 * layer_slot_floats(layer) * (3 + 2 * mlp->optimizer.num_slots));
+    }
+    mlp->gradient_samples = 0;
+}
+
+/*
+    Mean training loss of the samples since the last call, as the fused output head computed it while
+    taking the gradients, and starts a new sum
+    Returns NAN for models without the fused head (see fused_output_head) or when no samples were seen.
+*/
+double mlp_take_training_loss(MLP *mlp, long num_samples) {
+    double loss = mlp->loss_sum;
+    mlp->loss_sum = 0;
+    for (int i = 0; i < mlp->num_replicas; i++) {
+        loss += mlp->replicas[i]->loss_sum;
+        mlp->replicas[i]->loss_sum = 0;
+    }
+    return fused_output_head(mlp) && num_samples > 0 ? loss / num_samples : NAN;
+}
+
+// one optimizer step on the batch
+void batch_backward(MLP *mlp, Matrix inputs, Matrix targets) {
+    mlp_compute_gradients(mlp, inputs, targets);
+    mlp_apply_gradients(mlp);
+}
+
+
+/*
+    The loader decides batch size, order and prefetching, the last batch of an epoch may be smaller
+    Continues from mlp->epoch, so a model loaded from a checkpoint resumes with the shuffle order of
+    the epoch it stopped at.
+    The gradients of mlp->accumulation_steps batches are summed before each optimizer step, so the
+    effective batch size is that many loader batches; a short group at the end of an epoch is applied
+    as it is.
+    With a pruning schedule (mlp_set_pruning) the weights are pruned further at the start of each
+    epoch of the schedule. With checkpointing (mlp_set_checkpointing) a snapshot is staged after any
+    optimizer step that completes an interval, and written while the next steps run.
+    A mapped model (mlp_load_mapped) can not be trained, train prints an error and returns.
+*/
+void train(MLP *mlp, DataLoader *loader, int num_epochs) {
+    if (mlp->map != NULL) {
+        fprintf(stderr, "A mapped model can not be trained\n");
+        return;
+    }
+    int num_batches = loader->num_batches;
+    int accumulation_steps = mlp->accumulation_steps < 1 ? 1 : mlp->accumulation_steps;
+    mlp_reserve_workspace(mlp, loader->batch_size);
+    for (int epoch = 0; epoch < num_epochs; epoch++, mlp->epoch++) {
+        printf("\nEpoch %d\n", mlp->epoch+1);
+        loader_start_epoch(loader, mlp->epoch);
+        mlp_update_pruning(mlp);
+        mlp->learning_rate = lr_schedule_rate(mlp->optimizer.schedule, mlp->optimizer.learning_rate, mlp->epoch);
+        PROFILE_EPOCH_BEGIN();
+        Matrix batch_inputs, batch_targets;
+        long epoch_samples = 0;
+        mlp_take_training_loss(mlp, 0);
+        for (int i = 0;; i++) {
+            PROFILE_START(load_start);
+            if (loader_next(loader, &batch_inputs, &batch_targets) <= 0) {
+                break;
             }
-            for (int k = 0; k < output_size; k++) {
-                if (k == max_idx && batch_targets[j][k] == 1.0) {
-                    correct++;
-                    break;
+            PROFILE_RECORD(PROFILE_LOAD, PROFILE_NO_LAYER, load_start, 0,
+                           8.0 * batch_inputs.rows * (batch_inputs.cols + batch_targets.cols));
+            print_progress(i, num_batches);
+            mlp_compute_gradients_sparse(mlp, batch_inputs, loader_sparse_inputs(loader), batch_targets);
+            epoch_samples += batch_inputs.rows;
+            if ((i + 1) % accumulation_steps == 0) {
+                mlp_apply_gradients(mlp);
+                if (mlp->checkpoints != NULL) {
+                    checkpoint_writer_step(mlp->checkpoints, mlp);
                 }
             }
+            //check_nan(mlp);
         }
-        
-        free_matrix(batch_inputs, batch_size);
-        free_matrix(batch_targets, batch_size);
-        for (int i = 0; i <= mlp->num_layers; i++) {
-            free_matrix(activations[0][i], batch_size);
-            free_matrix(activations[1][i], batch_size);
+        mlp_apply_gradients(mlp);
+        if (mlp->checkpoints != NULL) {
+            checkpoint_writer_step(mlp->checkpoints, mlp);
+        }
+        PROFILE_EPOCH_END(mlp->epoch + 1, loader->dataset->num_samples, threadpool_size(mlp->pool));
+        print_progress(num_batches, num_batches);
+        printf("\n");
+        double training_loss = mlp_take_training_loss(mlp, epoch_samples);
+        if (!isnan(training_loss)) {
+            printf("Training loss: %f\n", training_loss);
+        }
+        int last_epoch = epoch == num_epochs - 1;
+        if (mlp->validation_every > 0 && ((mlp->epoch + 1) % mlp->validation_every == 0 || last_epoch)) {
+            Dataset *dataset = mlp->validation_set != NULL ? mlp->validation_set : loader->dataset;
+            int count = mlp->validation_samples > 0 && mlp->validation_samples < dataset->num_samples
+                        ? mlp->validation_samples : dataset->num_samples;
+            Evaluation evaluation = mlp_evaluate(mlp, dataset, 0, count, EVALUATION_BATCH_SIZE);
+            printf("Loss: %f\n", evaluation.loss);
+            printf("Accuracy: %f\n", evaluation.accuracy);
+            printf("Learning rate: %f\n", mlp->learning_rate);
+            if (mlp->pruning.sparsity > 0) {
+                printf("Sparsity: %f\n", mlp_sparsity(mlp));
+            }
         }
-        free(activations[0]);
-        free(activations[1]);
-        free(activations);
     }
+}
 
-    printf("Loss: %f\n", loss / (float)num_samples);
-    printf("Accuracy: %f\n", (float)correct / (float)num_samples);
+// debugging helper around mlp_infer that prints the output probabilities
+void mnist_predict(MLP *mlp, float *input, int target) {
+    Layer *output_layer = mlp->layers[mlp->num_layers-1];
+    Matrix inputs = matrix_view(input, 1, mlp->input_size, mlp->input_size);
+    void *scratch = aligned_alloc(MATRIX_ALIGNMENT, mlp_inference_scratch_bytes(mlp, 1));
+    int predicted;
+    Matrix outputs = matrix_activation(mlp_infer(mlp, inputs, scratch, &predicted), output_layer->activation);
+    for (int i = 0; i < output_layer->num_neurons; i++) {
+        printf("%f ", MAT(outputs, 0, i));
+    }
+    printf("Predicted: %d, Actual: %d\n", predicted, target);
+    free(scratch);
+}
+
+// prints the loss and accuracy over the dataset, and the sparsity of a pruned model, and returns the accuracy
+float validate(MLP *mlp, Dataset *dataset, int batch_size) {
+    Evaluation evaluation = mlp_evaluate(mlp, dataset, 0, dataset->num_samples, batch_size);
+    printf("Loss: %f\n", evaluation.loss);
+    printf("Accuracy: %f\n", evaluation.accuracy);
     printf("Learning rate: %f\n", mlp->learning_rate);
+    float sparsity = mlp_sparsity(mlp);
+    if (sparsity > 0) {
+        printf("Sparsity: %f\n", sparsity);
+    }
+    return evaluation.accuracy;
 }
 
 void print_progress(int current_step, int total_steps) {
@@ -288,7 +805,7 @@ void print_mlp(MLP *mlp) {
         for (int j = 0; j < mlp->layers[i]->num_neurons; j++) {
             printf("\tNeuron %d:\n", j);
             for (int k = 0; k < mlp->layers[i]->prev_num_neurons; k++) {
-                printf("\t\tWeight %d: %f\n", k, mlp->layers[i]->weights[j][k]);
+                printf("\t\tWeight %d: %f\n", k, MAT(mlp->layers[i]->weights, k, j));
             }
             printf("\t\tBias: %f\n", mlp->layers[i]->biases[j]);
         }
@@ -301,8 +818,8 @@ void check_nan(MLP *mlp) {
         Layer *layer = mlp->layers[i];
         for (int j = 0; j < layer->num_neurons; j++) {
             for (int k = 0; k < layer->prev_num_neurons; k++) {
-                if (isnan(layer->weights[j][k])) {
-                    printf("NaN at layer %d, neuron %d, weight %d = %f\n", i, j, k, layer->weights[j][k]);
+                if (isnan(MAT(layer->weights, k, j))) {
+                    printf("NaN at layer %d, neuron %d, weight %d = %f\n", i, j, k, MAT(layer->weights, k, j));
                     nan = 1;
                 }
             }
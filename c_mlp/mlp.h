@@ -1,36 +1,98 @@
+#ifndef MLP_H
+#define MLP_H
+#include"matrix.h"
+#include"threadpool.h"
+#include"arena.h"
+#include"dataset.h"
+#include"loader.h"
+#include"optimizer.h"
+#include"bf16.h"
+#include"sparse.h"
+#include"prune.h"
+
+typedef struct CheckpointWriter CheckpointWriter;
 
 typedef struct {
-    float **weights;
+    Matrix weights; // prev_num_neurons x num_neurons, so the forward pass is inputs @ weights
     float *biases;
     int num_neurons;
     int prev_num_neurons;
     void (*activation)(float*, float*, size_t);
     void (*activation_prime)(float*, float*, size_t);
+    float *optimizer_state; // the layer's part of the optimizer state, see mlp_set_optimizer
+    uint8_t *mask;          // 1 for every weight that is kept, NULL until the layer is pruned, see mlp_prune
 } Layer;
 
+// buffers for a forward and backward pass of up to max_batch_size samples, carved from one arena
 typedef struct {
+    Arena arena;
+    int max_batch_size;
+    Matrix *activations[2]; // pre-activations and outputs, num_layers + 1 each, index 0 is the input
+    Matrix *deltas;         // num_layers
+    // mixed precision only: hidden layers keep their pre-activations and outputs here instead of in
+    // activations, their GEMMs accumulate into the layer's deltas, which the backward pass overwrites
+    MatrixBF16 *activations_bf16[2];
+    float *row_buffer;      // one float32 row of pre-activations for activation_prime
+    SparseMatrix sparse_inputs; // CSR form of the batch's inputs, values is NULL when the batch is dense
+} Workspace;
+
+typedef struct MLP {
     Layer **layers;
     int num_layers; // only hidden layers and the output layer
     float (*loss)(float, float);
-    void (*loss_prime)(float**, float**, float**, int, int);
-    float learning_rate;
+    void (*loss_prime)(Matrix, Matrix, Matrix);
+    float learning_rate; // rate of the current epoch, set from the optimizer's schedule
+    Optimizer optimizer;
     int input_size;
+    int epoch;        // epochs trained so far, carried across checkpoints
+    ThreadPool *pool; // shared by the GEMMs and activations of every layer
+    Workspace workspace;
+    void *map;        // read-only checkpoint mapping the weights live in, NULL if they are owned
+    size_t map_size;
+    float *gradients;       // summed gradients of every layer, laid out like the optimizer state with one slot
+    size_t gradient_size;   // floats in gradients
+    int gradient_samples;   // samples summed into gradients since the last mlp_apply_gradients
+    double loss_sum;        // training loss summed by the fused output head, see mlp_take_training_loss
+    int accumulation_steps; // micro-batches train sums before each optimizer step
+    struct MLP **replicas;  // data-parallel workers, see mlp_set_data_parallel
+    int num_replicas;
+    int mixed_precision;    // bf16 activation caches, see mlp_set_mixed_precision
+    Arena evaluation_arena; // scratch of mlp_evaluate
+    Dataset *validation_set; // what train validates on, NULL for its training set, see mlp_set_validation
+    int validation_samples;
+    int validation_every;
+    PruneSchedule pruning;   // gradual pruning during train, see mlp_set_pruning
+    CheckpointWriter *checkpoints; // background checkpoints during train, see mlp_set_checkpointing
 } MLP;
 
 Layer *layer_init(int num_neurons, int prev_num_neurons);
 void layer_free(Layer *layer);
 MLP *mlp_init(int num_layers, int *num_neurons, void (*activations[])(float*, float*, size_t), void (*activations_prime[])(float*, float*, size_t),
-            float (*loss)(float, float), void (*loss_prime)(float**, float**, float**, int, int), float learning_rate, int input_size);
+            float (*loss)(float, float), void (*loss_prime)(Matrix, Matrix, Matrix), float learning_rate, int input_size);
+void mlp_init_weights(MLP *mlp, unsigned int seed);
 void mlp_free(MLP *mlp);
+void mlp_set_num_threads(MLP *mlp, int num_threads);
+void mlp_reserve_workspace(MLP *mlp, int max_batch_size);
+size_t mlp_workspace_bytes(const MLP *mlp, int max_batch_size);
+void mlp_set_optimizer(MLP *mlp, Optimizer optimizer);
+void mlp_set_data_parallel(MLP *mlp, int num_workers);
+void mlp_set_mixed_precision(MLP *mlp, int enabled);
+void mlp_set_validation(MLP *mlp, Dataset *dataset, int num_samples, int every_epochs);
+size_t layer_slot_floats(Layer *layer);
 
-float **batch_output(MLP *mlp, float **input, int batch_size);
-float ****batch_forward(MLP *mlp, float **inputs, int batch_size);
-void calculate_gradient_and_update(MLP *mlp, float **deltas, float **prev_activations, int batch_size, int layer_idx);
-void batch_backward(MLP *mlp, float **inputs, float **targets, int batch_size);
+Matrix **batch_forward(MLP *mlp, Matrix inputs);
+void calculate_gradient(MLP *mlp, Matrix deltas, int layer_idx, int accumulate);
+void mlp_compute_gradients(MLP *mlp, Matrix inputs, Matrix targets);
+void mlp_compute_gradients_sparse(MLP *mlp, Matrix inputs, const SparseMatrix *sparse_inputs, Matrix targets);
+void mlp_apply_gradients(MLP *mlp);
+double mlp_take_training_loss(MLP *mlp, long num_samples);
+void batch_backward(MLP *mlp, Matrix inputs, Matrix targets);
 
-void train(MLP *mlp, float **inputs, float **targets, int num_epochs, int num_samples, int batch_size);
+void train(MLP *mlp, DataLoader *loader, int num_epochs);
 void mnist_predict(MLP *mlp, float *input, int target);
-void validate(MLP *mlp, float **inputs, float **targets, int num_samples, int batch_size);
+float validate(MLP *mlp, Dataset *dataset, int batch_size);
 void print_progress(int current_step, int total_steps);
 void print_mlp(MLP *mlp);
-void check_nan(MLP *mlp);
\ No newline at end of file
+void check_nan(MLP *mlp);
+
+#endif
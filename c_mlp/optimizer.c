@@ -0,0 +1,231 @@
+#include<math.h>
+#include<stdlib.h>
+#include"optimizer.h"
+
+Optimizer optimizer_sgd(float learning_rate) {
+    Optimizer optimizer = { OPTIMIZER_SGD, learning_rate };
+    optimizer.schedule = lr_constant();
+    return optimizer;
+}
+
+// velocity = momentum * velocity + gradient, weights -= learning_rate * velocity
+Optimizer optimizer_momentum(float learning_rate, float momentum) {
+    Optimizer optimizer = optimizer_sgd(learning_rate);
+    optimizer.type = OPTIMIZER_MOMENTUM;
+    optimizer.momentum = momentum;
+    optimizer.num_slots = 1;
+    return optimizer;
+}
+
+Optimizer optimizer_adam(float learning_rate, float beta1, float beta2, float epsilon) {
+    Optimizer optimizer = optimizer_sgd(learning_rate);
+    optimizer.type = OPTIMIZER_ADAM;
+    optimizer.beta1 = beta1;
+    optimizer.beta2 = beta2;
+    optimizer.epsilon = epsilon;
+    optimizer.num_slots = 2;
+    return optimizer;
+}
+
+// Adam with weight decay applied to the weights directly instead of through the gradient
+Optimizer optimizer_adamw(float learning_rate, float beta1, float beta2, float epsilon, float weight_decay) {
+    Optimizer optimizer = optimizer_adam(learning_rate, beta1, beta2, epsilon);
+    optimizer.type = OPTIMIZER_ADAMW;
+    optimizer.weight_decay = weight_decay;
+    return optimizer;
+}
+
+// state tensors per parameter tensor, -1 for unknown ids
+int optimizer_num_slots(int type) {
+    switch (type) {
+    case OPTIMIZER_SGD: return 0;
+    case OPTIMIZER_MOMENTUM: return 1;
+    case OPTIMIZER_ADAM: return 2;
+    case OPTIMIZER_ADAMW: return 2;
+    }
+    return -1;
+}
+
+LrSchedule lr_constant() {
+    LrSchedule schedule = { LR_CONSTANT };
+    return schedule;
+}
+
+LrSchedule lr_exponential(float gamma) {
+    LrSchedule schedule = { LR_EXPONENTIAL, gamma };
+    return schedule;
+}
+
+LrSchedule lr_step(int step_size, float gamma) {
+    LrSchedule schedule = { LR_STEP, gamma, step_size };
+    return schedule;
+}
+
+LrSchedule lr_cosine(int total_epochs, float min_lr) {
+    LrSchedule schedule = { LR_COSINE, 0, 0, total_epochs, min_lr };
+    return schedule;
+}
+
+float lr_schedule_rate(LrSchedule schedule, float base_rate, int epoch) {
+    switch (schedule.type) {
+    case LR_EXPONENTIAL:
+        return base_rate * powf(schedule.gamma, epoch);
+    case LR_STEP:
+        return base_rate * powf(schedule.gamma, epoch / (schedule.step_size > 0 ? schedule.step_size : 1));
+    case LR_COSINE:
+        if (epoch >= schedule.total_epochs) {
+            return schedule.min_lr;
+        }
+        return schedule.min_lr + 0.5f * (base_rate - schedule.min_lr) * (1 + cosf(M_PI * epoch / schedule.total_epochs));
+    }
+    return base_rate;
+}
+
+// everything one fused update pass needs, with the step dependent terms already worked out
+typedef struct {
+    float learning_rate;
+    float grad_scale; // folds the 1 / batch_size of the mean gradient into the update
+    float momentum;
+    float beta1, beta2, epsilon;
+    float decay;      // learning_rate * weight_decay, or 0
+    float correction1, correction2; // 1 / (1 - beta^step)
+} UpdateParams;
+
+typedef void (*update_kernel)(size_t n, float *params, const float *grads, float *m, float *v, const UpdateParams *p);
+
+static void sgd_scalar(size_t n, float *params, const float *grads, float *m, float *v, const UpdateParams *p) {
+    float rate = p->learning_rate * p->grad_scale;
+    for (size_t i = 0; i < n; i++) {
+        params[i] -= rate * grads[i];
+    }
+}
+
+static void momentum_scalar(size_t n, float *params, const float *grads, float *m, float *v, const UpdateParams *p) {
+    for (size_t i = 0; i < n; i++) {
+        m[i] = p->momentum * m[i] + p->grad_scale * grads[i];
+        params[i] -= p->learning_rate * m[i];
+    }
+}
+
+static void adam_scalar(size_t n, float *params, const float *grads, float *m, float *v, const UpdateParams *p) {
+    for (size_t i = 0; i < n; i++) {
+        float g = p->grad_scale * grads[i];
+        m[i] = p->beta1 * m[i] + (1 - p->beta1) * g;
+        v[i] = p->beta2 * v[i] + (1 - p->beta2) * g * g;
+        float step = m[i] * p->correction1 / (sqrtf(v[i] * p->correction2) + p->epsilon);
+        params[i] -= p->learning_rate * step + p->decay * params[i];
+    }
+}
+
+static update_kernel scalar_kernels[] = { sgd_scalar, momentum_scalar, adam_scalar, adam_scalar };
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include<immintrin.h>
+#define OPTIMIZER_HAVE_AVX2 1
+
+// the AVX2 kernels do 8 floats at a time and hand the remainder to the scalar kernel
+
+__attribute__((target("avx2,fma")))
+static void sgd_avx2(size_t n, float *params, const float *grads, float *m, float *v, const UpdateParams *p) {
+    __m256 rate = _mm256_set1_ps(-p->learning_rate * p->grad_scale);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(params + i, _mm256_fmadd_ps(rate, _mm256_loadu_ps(grads + i), _mm256_loadu_ps(params + i)));
+    }
+    sgd_scalar(n - i, params + i, grads + i, NULL, NULL, p);
+}
+
+__attribute__((target("avx2,fma")))
+static void momentum_avx2(size_t n, float *params, const float *grads, float *m, float *v, const UpdateParams *p) {
+    __m256 momentum = _mm256_set1_ps(p->momentum);
+    __m256 scale = _mm256_set1_ps(p->grad_scale);
+    __m256 rate = _mm256_set1_ps(-p->learning_rate);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 velocity = _mm256_fmadd_ps(momentum, _mm256_loadu_ps(m + i), _mm256_mul_ps(scale, _mm256_loadu_ps(grads + i)));
+        _mm256_storeu_ps(m + i, velocity);
+        _mm256_storeu_ps(params + i, _mm256_fmadd_ps(rate, velocity, _mm256_loadu_ps(params + i)));
+    }
+    momentum_scalar(n - i, params + i, grads + i, m + i, NULL, p);
+}
+
+__attribute__((target("avx2,fma")))
+static void adam_avx2(size_t n, float *params, const float *grads, float *m, float *v, const UpdateParams *p) {
+    __m256 scale = _mm256_set1_ps(p->grad_scale);
+    __m256 beta1 = _mm256_set1_ps(p->beta1), one_minus_beta1 = _mm256_set1_ps(1 - p->beta1);
+    __m256 beta2 = _mm256_set1_ps(p->beta2), one_minus_beta2 = _mm256_set1_ps(1 - p->beta2);
+    __m256 correction1 = _mm256_set1_ps(p->correction1), correction2 = _mm256_set1_ps(p->correction2);
+    __m256 epsilon = _mm256_set1_ps(p->epsilon);
+    __m256 rate = _mm256_set1_ps(p->learning_rate);
+    __m256 decay = _mm256_set1_ps(p->decay);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 g = _mm256_mul_ps(scale, _mm256_loadu_ps(grads + i));
+        __m256 m_i = _mm256_fmadd_ps(beta1, _mm256_loadu_ps(m + i), _mm256_mul_ps(one_minus_beta1, g));
+        __m256 v_i = _mm256_fmadd_ps(beta2, _mm256_loadu_ps(v + i), _mm256_mul_ps(one_minus_beta2, _mm256_mul_ps(g, g)));
+        _mm256_storeu_ps(m + i, m_i);
+        _mm256_storeu_ps(v + i, v_i);
+        __m256 denominator = _mm256_add_ps(_mm256_sqrt_ps(_mm256_mul_ps(v_i, correction2)), epsilon);
+        __m256 step = _mm256_div_ps(_mm256_mul_ps(m_i, correction1), denominator);
+        __m256 w = _mm256_loadu_ps(params + i);
+        w = _mm256_sub_ps(w, _mm256_fmadd_ps(rate, step, _mm256_mul_ps(decay, w)));
+        _mm256_storeu_ps(params + i, w);
+    }
+    adam_scalar(n - i, params + i, grads + i, m + i, v + i, p);
+}
+
+static update_kernel avx2_kernels[] = { sgd_avx2, momentum_avx2, adam_avx2, adam_avx2 };
+#endif
+
+static update_kernel *active_kernels = NULL;
+
+static update_kernel *kernels() {
+    if (active_kernels == NULL) {
+        active_kernels = scalar_kernels;
+#ifdef OPTIMIZER_HAVE_AVX2
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            active_kernels = avx2_kernels;
+        }
+#endif
+    }
+    return active_kernels;
+}
+
+/*
+    One fused pass over a parameter tensor: reads the gradient once and updates the state and the
+    parameters in place
+    Parameters:
+    learning_rate: the rate for this epoch, see lr_schedule_rate
+    grad_scale: multiplies the gradients, 1 / batch_size turns summed gradients into their mean
+    decay: whether weight decay applies to this tensor (weights yes, biases no)
+    state: the tensor's first state slot, further slots follow every slot_stride floats
+    The optimizer's step must already count this update.
+*/
+void optimizer_update(const Optimizer *optimizer, float learning_rate, float grad_scale, int decay, size_t n,
+                      float *params, const float *grads, float *state, size_t slot_stride) {
+    optimizer_update_block(optimizer, learning_rate, grad_scale, decay, 1, n, n, params, grads, state, slot_stride);
+}
+
+/*
+    optimizer_update on a rows x cols block of a row-major tensor with leading dimension ld, such as one
+    model's columns of a sweep's stacked first layer
+    The gradients and every state slot are laid out like the parameters. The bias corrections are
+    worked out once for the whole block.
+*/
+void optimizer_update_block(const Optimizer *optimizer, float learning_rate, float grad_scale, int decay, int rows, size_t cols,
+                            size_t ld, float *params, const float *grads, float *state, size_t slot_stride) {
+    UpdateParams p = { learning_rate, grad_scale, optimizer->momentum, optimizer->beta1, optimizer->beta2, optimizer->epsilon };
+    p.decay = decay ? learning_rate * optimizer->weight_decay : 0.0f;
+    if (optimizer->type == OPTIMIZER_ADAM || optimizer->type == OPTIMIZER_ADAMW) {
+        p.correction1 = 1.0f / (1.0f - powf(optimizer->beta1, optimizer->step));
+        p.correction2 = 1.0f / (1.0f - powf(optimizer->beta2, optimizer->step));
+    }
+    update_kernel kernel = kernels()[optimizer->type];
+    for (int r = 0; r < rows; r++) {
+        size_t offset = r * ld;
+        float *m = optimizer->num_slots > 0 ? state + offset : NULL;
+        float *v = optimizer->num_slots > 1 ? state + slot_stride + offset : NULL;
+        kernel(cols, params + offset, grads + offset, m, v, &p);
+    }
+}
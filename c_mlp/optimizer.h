@@ -0,0 +1,60 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+#include<stddef.h>
+
+// optimizer ids, also stored in checkpoints
+#define OPTIMIZER_SGD 0
+#define OPTIMIZER_MOMENTUM 1
+#define OPTIMIZER_ADAM 2
+#define OPTIMIZER_ADAMW 3
+
+// learning rate schedule ids, the rate for an epoch is computed from the base rate
+#define LR_CONSTANT 0
+#define LR_EXPONENTIAL 1 // base * gamma^epoch
+#define LR_STEP 2        // base * gamma^(epoch / step_size)
+#define LR_COSINE 3      // cosine from base down to min_lr over total_epochs
+
+typedef struct {
+    int type;
+    float gamma;
+    int step_size;
+    int total_epochs;
+    float min_lr;
+} LrSchedule;
+
+/*
+    Optimizer settings and state
+    State tensors (momentum velocity, Adam's first and second moments) are num_slots copies of every
+    weight and bias tensor, kept in one block; the MLP lays them out per layer (see mlp_set_optimizer).
+*/
+typedef struct {
+    int type;
+    float learning_rate; // base rate the schedule starts from
+    float momentum;
+    float beta1, beta2, epsilon;
+    float weight_decay;  // decoupled (AdamW), applied to weights only
+    LrSchedule schedule;
+    long step;           // updates so far, for Adam's bias correction
+    int num_slots;
+    float *state;
+    size_t state_size;   // floats in state
+} Optimizer;
+
+Optimizer optimizer_sgd(float learning_rate);
+Optimizer optimizer_momentum(float learning_rate, float momentum);
+Optimizer optimizer_adam(float learning_rate, float beta1, float beta2, float epsilon);
+Optimizer optimizer_adamw(float learning_rate, float beta1, float beta2, float epsilon, float weight_decay);
+int optimizer_num_slots(int type);
+
+LrSchedule lr_constant();
+LrSchedule lr_exponential(float gamma);
+LrSchedule lr_step(int step_size, float gamma);
+LrSchedule lr_cosine(int total_epochs, float min_lr);
+float lr_schedule_rate(LrSchedule schedule, float base_rate, int epoch);
+
+void optimizer_update(const Optimizer *optimizer, float learning_rate, float grad_scale, int decay, size_t n,
+                      float *params, const float *grads, float *state, size_t slot_stride);
+void optimizer_update_block(const Optimizer *optimizer, float learning_rate, float grad_scale, int decay, int rows, size_t cols,
+                            size_t ld, float *params, const float *grads, float *state, size_t slot_stride);
+
+#endif
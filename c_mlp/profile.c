@@ -0,0 +1,208 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<pthread.h>
+#include"profile.h"
+#include"gemm.h"
+
+// trace events kept between two flushes, the rest of an epoch is dropped and counted
+#define PROFILE_TRACE_EVENTS (1 << 18)
+
+typedef struct {
+    uint64_t ns, calls, flops, bytes;
+} ProfileCounter;
+
+typedef struct {
+    uint64_t start, duration;
+    int16_t phase, layer;
+    int32_t thread;
+} TraceEvent;
+
+static const char *phase_names[PROFILE_NUM_PHASES] = {
+    "load", "forward_gemm", "activation", "loss", "backward_gemm", "allreduce", "update", "inference", "snapshot"
+};
+
+// index 0 holds the phases recorded without a layer
+static ProfileCounter counters[PROFILE_MAX_LAYERS + 1][PROFILE_NUM_PHASES];
+static uint64_t allocations = 0;
+static uint64_t allocated_bytes = 0;
+static uint64_t epoch_start = 0;
+static uint64_t origin = 0;
+
+static FILE *stats_file = NULL;
+static FILE *trace_file = NULL;
+static TraceEvent *trace_events = NULL;
+static uint64_t trace_count = 0;
+static uint64_t trace_dropped = 0;
+static int trace_written = 0;
+static int thread_count = 0;
+static _Thread_local int thread_id = -1;
+
+static pthread_once_t open_once = PTHREAD_ONCE_INIT;
+static int opened = 0;
+
+uint64_t profile_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void open_from_environment() {
+    if (!opened) {
+        profile_open(getenv("MLP_PROFILE_STATS"), getenv("MLP_PROFILE_TRACE"));
+    }
+}
+
+/*
+    Directs the per-epoch stats to stats_path (stderr if NULL) and the trace events to trace_path (no
+    trace if NULL). Returns 0, or -1 if a file could not be opened.
+*/
+int profile_open(const char *stats_path, const char *trace_path) {
+    static int registered = 0;
+    if (!registered) {
+        atexit(profile_close);
+        registered = 1;
+    }
+    profile_close();
+    opened = 1;
+    origin = epoch_start = profile_now();
+    stats_file = stderr;
+    if (stats_path != NULL && (stats_file = fopen(stats_path, "w")) == NULL) {
+        fprintf(stderr, "Could not open profile stats file %s\n", stats_path);
+        stats_file = stderr;
+        return -1;
+    }
+    if (trace_path != NULL) {
+        trace_file = fopen(trace_path, "w");
+        trace_events = malloc(PROFILE_TRACE_EVENTS * sizeof(TraceEvent));
+        if (trace_file == NULL || trace_events == NULL) {
+            fprintf(stderr, "Could not open profile trace file %s\n", trace_path);
+            if (trace_file != NULL) {
+                fclose(trace_file);
+            }
+            free(trace_events);
+            trace_file = NULL;
+            trace_events = NULL;
+            return -1;
+        }
+        fprintf(trace_file, "[");
+        trace_written = 0;
+    }
+    return 0;
+}
+
+static void flush_trace() {
+    if (trace_file == NULL) {
+        return;
+    }
+    uint64_t count = trace_count < PROFILE_TRACE_EVENTS ? trace_count : PROFILE_TRACE_EVENTS;
+    for (uint64_t i = 0; i < count; i++) {
+        TraceEvent *e = &trace_events[i];
+        const char *name = phase_names[e->phase];
+        fprintf(trace_file, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"layer\":%d}}",
+                trace_written++ ? "," : "", name, e->layer >= 0 ? "layer" : "global", (e->start - origin) / 1e3,
+                e->duration / 1e3, e->thread, e->layer);
+    }
+    fflush(trace_file);
+    trace_count = 0;
+}
+
+void profile_close() {
+    if (trace_file != NULL) {
+        flush_trace();
+        fprintf(trace_file, "\n]\n");
+        fclose(trace_file);
+        free(trace_events);
+        trace_file = NULL;
+        trace_events = NULL;
+    }
+    if (stats_file != NULL && stats_file != stderr) {
+        fclose(stats_file);
+    }
+    stats_file = NULL;
+    opened = 0;
+}
+
+// adds the span from start to now to (phase, layer), and to the trace when one is open
+void profile_record(ProfilePhase phase, int layer, uint64_t start, double flops, double bytes) {
+    uint64_t end = profile_now();
+    int slot = layer < 0 ? 0 : layer < PROFILE_MAX_LAYERS ? layer + 1 : PROFILE_MAX_LAYERS;
+    ProfileCounter *counter = &counters[slot][phase];
+    __atomic_add_fetch(&counter->ns, end - start, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counter->calls, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counter->flops, (uint64_t)flops, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&counter->bytes, (uint64_t)bytes, __ATOMIC_RELAXED);
+
+    if (trace_events != NULL) {
+        uint64_t index = __atomic_fetch_add(&trace_count, 1, __ATOMIC_RELAXED);
+        if (index >= PROFILE_TRACE_EVENTS) {
+            __atomic_add_fetch(&trace_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        if (thread_id < 0) {
+            thread_id = __atomic_fetch_add(&thread_count, 1, __ATOMIC_RELAXED);
+        }
+        trace_events[index] = (TraceEvent){ start, end - start, phase, layer, thread_id };
+    }
+}
+
+void profile_count_allocation(size_t bytes) {
+    __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&allocated_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+// clears the counters, the next profile_epoch_end reports what happens from here on
+void profile_epoch_begin() {
+    pthread_once(&open_once, open_from_environment);
+    memset(counters, 0, sizeof(counters));
+    allocations = allocated_bytes = 0;
+    trace_dropped = 0;
+    epoch_start = profile_now();
+}
+
+/*
+    Writes one JSON line with the counters since profile_epoch_begin and flushes the trace
+    Not only for epochs: any interval, such as a run of inference calls, can be bracketed.
+    threads: threads the work ran on, scales the peak that gemm_efficiency is measured against
+*/
+void profile_epoch_end(int epoch, long samples, int threads) {
+    pthread_once(&open_once, open_from_environment);
+    double seconds = (profile_now() - epoch_start) * 1e-9;
+    double peak = gemm_peak_gflops() * (threads > 0 ? threads : 1);
+    double gemm_ns = 0, gemm_flops = 0;
+    for (int l = 0; l <= PROFILE_MAX_LAYERS; l++) {
+        for (int p = 0; p < PROFILE_NUM_PHASES; p++) {
+            if (p == PROFILE_FORWARD_GEMM || p == PROFILE_BACKWARD_GEMM || p == PROFILE_INFERENCE) {
+                gemm_ns += counters[l][p].ns;
+                gemm_flops += counters[l][p].flops;
+            }
+        }
+    }
+    double gemm_gflops = gemm_ns > 0 ? gemm_flops / gemm_ns : 0;
+
+    fprintf(stats_file, "{\"epoch\":%d,\"samples\":%ld,\"seconds\":%.6f,\"samples_per_second\":%.1f,\"threads\":%d,"
+            "\"gemm_kernel\":\"%s\",\"peak_gflops\":%.2f,\"gemm_gflops\":%.2f,\"gemm_efficiency\":%.3f,"
+            "\"allocations\":%llu,\"allocated_bytes\":%llu,\"trace_events_dropped\":%llu,\"phases\":[",
+            epoch, samples, seconds, seconds > 0 ? samples / seconds : 0, threads, gemm_kernel_name(), peak, gemm_gflops,
+            peak > 0 ? gemm_gflops / peak : 0, (unsigned long long)allocations, (unsigned long long)allocated_bytes,
+            (unsigned long long)trace_dropped);
+    int first = 1;
+    for (int l = 0; l <= PROFILE_MAX_LAYERS; l++) {
+        for (int p = 0; p < PROFILE_NUM_PHASES; p++) {
+            ProfileCounter *c = &counters[l][p];
+            if (c->calls == 0) {
+                continue;
+            }
+            double ns = c->ns > 0 ? c->ns : 1;
+            fprintf(stats_file, "%s{\"phase\":\"%s\",\"layer\":%d,\"calls\":%llu,\"seconds\":%.6f,\"share\":%.4f,"
+                    "\"gflops\":%.3f,\"gbytes_per_second\":%.3f}",
+                    first ? "" : ",", phase_names[p], l - 1, (unsigned long long)c->calls, c->ns * 1e-9,
+                    seconds > 0 ? c->ns * 1e-9 / seconds : 0, c->flops / ns, c->bytes / ns);
+            first = 0;
+        }
+    }
+    fprintf(stats_file, "]}\n");
+    fflush(stats_file);
+    flush_trace();
+}
@@ -0,0 +1,65 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+#include<stddef.h>
+#include<stdint.h>
+
+/*
+    Per-layer, per-phase timing of training and inference
+    Compiled in with -DMLP_PROFILE; without it every PROFILE_ macro expands to nothing and profile.c
+    does not have to be linked. The hot paths record wall time, calls, FLOPs and bytes moved for each
+    (phase, layer) pair, plus the heap allocations made by the library. train() writes one JSON line
+    per epoch to the stats file and resets the counters.
+    Output goes where profile_open points it, or else to $MLP_PROFILE_STATS (default stderr) and
+    $MLP_PROFILE_TRACE (default none). The trace file is in Chrome's trace-event format, load it in
+    chrome://tracing or ui.perfetto.dev for a timeline of every recorded span on every thread. Files
+    are closed at exit.
+    The forward activation runs inside the GEMM epilogue and is counted in forward_gemm; activation
+    is the backward derivative pass.
+    Counters are updated with atomics, so replicas of a data-parallel model can record concurrently.
+    Only threads that are idle when train() ends an epoch may record: the trace is flushed and the
+    counters reset without a lock. The checkpoint writer keeps its timing in CheckpointStats.
+*/
+typedef enum {
+    PROFILE_LOAD,          // DataLoader batch assembly
+    PROFILE_FORWARD_GEMM,  // forward GEMM with its fused bias and activation epilogue
+    PROFILE_ACTIVATION,    // activation derivative in the backward pass
+    PROFILE_LOSS,          // loss derivative of the output layer
+    PROFILE_BACKWARD_GEMM, // delta propagation and weight gradient GEMMs
+    PROFILE_ALLREDUCE,     // gradient all-reduce across data-parallel replicas
+    PROFILE_UPDATE,        // optimizer step
+    PROFILE_INFERENCE,     // mlp_infer layers, GEMV or GEMM with epilogue
+    PROFILE_SNAPSHOT,      // copying the model into a checkpoint staging buffer, the stall training sees
+    PROFILE_NUM_PHASES
+} ProfilePhase;
+
+// phases that do not belong to a layer are recorded with layer PROFILE_NO_LAYER
+#define PROFILE_NO_LAYER -1
+#define PROFILE_MAX_LAYERS 32
+
+int profile_open(const char *stats_path, const char *trace_path);
+void profile_close();
+uint64_t profile_now();
+void profile_record(ProfilePhase phase, int layer, uint64_t start, double flops, double bytes);
+void profile_count_allocation(size_t bytes);
+void profile_epoch_begin();
+void profile_epoch_end(int epoch, long samples, int threads);
+
+#ifdef MLP_PROFILE
+#define PROFILE_START(var) uint64_t var = profile_now()
+#define PROFILE_RECORD(phase, layer, start, flops, bytes) profile_record(phase, layer, start, flops, bytes)
+#define PROFILE_ALLOCATION(bytes) profile_count_allocation(bytes)
+#define PROFILE_EPOCH_BEGIN() profile_epoch_begin()
+#define PROFILE_EPOCH_END(epoch, samples, threads) profile_epoch_end(epoch, samples, threads)
+#else
+#define PROFILE_START(var)
+#define PROFILE_RECORD(phase, layer, start, flops, bytes) ((void)0)
+#define PROFILE_ALLOCATION(bytes) ((void)0)
+#define PROFILE_EPOCH_BEGIN() ((void)0)
+#define PROFILE_EPOCH_END(epoch, samples, threads) ((void)0)
+#endif
+
+// FLOPs and compulsory bytes of C (m x n) = A (m x k) @ B (k x n), C read too when accumulating
+#define GEMM_FLOPS(m, n, k) (2.0 * (m) * (n) * (k))
+#define GEMM_BYTES(m, n, k, accumulate) (4.0 * ((double)(m) * (k) + (double)(k) * (n) + (double)(m) * (n) * ((accumulate) ? 2 : 1)))
+
+#endif
@@ -0,0 +1,634 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include<limits.h>
+#include<time.h>
+#include"prune.h"
+#include"mlp.h"
+#include"activation.h"
+#include"gemm.h"
+#include"inference.h"
+#include"evaluate.h"
+#include"profile.h"
+
+// dense layers of a pruned model run one GEMV per row below this batch size, as in mlp_infer
+#define PRUNED_GEMV_ROWS 8
+// samples and minimum duration of each validate_pruning timing
+#define TIMING_SAMPLES 512
+#define TIMING_SECONDS 0.3
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_layers;
+    uint32_t input_size;
+    uint32_t reserved;
+} PrunedHeader;
+
+typedef struct {
+    uint32_t num_neurons;
+    uint32_t prev_num_neurons;
+    uint32_t activation_id;
+    uint32_t block_width;
+    uint32_t entries; // stored entries of a sparse layer, 0 for a dense one
+    uint32_t dense;
+} PrunedLayerHeader;
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int compare_floats(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+static int units_per_row(const Layer *layer, int block_width) {
+    return (layer->num_neurons + block_width - 1) / block_width;
+}
+
+// mean magnitude of every run of block_width weights along the rows of the layer, the last run of a row may be shorter
+static void unit_scores(const Layer *layer, int block_width, float *scores) {
+    int units = units_per_row(layer, block_width);
+    for (int k = 0; k < layer->prev_num_neurons; k++) {
+        const float *row = matrix_row(layer->weights, k);
+        for (int u = 0; u < units; u++) {
+            int start = u * block_width, end = start + block_width < layer->num_neurons ? start + block_width : layer->num_neurons;
+            float sum = 0;
+            for (int j = start; j < end; j++) {
+                sum += fabsf(row[j]);
+            }
+            scores[(size_t)k * units + u] = sum / (end - start);
+        }
+    }
+}
+
+// the score at or below which the smallest fraction sparsity of n scores fall, -1 when nothing is pruned
+static float threshold(float *scores, size_t n, float sparsity) {
+    size_t pruned = (size_t)(sparsity * n);
+    if (pruned == 0) {
+        return -1.0f;
+    }
+    qsort(scores, n, sizeof(float), compare_floats);
+    return scores[pruned - 1];
+}
+
+// keeps the units scoring above the threshold and zeroes the rest
+static void mask_layer(Layer *layer, int block_width, const float *scores, float threshold) {
+    size_t n = (size_t)layer->prev_num_neurons * layer->num_neurons;
+    if (layer->mask == NULL) {
+        layer->mask = malloc(n);
+        PROFILE_ALLOCATION(n);
+        if (layer->mask == NULL) {
+            fprintf(stderr, "Could not allocate pruning mask\n");
+            exit(1);
+        }
+    }
+    int units = units_per_row(layer, block_width);
+    for (int k = 0; k < layer->prev_num_neurons; k++) {
+        float *row = matrix_row(layer->weights, k);
+        for (int j = 0; j < layer->num_neurons; j++) {
+            uint8_t keep = scores[(size_t)k * units + j / block_width] > threshold;
+            layer->mask[(size_t)k * layer->num_neurons + j] = keep;
+            row[j] = keep ? row[j] : 0.0f;
+        }
+    }
+}
+
+/*
+    Prunes the weights of smallest magnitude until a fraction sparsity of them is zero, and masks them
+    so later updates keep them at zero
+    Parameters:
+    scope: PRUNE_GLOBAL ranks the weights of all layers together, PRUNE_PER_LAYER prunes every layer
+           to the sparsity
+    block_width: 1 for single weights, SPARSE_BLOCK_WIDTH for runs of consecutive outputs of one input
+    Pruned weights score zero, so pruning a pruned model further keeps what it already removed.
+    Biases are never pruned. Returns 0, or -1 for a mapped model or invalid parameters.
+*/
+int mlp_prune(MLP *mlp, float sparsity, int scope, int block_width) {
+    if (mlp->map != NULL || sparsity < 0 || sparsity > 1 || (block_width != 1 && block_width != SPARSE_BLOCK_WIDTH)
+        || (scope != PRUNE_GLOBAL && scope != PRUNE_PER_LAYER)) {
+        fprintf(stderr, "Cannot prune %s to sparsity %f with blocks of %d\n", mlp->map != NULL ? "a mapped model" : "the model",
+                sparsity, block_width);
+        return -1;
+    }
+    size_t offsets[mlp->num_layers + 1];
+    offsets[0] = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        offsets[i+1] = offsets[i] + (size_t)mlp->layers[i]->prev_num_neurons * units_per_row(mlp->layers[i], block_width);
+    }
+    float *scores = malloc(offsets[mlp->num_layers] * sizeof(float));
+    float *sorted = malloc(offsets[mlp->num_layers] * sizeof(float));
+    if (scores == NULL || sorted == NULL) {
+        fprintf(stderr, "Could not allocate pruning scores\n");
+        exit(1);
+    }
+    for (int i = 0; i < mlp->num_layers; i++) {
+        unit_scores(mlp->layers[i], block_width, scores + offsets[i]);
+    }
+    memcpy(sorted, scores, offsets[mlp->num_layers] * sizeof(float));
+    float global = scope == PRUNE_GLOBAL ? threshold(sorted, offsets[mlp->num_layers], sparsity) : 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        float cut = scope == PRUNE_GLOBAL ? global : threshold(sorted + offsets[i], offsets[i+1] - offsets[i], sparsity);
+        mask_layer(mlp->layers[i], block_width, scores + offsets[i], cut);
+    }
+    free(scores);
+    free(sorted);
+    return 0;
+}
+
+// prunes gradually during train from now on, a schedule with sparsity 0 stops pruning (the masks stay)
+void mlp_set_pruning(MLP *mlp, PruneSchedule schedule) {
+    mlp->pruning = schedule;
+}
+
+/*
+    Prunes to the schedule's sparsity for mlp->epoch, train calls it at the start of every epoch
+    After end_epoch the masks keep the target, unless the model has none (it was loaded from a
+    checkpoint, which stores the zeros but not the masks): then they are rebuilt at the target.
+*/
+void mlp_update_pruning(MLP *mlp) {
+    PruneSchedule schedule = mlp->pruning;
+    if (schedule.sparsity <= 0 || mlp->epoch < schedule.begin_epoch
+        || (mlp->epoch > schedule.end_epoch && mlp->layers[0]->mask != NULL)) {
+        return;
+    }
+    float progress = 1.0f;
+    if (schedule.end_epoch > schedule.begin_epoch && mlp->epoch < schedule.end_epoch) {
+        progress = (float)(mlp->epoch - schedule.begin_epoch) / (schedule.end_epoch - schedule.begin_epoch);
+    }
+    float remaining = 1.0f - progress;
+    float sparsity = schedule.sparsity * (1.0f - remaining * remaining * remaining);
+    if (sparsity > 0) {
+        mlp_prune(mlp, sparsity, schedule.scope, schedule.block_width);
+    }
+}
+
+// fraction of the weights (biases aside) that are zero
+float mlp_sparsity(const MLP *mlp) {
+    size_t zeros = 0, total = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        const Layer *layer = mlp->layers[i];
+        for (int k = 0; k < layer->prev_num_neurons; k++) {
+            const float *row = matrix_row(layer->weights, k);
+            for (int j = 0; j < layer->num_neurons; j++) {
+                zeros += row[j] == 0.0f;
+            }
+        }
+        total += (size_t)layer->prev_num_neurons * layer->num_neurons;
+    }
+    return total > 0 ? (float)zeros / total : 0.0f;
+}
+
+// entries the layer's weights need as single weights (block_width 1) or in block-sparse form
+static int count_entries(const Layer *layer, int block_width) {
+    int entries = 0;
+    for (int k = 0; k < layer->prev_num_neurons; k++) {
+        const float *row = matrix_row(layer->weights, k);
+        for (int start = 0; start < layer->num_neurons; start += block_width) {
+            int end = start + block_width < layer->num_neurons ? start + block_width : layer->num_neurons;
+            int nonzero = 0;
+            for (int j = start; j < end; j++) {
+                nonzero |= row[j] != 0.0f;
+            }
+            entries += nonzero;
+        }
+    }
+    return entries;
+}
+
+// sparse weights are stored by output, one row per output or per strip of block_width outputs
+static int stored_rows(const PrunedLayer *layer) {
+    return (layer->num_neurons + layer->block_width - 1) / layer->block_width;
+}
+
+// room for a prev_num_neurons x num_neurons layer of the given number of entries
+static void layer_alloc(PrunedLayer *layer, int entries) {
+    layer->biases = malloc(layer->num_neurons * sizeof(float));
+    if (layer->dense.data == NULL) {
+        layer->weights = (SparseMatrix){ NULL, NULL, NULL, stored_rows(layer), layer->prev_num_neurons, entries };
+        layer->weights.values = malloc(((size_t)entries * layer->block_width + 1) * sizeof(float));
+        layer->weights.indices = malloc(((size_t)entries + 1) * sizeof(int));
+        layer->weights.row_start = calloc(stored_rows(layer) + 1, sizeof(int));
+    }
+    if (layer->biases == NULL || (layer->dense.data == NULL && (layer->weights.values == NULL || layer->weights.indices == NULL
+                                                                || layer->weights.row_start == NULL))) {
+        fprintf(stderr, "Could not allocate pruned layer of %d entries\n", entries);
+        exit(1);
+    }
+}
+
+// for every output (strip of outputs), the inputs with a non-zero weight (run) in input order
+static void compress_layer(PrunedLayer *pruned, const Layer *layer) {
+    int width = pruned->block_width, entries = 0;
+    SparseMatrix *W = &pruned->weights;
+    for (int s = 0; s < W->rows; s++) {
+        int start = s * width, end = start + width < layer->num_neurons ? start + width : layer->num_neurons;
+        for (int k = 0; k < layer->prev_num_neurons; k++) {
+            const float *row = matrix_row(layer->weights, k);
+            int nonzero = 0;
+            for (int j = start; j < end; j++) {
+                nonzero |= row[j] != 0.0f;
+            }
+            if (!nonzero) {
+                continue;
+            }
+            float *run = W->values + (size_t)entries * width;
+            memset(run, 0, width * sizeof(float));
+            memcpy(run, row + start, (end - start) * sizeof(float));
+            W->indices[entries++] = k;
+        }
+        W->row_start[s+1] = entries;
+    }
+}
+
+/*
+    Compresses the zeros out of the model's weights for serving
+    block_width 1 gives layers of single weights, SPARSE_BLOCK_WIDTH block-sparse ones, which suit
+    models pruned with the same block width (unstructured zeros rarely empty a whole run). Layers that
+    would keep more than PRUNE_MAX_DENSITY of their entries (PRUNE_MAX_SINGLE_DENSITY of single
+    weights) are copied dense, the sparse kernels are no faster than the dense ones above that.
+    Returns NULL for another block width.
+*/
+PrunedMLP *prune_export(const MLP *mlp, int block_width) {
+    if (block_width != 1 && block_width != SPARSE_BLOCK_WIDTH) {
+        fprintf(stderr, "Pruned layers are stored in blocks of 1 or %d, not %d\n", SPARSE_BLOCK_WIDTH, block_width);
+        return NULL;
+    }
+    PrunedMLP *pmlp = malloc(sizeof(PrunedMLP));
+    pmlp->num_layers = mlp->num_layers;
+    pmlp->input_size = mlp->input_size;
+    pmlp->layers = calloc(mlp->num_layers, sizeof(PrunedLayer));
+    for (int i = 0; i < mlp->num_layers; i++) {
+        const Layer *layer = mlp->layers[i];
+        PrunedLayer *pruned = &pmlp->layers[i];
+        pruned->num_neurons = layer->num_neurons;
+        pruned->prev_num_neurons = layer->prev_num_neurons;
+        pruned->block_width = block_width;
+        pruned->activation = layer->activation;
+        int entries = count_entries(layer, block_width);
+        float max_density = block_width == 1 ? PRUNE_MAX_SINGLE_DENSITY : PRUNE_MAX_DENSITY;
+        if ((double)entries * block_width > max_density * layer->prev_num_neurons * layer->num_neurons) {
+            pruned->dense = allocate_matrix(layer->prev_num_neurons, layer->num_neurons);
+            matrix_copy(pruned->dense, layer->weights);
+        }
+        layer_alloc(pruned, entries);
+        if (pruned->dense.data == NULL) {
+            compress_layer(pruned, layer);
+        }
+        memcpy(pruned->biases, layer->biases, layer->num_neurons * sizeof(float));
+    }
+    return pmlp;
+}
+
+void pruned_free(PrunedMLP *pmlp) {
+    for (int i = 0; i < pmlp->num_layers; i++) {
+        PrunedLayer *layer = &pmlp->layers[i];
+        if (layer->dense.data != NULL) {
+            free_matrix(layer->dense);
+        } else if (layer->weights.row_start != NULL) {
+            sparse_free(layer->weights);
+        }
+        free(layer->biases);
+    }
+    free(pmlp->layers);
+    free(pmlp);
+}
+
+// bytes of weights, indices and biases the model reads per forward pass
+size_t pruned_model_bytes(const PrunedMLP *pmlp) {
+    size_t bytes = 0;
+    for (int i = 0; i < pmlp->num_layers; i++) {
+        const PrunedLayer *layer = &pmlp->layers[i];
+        if (layer->dense.data != NULL) {
+            bytes += (size_t)layer->prev_num_neurons * layer->num_neurons * sizeof(float);
+        } else {
+            bytes += (size_t)layer->weights.capacity * (layer->block_width * sizeof(float) + sizeof(int))
+                     + (stored_rows(layer) + 1) * sizeof(int);
+        }
+        bytes += layer->num_neurons * sizeof(float);
+    }
+    return bytes;
+}
+
+// widest layer, rounded up to whole runs so the last strip of a block-sparse layer can overhang
+static int scratch_width(const PrunedMLP *pmlp) {
+    int width = 0;
+    for (int i = 0; i < pmlp->num_layers; i++) {
+        width = pmlp->layers[i].num_neurons > width ? pmlp->layers[i].num_neurons : width;
+    }
+    return (width + SPARSE_BLOCK_WIDTH - 1) / SPARSE_BLOCK_WIDTH * SPARSE_BLOCK_WIDTH;
+}
+
+// two ping-pong buffers wide enough for the widest layer
+size_t pruned_scratch_bytes(const PrunedMLP *pmlp, int max_batch_size) {
+    return 2 * arena_matrix_bytes(max_batch_size, scratch_width(pmlp));
+}
+
+/*
+    Runs a batch through the pruned network and returns the logits of the output layer
+    Parameters:
+    inputs: batch_size x input_size
+    scratch: at least pruned_scratch_bytes(pmlp, batch_size) bytes, aligned to MATRIX_ALIGNMENT
+    predictions: receives the argmax of every row, or NULL
+    Like mlp_infer the logits live in scratch and any number of threads can run the same model with
+    their own scratch. Sparse layers go through sgemm_sparse_fused for any batch size.
+*/
+Matrix pruned_infer(const PrunedMLP *pmlp, Matrix inputs, void *scratch, int *predictions) {
+    int batch_size = inputs.rows, width = scratch_width(pmlp);
+    float *buffers[2] = { scratch, (float *)((char *)scratch + arena_matrix_bytes(batch_size, width)) };
+
+    Matrix x = inputs;
+    for (int i = 0; i < pmlp->num_layers; i++) {
+        const PrunedLayer *layer = &pmlp->layers[i];
+        Matrix y = matrix_view(buffers[i % 2], batch_size, layer->num_neurons, width);
+        void (*activation)(float*, float*, size_t) = i < pmlp->num_layers - 1 ? layer->activation : NULL;
+        GemmEpilogue epilogue = { layer->biases, { NULL }, activation, activation_is_rowwise(activation) };
+        if (layer->dense.data == NULL) {
+            sgemm_sparse_fused(x, layer->weights, layer->block_width, y, &epilogue);
+        } else if (batch_size >= PRUNED_GEMV_ROWS) {
+            sgemm_fused(NULL, GEMM_N, GEMM_N, 1.0f, x, layer->dense, 0.0f, y, &epilogue);
+        } else {
+            for (int r = 0; r < batch_size; r++) {
+                sgemv_fused(matrix_row(x, r), layer->dense, matrix_row(y, r), &epilogue);
+            }
+        }
+        x = y;
+    }
+
+    if (predictions != NULL) {
+        for (int i = 0; i < batch_size; i++) {
+            const float *row = matrix_row(x, i);
+            int max_idx = 0;
+            for (int j = 1; j < x.cols; j++) {
+                if (row[j] > row[max_idx]) {
+                    max_idx = j;
+                }
+            }
+            predictions[i] = max_idx;
+        }
+    }
+    return x;
+}
+
+// returns 0 on success
+int pruned_save(const PrunedMLP *pmlp, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file %s\n", path);
+        return -1;
+    }
+    PrunedHeader header = {0};
+    memcpy(header.magic, PRUNED_MAGIC, 8);
+    header.version = PRUNED_VERSION;
+    header.num_layers = pmlp->num_layers;
+    header.input_size = pmlp->input_size;
+    int error = fwrite(&header, sizeof(header), 1, file) != 1;
+    for (int i = 0; i < pmlp->num_layers && !error; i++) {
+        const PrunedLayer *layer = &pmlp->layers[i];
+        PrunedLayerHeader layer_header = {0};
+        layer_header.num_neurons = layer->num_neurons;
+        layer_header.prev_num_neurons = layer->prev_num_neurons;
+        layer_header.activation_id = activation_id(layer->activation);
+        layer_header.block_width = layer->block_width;
+        layer_header.dense = layer->dense.data != NULL;
+        layer_header.entries = layer_header.dense ? 0 : layer->weights.capacity;
+        size_t weights = (size_t)layer->prev_num_neurons * layer->num_neurons, entries = layer_header.entries;
+        error = layer_header.activation_id == 0 || fwrite(&layer_header, sizeof(layer_header), 1, file) != 1;
+        if (!error && layer_header.dense) {
+            error = fwrite(layer->dense.data, sizeof(float), weights, file) != weights;
+        } else if (!error) {
+            error = fwrite(layer->weights.row_start, sizeof(int), stored_rows(layer) + 1, file) != (size_t)stored_rows(layer) + 1
+                || fwrite(layer->weights.indices, sizeof(int), entries, file) != entries
+                || fwrite(layer->weights.values, sizeof(float), entries * layer->block_width, file) != entries * layer->block_width;
+        }
+        error = error || fwrite(layer->biases, sizeof(float), layer->num_neurons, file) != (size_t)layer->num_neurons;
+    }
+    error = fclose(file) != 0 || error;
+    if (error) {
+        fprintf(stderr, "Could not write pruned model %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// row offsets that run from 0 to entries without going back, and entries of existing inputs
+static int valid_structure(const PrunedLayer *layer) {
+    const SparseMatrix *W = &layer->weights;
+    int rows = stored_rows(layer);
+    if (W->row_start[0] != 0 || W->row_start[rows] != W->capacity) {
+        return 0;
+    }
+    for (int k = 0; k < rows; k++) {
+        if (W->row_start[k+1] < W->row_start[k]) {
+            return 0;
+        }
+    }
+    for (int q = 0; q < W->capacity; q++) {
+        if (W->indices[q] < 0 || W->indices[q] >= layer->prev_num_neurons) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// bytes left in the file after the current position, -1 if they can not be told
+static long remaining_bytes(FILE *file) {
+    long position = ftell(file);
+    if (position < 0 || fseek(file, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    long end = ftell(file);
+    return fseek(file, position, SEEK_SET) == 0 && end >= position ? end - position : -1;
+}
+
+// bytes a layer's weights and biases take in the file
+static size_t layer_file_bytes(const PrunedLayer *layer, int dense, size_t entries) {
+    size_t weights = dense ? (size_t)layer->prev_num_neurons * layer->num_neurons * sizeof(float)
+                           : ((size_t)stored_rows(layer) + 1 + entries) * sizeof(int) + entries * layer->block_width * sizeof(float);
+    return weights + (size_t)layer->num_neurons * sizeof(float);
+}
+
+/*
+    returns NULL if the file is missing or malformed
+    Every count is checked against INT_MAX and the bytes left in the file before anything is
+    allocated, so a crafted header can not make the load allocate more than the file holds.
+*/
+PrunedMLP *pruned_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file %s\n", path);
+        return NULL;
+    }
+    PrunedHeader header;
+    int valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, PRUNED_MAGIC, 8) == 0
+        && header.version == PRUNED_VERSION && header.num_layers > 0 && header.input_size > 0 && header.input_size <= INT_MAX;
+    long remaining = valid ? remaining_bytes(file) : -1;
+    if (remaining < 0 || header.num_layers > (size_t)remaining / sizeof(PrunedLayerHeader)) {
+        fprintf(stderr, "%s is not a version %d pruned model\n", path, PRUNED_VERSION);
+        fclose(file);
+        return NULL;
+    }
+    PrunedMLP *pmlp = malloc(sizeof(PrunedMLP));
+    PrunedLayer *layers = calloc(header.num_layers, sizeof(PrunedLayer));
+    if (pmlp == NULL || layers == NULL) {
+        fprintf(stderr, "Could not allocate a pruned model of %u layers\n", header.num_layers);
+        free(pmlp);
+        free(layers);
+        fclose(file);
+        return NULL;
+    }
+    pmlp->num_layers = 0;
+    pmlp->input_size = header.input_size;
+    pmlp->layers = layers;
+    for (uint32_t i = 0; i < header.num_layers && valid; i++) {
+        PrunedLayerHeader layer_header;
+        void (*activation_prime)(float*, float*, size_t);
+        PrunedLayer *layer = &pmlp->layers[i];
+        valid = fread(&layer_header, sizeof(layer_header), 1, file) == 1
+            && layer_header.num_neurons > 0 && layer_header.num_neurons <= INT_MAX && layer_header.entries <= INT_MAX
+            && layer_header.prev_num_neurons == (i == 0 ? header.input_size : (uint32_t)pmlp->layers[i-1].num_neurons)
+            && activation_from_id(layer_header.activation_id, &layer->activation, &activation_prime) == 0
+            && (layer_header.block_width == 1 || layer_header.block_width == SPARSE_BLOCK_WIDTH)
+            && layer_header.entries <= (uint64_t)layer_header.prev_num_neurons * layer_header.num_neurons;
+        if (!valid) {
+            break;
+        }
+        layer->num_neurons = layer_header.num_neurons;
+        layer->prev_num_neurons = layer_header.prev_num_neurons;
+        layer->block_width = layer_header.block_width;
+        remaining = remaining_bytes(file);
+        if (remaining < 0 || layer_file_bytes(layer, layer_header.dense != 0, layer_header.entries) > (size_t)remaining) {
+            valid = 0;
+            break;
+        }
+        if (layer_header.dense) {
+            layer->dense = allocate_matrix(layer->prev_num_neurons, layer->num_neurons);
+        }
+        layer_alloc(layer, layer_header.entries);
+        pmlp->num_layers++;
+        size_t weights = (size_t)layer->prev_num_neurons * layer->num_neurons, entries = layer_header.entries;
+        if (layer_header.dense) {
+            valid = fread(layer->dense.data, sizeof(float), weights, file) == weights;
+        } else {
+            valid = fread(layer->weights.row_start, sizeof(int), stored_rows(layer) + 1, file) == (size_t)stored_rows(layer) + 1
+                && fread(layer->weights.indices, sizeof(int), entries, file) == entries
+                && fread(layer->weights.values, sizeof(float), entries * layer->block_width, file) == entries * layer->block_width
+                && valid_structure(layer);
+        }
+        valid = valid && fread(layer->biases, sizeof(float), layer->num_neurons, file) == (size_t)layer->num_neurons;
+    }
+    fclose(file);
+    if (!valid) {
+        fprintf(stderr, "%s is not a valid version %d pruned model\n", path, PRUNED_VERSION);
+        pruned_free(pmlp);
+        return NULL;
+    }
+    return pmlp;
+}
+
+typedef Matrix (*infer_function)(const void *model, Matrix inputs, void *scratch, int *predictions);
+
+static Matrix infer_dense(const void *model, Matrix inputs, void *scratch, int *predictions) {
+    return mlp_infer(model, inputs, scratch, predictions);
+}
+
+static Matrix infer_pruned(const void *model, Matrix inputs, void *scratch, int *predictions) {
+    return pruned_infer(model, inputs, scratch, predictions);
+}
+
+// microseconds per sample of one pass of the inputs through infer in batches of batch_size
+static double time_pass(infer_function infer, const void *model, Matrix inputs, int batch_size, void *scratch) {
+    int predictions[batch_size];
+    double start = now_seconds();
+    for (int r = 0; r < inputs.rows; r += batch_size) {
+        int rows = inputs.rows - r < batch_size ? inputs.rows - r : batch_size;
+        infer(model, matrix_row_view(inputs, r, rows), scratch, predictions);
+    }
+    return (now_seconds() - start) / inputs.rows * 1e6;
+}
+
+// best pass of the dense and the pruned model, alternated so that the machine slowing down hits both alike
+static void time_inference(const MLP *mlp, void *dense_scratch, const PrunedMLP *pmlp, void *pruned_scratch, Matrix inputs,
+                           int batch_size, double *dense, double *pruned) {
+    double start = now_seconds();
+    *dense = *pruned = INFINITY;
+    while (now_seconds() - start < TIMING_SECONDS) {
+        double pass = time_pass(infer_dense, mlp, inputs, batch_size, dense_scratch);
+        *dense = pass < *dense ? pass : *dense;
+        pass = time_pass(infer_pruned, pmlp, inputs, batch_size, pruned_scratch);
+        *pruned = pass < *pruned ? pass : *pruned;
+    }
+}
+
+/*
+    validate at a series of sparsity levels: prunes the model one-shot to each level in turn (no
+    retraining in between, so the levels should ascend) and prints the loss and accuracy over the
+    dataset, the size of the exported model and its inference time per sample against the dense
+    model's, timed alongside it, for requests of one sample and for batches of EVALUATION_BATCH_SIZE
+    A level of 0 reports the model as it is. The weights and masks are restored afterwards.
+*/
+void validate_pruning(MLP *mlp, Dataset *dataset, const float *sparsities, int num_levels, int scope, int block_width) {
+    if (mlp->map != NULL) {
+        fprintf(stderr, "validate_pruning needs a model that owns its weights\n");
+        return;
+    }
+    float *saved[mlp->num_layers];
+    uint8_t *saved_masks[mlp->num_layers];
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        size_t n = (size_t)layer->prev_num_neurons * layer->num_neurons;
+        saved[i] = malloc(n * sizeof(float));
+        memcpy(saved[i], layer->weights.data, n * sizeof(float));
+        saved_masks[i] = layer->mask;
+        layer->mask = NULL;
+    }
+
+    Matrix timing_inputs, timing_targets;
+    int timing_samples = dataset->num_samples < TIMING_SAMPLES ? dataset->num_samples : TIMING_SAMPLES;
+    dataset_batch(dataset, 0, timing_samples, &timing_inputs, &timing_targets);
+    Matrix inputs = allocate_matrix(timing_samples, timing_inputs.cols);
+    matrix_copy(inputs, timing_inputs);
+    void *dense_scratch = aligned_alloc(MATRIX_ALIGNMENT, mlp_inference_scratch_bytes(mlp, EVALUATION_BATCH_SIZE));
+    size_t dense_bytes = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        dense_bytes += ((size_t)mlp->layers[i]->prev_num_neurons + 1) * mlp->layers[i]->num_neurons * sizeof(float);
+    }
+
+    printf("%s magnitude pruning %s, dense model %.1f KB, speedups over it in batches of 1 and %d\n",
+           scope == PRUNE_GLOBAL ? "global" : "per-layer", block_width == 1 ? "of single weights" : "in blocks of 8",
+           dense_bytes / 1024.0, EVALUATION_BATCH_SIZE);
+    printf("%9s %10s %10s %10s %12s %9s %12s %9s\n", "sparsity", "loss", "accuracy", "size KB", "us/request", "speedup",
+           "us/sample", "speedup");
+    for (int l = 0; l < num_levels; l++) {
+        if (sparsities[l] > 0 && mlp_prune(mlp, sparsities[l], scope, block_width) != 0) {
+            break;
+        }
+        Evaluation evaluation = mlp_evaluate(mlp, dataset, 0, dataset->num_samples, EVALUATION_BATCH_SIZE);
+        PrunedMLP *pmlp = prune_export(mlp, block_width);
+        if (pmlp == NULL) {
+            break;
+        }
+        void *scratch = aligned_alloc(MATRIX_ALIGNMENT, pruned_scratch_bytes(pmlp, EVALUATION_BATCH_SIZE));
+        double dense_latency, latency, dense_batched, batched;
+        time_inference(mlp, dense_scratch, pmlp, scratch, inputs, 1, &dense_latency, &latency);
+        time_inference(mlp, dense_scratch, pmlp, scratch, inputs, EVALUATION_BATCH_SIZE, &dense_batched, &batched);
+        printf("%9.3f %10.4f %10.4f %10.1f %12.2f %8.2fx %12.3f %8.2fx\n", mlp_sparsity(mlp), evaluation.loss, evaluation.accuracy,
+               pruned_model_bytes(pmlp) / 1024.0, latency, dense_latency / latency, batched, dense_batched / batched);
+        free(scratch);
+        pruned_free(pmlp);
+    }
+
+    free(dense_scratch);
+    free_matrix(inputs);
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        memcpy(layer->weights.data, saved[i], (size_t)layer->prev_num_neurons * layer->num_neurons * sizeof(float));
+        free(saved[i]);
+        free(layer->mask);
+        layer->mask = saved_masks[i];
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef PRUNE_H
+#define PRUNE_H
+#include<stdint.h>
+#include"matrix.h"
+#include"sparse.h"
+#include"dataset.h"
+
+typedef struct MLP MLP;
+
+// what a sparsity is measured over
+#define PRUNE_GLOBAL 0    // one magnitude threshold across the weights of every layer
+#define PRUNE_PER_LAYER 1 // every layer pruned to the sparsity on its own
+
+// layers whose exported weights would keep more than this fraction of entries stay dense: runs of
+// SPARSE_BLOCK_WIDTH beat the dense GEMV and GEMM up to about a third, single weights only below a few percent
+#define PRUNE_MAX_DENSITY 0.3f
+#define PRUNE_MAX_SINGLE_DENSITY 0.05f
+
+/*
+    Gradual magnitude pruning during train, see mlp_set_pruning
+    From begin_epoch to end_epoch the pruned fraction of the weights follows the cubic
+        s(e) = sparsity * (1 - (1 - (e - begin_epoch) / (end_epoch - begin_epoch))^3)
+    which prunes fastest while there is redundancy to remove and slows down near the target, so the
+    network recovers in between. Later epochs train at the target with the pruned weights held at zero.
+    block_width 1 prunes single weights; SPARSE_BLOCK_WIDTH prunes runs of that many outputs of one
+    input by their mean magnitude, which the block-sparse kernels then skip as a whole.
+*/
+typedef struct {
+    float sparsity; // 0 turns pruning off
+    int scope;
+    int block_width;
+    int begin_epoch;
+    int end_epoch;
+} PruneSchedule;
+
+int mlp_prune(MLP *mlp, float sparsity, int scope, int block_width);
+void mlp_set_pruning(MLP *mlp, PruneSchedule schedule);
+void mlp_update_pruning(MLP *mlp);
+float mlp_sparsity(const MLP *mlp);
+
+/*
+    A pruned model for serving
+    Sparse weights are stored by output and run through sgemm_sparse_fused: weights is the CSR form of
+    the transposed weights, num_neurons x prev_num_neurons, for single weights (block_width 1), and its
+    block-sparse form for runs, one row per strip of SPARSE_BLOCK_WIDTH outputs, see SparseMatrix.
+    Layers too dense for that (see prune_export) keep dense weights and go through the same GEMV / GEMM
+    as mlp_infer; dense.data is NULL for sparse layers.
+*/
+typedef struct {
+    int num_neurons;
+    int prev_num_neurons;
+    int block_width;
+    SparseMatrix weights;
+    Matrix dense;
+    float *biases;
+    void (*activation)(float*, float*, size_t);
+} PrunedLayer;
+
+typedef struct {
+    PrunedLayer *layers;
+    int num_layers;
+    int input_size;
+} PrunedMLP;
+
+#define PRUNED_MAGIC "MLPPRUNE"
+#define PRUNED_VERSION 2
+
+PrunedMLP *prune_export(const MLP *mlp, int block_width);
+void pruned_free(PrunedMLP *pmlp);
+size_t pruned_model_bytes(const PrunedMLP *pmlp);
+size_t pruned_scratch_bytes(const PrunedMLP *pmlp, int max_batch_size);
+Matrix pruned_infer(const PrunedMLP *pmlp, Matrix inputs, void *scratch, int *predictions);
+int pruned_save(const PrunedMLP *pmlp, const char *path);
+PrunedMLP *pruned_load(const char *path);
+void validate_pruning(MLP *mlp, Dataset *dataset, const float *sparsities, int num_levels, int scope, int block_width);
+
+#endif
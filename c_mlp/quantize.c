@@ -0,0 +1,445 @@
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<math.h>
+#include<limits.h>
+#include"quantize.h"
+#include"quantize_kernels.h"
+#include"activation.h"
+
+#define QUANT_MAX 127 // weights in [-127, 127], activations in [0, 127]
+#define CALIBRATION_BATCH 256
+
+/*
+    Quantized model file (little-endian):
+    QuantizedHeader, then for every layer a QuantizedLayerHeader followed by its packed weights
+    (n8 * k4 * 32 bytes), scales and biases (num_neurons floats each).
+*/
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t num_layers;
+    uint32_t input_size;
+    uint32_t reserved;
+} QuantizedHeader;
+
+typedef struct {
+    uint32_t num_neurons;
+    uint32_t prev_num_neurons;
+    uint32_t activation_id;
+    int32_t input_zero_point;
+    float input_scale;
+    uint32_t reserved;
+} QuantizedLayerHeader;
+
+static const QuantKernel *active_kernel = NULL;
+
+static int kernel_supported(const QuantKernel *kernel) {
+#ifdef QUANT_HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (kernel == &quant_kernel_avx512vnni) {
+        return __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl");
+    }
+    if (kernel == &quant_kernel_avxvnni) {
+        return __builtin_cpu_supports("avxvnni");
+    }
+    if (kernel == &quant_kernel_avx2) {
+        return __builtin_cpu_supports("avx2");
+    }
+#endif
+    return kernel == &quant_kernel_scalar;
+}
+
+static const QuantKernel *find_kernel(const char *name) {
+    const QuantKernel *kernels[] = {
+#ifdef QUANT_HAVE_X86_KERNELS
+        &quant_kernel_avx512vnni, &quant_kernel_avxvnni, &quant_kernel_avx2,
+#endif
+        &quant_kernel_scalar
+    };
+    int num_kernels = sizeof(kernels) / sizeof(kernels[0]);
+    for (int i = 0; i < num_kernels; i++) {
+        int matches = name == NULL || strcmp(name, "auto") == 0 || strcmp(name, kernels[i]->name) == 0;
+        if (matches && kernel_supported(kernels[i])) {
+            return kernels[i];
+        }
+    }
+    return NULL;
+}
+
+static const QuantKernel *current_kernel() {
+    if (active_kernel == NULL) {
+        // MLP_QGEMM_KERNEL=scalar|avx2|avxvnni|avx512vnni overrides the CPUID choice
+        const char *name = getenv("MLP_QGEMM_KERNEL");
+        active_kernel = name != NULL ? find_kernel(name) : NULL;
+        if (active_kernel == NULL) {
+            active_kernel = find_kernel("auto");
+        }
+    }
+    return active_kernel;
+}
+
+// selects an integer kernel by name ("auto" picks the fastest one the CPU supports), returns -1 if unavailable
+int quantize_select_kernel(const char *name) {
+    const QuantKernel *kernel = find_kernel(name);
+    if (kernel == NULL) {
+        return -1;
+    }
+    active_kernel = kernel;
+    return 0;
+}
+
+const char *quantize_kernel_name() {
+    return current_kernel()->name;
+}
+
+static size_t align_up(size_t bytes) {
+    return (bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+static void *aligned_zeroed(size_t bytes) {
+    void *block = aligned_alloc(MATRIX_ALIGNMENT, align_up(bytes > 0 ? bytes : 1));
+    if (block == NULL) {
+        fprintf(stderr, "Could not allocate %zu bytes\n", bytes);
+        exit(1);
+    }
+    memset(block, 0, align_up(bytes));
+    return block;
+}
+
+static size_t packed_weight_bytes(const QuantizedLayer *layer) {
+    return (size_t)layer->n8 * layer->k4 * QGEMM_NR * QGEMM_KR;
+}
+
+// packed dimensions of a layer whose sizes are set
+static void layer_shape(QuantizedLayer *layer) {
+    layer->k4 = (layer->prev_num_neurons + QGEMM_KR - 1) / QGEMM_KR;
+    layer->n8 = (layer->num_neurons + QGEMM_NR - 1) / QGEMM_NR;
+}
+
+// allocates the buffers of a layer whose sizes, activation and input quantization are set
+static void layer_alloc(QuantizedLayer *layer) {
+    layer_shape(layer);
+    layer->weights = aligned_zeroed(packed_weight_bytes(layer));
+    layer->scales = aligned_zeroed(layer->num_neurons * sizeof(float));
+    layer->biases = aligned_zeroed(layer->num_neurons * sizeof(float));
+}
+
+// scale and zero point covering [lo, hi], which always contains 0 so that 0 is exact
+static void input_quantization(float lo, float hi, float *scale, int *zero_point) {
+    *scale = (hi - lo) / QUANT_MAX;
+    if (*scale == 0) {
+        *scale = 1;
+    }
+    *zero_point = (int)lrintf(-lo / *scale);
+    if (*zero_point > QUANT_MAX) {
+        *zero_point = QUANT_MAX;
+    }
+}
+
+// range of the inputs of every layer over the calibration samples, run through the float model
+static void calibrate(MLP *mlp, Matrix calibration, float *lo, float *hi) {
+    for (int i = 0; i < mlp->num_layers; i++) {
+        lo[i] = hi[i] = 0;
+    }
+    for (int start = 0; start < calibration.rows; start += CALIBRATION_BATCH) {
+        int count = calibration.rows - start < CALIBRATION_BATCH ? calibration.rows - start : CALIBRATION_BATCH;
+        Matrix **activations = batch_forward(mlp, matrix_row_view(calibration, start, count));
+        for (int i = 0; i < mlp->num_layers; i++) {
+            // a mixed precision model keeps its hidden outputs in bf16
+            int hidden_bf16 = mlp->mixed_precision && i > 0;
+            Matrix inputs = activations[1][i];
+            MatrixBF16 inputs_bf16 = mlp->workspace.activations_bf16[1][i];
+            int cols = hidden_bf16 ? inputs_bf16.cols : inputs.cols;
+            for (int r = 0; r < count; r++) {
+                for (int j = 0; j < cols; j++) {
+                    float x = hidden_bf16 ? bf16_to_float(matrix_bf16_row(inputs_bf16, r)[j]) : matrix_row(inputs, r)[j];
+                    lo[i] = x < lo[i] ? x : lo[i];
+                    hi[i] = x > hi[i] ? x : hi[i];
+                }
+            }
+        }
+    }
+}
+
+// per output neuron symmetric weights, packed for the kernels, and the float epilogue constants
+static void quantize_weights(QuantizedLayer *qlayer, const Layer *layer) {
+    for (int j = 0; j < layer->num_neurons; j++) {
+        float max = 0;
+        for (int k = 0; k < layer->prev_num_neurons; k++) {
+            float w = fabsf(MAT(layer->weights, k, j));
+            max = w > max ? w : max;
+        }
+        float weight_scale = max > 0 ? max / QUANT_MAX : 1;
+        int column_sum = 0;
+        int8_t *block = qlayer->weights + (size_t)(j / QGEMM_NR) * qlayer->k4 * QGEMM_NR * QGEMM_KR;
+        for (int k = 0; k < layer->prev_num_neurons; k++) {
+            int q = (int)lrintf(MAT(layer->weights, k, j) / weight_scale);
+            q = q > QUANT_MAX ? QUANT_MAX : q < -QUANT_MAX ? -QUANT_MAX : q;
+            block[(k / QGEMM_KR) * QGEMM_NR * QGEMM_KR + (j % QGEMM_NR) * QGEMM_KR + k % QGEMM_KR] = (int8_t)q;
+            column_sum += q;
+        }
+        qlayer->scales[j] = qlayer->input_scale * weight_scale;
+        qlayer->biases[j] = layer->biases[j] - qlayer->scales[j] * qlayer->input_zero_point * column_sum;
+    }
+}
+
+/*
+    Quantizes a trained model
+    Parameters:
+    calibration: sample inputs, a few thousand rows of the training set is plenty, that set the range
+                 of every layer's inputs
+    The float model is only read (its workspace is used for the calibration passes).
+*/
+QuantizedMLP *quantize_mlp(MLP *mlp, Matrix calibration) {
+    float *lo = malloc(mlp->num_layers * sizeof(float));
+    float *hi = malloc(mlp->num_layers * sizeof(float));
+    calibrate(mlp, calibration, lo, hi);
+
+    QuantizedMLP *qmlp = malloc(sizeof(QuantizedMLP));
+    qmlp->num_layers = mlp->num_layers;
+    qmlp->input_size = mlp->input_size;
+    qmlp->layers = calloc(mlp->num_layers, sizeof(QuantizedLayer));
+    for (int i = 0; i < mlp->num_layers; i++) {
+        QuantizedLayer *qlayer = &qmlp->layers[i];
+        Layer *layer = mlp->layers[i];
+        qlayer->num_neurons = layer->num_neurons;
+        qlayer->prev_num_neurons = layer->prev_num_neurons;
+        qlayer->activation = layer->activation;
+        input_quantization(lo[i], hi[i], &qlayer->input_scale, &qlayer->input_zero_point);
+        layer_alloc(qlayer);
+        quantize_weights(qlayer, layer);
+    }
+    free(lo);
+    free(hi);
+    return qmlp;
+}
+
+void quantized_free(QuantizedMLP *qmlp) {
+    for (int i = 0; i < qmlp->num_layers; i++) {
+        free(qmlp->layers[i].weights);
+        free(qmlp->layers[i].scales);
+        free(qmlp->layers[i].biases);
+    }
+    free(qmlp->layers);
+    free(qmlp);
+}
+
+// widest packed input, widest packed output and widest float output over the layers
+static void max_widths(const QuantizedMLP *qmlp, int *max_k, int *max_n_packed, int *max_n) {
+    *max_k = *max_n_packed = *max_n = 0;
+    for (int i = 0; i < qmlp->num_layers; i++) {
+        const QuantizedLayer *layer = &qmlp->layers[i];
+        *max_k = layer->k4 * QGEMM_KR > *max_k ? layer->k4 * QGEMM_KR : *max_k;
+        *max_n_packed = layer->n8 * QGEMM_NR > *max_n_packed ? layer->n8 * QGEMM_NR : *max_n_packed;
+        *max_n = layer->num_neurons > *max_n ? layer->num_neurons : *max_n;
+    }
+}
+
+// two ping-pong uint8 activation buffers, the int32 GEMM output and the float outputs of a layer
+size_t quantized_scratch_bytes(const QuantizedMLP *qmlp, int max_batch_size) {
+    int max_k, max_n_packed, max_n;
+    max_widths(qmlp, &max_k, &max_n_packed, &max_n);
+    return 2 * align_up((size_t)max_batch_size * max_k)
+        + align_up((size_t)max_batch_size * max_n_packed * sizeof(int32_t))
+        + arena_matrix_bytes(max_batch_size, max_n);
+}
+
+/*
+    q = round(x / scale + zero_point) clamped to [lo, 127], the padding up to width is zeroed
+    Clamping first keeps the value positive, so truncating after adding 0.5 rounds and the loop
+    vectorizes (lrintf is a libm call).
+*/
+static void quantize_row(const float *x, int n, uint8_t *q, int width, float scale, int zero_point, int lo) {
+    float inverse = 1.0f / scale;
+    float min = lo, max = QUANT_MAX, offset = zero_point + 0.5f;
+    for (int j = 0; j < n; j++) {
+        float v = x[j] * inverse + offset;
+        v = v < min + 0.5f ? min + 0.5f : v;
+        v = v > max + 0.5f ? max + 0.5f : v;
+        q[j] = (uint8_t)(int)v;
+    }
+    memset(q + n, 0, width - n);
+}
+
+/*
+    Runs a batch through the quantized network and returns the float logits of the output layer
+    Parameters:
+    inputs: batch_size x input_size floats
+    scratch: at least quantized_scratch_bytes(qmlp, batch_size) bytes, aligned to MATRIX_ALIGNMENT
+    predictions: receives the argmax of every row, or NULL
+    Like mlp_infer the logits live in scratch, the output layer's activation is not applied, and any
+    number of threads can run the same model with their own scratch.
+*/
+Matrix quantized_infer(const QuantizedMLP *qmlp, Matrix inputs, void *scratch, int *predictions) {
+    int batch_size = inputs.rows;
+    int max_k, max_n_packed, max_n;
+    max_widths(qmlp, &max_k, &max_n_packed, &max_n);
+    size_t activation_bytes = align_up((size_t)batch_size * max_k);
+    uint8_t *activations[2] = { scratch, (uint8_t *)scratch + activation_bytes };
+    int32_t *sums = (int32_t *)((char *)scratch + 2 * activation_bytes);
+    float *outputs = (float *)((char *)sums + align_up((size_t)batch_size * max_n_packed * sizeof(int32_t)));
+    qgemm_kernel qgemm = current_kernel()->qgemm;
+
+    const QuantizedLayer *first = &qmlp->layers[0];
+    for (int r = 0; r < batch_size; r++) {
+        quantize_row(matrix_row(inputs, r), first->prev_num_neurons, activations[0] + (size_t)r * first->k4 * QGEMM_KR,
+                     first->k4 * QGEMM_KR, first->input_scale, first->input_zero_point, 0);
+    }
+
+    Matrix y = { NULL };
+    for (int i = 0; i < qmlp->num_layers; i++) {
+        const QuantizedLayer *layer = &qmlp->layers[i];
+        int n_packed = layer->n8 * QGEMM_NR;
+        qgemm(batch_size, n_packed, layer->k4, activations[i % 2], layer->k4 * QGEMM_KR, layer->weights, sums, n_packed);
+
+        y = matrix_view(outputs, batch_size, layer->num_neurons, layer->num_neurons);
+        const QuantizedLayer *next = i < qmlp->num_layers - 1 ? &qmlp->layers[i + 1] : NULL;
+        // ReLU is the clamp at the zero point in quantize_row, anything else runs on the float row
+        int fused_relu = next != NULL && layer->activation == relu_vector;
+        for (int r = 0; r < batch_size; r++) {
+            float *row = matrix_row(y, r);
+            const int32_t *sum = sums + (size_t)r * n_packed;
+            for (int j = 0; j < layer->num_neurons; j++) {
+                row[j] = layer->scales[j] * sum[j] + layer->biases[j];
+            }
+            if (next == NULL) {
+                continue;
+            }
+            if (!fused_relu && layer->activation != NULL) {
+                layer->activation(row, row, layer->num_neurons);
+            }
+            quantize_row(row, layer->num_neurons, activations[(i + 1) % 2] + (size_t)r * next->k4 * QGEMM_KR, next->k4 * QGEMM_KR,
+                         next->input_scale, next->input_zero_point, fused_relu ? next->input_zero_point : 0);
+        }
+    }
+
+    if (predictions != NULL) {
+        for (int i = 0; i < batch_size; i++) {
+            const float *row = matrix_row(y, i);
+            int max_idx = 0;
+            for (int j = 1; j < y.cols; j++) {
+                if (row[j] > row[max_idx]) {
+                    max_idx = j;
+                }
+            }
+            predictions[i] = max_idx;
+        }
+    }
+    return y;
+}
+
+// returns 0 on success
+int quantized_save(const QuantizedMLP *qmlp, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file %s\n", path);
+        return -1;
+    }
+    QuantizedHeader header = {0};
+    memcpy(header.magic, QUANTIZED_MAGIC, 8);
+    header.version = QUANTIZED_VERSION;
+    header.num_layers = qmlp->num_layers;
+    header.input_size = qmlp->input_size;
+    int error = fwrite(&header, sizeof(header), 1, file) != 1;
+    for (int i = 0; i < qmlp->num_layers && !error; i++) {
+        const QuantizedLayer *layer = &qmlp->layers[i];
+        QuantizedLayerHeader layer_header = {0};
+        layer_header.num_neurons = layer->num_neurons;
+        layer_header.prev_num_neurons = layer->prev_num_neurons;
+        layer_header.activation_id = activation_id(layer->activation);
+        layer_header.input_zero_point = layer->input_zero_point;
+        layer_header.input_scale = layer->input_scale;
+        error = layer_header.activation_id == 0
+            || fwrite(&layer_header, sizeof(layer_header), 1, file) != 1
+            || fwrite(layer->weights, 1, packed_weight_bytes(layer), file) != packed_weight_bytes(layer)
+            || fwrite(layer->scales, sizeof(float), layer->num_neurons, file) != (size_t)layer->num_neurons
+            || fwrite(layer->biases, sizeof(float), layer->num_neurons, file) != (size_t)layer->num_neurons;
+    }
+    error = fclose(file) != 0 || error;
+    if (error) {
+        fprintf(stderr, "Could not write quantized model %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// bytes left in the file after the current position, -1 if they can not be told
+static long remaining_bytes(FILE *file) {
+    long position = ftell(file);
+    if (position < 0 || fseek(file, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    long end = ftell(file);
+    return fseek(file, position, SEEK_SET) == 0 && end >= position ? end - position : -1;
+}
+
+/*
+    returns NULL if the file is missing or malformed
+    Every count is checked against INT_MAX and the bytes left in the file before anything is
+    allocated, so a crafted header can not make the load allocate more than the file holds.
+*/
+QuantizedMLP *quantized_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file %s\n", path);
+        return NULL;
+    }
+    QuantizedHeader header;
+    int valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, QUANTIZED_MAGIC, 8) == 0
+        && header.version == QUANTIZED_VERSION && header.num_layers > 0 && header.input_size > 0 && header.input_size <= INT_MAX;
+    long remaining = valid ? remaining_bytes(file) : -1;
+    if (remaining < 0 || header.num_layers > (size_t)remaining / sizeof(QuantizedLayerHeader)) {
+        fprintf(stderr, "%s is not a version %d quantized model\n", path, QUANTIZED_VERSION);
+        fclose(file);
+        return NULL;
+    }
+    QuantizedMLP *qmlp = malloc(sizeof(QuantizedMLP));
+    QuantizedLayer *layers = calloc(header.num_layers, sizeof(QuantizedLayer));
+    if (qmlp == NULL || layers == NULL) {
+        fprintf(stderr, "Could not allocate a quantized model of %u layers\n", header.num_layers);
+        free(qmlp);
+        free(layers);
+        fclose(file);
+        return NULL;
+    }
+    qmlp->num_layers = 0;
+    qmlp->input_size = header.input_size;
+    qmlp->layers = layers;
+    for (uint32_t i = 0; i < header.num_layers && valid; i++) {
+        QuantizedLayerHeader layer_header;
+        void (*activation_prime)(float*, float*, size_t);
+        QuantizedLayer *layer = &qmlp->layers[i];
+        valid = fread(&layer_header, sizeof(layer_header), 1, file) == 1
+            && layer_header.num_neurons > 0 && layer_header.num_neurons <= INT_MAX
+            && layer_header.prev_num_neurons == (i == 0 ? header.input_size : qmlp->layers[i-1].num_neurons)
+            && activation_from_id(layer_header.activation_id, &layer->activation, &activation_prime) == 0
+            && layer_header.input_zero_point >= 0 && layer_header.input_zero_point <= QUANT_MAX
+            && layer_header.input_scale > 0;
+        if (!valid) {
+            break;
+        }
+        layer->num_neurons = layer_header.num_neurons;
+        layer->prev_num_neurons = layer_header.prev_num_neurons;
+        layer->input_zero_point = layer_header.input_zero_point;
+        layer->input_scale = layer_header.input_scale;
+        layer_shape(layer);
+        remaining = remaining_bytes(file);
+        if (remaining < 0 || packed_weight_bytes(layer) + 2 * (size_t)layer->num_neurons * sizeof(float) > (size_t)remaining) {
+            valid = 0;
+            break;
+        }
+        layer_alloc(layer);
+        qmlp->num_layers++;
+        valid = fread(layer->weights, 1, packed_weight_bytes(layer), file) == packed_weight_bytes(layer)
+            && fread(layer->scales, sizeof(float), layer->num_neurons, file) == (size_t)layer->num_neurons
+            && fread(layer->biases, sizeof(float), layer->num_neurons, file) == (size_t)layer->num_neurons;
+    }
+    fclose(file);
+    if (!valid) {
+        fprintf(stderr, "%s is not a valid version %d quantized model\n", path, QUANTIZED_VERSION);
+        quantized_free(qmlp);
+        return NULL;
+    }
+    return qmlp;
+}
@@ -0,0 +1,46 @@
+#ifndef QUANTIZE_H
+#define QUANTIZE_H
+#include<stdint.h>
+#include"mlp.h"
+
+/*
+    Post-training INT8 quantization for serving
+    Weights are symmetric int8 with one scale per output neuron. The inputs of every layer are unsigned
+    7-bit values with a scale and zero point calibrated from the range the float model produces on a
+    sample of data, so x ~= input_scale * (q - input_zero_point).
+    Layers run as int8 x uint8 -> int32 GEMMs (see quantize_kernels.h). The int32 sums are turned back
+    into floats with one multiply-add per output (the zero point's contribution is folded into the
+    bias), activated, and requantized straight into the next layer's input, ReLU by clamping at the
+    zero point. The output layer returns float logits.
+*/
+typedef struct {
+    int num_neurons;
+    int prev_num_neurons;
+    int k4, n8;           // prev_num_neurons / 4 and num_neurons / 8, rounded up: the packed shape
+    int8_t *weights;      // n8 * k4 * 32 bytes, in the block layout of quantize_kernels.h
+    float *scales;        // input_scale * weight scale, one per output neuron
+    float *biases;        // float biases minus scales * input_zero_point * column sums of the weights
+    float input_scale;
+    int input_zero_point;
+    void (*activation)(float*, float*, size_t);
+} QuantizedLayer;
+
+typedef struct {
+    QuantizedLayer *layers;
+    int num_layers;
+    int input_size;
+} QuantizedMLP;
+
+#define QUANTIZED_MAGIC "MLPQINT8"
+#define QUANTIZED_VERSION 1
+
+QuantizedMLP *quantize_mlp(MLP *mlp, Matrix calibration);
+void quantized_free(QuantizedMLP *qmlp);
+size_t quantized_scratch_bytes(const QuantizedMLP *qmlp, int max_batch_size);
+Matrix quantized_infer(const QuantizedMLP *qmlp, Matrix inputs, void *scratch, int *predictions);
+int quantized_save(const QuantizedMLP *qmlp, const char *path);
+QuantizedMLP *quantized_load(const char *path);
+int quantize_select_kernel(const char *name);
+const char *quantize_kernel_name();
+
+#endif
@@ -0,0 +1,128 @@
+#include<string.h>
+#include"quantize_kernels.h"
+
+static void qgemm_scalar(int m, int n, int k4, const uint8_t *a, int lda, const int8_t *b, int32_t *c, int ldc) {
+    for (int i = 0; i < m; i++) {
+        const uint8_t *row = a + (size_t)i * lda;
+        for (int j = 0; j < n; j += QGEMM_NR) {
+            const int8_t *block = b + (size_t)(j / QGEMM_NR) * k4 * QGEMM_NR * QGEMM_KR;
+            int32_t acc[QGEMM_NR] = {0};
+            for (int p = 0; p < k4; p++) {
+                const uint8_t *x = row + p * QGEMM_KR;
+                const int8_t *w = block + p * QGEMM_NR * QGEMM_KR;
+                for (int jj = 0; jj < QGEMM_NR; jj++) {
+                    acc[jj] += x[0] * w[4*jj] + x[1] * w[4*jj + 1] + x[2] * w[4*jj + 2] + x[3] * w[4*jj + 3];
+                }
+            }
+            memcpy(c + (size_t)i * ldc + j, acc, sizeof(acc));
+        }
+    }
+}
+
+const QuantKernel quant_kernel_scalar = { "scalar", qgemm_scalar };
+
+#ifdef QUANT_HAVE_X86_KERNELS
+#include<immintrin.h>
+
+/*
+    The x86 kernels share one body: tiles of up to MR rows x NB column blocks, MR * NB ymm accumulators.
+    Each step of k broadcasts 4 bytes of a row to every lane and multiplies them with 4 rows of the
+    block's 8 columns; DPBUSD adds the 4 products of each lane into its int32 accumulator. Column
+    blocks are the outer loop, so the NB blocks of B stay in L1 while every row of A streams past.
+    The row and block loops are unrolled, otherwise gcc keeps acc in memory.
+*/
+#define QGEMM_KERNEL(NAME, TARGET, DPBUSD, MR, NB)                                                              \
+__attribute__((target(TARGET), always_inline))                                                                 \
+static inline void NAME##_tile(int rows, int blocks, int k4, const uint8_t *a, int lda, const int8_t *b,        \
+                               size_t block_stride, int32_t *c, int ldc) {                                      \
+    __m256i acc[MR][NB];                                                                                        \
+    _Pragma("GCC unroll 8")                                                                                     \
+    for (int r = 0; r < MR; r++) {                                                                              \
+        _Pragma("GCC unroll 8")                                                                                 \
+        for (int h = 0; h < NB; h++) {                                                                          \
+            acc[r][h] = _mm256_setzero_si256();                                                                 \
+        }                                                                                                       \
+    }                                                                                                           \
+    for (int p = 0; p < k4; p++) {                                                                              \
+        __m256i w[NB];                                                                                          \
+        _Pragma("GCC unroll 8")                                                                                 \
+        for (int h = 0; h < blocks; h++) {                                                                      \
+            w[h] = _mm256_load_si256((const __m256i *)(b + h * block_stride + p * 32));                         \
+        }                                                                                                       \
+        _Pragma("GCC unroll 8")                                                                                 \
+        for (int r = 0; r < rows; r++) {                                                                        \
+            int32_t x;                                                                                          \
+            memcpy(&x, a + (size_t)r * lda + p * 4, sizeof(x));                                                 \
+            __m256i xv = _mm256_set1_epi32(x);                                                                  \
+            _Pragma("GCC unroll 8")                                                                             \
+            for (int h = 0; h < blocks; h++) {                                                                  \
+                acc[r][h] = DPBUSD(acc[r][h], xv, w[h]);                                                        \
+            }                                                                                                   \
+        }                                                                                                       \
+    }                                                                                                           \
+    _Pragma("GCC unroll 8")                                                                                     \
+    for (int r = 0; r < rows; r++) {                                                                            \
+        _Pragma("GCC unroll 8")                                                                                 \
+        for (int h = 0; h < blocks; h++) {                                                                      \
+            _mm256_storeu_si256((__m256i *)(c + (size_t)r * ldc + h * QGEMM_NR), acc[r][h]);                   \
+        }                                                                                                       \
+    }                                                                                                           \
+}                                                                                                               \
+                                                                                                                \
+__attribute__((target(TARGET)))                                                                                \
+static void NAME(int m, int n, int k4, const uint8_t *a, int lda, const int8_t *b, int32_t *c, int ldc) {      \
+    size_t block_stride = (size_t)k4 * QGEMM_NR * QGEMM_KR;                                                     \
+    int num_blocks = n / QGEMM_NR;                                                                              \
+    for (int jb = 0; jb < num_blocks; jb += NB) {                                                               \
+        const int8_t *bj = b + jb * block_stride;                                                               \
+        int32_t *cj = c + jb * QGEMM_NR;                                                                        \
+        int i = 0;                                                                                              \
+        if (jb + NB <= num_blocks) {                                                                            \
+            for (; i + MR <= m; i += MR) {                                                                      \
+                NAME##_tile(MR, NB, k4, a + (size_t)i * lda, lda, bj, block_stride, cj + (size_t)i * ldc, ldc); \
+            }                                                                                                   \
+            for (; i < m; i++) {                                                                                \
+                NAME##_tile(1, NB, k4, a + (size_t)i * lda, lda, bj, block_stride, cj + (size_t)i * ldc, ldc);  \
+            }                                                                                                   \
+        } else {                                                                                                \
+            for (int h = jb; h < num_blocks; h++) {                                                             \
+                const int8_t *bh = b + h * block_stride;                                                        \
+                int32_t *ch = c + h * QGEMM_NR;                                                                 \
+                for (i = 0; i + MR <= m; i += MR) {                                                             \
+                    NAME##_tile(MR, 1, k4, a + (size_t)i * lda, lda, bh, block_stride, ch + (size_t)i * ldc, ldc); \
+                }                                                                                               \
+                for (; i < m; i++) {                                                                            \
+                    NAME##_tile(1, 1, k4, a + (size_t)i * lda, lda, bh, block_stride, ch + (size_t)i * ldc, ldc); \
+                }                                                                                               \
+            }                                                                                                   \
+        }                                                                                                       \
+    }                                                                                                           \
+}
+
+// vpmaddubsw gives int16 sums of adjacent pairs, vpmaddwd against ones widens and adds the pairs
+__attribute__((target("avx2"), always_inline))
+static inline __m256i dpbusd_avx2(__m256i acc, __m256i x, __m256i w) {
+    __m256i pairs = _mm256_maddubs_epi16(x, w);
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+}
+
+__attribute__((target("avxvnni"), always_inline))
+static inline __m256i dpbusd_avxvnni(__m256i acc, __m256i x, __m256i w) {
+    return _mm256_dpbusd_avx_epi32(acc, x, w);
+}
+
+__attribute__((target("avx512vnni,avx512vl"), always_inline))
+static inline __m256i dpbusd_avx512vnni(__m256i acc, __m256i x, __m256i w) {
+    return _mm256_dpbusd_epi32(acc, x, w);
+}
+
+// 16 ymm registers: 8 accumulators, leaving room for vpmaddubsw's temporaries (AVX2) or more B blocks
+QGEMM_KERNEL(qgemm_avx2, "avx2", dpbusd_avx2, 4, 2)
+QGEMM_KERNEL(qgemm_avxvnni, "avx2,avxvnni", dpbusd_avxvnni, 4, 3)
+// AVX-512VL has 32 ymm registers: 24 accumulators, 4 B blocks and the broadcast
+QGEMM_KERNEL(qgemm_avx512vnni, "avx2,avx512vnni,avx512vl", dpbusd_avx512vnni, 6, 4)
+
+const QuantKernel quant_kernel_avx2 = { "avx2", qgemm_avx2 };
+const QuantKernel quant_kernel_avxvnni = { "avxvnni", qgemm_avxvnni };
+const QuantKernel quant_kernel_avx512vnni = { "avx512vnni", qgemm_avx512vnni };
+#endif
@@ -0,0 +1,32 @@
+#ifndef QUANTIZE_KERNELS_H
+#define QUANTIZE_KERNELS_H
+#include<stdint.h>
+
+#define QGEMM_KR 4 // rows of B interleaved per column, the group vpmaddubsw / vpdpbusd sum over
+#define QGEMM_NR 8 // columns per packed block, one ymm of int32 accumulators
+
+/*
+    Integer GEMM: C (m x n) = A (m x k) @ B (k x n), exact in int32
+    a: unsigned activations in [0, 127], m rows of k4 * QGEMM_KR bytes, lda bytes apart
+    b: signed weights in [-127, 127], packed in n / QGEMM_NR blocks of k4 x QGEMM_NR x QGEMM_KR bytes:
+       block j holds columns [8j, 8j + 8), for every group of 4 rows the 4 values of column 0, then column 1...
+    c: m rows of n int32, ldc apart; n is a multiple of QGEMM_NR (the packed width)
+    Activations are kept to 7 bits so a vpmaddubsw pair sum (at most 2 * 127 * 127) never saturates
+    int16, which keeps every kernel bitwise identical to the scalar one.
+*/
+typedef void (*qgemm_kernel)(int m, int n, int k4, const uint8_t *a, int lda, const int8_t *b, int32_t *c, int ldc);
+
+typedef struct {
+    const char *name;
+    qgemm_kernel qgemm;
+} QuantKernel;
+
+extern const QuantKernel quant_kernel_scalar;
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define QUANT_HAVE_X86_KERNELS 1
+extern const QuantKernel quant_kernel_avx2;
+extern const QuantKernel quant_kernel_avxvnni;
+extern const QuantKernel quant_kernel_avx512vnni;
+#endif
+
+#endif
@@ -0,0 +1,645 @@
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<errno.h>
+#include<time.h>
+#include<unistd.h>
+#include<poll.h>
+#include<fcntl.h>
+#include<signal.h>
+#include<pthread.h>
+#include<sys/socket.h>
+#include<sys/uio.h>
+#include<sys/un.h>
+#include"server.h"
+#include"inference.h"
+#include"activation.h"
+#include"threadpool.h"
+
+typedef struct {
+    int fd;                   // -1 when the slot is free
+    unsigned long generation; // bumped on close, so replies meant for an earlier client of the slot are dropped
+    pthread_mutex_t write_lock; // workers reply concurrently and the poll thread closes the socket under it,
+                                // taken before the server's lock when both are held
+    char *buffer;             // the request being read, ServerRequest then its features
+    size_t filled;
+    int outstanding;          // requests queued or being served, under the server's lock
+    // the rest under write_lock: replies the socket has not taken yet are bytes [reply_start, reply_end)
+    // of replies, which has room for max_outstanding of them
+    char *replies;
+    size_t reply_start, reply_end;
+    int queued;               // requests handed to the workers whose reply is not in replies yet
+    int paused;               // left out of the poll for input until it has fewer than max_outstanding unanswered
+} Connection;
+
+typedef struct {
+    int connection;
+    unsigned long generation;
+    uint32_t id;
+    double arrival;
+} QueuedRequest;
+
+typedef struct {
+    InferenceServer *server;
+    pthread_t thread;
+    Matrix inputs;            // max_batch_size x input_size
+    QueuedRequest *requests;  // of the batch being served
+    int *predictions;
+    void *scratch;            // mlp_infer's
+} Worker;
+
+struct InferenceServer {
+    const MLP *mlp;
+    ServerConfig config;
+    int input_size, num_outputs;
+    char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+    int listen_fd;
+    size_t reply_bytes; // of one SERVER_OK reply with its outputs
+    int wake_pipe[2]; // server_stop writes a byte to wake the poll loop, and so do workers that unpause a connection
+    volatile sig_atomic_t stop_requested;
+    Connection *connections;
+    struct pollfd *poll_fds;
+    int *poll_connections; // connection of each poll_fds entry after the first two
+
+    // a ring of max_queue requests, their features in a matching ring of rows
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty, not_full;
+    QueuedRequest *queue;
+    float *queue_features;
+    int head, count;
+    // open connections with no request outstanding; with none left a closed-loop client cannot send
+    // more, so a batch is not held back waiting for it
+    int idle_connections;
+    int stop;
+    long requests, batches;
+    Worker *workers;
+    int running_workers;
+};
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// sends all of iov, advancing it past partial writes; the client's socket is blocking
+static int send_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        struct msghdr message = { .msg_iov = iov, .msg_iovlen = iovcnt };
+        ssize_t sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    return 0;
+}
+
+static int recv_all(int fd, void *buffer, size_t bytes) {
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t n = recv(fd, (char *)buffer + done, bytes - done, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+// requests per forward pass, how long the oldest may wait for more, and room for the clients
+ServerConfig server_default_config() {
+    ServerConfig config;
+    config.max_batch_size = 64;
+    config.max_delay = 200e-6;
+    config.num_workers = default_num_threads();
+    config.max_queue = 1024;
+    config.max_connections = 256;
+    config.max_outstanding = 128;
+    return config;
+}
+
+/*
+    Binds the socket and sizes every buffer, the workers start with server_run
+    Parameters:
+    mlp: the model, only read, so it can be a read-only checkpoint mapping
+    socket_path: replaced if a socket is already there, removed again by server_free
+    config: see ServerConfig, out of range values are clamped
+    Returns NULL if the socket cannot be set up.
+*/
+InferenceServer *server_create(const MLP *mlp, const char *socket_path, ServerConfig config) {
+    InferenceServer *server = calloc(1, sizeof(InferenceServer));
+    config.max_batch_size = config.max_batch_size < 1 ? 1 : config.max_batch_size;
+    config.num_workers = config.num_workers < 1 ? 1 : config.num_workers;
+    config.max_queue = config.max_queue < config.max_batch_size ? config.max_batch_size : config.max_queue;
+    config.max_connections = config.max_connections < 1 ? 1 : config.max_connections;
+    config.max_delay = config.max_delay < 0 ? 0 : config.max_delay;
+    config.max_outstanding = config.max_outstanding < 1 ? 1 : config.max_outstanding;
+    server->mlp = mlp;
+    server->config = config;
+    server->input_size = mlp->input_size;
+    server->num_outputs = mlp->layers[mlp->num_layers - 1]->num_neurons;
+    server->reply_bytes = sizeof(ServerReply) + server->num_outputs * sizeof(float);
+    server->listen_fd = -1;
+    server->wake_pipe[0] = server->wake_pipe[1] = -1;
+
+    if (strlen(socket_path) >= sizeof(server->socket_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", socket_path);
+        free(server);
+        return NULL;
+    }
+    strcpy(server->socket_path, socket_path);
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    strcpy(address.sun_path, socket_path);
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socket_path);
+    if (server->listen_fd < 0 || bind(server->listen_fd, (struct sockaddr *)&address, sizeof(address)) != 0
+        || listen(server->listen_fd, config.max_connections) != 0 || pipe(server->wake_pipe) != 0) {
+        fprintf(stderr, "Could not listen on %s: %s\n", socket_path, strerror(errno));
+        if (server->listen_fd >= 0) {
+            close(server->listen_fd);
+        }
+        free(server);
+        return NULL;
+    }
+    // workers must never block on a wake-up, and a full pipe wakes the poll loop anyway
+    fcntl(server->wake_pipe[1], F_SETFL, fcntl(server->wake_pipe[1], F_GETFL) | O_NONBLOCK);
+
+    size_t request_bytes = sizeof(ServerRequest) + server->input_size * sizeof(float);
+    server->connections = calloc(config.max_connections, sizeof(Connection));
+    server->workers = calloc(config.num_workers, sizeof(Worker));
+    if (server->connections == NULL || server->workers == NULL) {
+        fprintf(stderr, "Could not allocate the inference server\n");
+        exit(1);
+    }
+    for (int i = 0; i < config.max_connections; i++) {
+        server->connections[i].fd = -1;
+        server->connections[i].buffer = malloc(request_bytes);
+        // and room for the SERVER_BAD_REQUEST reply a connection is closed with
+        server->connections[i].replies = malloc(config.max_outstanding * server->reply_bytes + sizeof(ServerReply));
+        if (server->connections[i].buffer == NULL || server->connections[i].replies == NULL) {
+            fprintf(stderr, "Could not allocate the inference server\n");
+            exit(1);
+        }
+        pthread_mutex_init(&server->connections[i].write_lock, NULL);
+    }
+    server->poll_fds = malloc((config.max_connections + 2) * sizeof(struct pollfd));
+    server->poll_connections = malloc(config.max_connections * sizeof(int));
+
+    pthread_mutex_init(&server->lock, NULL);
+    // the batch deadline is on the monotonic clock, so is the wait for it
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&server->not_empty, &attributes);
+    pthread_condattr_destroy(&attributes);
+    pthread_cond_init(&server->not_full, NULL);
+    server->queue = malloc(config.max_queue * sizeof(QueuedRequest));
+    server->queue_features = malloc((size_t)config.max_queue * server->input_size * sizeof(float));
+
+    for (int i = 0; i < config.num_workers; i++) {
+        Worker *worker = &server->workers[i];
+        worker->server = server;
+        worker->inputs = allocate_matrix(config.max_batch_size, server->input_size);
+        worker->requests = malloc(config.max_batch_size * sizeof(QueuedRequest));
+        worker->predictions = malloc(config.max_batch_size * sizeof(int));
+        worker->scratch = aligned_alloc(MATRIX_ALIGNMENT, mlp_inference_scratch_bytes(mlp, config.max_batch_size));
+    }
+    if (server->poll_fds == NULL || server->poll_connections == NULL || server->queue == NULL || server->queue_features == NULL) {
+        fprintf(stderr, "Could not allocate the inference server\n");
+        exit(1);
+    }
+    return server;
+}
+
+static void close_connection(InferenceServer *server, int index) {
+    Connection *connection = &server->connections[index];
+    pthread_mutex_lock(&connection->write_lock);
+    close(connection->fd);
+    connection->fd = -1;
+    connection->filled = 0;
+    connection->reply_start = connection->reply_end = 0;
+    connection->queued = 0;
+    connection->paused = 0;
+    // workers read the generation under either lock
+    pthread_mutex_lock(&server->lock);
+    connection->generation++;
+    server->idle_connections -= connection->outstanding == 0;
+    connection->outstanding = 0;
+    pthread_mutex_unlock(&server->lock);
+    pthread_mutex_unlock(&connection->write_lock);
+}
+
+// whether the connection has max_outstanding requests unanswered, under its write_lock
+static int connection_full(const InferenceServer *server, const Connection *connection) {
+    size_t pending = connection->reply_end - connection->reply_start;
+    int unsent = (pending + server->reply_bytes - 1) / server->reply_bytes;
+    return connection->queued + unsent >= server->config.max_outstanding;
+}
+
+/*
+    Writes as much of the connection's pending replies as its socket takes without blocking, under its
+    write_lock. What is left waits for the poll loop to see the socket writable.
+*/
+static void flush_replies(Connection *connection) {
+    while (connection->reply_end > connection->reply_start) {
+        ssize_t sent = send(connection->fd, connection->replies + connection->reply_start,
+                            connection->reply_end - connection->reply_start, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (sent <= 0) {
+            // the client is gone, the poll loop closes the connection
+            break;
+        }
+        connection->reply_start += sent;
+    }
+    connection->reply_start = connection->reply_end = 0;
+}
+
+// appends a reply behind the pending ones and writes what the socket takes, under the connection's write_lock
+static void send_reply(Connection *connection, const ServerReply *reply, const float *outputs) {
+    size_t output_bytes = reply->num_outputs * sizeof(float);
+    // pending bytes move to the front, so the buffer never has to hold more than max_outstanding replies
+    if (connection->reply_start > 0) {
+        memmove(connection->replies, connection->replies + connection->reply_start, connection->reply_end - connection->reply_start);
+        connection->reply_end -= connection->reply_start;
+        connection->reply_start = 0;
+    }
+    memcpy(connection->replies + connection->reply_end, reply, sizeof(ServerReply));
+    if (output_bytes > 0) {
+        memcpy(connection->replies + connection->reply_end + sizeof(ServerReply), outputs, output_bytes);
+    }
+    connection->reply_end += sizeof(ServerReply) + output_bytes;
+    flush_replies(connection);
+}
+
+/*
+    Hands a complete request to the workers, waiting while the queue is full, which is only ever until
+    a worker takes a batch since workers never block on a client
+    Returns 1 once the connection has max_outstanding requests unanswered.
+*/
+static int enqueue(InferenceServer *server, int index) {
+    Connection *connection = &server->connections[index];
+    ServerRequest *request = (ServerRequest *)connection->buffer;
+    pthread_mutex_lock(&connection->write_lock);
+    connection->queued++;
+    int full = connection_full(server, connection);
+    pthread_mutex_unlock(&connection->write_lock);
+    pthread_mutex_lock(&server->lock);
+    while (server->count == server->config.max_queue && !server->stop) {
+        pthread_cond_wait(&server->not_full, &server->lock);
+    }
+    int slot = (server->head + server->count) % server->config.max_queue;
+    server->queue[slot] = (QueuedRequest){ index, connection->generation, request->id, now() };
+    memcpy(server->queue_features + (size_t)slot * server->input_size, connection->buffer + sizeof(ServerRequest),
+           server->input_size * sizeof(float));
+    server->count++;
+    server->idle_connections -= connection->outstanding++ == 0;
+    pthread_cond_signal(&server->not_empty);
+    pthread_mutex_unlock(&server->lock);
+    return full;
+}
+
+/*
+    Reads whatever the client has sent without blocking, queueing every request it completes, until
+    the connection has max_outstanding requests unanswered
+*/
+static void read_requests(InferenceServer *server, int index) {
+    Connection *connection = &server->connections[index];
+    size_t request_bytes = sizeof(ServerRequest) + server->input_size * sizeof(float);
+    for (;;) {
+        size_t wanted = (connection->filled < sizeof(ServerRequest) ? sizeof(ServerRequest) : request_bytes) - connection->filled;
+        ssize_t n = recv(connection->fd, connection->buffer + connection->filled, wanted, MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        }
+        if (n <= 0) {
+            close_connection(server, index);
+            return;
+        }
+        connection->filled += n;
+        ServerRequest *request = (ServerRequest *)connection->buffer;
+        if (connection->filled == sizeof(ServerRequest)
+            && (request->magic != SERVER_MAGIC || request->num_features != (uint32_t)server->input_size)) {
+            // behind the replies still pending, and only as far as the socket takes it before the close
+            ServerReply reply = { SERVER_MAGIC, request->id, SERVER_BAD_REQUEST, -1, 0 };
+            pthread_mutex_lock(&connection->write_lock);
+            send_reply(connection, &reply, NULL);
+            pthread_mutex_unlock(&connection->write_lock);
+            close_connection(server, index);
+            return;
+        }
+        if (connection->filled == request_bytes) {
+            connection->filled = 0;
+            if (enqueue(server, index)) {
+                return;
+            }
+        }
+    }
+}
+
+static void accept_connection(InferenceServer *server) {
+    int fd = accept(server->listen_fd, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+    for (int i = 0; i < server->config.max_connections; i++) {
+        Connection *connection = &server->connections[i];
+        if (connection->fd < 0) {
+            pthread_mutex_lock(&connection->write_lock);
+            connection->fd = fd;
+            connection->filled = 0;
+            connection->reply_start = connection->reply_end = 0;
+            connection->queued = 0;
+            connection->paused = 0;
+            pthread_mutex_unlock(&connection->write_lock);
+            pthread_mutex_lock(&server->lock);
+            server->idle_connections++;
+            pthread_mutex_unlock(&server->lock);
+            return;
+        }
+    }
+    close(fd);
+}
+
+/*
+    Runs the batch's forward pass and answers each request from its row of the outputs
+    Replies never block the worker, see send_reply. A paused connection that now has room for more
+    requests is unpaused and the poll loop woken to read from it again.
+*/
+static void serve_batch(Worker *worker, int batch_size) {
+    InferenceServer *server = worker->server;
+    const MLP *mlp = server->mlp;
+    Matrix outputs = mlp_infer(mlp, matrix_row_view(worker->inputs, 0, batch_size), worker->scratch, worker->predictions);
+    matrix_activation(outputs, mlp->layers[mlp->num_layers - 1]->activation);
+    int wake = 0;
+    for (int i = 0; i < batch_size; i++) {
+        QueuedRequest *request = &worker->requests[i];
+        Connection *connection = &server->connections[request->connection];
+        ServerReply reply = { SERVER_MAGIC, request->id, SERVER_OK, worker->predictions[i], server->num_outputs };
+        pthread_mutex_lock(&connection->write_lock);
+        // a client that went away is noticed by the poll loop, its replies are dropped
+        if (connection->fd >= 0 && connection->generation == request->generation) {
+            connection->queued--;
+            send_reply(connection, &reply, matrix_row(outputs, i));
+            if (connection->paused && !connection_full(server, connection)) {
+                connection->paused = 0;
+                wake = 1;
+            }
+        }
+        pthread_mutex_unlock(&connection->write_lock);
+    }
+    if (wake) {
+        char byte = 0;
+        ssize_t written = write(server->wake_pipe[1], &byte, 1);
+        (void)written;
+    }
+}
+
+/*
+    Takes a batch as soon as max_batch_size requests are queued, the oldest one has waited max_delay,
+    or every client already has a request outstanding, whichever comes first
+*/
+static void *worker_main(void *arg) {
+    Worker *worker = arg;
+    InferenceServer *server = worker->server;
+    ServerConfig *config = &server->config;
+    pthread_mutex_lock(&server->lock);
+    for (;;) {
+        while (!server->stop && server->count == 0) {
+            pthread_cond_wait(&server->not_empty, &server->lock);
+        }
+        // another worker may take the head meanwhile, so the deadline is the current head's
+        while (!server->stop && server->count > 0 && server->count < config->max_batch_size && server->idle_connections > 0) {
+            double deadline = server->queue[server->head].arrival + config->max_delay;
+            if (now() >= deadline) {
+                break;
+            }
+            struct timespec until = { (time_t)deadline, (long)((deadline - (time_t)deadline) * 1e9) };
+            pthread_cond_timedwait(&server->not_empty, &server->lock, &until);
+        }
+        if (server->stop) {
+            break;
+        }
+        int batch_size = server->count < config->max_batch_size ? server->count : config->max_batch_size;
+        if (batch_size == 0) {
+            continue;
+        }
+        for (int i = 0; i < batch_size; i++) {
+            int slot = (server->head + i) % config->max_queue;
+            worker->requests[i] = server->queue[slot];
+            memcpy(matrix_row(worker->inputs, i), server->queue_features + (size_t)slot * server->input_size,
+                   server->input_size * sizeof(float));
+        }
+        server->head = (server->head + batch_size) % config->max_queue;
+        server->count -= batch_size;
+        server->requests += batch_size;
+        server->batches++;
+        pthread_cond_signal(&server->not_full);
+        pthread_mutex_unlock(&server->lock);
+
+        serve_batch(worker, batch_size);
+
+        pthread_mutex_lock(&server->lock);
+        for (int i = 0; i < batch_size; i++) {
+            Connection *connection = &server->connections[worker->requests[i].connection];
+            if (connection->generation == worker->requests[i].generation && connection->outstanding > 0) {
+                server->idle_connections += --connection->outstanding == 0;
+            }
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+}
+
+/*
+    Serves until server_stop, on the calling thread plus config.num_workers workers
+    Requests still queued when it stops are dropped. Returns 0, or -1 if the workers cannot start.
+*/
+int server_run(InferenceServer *server) {
+    server->stop = 0;
+    for (server->running_workers = 0; server->running_workers < server->config.num_workers; server->running_workers++) {
+        Worker *worker = &server->workers[server->running_workers];
+        if (pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            fprintf(stderr, "Could not start inference worker\n");
+            break;
+        }
+    }
+    int status = server->running_workers == server->config.num_workers ? 0 : -1;
+
+    while (status == 0) {
+        struct pollfd *fds = server->poll_fds;
+        fds[0] = (struct pollfd){ server->wake_pipe[0], POLLIN, 0 };
+        fds[1] = (struct pollfd){ server->listen_fd, POLLIN, 0 };
+        int num_fds = 2;
+        for (int i = 0; i < server->config.max_connections; i++) {
+            Connection *connection = &server->connections[i];
+            if (connection->fd >= 0) {
+                // input only while the client is under max_outstanding, output while replies are pending
+                pthread_mutex_lock(&connection->write_lock);
+                connection->paused = connection_full(server, connection);
+                short events = (connection->paused ? 0 : POLLIN) | (connection->reply_end > connection->reply_start ? POLLOUT : 0);
+                pthread_mutex_unlock(&connection->write_lock);
+                server->poll_connections[num_fds - 2] = i;
+                fds[num_fds++] = (struct pollfd){ connection->fd, events, 0 };
+            }
+        }
+        if (poll(fds, num_fds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Inference server poll failed: %s\n", strerror(errno));
+            status = -1;
+            break;
+        }
+        if (fds[0].revents != 0) {
+            char bytes[64];
+            ssize_t drained = read(server->wake_pipe[0], bytes, sizeof(bytes));
+            (void)drained;
+            if (server->stop_requested) {
+                break;
+            }
+        }
+        for (int i = 2; i < num_fds; i++) {
+            int index = server->poll_connections[i - 2];
+            Connection *connection = &server->connections[index];
+            if (fds[i].revents & POLLOUT) {
+                pthread_mutex_lock(&connection->write_lock);
+                flush_replies(connection);
+                pthread_mutex_unlock(&connection->write_lock);
+            }
+            if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                // a paused client that hung up is not read from, its replies could not be delivered anyway
+                if (fds[i].events & POLLIN) {
+                    read_requests(server, index);
+                } else {
+                    close_connection(server, index);
+                }
+            }
+        }
+        if (fds[1].revents != 0) {
+            accept_connection(server);
+        }
+    }
+
+    pthread_mutex_lock(&server->lock);
+    server->stop = 1;
+    pthread_cond_broadcast(&server->not_empty);
+    pthread_cond_broadcast(&server->not_full);
+    pthread_mutex_unlock(&server->lock);
+    for (int i = 0; i < server->running_workers; i++) {
+        pthread_join(server->workers[i].thread, NULL);
+    }
+    server->running_workers = 0;
+    for (int i = 0; i < server->config.max_connections; i++) {
+        if (server->connections[i].fd >= 0) {
+            close_connection(server, i);
+        }
+    }
+    server->head = server->count = 0;
+    server->idle_connections = 0;
+    server->stop_requested = 0;
+    return status;
+}
+
+// makes server_run return, safe to call from a signal handler or another thread
+void server_stop(InferenceServer *server) {
+    server->stop_requested = 1;
+    char byte = 0;
+    ssize_t written = write(server->wake_pipe[1], &byte, 1);
+    (void)written;
+}
+
+// requests answered and forward passes run so far, requests / batches is the mean batch size
+void server_stats(InferenceServer *server, long *requests, long *batches) {
+    pthread_mutex_lock(&server->lock);
+    *requests = server->requests;
+    *batches = server->batches;
+    pthread_mutex_unlock(&server->lock);
+}
+
+void server_free(InferenceServer *server) {
+    close(server->listen_fd);
+    unlink(server->socket_path);
+    close(server->wake_pipe[0]);
+    close(server->wake_pipe[1]);
+    for (int i = 0; i < server->config.max_connections; i++) {
+        free(server->connections[i].buffer);
+        free(server->connections[i].replies);
+        pthread_mutex_destroy(&server->connections[i].write_lock);
+    }
+    for (int i = 0; i < server->config.num_workers; i++) {
+        free_matrix(server->workers[i].inputs);
+        free(server->workers[i].requests);
+        free(server->workers[i].predictions);
+        free(server->workers[i].scratch);
+    }
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->not_empty);
+    pthread_cond_destroy(&server->not_full);
+    free(server->connections);
+    free(server->poll_fds);
+    free(server->poll_connections);
+    free(server->queue);
+    free(server->queue_features);
+    free(server->workers);
+    free(server);
+}
+
+// returns the connected socket, or -1
+int server_connect(const char *socket_path) {
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", socket_path);
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Could not connect to %s: %s\n", socket_path, strerror(errno));
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+// one request, header and features in a single write; returns 0 or -1
+int server_send_request(int fd, uint32_t id, const float *features, int num_features) {
+    ServerRequest request = { SERVER_MAGIC, id, (uint32_t)num_features };
+    struct iovec iov[2] = { { &request, sizeof(request) }, { (void *)features, num_features * sizeof(float) } };
+    return send_all(fd, iov, 2);
+}
+
+/*
+    Reads the next reply and its outputs into outputs, which has room for max_outputs
+    Returns 0, or -1 if the connection failed or the reply is malformed or does not fit.
+*/
+int server_receive_reply(int fd, ServerReply *reply, float *outputs, int max_outputs) {
+    if (recv_all(fd, reply, sizeof(ServerReply)) != 0 || reply->magic != SERVER_MAGIC || reply->num_outputs > (uint32_t)max_outputs) {
+        return -1;
+    }
+    return recv_all(fd, outputs, reply->num_outputs * sizeof(float));
+}
@@ -0,0 +1,67 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include<stdint.h>
+#include"mlp.h"
+
+/*
+    Wire format of the inference server, in native byte order since the socket is local
+    A client sends any number of requests on one connection, each a ServerRequest followed by
+    num_features floats, and gets one ServerReply per request followed by num_outputs floats: the
+    output layer's activations, probabilities for a softmax model. Requests of one connection may be
+    answered out of order when they land in different batches, the id is echoed back to match them.
+    A request whose num_features is not the model's input size gets SERVER_BAD_REQUEST with no
+    outputs, and the connection is closed since the rest of its stream cannot be framed.
+*/
+#define SERVER_MAGIC 0x3152504dU // "MPR1"
+#define SERVER_OK 0
+#define SERVER_BAD_REQUEST 1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t id;
+    uint32_t num_features;
+} ServerRequest;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t id;
+    int32_t status;
+    int32_t prediction; // argmax of the outputs
+    uint32_t num_outputs;
+} ServerReply;
+
+typedef struct {
+    int max_batch_size;  // requests per forward pass
+    double max_delay;    // seconds the oldest queued request waits for its batch to fill
+    int num_workers;     // threads running forward passes, each on a batch of its own
+    int max_queue;       // queued requests before the server stops reading from its clients
+    int max_connections;
+    int max_outstanding; // requests of one connection queued, being served or with replies not yet written
+                         // before the server stops reading from it
+} ServerConfig;
+
+/*
+    Serves a model over a Unix domain socket with dynamic batching
+    One thread polls the socket and queues complete requests. Workers take up to max_batch_size of
+    them at once, as soon as there are that many or the oldest has waited max_delay, run them through
+    mlp_infer together and write each reply straight from the batch's outputs. Replies go out without
+    blocking: what a client's socket does not take waits in its connection's reply buffer, and a client
+    that stops reading is no longer read from once it has max_outstanding requests unanswered, so it
+    only ever holds up its own requests. Every buffer is sized when the server is created, nothing is
+    allocated per request.
+*/
+typedef struct InferenceServer InferenceServer;
+
+ServerConfig server_default_config();
+InferenceServer *server_create(const MLP *mlp, const char *socket_path, ServerConfig config);
+int server_run(InferenceServer *server);
+void server_stop(InferenceServer *server);
+void server_stats(InferenceServer *server, long *requests, long *batches);
+void server_free(InferenceServer *server);
+
+// client side of the protocol, blocking
+int server_connect(const char *socket_path);
+int server_send_request(int fd, uint32_t id, const float *features, int num_features);
+int server_receive_reply(int fd, ServerReply *reply, float *outputs, int max_outputs);
+
+#endif
@@ -0,0 +1,71 @@
+#include<stdlib.h>
+#include<stdio.h>
+#include"sparse.h"
+#include"profile.h"
+
+// room for up to max_rows rows of cols columns with capacity non-zeros in total
+SparseMatrix sparse_allocate(int max_rows, int cols, int capacity) {
+    SparseMatrix S = { NULL, NULL, NULL, 0, cols, capacity };
+    S.values = malloc((capacity > 0 ? capacity : 1) * sizeof(float));
+    S.indices = malloc((capacity > 0 ? capacity : 1) * sizeof(int));
+    S.row_start = calloc(max_rows + 1, sizeof(int));
+    PROFILE_ALLOCATION((size_t)capacity * (sizeof(float) + sizeof(int)) + (max_rows + 1) * sizeof(int));
+    if (S.values == NULL || S.indices == NULL || S.row_start == NULL) {
+        fprintf(stderr, "Could not allocate sparse matrix of %d non-zeros\n", capacity);
+        exit(1);
+    }
+    return S;
+}
+
+void sparse_free(SparseMatrix S) {
+    free(S.values);
+    free(S.indices);
+    free(S.row_start);
+}
+
+/*
+    Compresses the non-zeros of dense into S, which must have room for dense.rows rows
+    Returns 0, or -1 without finishing as soon as there are more non-zeros than S has capacity for,
+    which is how callers fall back to the dense path for batches that are not sparse enough.
+*/
+int sparse_from_dense(Matrix dense, SparseMatrix *S) {
+    int nnz = 0;
+    S->rows = dense.rows;
+    S->cols = dense.cols;
+    S->row_start[0] = 0;
+    for (int i = 0; i < dense.rows; i++) {
+        const float *row = matrix_row(dense, i);
+        if (nnz + dense.cols <= S->capacity) {
+            // every element is written and only kept by advancing past it, zeros are not a branch
+            for (int j = 0; j < dense.cols; j++) {
+                S->values[nnz] = row[j];
+                S->indices[nnz] = j;
+                nnz += row[j] != 0.0f;
+            }
+        } else {
+            // near the end of the capacity
+            for (int j = 0; j < dense.cols; j++) {
+                if (row[j] == 0.0f) {
+                    continue;
+                }
+                if (nnz == S->capacity) {
+                    S->rows = 0;
+                    return -1;
+                }
+                S->values[nnz] = row[j];
+                S->indices[nnz] = j;
+                nnz++;
+            }
+        }
+        S->row_start[i+1] = nnz;
+    }
+    return 0;
+}
+
+// rows [start, start + count) of S, sharing its storage
+SparseMatrix sparse_row_view(SparseMatrix S, int start, int count) {
+    SparseMatrix V = S;
+    V.row_start = S.row_start + start;
+    V.rows = count;
+    return V;
+}
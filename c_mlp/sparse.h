@@ -0,0 +1,39 @@
+#ifndef SPARSE_H
+#define SPARSE_H
+#include"matrix.h"
+
+// batches with more than this fraction of non-zero inputs go through the dense GEMM, see loader_set_sparse
+#define SPARSE_MAX_DENSITY 0.3f
+
+// length of the runs of consecutive columns a block-sparse matrix stores, one ymm of floats
+#define SPARSE_BLOCK_WIDTH 8
+
+/*
+    Compressed sparse row matrix
+    values, indices: the non-zero values of each row in column order, and their columns
+    row_start: rows + 1 offsets into values, row i holds entries row_start[i] to row_start[i+1] - 1
+    capacity: entries values and indices have room for
+    Row views share the arrays of their matrix and keep its absolute offsets, they must not be freed.
+    In block-sparse form (pruned weights, see prune.h) a row stands for a strip of SPARSE_BLOCK_WIDTH
+    consecutive columns of a k x n matrix and each entry for the strip's run in one of its rows:
+    indices holds that row and values SPARSE_BLOCK_WIDTH floats per entry, zero past column n.
+*/
+typedef struct {
+    float *values;
+    int *indices;
+    int *row_start;
+    int rows;
+    int cols;
+    int capacity;
+} SparseMatrix;
+
+SparseMatrix sparse_allocate(int max_rows, int cols, int capacity);
+void sparse_free(SparseMatrix S);
+int sparse_from_dense(Matrix dense, SparseMatrix *S);
+SparseMatrix sparse_row_view(SparseMatrix S, int start, int count);
+
+static inline int sparse_nnz(SparseMatrix S) {
+    return S.row_start[S.rows] - S.row_start[0];
+}
+
+#endif
@@ -0,0 +1,389 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<math.h>
+#include"sweep.h"
+#include"activation.h"
+#include"loss.h"
+#include"gemm.h"
+#include"evaluate.h"
+#include"profile.h"
+
+static float *sweep_alloc(size_t floats, const char *what) {
+    size_t bytes = arena_matrix_bytes(1, floats > 0 ? (int)floats : 1);
+    float *data = aligned_alloc(MATRIX_ALIGNMENT, bytes);
+    PROFILE_ALLOCATION(bytes);
+    if (data == NULL) {
+        fprintf(stderr, "Could not allocate %s\n", what);
+        exit(1);
+    }
+    memset(data, 0, bytes);
+    return data;
+}
+
+// block k of a batch x (num_models * width) matrix: model k's columns
+static Matrix model_block(Matrix M, int k, int width) {
+    return matrix_view(M.data + (size_t)k * width, M.rows, width, M.ld);
+}
+
+// copies model k's weights and biases out of the sweep into an MLP of the same topology, or back in
+static void copy_model(ModelSweep *sweep, int k, MLP *mlp, int to_mlp) {
+    for (int l = 0; l < sweep->num_layers; l++) {
+        SweepLayer *stacked = &sweep->layers[l];
+        Layer *layer = mlp->layers[l];
+        int num = stacked->num_neurons, prev = stacked->prev_num_neurons;
+        for (int r = 0; r < prev; r++) {
+            float *row = l == 0 ? matrix_row(stacked->weights, r) + (size_t)k * num : matrix_row(stacked->weights, k * prev + r);
+            memcpy(to_mlp ? matrix_row(layer->weights, r) : row, to_mlp ? row : matrix_row(layer->weights, r), num * sizeof(float));
+        }
+        float *biases = stacked->biases + (size_t)k * num;
+        memcpy(to_mlp ? layer->biases : biases, to_mlp ? biases : layer->biases, num * sizeof(float));
+    }
+}
+
+/*
+    Stacks num_models copies of the template's topology, model k drawn by mlp_init_weights from seeds[k]
+    and trained at base rate learning_rates[k]
+    The optimizer settings and schedule are taken from the template, with fresh state. Returns NULL if
+    the template does not end in a softmax layer with cross-entropy loss.
+*/
+ModelSweep *sweep_create(const MLP *template, int num_models, const float *learning_rates, const unsigned int *seeds) {
+    int num_layers = template->num_layers;
+    if (num_models < 1 || template->layers[num_layers - 1]->activation != softmax || template->loss != cross_entropy) {
+        fprintf(stderr, "Sweeps need at least one model with a softmax output layer and cross-entropy loss\n");
+        return NULL;
+    }
+    ModelSweep *sweep = malloc(sizeof(ModelSweep));
+    sweep->num_models = num_models;
+    sweep->num_layers = num_layers;
+    sweep->input_size = template->input_size;
+    sweep->optimizer = template->optimizer;
+    sweep->optimizer.step = 0;
+    sweep->optimizer.state = NULL;
+    sweep->optimizer.state_size = 0;
+    sweep->learning_rates = malloc(num_models * sizeof(float));
+    memcpy(sweep->learning_rates, learning_rates, num_models * sizeof(float));
+    sweep->epoch = 0;
+    sweep->pool = threadpool_create(threadpool_size(template->pool));
+    sweep->max_batch_size = 0;
+    sweep->loss_sum = calloc(num_models, sizeof(double));
+    sweep->correct = calloc(num_models, sizeof(long));
+    sweep->samples = 0;
+
+    int num_neurons[num_layers];
+    void (*activations[num_layers])(float*, float*, size_t);
+    void (*activation_primes[num_layers])(float*, float*, size_t);
+    sweep->layers = malloc(num_layers * sizeof(SweepLayer));
+    int num_slots = sweep->optimizer.num_slots;
+    for (int l = 0; l < num_layers; l++) {
+        Layer *layer = template->layers[l];
+        SweepLayer *stacked = &sweep->layers[l];
+        int num = layer->num_neurons, prev = layer->prev_num_neurons;
+        stacked->num_neurons = num;
+        stacked->prev_num_neurons = prev;
+        stacked->weights = l == 0 ? allocate_matrix(prev, num_models * num) : allocate_matrix(num_models * prev, num);
+        stacked->grad_weights = allocate_matrix(stacked->weights.rows, stacked->weights.cols);
+        size_t weights_floats = (size_t)num_models * prev * num, biases_floats = (size_t)num_models * num;
+        stacked->biases = sweep_alloc(biases_floats, "sweep biases");
+        stacked->grad_biases = sweep_alloc(biases_floats, "sweep gradients");
+        stacked->state_weights = num_slots > 0 ? sweep_alloc(num_slots * weights_floats, "sweep optimizer state") : NULL;
+        stacked->state_biases = num_slots > 0 ? sweep_alloc(num_slots * biases_floats, "sweep optimizer state") : NULL;
+        stacked->activation = layer->activation;
+        stacked->activation_prime = layer->activation_prime;
+        num_neurons[l] = num;
+        activations[l] = layer->activation;
+        activation_primes[l] = layer->activation_prime;
+    }
+
+    MLP *model = mlp_init(num_layers, num_neurons, activations, activation_primes, template->loss, template->loss_prime,
+                          template->optimizer.learning_rate, template->input_size);
+    for (int k = 0; k < num_models; k++) {
+        mlp_init_weights(model, seeds[k]);
+        copy_model(sweep, k, model, 0);
+    }
+    mlp_free(model);
+    return sweep;
+}
+
+static void sweep_workspace_free(ModelSweep *sweep) {
+    if (sweep->max_batch_size == 0) {
+        return;
+    }
+    arena_free(&sweep->arena);
+    free(sweep->pre);
+    free(sweep->outputs);
+    free(sweep->deltas);
+    sweep->max_batch_size = 0;
+}
+
+void sweep_free(ModelSweep *sweep) {
+    for (int l = 0; l < sweep->num_layers; l++) {
+        SweepLayer *stacked = &sweep->layers[l];
+        free_matrix(stacked->weights);
+        free_matrix(stacked->grad_weights);
+        free(stacked->biases);
+        free(stacked->grad_biases);
+        free(stacked->state_weights);
+        free(stacked->state_biases);
+    }
+    sweep_workspace_free(sweep);
+    threadpool_free(sweep->pool);
+    free(sweep->layers);
+    free(sweep->learning_rates);
+    free(sweep->loss_sum);
+    free(sweep->correct);
+    free(sweep);
+}
+
+void sweep_set_num_threads(ModelSweep *sweep, int num_threads) {
+    threadpool_free(sweep->pool);
+    sweep->pool = threadpool_create(num_threads);
+}
+
+// pre-activations, outputs and deltas of every layer for all models, and sweep_evaluate's conversion buffers
+static void sweep_reserve_workspace(ModelSweep *sweep, int max_batch_size) {
+    if (max_batch_size <= sweep->max_batch_size) {
+        return;
+    }
+    sweep_workspace_free(sweep);
+    int num_classes = sweep->layers[sweep->num_layers - 1].num_neurons;
+    size_t bytes = arena_matrix_bytes(max_batch_size, sweep->input_size) + arena_matrix_bytes(max_batch_size, num_classes);
+    for (int l = 0; l < sweep->num_layers; l++) {
+        bytes += 3 * arena_matrix_bytes(max_batch_size, sweep->num_models * sweep->layers[l].num_neurons);
+    }
+    arena_init(&sweep->arena, bytes);
+    sweep->pre = malloc(sweep->num_layers * sizeof(Matrix));
+    sweep->outputs = malloc(sweep->num_layers * sizeof(Matrix));
+    sweep->deltas = malloc(sweep->num_layers * sizeof(Matrix));
+    for (int l = 0; l < sweep->num_layers; l++) {
+        int width = sweep->num_models * sweep->layers[l].num_neurons;
+        sweep->pre[l] = arena_matrix(&sweep->arena, max_batch_size, width);
+        sweep->outputs[l] = arena_matrix(&sweep->arena, max_batch_size, width);
+        sweep->deltas[l] = arena_matrix(&sweep->arena, max_batch_size, width);
+    }
+    sweep->input_buffer = arena_matrix(&sweep->arena, max_batch_size, sweep->input_size);
+    sweep->target_buffer = arena_matrix(&sweep->arena, max_batch_size, num_classes);
+    sweep->max_batch_size = max_batch_size;
+}
+
+/*
+    Forward pass of every model over the same inputs, leaves the output layer's logits in outputs
+    The first layer is one GEMM against the side-by-side weights. Its epilogue applies elementwise
+    activations; a softmax there has to stay within each model's block, so it is applied per block
+    afterwards. Deeper layers are one sgemm_batched product per model.
+*/
+static void sweep_forward(ModelSweep *sweep, Matrix inputs) {
+    int batch_size = inputs.rows, num_models = sweep->num_models, last = sweep->num_layers - 1;
+    for (int l = 0; l < sweep->num_layers; l++) {
+        SweepLayer *layer = &sweep->layers[l];
+        int num = layer->num_neurons, prev = layer->prev_num_neurons;
+        sweep->pre[l].rows = sweep->outputs[l].rows = sweep->deltas[l].rows = batch_size;
+        void (*activation)(float*, float*, size_t) = l == last ? NULL : layer->activation;
+        int rowwise = activation_is_rowwise(activation);
+
+        if (l == 0) {
+            GemmEpilogue epilogue = { layer->biases, sweep->pre[0], rowwise ? NULL : activation, 0 };
+            sgemm_fused(sweep->pool, GEMM_N, GEMM_N, 1.0f, inputs, layer->weights, 0.0f, sweep->outputs[0], &epilogue);
+            for (int i = 0; rowwise && i < batch_size; i++) {
+                for (int k = 0; k < num_models; k++) {
+                    activation(matrix_row(sweep->pre[0], i) + k * num, matrix_row(sweep->outputs[0], i) + k * num, num);
+                }
+            }
+        } else {
+            GemmEpilogue epilogue = { layer->biases, model_block(sweep->pre[l], 0, num), activation, rowwise };
+            GemmStrides strides = { prev, (long)prev * num, num, num };
+            sgemm_batched(sweep->pool, num_models, GEMM_N, GEMM_N, 1.0f, model_block(sweep->outputs[l-1], 0, prev),
+                          matrix_view(layer->weights.data, prev, num, num), 0.0f, model_block(sweep->outputs[l], 0, num), &epilogue, strides);
+        }
+    }
+}
+
+// predictions of the batch that match the argmax of their targets
+static long count_correct(Matrix logits, Matrix targets) {
+    long correct = 0;
+    for (int i = 0; i < logits.rows; i++) {
+        float *row = matrix_row(logits, i), *target = matrix_row(targets, i);
+        int predicted = 0, label = 0;
+        for (int j = 1; j < logits.cols; j++) {
+            predicted = row[j] > row[predicted] ? j : predicted;
+            label = target[j] > target[label] ? j : label;
+        }
+        correct += predicted == label;
+    }
+    return correct;
+}
+
+typedef struct {
+    ModelSweep *sweep;
+    float grad_scale;
+} UpdateArgs;
+
+// one optimizer step of models [begin, end); the first layer's weights of a model are a column block
+static void update_models(void *arg, int begin, int end) {
+    UpdateArgs *args = arg;
+    ModelSweep *sweep = args->sweep;
+    for (int k = begin; k < end; k++) {
+        float learning_rate = lr_schedule_rate(sweep->optimizer.schedule, sweep->learning_rates[k], sweep->epoch);
+        for (int l = 0; l < sweep->num_layers; l++) {
+            SweepLayer *layer = &sweep->layers[l];
+            int num = layer->num_neurons, prev = layer->prev_num_neurons;
+            size_t weights_floats = (size_t)sweep->num_models * prev * num, biases_floats = (size_t)sweep->num_models * num;
+            // where model k's weights start, and how many contiguous floats they span per row
+            size_t offset = l == 0 ? (size_t)k * num : (size_t)k * prev * num;
+            int rows = l == 0 ? prev : 1;
+            size_t cols = l == 0 ? (size_t)num : (size_t)prev * num, ld = l == 0 ? (size_t)sweep->num_models * num : cols;
+            optimizer_update_block(&sweep->optimizer, learning_rate, args->grad_scale, 1, rows, cols, ld, layer->weights.data + offset,
+                                   layer->grad_weights.data + offset, layer->state_weights != NULL ? layer->state_weights + offset : NULL,
+                                   weights_floats);
+            optimizer_update(&sweep->optimizer, learning_rate, args->grad_scale, 0, num, layer->biases + (size_t)k * num,
+                             layer->grad_biases + (size_t)k * num, layer->state_biases != NULL ? layer->state_biases + (size_t)k * num : NULL,
+                             biases_floats);
+        }
+    }
+}
+
+/*
+    One optimizer step of every model on the batch, with the mean gradient of the batch like batch_backward
+    The output deltas come from softmax_cross_entropy on each model's logits, which also gives the
+    training loss. Hidden deltas and deeper weight gradients are sgemm_batched products, the first
+    layer's weight gradient is one inputs^T @ deltas GEMM across all models.
+*/
+void sweep_step(ModelSweep *sweep, Matrix inputs, Matrix targets) {
+    int batch_size = inputs.rows, num_models = sweep->num_models, last = sweep->num_layers - 1;
+    if (batch_size == 0) {
+        return;
+    }
+    sweep_reserve_workspace(sweep, batch_size);
+    sweep_forward(sweep, inputs);
+
+    int num_classes = sweep->layers[last].num_neurons;
+    for (int k = 0; k < num_models; k++) {
+        Matrix logits = model_block(sweep->outputs[last], k, num_classes);
+        sweep->loss_sum[k] += softmax_cross_entropy(logits, targets, model_block(sweep->deltas[last], k, num_classes));
+        sweep->correct[k] += count_correct(logits, targets);
+    }
+    sweep->samples += batch_size;
+
+    for (int l = last; l >= 0; l--) {
+        SweepLayer *layer = &sweep->layers[l];
+        int num = layer->num_neurons, prev = layer->prev_num_neurons;
+        Matrix deltas = sweep->deltas[l];
+        if (l < last) {
+            SweepLayer *next = &sweep->layers[l+1];
+            GemmStrides strides = { next->num_neurons, (long)num * next->num_neurons, num, 0 };
+            sgemm_batched(sweep->pool, num_models, GEMM_N, GEMM_T, 1.0f, model_block(sweep->deltas[l+1], 0, next->num_neurons),
+                          matrix_view(next->weights.data, num, next->num_neurons, next->num_neurons), 0.0f, model_block(deltas, 0, num),
+                          NULL, strides);
+            // elementwise activations take whole rows, a softmax one model at a time
+            int width = layer->activation_prime == softmax_prime ? num : num_models * num;
+            for (int i = 0; i < batch_size; i++) {
+                for (int j = 0; j < num_models * num; j += width) {
+                    activation_backward(layer->activation_prime, matrix_row(sweep->pre[l], i) + j, matrix_row(deltas, i) + j, width);
+                }
+            }
+        }
+
+        if (l == 0) {
+            sgemm_parallel(sweep->pool, GEMM_T, GEMM_N, 1.0f, inputs, deltas, 0.0f, layer->grad_weights);
+        } else {
+            GemmStrides strides = { prev, num, (long)prev * num, 0 };
+            sgemm_batched(sweep->pool, num_models, GEMM_T, GEMM_N, 1.0f, model_block(sweep->outputs[l-1], 0, prev),
+                          model_block(deltas, 0, num), 0.0f, matrix_view(layer->grad_weights.data, prev, num, num), NULL, strides);
+        }
+        memset(layer->grad_biases, 0, (size_t)num_models * num * sizeof(float));
+        for (int i = 0; i < batch_size; i++) {
+            float *row = matrix_row(deltas, i);
+            for (int j = 0; j < num_models * num; j++) {
+                layer->grad_biases[j] += row[j];
+            }
+        }
+    }
+
+    sweep->optimizer.step++;
+    UpdateArgs args = { sweep, 1.0f / batch_size };
+    threadpool_parallel_for(sweep->pool, num_models, update_models, &args);
+}
+
+/*
+    Mean training loss and accuracy of each model over the batches since the last call, into arrays
+    of num_models, and starts new sums; NAN when no batch was trained
+*/
+void sweep_take_stats(ModelSweep *sweep, double *loss, double *accuracy) {
+    for (int k = 0; k < sweep->num_models; k++) {
+        loss[k] = sweep->samples > 0 ? sweep->loss_sum[k] / sweep->samples : NAN;
+        accuracy[k] = sweep->samples > 0 ? (double)sweep->correct[k] / sweep->samples : NAN;
+        sweep->loss_sum[k] = 0;
+        sweep->correct[k] = 0;
+    }
+    sweep->samples = 0;
+}
+
+// like train, with a table of every model's learning rate, training loss and accuracy after each epoch
+void sweep_train(ModelSweep *sweep, DataLoader *loader, int num_epochs) {
+    int num_batches = loader->num_batches, num_models = sweep->num_models;
+    double loss[num_models], accuracy[num_models];
+    sweep_reserve_workspace(sweep, loader->batch_size);
+    for (int epoch = 0; epoch < num_epochs; epoch++, sweep->epoch++) {
+        printf("\nEpoch %d\n", sweep->epoch+1);
+        loader_start_epoch(loader, sweep->epoch);
+        sweep_take_stats(sweep, loss, accuracy);
+        Matrix batch_inputs, batch_targets;
+        for (int i = 0; loader_next(loader, &batch_inputs, &batch_targets) > 0; i++) {
+            print_progress(i, num_batches);
+            sweep_step(sweep, batch_inputs, batch_targets);
+        }
+        print_progress(num_batches, num_batches);
+        printf("\n");
+        sweep_take_stats(sweep, loss, accuracy);
+        printf("%6s %14s %14s %10s\n", "model", "learning rate", "training loss", "accuracy");
+        for (int k = 0; k < num_models; k++) {
+            printf("%6d %14f %14f %10f\n", k, lr_schedule_rate(sweep->optimizer.schedule, sweep->learning_rates[k], sweep->epoch),
+                   loss[k], accuracy[k]);
+        }
+    }
+}
+
+// mean loss and accuracy of each model on samples [start, start + count), into arrays of num_models
+void sweep_evaluate(ModelSweep *sweep, const Dataset *dataset, int start, int count, double *loss, double *accuracy) {
+    int num_models = sweep->num_models, last = sweep->num_layers - 1;
+    int num_classes = sweep->layers[last].num_neurons;
+    sweep_reserve_workspace(sweep, EVALUATION_BATCH_SIZE);
+    double loss_sum[num_models];
+    long correct[num_models];
+    memset(loss_sum, 0, sizeof(loss_sum));
+    memset(correct, 0, sizeof(correct));
+    for (int offset = 0; offset < count; offset += EVALUATION_BATCH_SIZE) {
+        int rows = count - offset < EVALUATION_BATCH_SIZE ? count - offset : EVALUATION_BATCH_SIZE;
+        Matrix inputs, targets;
+        dataset_read(dataset, start + offset, rows, sweep->input_buffer, sweep->target_buffer, &inputs, &targets);
+        sweep_forward(sweep, inputs);
+        for (int k = 0; k < num_models; k++) {
+            Matrix logits = model_block(sweep->outputs[last], k, num_classes);
+            // the deltas are only scratch here
+            loss_sum[k] += softmax_cross_entropy(logits, targets, model_block(sweep->deltas[last], k, num_classes));
+            correct[k] += count_correct(logits, targets);
+        }
+    }
+    for (int k = 0; k < num_models; k++) {
+        loss[k] = count > 0 ? loss_sum[k] / count : NAN;
+        accuracy[k] = count > 0 ? (double)correct[k] / count : NAN;
+    }
+}
+
+/*
+    Copies model k's weights and biases into mlp, which must have the sweep's topology, so it can be
+    evaluated, checkpointed or served on its own
+    Returns 0, or -1 if the topology differs.
+*/
+int sweep_export(ModelSweep *sweep, int model, MLP *mlp) {
+    int matches = model >= 0 && model < sweep->num_models && mlp->num_layers == sweep->num_layers && mlp->input_size == sweep->input_size;
+    for (int l = 0; matches && l < sweep->num_layers; l++) {
+        matches = mlp->layers[l]->num_neurons == sweep->layers[l].num_neurons;
+    }
+    if (!matches) {
+        fprintf(stderr, "Cannot export model %d of the sweep into a model of another topology\n", model);
+        return -1;
+    }
+    copy_model(sweep, model, mlp, 1);
+    return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+#include"mlp.h"
+
+/*
+    One layer of every model of a sweep, stacked
+    The first layer's weights sit side by side, prev_num_neurons x (num_models * num_neurons) with model
+    k's columns from k * num_neurons, so the shared inputs go through all of them in one wide GEMM.
+    Deeper layers hold the models' prev_num_neurons x num_neurons weights one after the other, for
+    sgemm_batched. Biases, gradients and every optimizer state slot are laid out like the weights.
+*/
+typedef struct {
+    int num_neurons;
+    int prev_num_neurons;
+    Matrix weights;
+    float *biases;          // num_models * num_neurons
+    Matrix grad_weights;
+    float *grad_biases;
+    float *state_weights;   // num_slots copies of the weights, NULL for plain SGD
+    float *state_biases;
+    void (*activation)(float*, float*, size_t);
+    void (*activation_prime)(float*, float*, size_t);
+} SweepLayer;
+
+/*
+    num_models networks of one topology trained in lockstep on the same batches, for hyperparameter sweeps
+    Every model has its own initial weights and base learning rate; the optimizer type, its settings
+    and the learning rate schedule are the template's. Activations and deltas of all models share one
+    batch x (num_models * num_neurons) matrix per layer, model k's columns in the k-th block.
+    Only models with the fused softmax + cross-entropy head are supported.
+*/
+typedef struct {
+    int num_models;
+    int num_layers;
+    int input_size;
+    SweepLayer *layers;
+    Optimizer optimizer;    // shared settings and step count, the state lives in the layers
+    float *learning_rates;  // base rate of each model
+    int epoch;
+    ThreadPool *pool;
+    // workspace for batches of up to max_batch_size, one matrix per layer
+    Arena arena;
+    int max_batch_size;
+    Matrix *pre;
+    Matrix *outputs;
+    Matrix *deltas;
+    Matrix input_buffer;    // uint8 datasets are converted into these by sweep_evaluate
+    Matrix target_buffer;
+    // training loss and correct predictions of each model since the last sweep_take_stats
+    double *loss_sum;
+    long *correct;
+    long samples;
+} ModelSweep;
+
+ModelSweep *sweep_create(const MLP *template, int num_models, const float *learning_rates, const unsigned int *seeds);
+void sweep_free(ModelSweep *sweep);
+void sweep_set_num_threads(ModelSweep *sweep, int num_threads);
+void sweep_step(ModelSweep *sweep, Matrix inputs, Matrix targets);
+void sweep_take_stats(ModelSweep *sweep, double *loss, double *accuracy);
+void sweep_train(ModelSweep *sweep, DataLoader *loader, int num_epochs);
+void sweep_evaluate(ModelSweep *sweep, const Dataset *dataset, int start, int count, double *loss, double *accuracy);
+int sweep_export(ModelSweep *sweep, int model, MLP *mlp);
+
+#endif
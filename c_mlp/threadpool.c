@@ -0,0 +1,139 @@
+#include<stdlib.h>
+#include<stdio.h>
+#include<pthread.h>
+#include<unistd.h>
+#include"threadpool.h"
+
+struct ThreadPool {
+    pthread_t *threads;
+    int num_threads; // including the thread that calls threadpool_parallel_for
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    unsigned long generation; // bumped for every parallel_for so workers can tell new work from old
+    int pending;              // worker chunks still running
+    int shutdown;
+    // the current job
+    parallel_for_fn fn;
+    void *arg;
+    int n;
+};
+
+typedef struct {
+    ThreadPool *pool;
+    int index;
+} WorkerArgs;
+
+static void run_chunk(ThreadPool *pool, int index) {
+    int begin = (int)((long)pool->n * index / pool->num_threads);
+    int end = (int)((long)pool->n * (index + 1) / pool->num_threads);
+    if (begin < end) {
+        pool->fn(pool->arg, begin, end);
+    }
+}
+
+static void *worker_main(void *p) {
+    WorkerArgs *args = p;
+    ThreadPool *pool = args->pool;
+    int index = args->index;
+    free(args);
+
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->generation == seen && !pool->shutdown) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_chunk(pool, index);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+ThreadPool *threadpool_create(int num_threads) {
+    ThreadPool *pool = malloc(sizeof(ThreadPool));
+    pool->num_threads = num_threads < 1 ? 1 : num_threads;
+    pool->threads = malloc(pool->num_threads * sizeof(pthread_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+    pool->generation = 0;
+    pool->pending = 0;
+    pool->shutdown = 0;
+    for (int i = 1; i < pool->num_threads; i++) {
+        WorkerArgs *args = malloc(sizeof(WorkerArgs));
+        args->pool = pool;
+        args->index = i;
+        if (pthread_create(&pool->threads[i], NULL, worker_main, args) != 0) {
+            fprintf(stderr, "Could not start worker thread %d\n", i);
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+void threadpool_free(ThreadPool *pool) {
+    if (pool == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i < pool->num_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work_ready);
+    pthread_cond_destroy(&pool->work_done);
+    free(pool->threads);
+    free(pool);
+}
+
+int threadpool_size(ThreadPool *pool) {
+    return pool == NULL ? 1 : pool->num_threads;
+}
+
+void threadpool_parallel_for(ThreadPool *pool, int n, parallel_for_fn fn, void *arg) {
+    if (n <= 0) {
+        return;
+    }
+    if (pool == NULL || pool->num_threads == 1 || n == 1) {
+        fn(arg, 0, n);
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->n = n;
+    pool->pending = pool->num_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_ready);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_chunk(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->work_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// MLP_NUM_THREADS if set, otherwise one thread per online CPU
+int default_num_threads() {
+    const char *env = getenv("MLP_NUM_THREADS");
+    long num_threads = env != NULL ? atol(env) : sysconf(_SC_NPROCESSORS_ONLN);
+    return num_threads < 1 ? 1 : (int)num_threads;
+}
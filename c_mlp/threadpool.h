@@ -0,0 +1,21 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+/*
+    Persistent pool of worker threads
+    threadpool_parallel_for splits [0, n) into one contiguous chunk per thread (the calling thread
+    takes the first one) and returns once every chunk is done. Chunk boundaries only depend on n
+    and the pool size, and callers make each index's work independent of the chunking, so results
+    are bitwise identical for any number of threads.
+*/
+typedef struct ThreadPool ThreadPool;
+
+typedef void (*parallel_for_fn)(void *arg, int begin, int end);
+
+ThreadPool *threadpool_create(int num_threads);
+void threadpool_free(ThreadPool *pool);
+int threadpool_size(ThreadPool *pool);
+void threadpool_parallel_for(ThreadPool *pool, int n, parallel_for_fn fn, void *arg);
+int default_num_threads();
+
+#endif
@@ -0,0 +1,188 @@
+/*
+    One-time conversion of MNIST-style CSV or IDX files to the binary dataset format read by dataset_open
+    Build from c_mlp/:
+        gcc -O2 -I. tools/convert_dataset.c dataset.c matrix.c -o convert_dataset
+    Usage:
+        ./convert_dataset csv <input.csv> <output.bin> [--classes N] [--float] [--skip-header]
+            one sample per line, the class index first and the features after it. Features are stored
+            as uint8 scaled by 1/255 unless --float is given, in which case they are stored as is.
+        ./convert_dataset idx <images-idx3-ubyte> <labels-idx1-ubyte> <output.bin> [--classes N]
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<stdint.h>
+#include"dataset.h"
+
+static int count_fields(const char *line) {
+    int fields = 1;
+    for (const char *c = line; *c != '\0' && *c != '\n' && *c != '\r'; c++) {
+        fields += *c == ',';
+    }
+    return fields;
+}
+
+static int convert_csv(const char *input_path, const char *output_path, int num_classes, int as_float, int skip_header) {
+    FILE *input = fopen(input_path, "r");
+    if (input == NULL) {
+        fprintf(stderr, "Could not open file %s\n", input_path);
+        return 1;
+    }
+    // getline grows the buffer, so there is no limit on the line length
+    char *line = NULL;
+    size_t line_capacity = 0;
+    DatasetWriter *writer = NULL;
+    int feature_dim = 0;
+    void *features = NULL;
+    long line_number = 0;
+    int status = 0;
+
+    while (getline(&line, &line_capacity, input) > 0) {
+        line_number++;
+        if (skip_header && line_number == 1) {
+            continue;
+        }
+        if (line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+        if (writer == NULL) {
+            feature_dim = count_fields(line) - 1;
+            writer = dataset_writer_open(output_path, feature_dim, as_float ? DATASET_FLOAT32 : DATASET_UINT8,
+                                         as_float ? 1.0f : 1.0f / 255.0f);
+            features = malloc(feature_dim * sizeof(float));
+            if (writer == NULL) {
+                status = 1;
+                break;
+            }
+        }
+        if (count_fields(line) != feature_dim + 1) {
+            fprintf(stderr, "%s:%ld: expected %d fields, found %d\n", input_path, line_number, feature_dim + 1, count_fields(line));
+            status = 1;
+            break;
+        }
+
+        char *cursor = line;
+        int label = (int)strtol(cursor, &cursor, 10);
+        for (int i = 0; i < feature_dim; i++) {
+            cursor++; // the comma
+            if (as_float) {
+                ((float *)features)[i] = strtof(cursor, &cursor);
+                continue;
+            }
+            long value = strtol(cursor, &cursor, 10);
+            if (value < 0 || value > 255) {
+                fprintf(stderr, "%s:%ld: %ld does not fit in uint8, use --float\n", input_path, line_number, value);
+                status = 1;
+                break;
+            }
+            ((uint8_t *)features)[i] = value;
+        }
+        if (status != 0 || dataset_writer_append(writer, features, label) != 0) {
+            status = 1;
+            break;
+        }
+    }
+
+    if (writer != NULL) {
+        int samples = writer->header.num_samples;
+        status |= dataset_writer_close(writer, num_classes) != 0;
+        if (status == 0) {
+            printf("%s: %d samples, %d features\n", output_path, samples, feature_dim);
+        }
+    }
+    free(features);
+    free(line);
+    fclose(input);
+    return status;
+}
+
+static uint32_t read_be32(FILE *file) {
+    unsigned char bytes[4] = {0};
+    if (fread(bytes, 1, 4, file) != 4) {
+        return 0;
+    }
+    return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+static int convert_idx(const char *images_path, const char *labels_path, const char *output_path, int num_classes) {
+    FILE *images = fopen(images_path, "rb");
+    FILE *labels = fopen(labels_path, "rb");
+    if (images == NULL || labels == NULL) {
+        fprintf(stderr, "Could not open file %s\n", images == NULL ? images_path : labels_path);
+        if (images != NULL) fclose(images);
+        if (labels != NULL) fclose(labels);
+        return 1;
+    }
+    // IDX: big-endian magic 0x00000803 (uint8, 3 dims) for images and 0x00000801 for labels, then the dims
+    uint32_t images_magic = read_be32(images);
+    uint32_t num_images = read_be32(images);
+    uint32_t rows = read_be32(images);
+    uint32_t cols = read_be32(images);
+    uint32_t labels_magic = read_be32(labels);
+    uint32_t num_labels = read_be32(labels);
+    if (images_magic != 0x803 || labels_magic != 0x801 || num_images != num_labels) {
+        fprintf(stderr, "%s and %s are not matching IDX image and label files\n", images_path, labels_path);
+        fclose(images);
+        fclose(labels);
+        return 1;
+    }
+
+    int feature_dim = rows * cols;
+    DatasetWriter *writer = dataset_writer_open(output_path, feature_dim, DATASET_UINT8, 1.0f / 255.0f);
+    uint8_t *pixels = malloc(feature_dim);
+    int status = writer == NULL;
+    for (uint32_t i = 0; i < num_images && status == 0; i++) {
+        int label = fgetc(labels);
+        if (label == EOF || fread(pixels, 1, feature_dim, images) != (size_t)feature_dim) {
+            fprintf(stderr, "Unexpected end of IDX data at sample %u\n", i);
+            status = 1;
+            break;
+        }
+        status = dataset_writer_append(writer, pixels, label) != 0;
+    }
+    if (writer != NULL) {
+        status |= dataset_writer_close(writer, num_classes) != 0;
+    }
+    if (status == 0) {
+        printf("%s: %u samples, %d features\n", output_path, num_images, feature_dim);
+    }
+    free(pixels);
+    fclose(images);
+    fclose(labels);
+    return status;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: convert_dataset csv <input.csv> <output.bin> [--classes N] [--float] [--skip-header]\n");
+    fprintf(stderr, "       convert_dataset idx <images-idx3-ubyte> <labels-idx1-ubyte> <output.bin> [--classes N]\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        usage();
+        return 1;
+    }
+    int num_classes = 0, as_float = 0, skip_header = 0;
+    int positional = strcmp(argv[1], "idx") == 0 ? 5 : 4;
+    for (int i = positional; i < argc; i++) {
+        if (strcmp(argv[i], "--classes") == 0 && i + 1 < argc) {
+            num_classes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--float") == 0) {
+            as_float = 1;
+        } else if (strcmp(argv[i], "--skip-header") == 0) {
+            skip_header = 1;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    if (strcmp(argv[1], "csv") == 0) {
+        return convert_csv(argv[2], argv[3], num_classes, as_float, skip_header);
+    }
+    if (strcmp(argv[1], "idx") == 0 && argc >= 5) {
+        return convert_idx(argv[2], argv[3], argv[4], num_classes);
+    }
+    usage();
+    return 1;
+}
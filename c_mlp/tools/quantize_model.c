@@ -0,0 +1,127 @@
+/*
+    Post-training INT8 quantization of a checkpoint
+    Calibrates the activation ranges on the first samples of a dataset, writes the quantized model
+    and reports its accuracy and throughput against the float32 model.
+    Build from c_mlp/:
+        gcc -O2 -I. tools/quantize_model.c quantize.c quantize_kernels.c checkpoint.c allreduce.c inference.c evaluate.c mlp.c optimizer.c gemm.c gemm_kernels.c bf16.c sparse.c matrix.c arena.c dataset.c loader.c threadpool.c activation.c activation_kernels.c loss.c -o quantize_model -lm -lpthread
+    Usage:
+        ./quantize_model <model.ckpt> <calibration.bin> <output.q8> [--samples N] [--test test.bin]
+            calibrates on the first N samples (default 2048) of calibration.bin and evaluates on
+            test.bin, or on calibration.bin when no test set is given
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include"mlp.h"
+#include"checkpoint.h"
+#include"inference.h"
+#include"quantize.h"
+
+#define EVAL_BATCH 256
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// accuracy of the quantized model over the dataset, and its samples per second
+static float quantized_accuracy(QuantizedMLP *qmlp, Dataset *dataset, double *samples_per_second) {
+    void *scratch = aligned_alloc(MATRIX_ALIGNMENT, quantized_scratch_bytes(qmlp, EVAL_BATCH));
+    int predictions[EVAL_BATCH];
+    int correct = 0;
+    double seconds = 0;
+    for (int start = 0; start < dataset->num_samples; start += EVAL_BATCH) {
+        int count = dataset->num_samples - start < EVAL_BATCH ? dataset->num_samples - start : EVAL_BATCH;
+        Matrix inputs, targets;
+        dataset_batch(dataset, start, count, &inputs, &targets);
+        double begin = now_seconds();
+        quantized_infer(qmlp, inputs, scratch, predictions);
+        seconds += now_seconds() - begin;
+        for (int i = 0; i < count; i++) {
+            correct += MAT(targets, i, predictions[i]) == 1.0f;
+        }
+    }
+    free(scratch);
+    *samples_per_second = dataset->num_samples / seconds;
+    return (float)correct / dataset->num_samples;
+}
+
+// samples per second of the float model on the same batches
+static double float_throughput(MLP *mlp, Dataset *dataset) {
+    void *scratch = aligned_alloc(MATRIX_ALIGNMENT, mlp_inference_scratch_bytes(mlp, EVAL_BATCH));
+    int predictions[EVAL_BATCH];
+    double seconds = 0;
+    for (int start = 0; start < dataset->num_samples; start += EVAL_BATCH) {
+        int count = dataset->num_samples - start < EVAL_BATCH ? dataset->num_samples - start : EVAL_BATCH;
+        Matrix inputs, targets;
+        dataset_batch(dataset, start, count, &inputs, &targets);
+        double begin = now_seconds();
+        mlp_infer(mlp, inputs, scratch, predictions);
+        seconds += now_seconds() - begin;
+    }
+    free(scratch);
+    return dataset->num_samples / seconds;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4) {
+        fprintf(stderr, "Usage: %s <model.ckpt> <calibration.bin> <output.q8> [--samples N] [--test test.bin]\n", argv[0]);
+        return 1;
+    }
+    int num_calibration = 2048;
+    const char *test_path = NULL;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--samples") == 0 && i + 1 < argc) {
+            num_calibration = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--test") == 0 && i + 1 < argc) {
+            test_path = argv[++i];
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    MLP *mlp = mlp_load(argv[1]);
+    Dataset *calibration_set = dataset_open(argv[2]);
+    if (mlp == NULL || calibration_set == NULL) {
+        return 1;
+    }
+    if (calibration_set->feature_dim != mlp->input_size) {
+        fprintf(stderr, "%s has %d features, the model takes %d\n", argv[2], calibration_set->feature_dim, mlp->input_size);
+        return 1;
+    }
+    if (num_calibration > calibration_set->num_samples) {
+        num_calibration = calibration_set->num_samples;
+    }
+
+    Matrix calibration, targets;
+    dataset_batch(calibration_set, 0, num_calibration, &calibration, &targets);
+    QuantizedMLP *qmlp = quantize_mlp(mlp, calibration);
+    if (quantized_save(qmlp, argv[3]) != 0) {
+        return 1;
+    }
+    printf("Quantized %s on %d samples into %s (integer kernel: %s)\n", argv[1], num_calibration, argv[3], quantize_kernel_name());
+
+    Dataset *test_set = test_path != NULL ? dataset_open(test_path) : calibration_set;
+    if (test_set == NULL) {
+        return 1;
+    }
+    printf("float32:\n");
+    float float_accuracy = validate(mlp, test_set, EVAL_BATCH);
+    double float_speed = float_throughput(mlp, test_set);
+    double int8_speed;
+    float int8_accuracy = quantized_accuracy(qmlp, test_set, &int8_speed);
+    printf("int8:\nAccuracy: %f\n", int8_accuracy);
+    printf("Accuracy delta: %+.4f, throughput %.0f -> %.0f samples/sec (%.2fx)\n", int8_accuracy - float_accuracy,
+           float_speed, int8_speed, int8_speed / float_speed);
+
+    if (test_set != calibration_set) {
+        dataset_close(test_set);
+    }
+    dataset_close(calibration_set);
+    quantized_free(qmlp);
+    mlp_free(mlp);
+    return 0;
+}
@@ -0,0 +1,80 @@
+/*
+    Inference daemon: serves a checkpoint over a Unix domain socket, see server.h for the protocol
+    Concurrent requests are coalesced into batches of up to --batch requests, waiting at most
+    --delay-us microseconds for a batch to fill, and run on --workers threads. SIGINT or SIGTERM
+    stops it and prints how many requests it answered in how many batches.
+    Build from c_mlp/:
+        make serve_model
+    Usage:
+        ./serve_model <model.ckpt> <socket_path> [--batch N] [--delay-us N] [--workers N] [--queue N]
+    Drive it with bench/bench_server --socket <socket_path>.
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<signal.h>
+#include"mlp.h"
+#include"checkpoint.h"
+#include"server.h"
+
+static InferenceServer *running_server = NULL;
+
+static void handle_signal(int signal) {
+    (void)signal;
+    if (running_server != NULL) {
+        server_stop(running_server);
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s <model.ckpt> <socket_path> [--batch N] [--delay-us N] [--workers N] [--queue N] [--outstanding N]\n", argv[0]);
+        return 1;
+    }
+    ServerConfig config = server_default_config();
+    for (int i = 3; i < argc; i++) {
+        if (i + 1 < argc && strcmp(argv[i], "--batch") == 0) {
+            config.max_batch_size = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--delay-us") == 0) {
+            config.max_delay = atof(argv[++i]) * 1e-6;
+        } else if (i + 1 < argc && strcmp(argv[i], "--workers") == 0) {
+            config.num_workers = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--queue") == 0) {
+            config.max_queue = atoi(argv[++i]);
+        } else if (i + 1 < argc && strcmp(argv[i], "--outstanding") == 0) {
+            config.max_outstanding = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    MLP *mlp = mlp_load_mapped(argv[1]);
+    if (mlp == NULL) {
+        return 1;
+    }
+    InferenceServer *server = server_create(mlp, argv[2], config);
+    if (server == NULL) {
+        mlp_free(mlp);
+        return 1;
+    }
+    running_server = server;
+    struct sigaction action = { 0 };
+    action.sa_handler = handle_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    printf("Serving %s on %s: %d inputs, %d outputs, batches of up to %d, %.0f us delay, %d workers\n", argv[1], argv[2],
+           mlp->input_size, mlp->layers[mlp->num_layers - 1]->num_neurons, config.max_batch_size, config.max_delay * 1e6,
+           config.num_workers);
+    fflush(stdout);
+    int status = server_run(server);
+
+    long requests, batches;
+    server_stats(server, &requests, &batches);
+    printf("Answered %ld requests in %ld batches (%.1f per batch)\n", requests, batches, batches > 0 ? (double)requests / batches : 0.0);
+    running_server = NULL;
+    server_free(server);
+    mlp_free(mlp);
+    return status != 0;
+}
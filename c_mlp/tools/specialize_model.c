@@ -0,0 +1,341 @@
+/*
+    Generates a forward pass specialized to one network topology, as a standalone C source and header
+    Every dimension and activation is a compile-time constant in the generated code: each layer is a
+    loop nest with fixed trip counts and its activation written out inline, the hidden activations live
+    in fixed-size arrays on the stack, and nothing is allocated or called through a pointer. The
+    generated files only need a C compiler, build them into the service with e.g.
+        cc -O2 -march=native -c <name>.c
+    The column blocks are written for the compiler to keep in vector registers; with only baseline SSE
+    they spill, and -O3's extra unrolling has measured slower than -O2 on AVX-512.
+    The generated API, with NAME the upper-cased name:
+        NAME_INPUT_SIZE, NAME_OUTPUT_SIZE
+        void <name>_forward(const float *input, float *output)    outputs after the output activation
+        int <name>_predict(const float *input)                     argmax of the output layer's logits
+        void <name>_forward_batch(const float *input, int count, float *output)
+        <name>_params <name>_weights                              per layer w<i>[prev][num] and b<i>[num]
+    The functions are reentrant. Exponentials use the same polynomial as activation_kernels.h, so the
+    outputs match mlp_infer up to float summation order.
+    Build from c_mlp/:
+        make specialize_model
+    Usage:
+        ./specialize_model <model.ckpt> <name> [output_dir]
+            embeds the checkpoint's weights as constants
+        ./specialize_model --spec <layers> <name> [output_dir] [--seed S]
+            layers like 784-64:relu-32:relu-10:softmax (input size first, then size:activation per layer).
+            With --seed the weights mlp_init_weights draws from S are embedded, without it <name>_weights
+            is left zeroed for the caller to fill (same layout as a checkpoint's weights and biases).
+*/
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<ctype.h>
+#include"mlp.h"
+#include"checkpoint.h"
+#include"activation.h"
+#include"activation_kernels.h"
+#include"loss.h"
+
+#define MAX_SPEC_LAYERS 64
+// output columns a generated layer keeps in accumulators while it walks the non-zero inputs
+#define SPECIALIZE_BLOCK 32
+
+static const struct {
+    const char *name;
+    int id;
+} activation_names[] = {
+    { "sigmoid", ACTIVATION_SIGMOID }, { "relu", ACTIVATION_RELU }, { "softmax", ACTIVATION_SOFTMAX },
+    { "tanh", ACTIVATION_TANH }, { "leaky_relu", ACTIVATION_LEAKY_RELU }
+};
+
+static const char *activation_name(int id) {
+    for (size_t i = 0; i < sizeof(activation_names) / sizeof(activation_names[0]); i++) {
+        if (activation_names[i].id == id) {
+            return activation_names[i].name;
+        }
+    }
+    return NULL;
+}
+
+// builds an untrained model from a spec like 784-64:relu-10:softmax, NULL if it does not parse
+static MLP *model_from_spec(const char *spec) {
+    int input_size = 0, num_layers = 0;
+    int num_neurons[MAX_SPEC_LAYERS];
+    void (*activations[MAX_SPEC_LAYERS])(float*, float*, size_t);
+    void (*activation_primes[MAX_SPEC_LAYERS])(float*, float*, size_t);
+    const char *p = spec;
+    int consumed;
+    if (sscanf(p, "%d%n", &input_size, &consumed) != 1 || input_size <= 0) {
+        return NULL;
+    }
+    p += consumed;
+    while (*p == '-') {
+        char name[32];
+        int size;
+        if (num_layers == MAX_SPEC_LAYERS || sscanf(p, "-%d:%31[a-z_]%n", &size, name, &consumed) != 2 || size <= 0) {
+            return NULL;
+        }
+        int id = 0;
+        for (size_t i = 0; i < sizeof(activation_names) / sizeof(activation_names[0]); i++) {
+            if (strcmp(activation_names[i].name, name) == 0) {
+                id = activation_names[i].id;
+            }
+        }
+        if (activation_from_id(id, &activations[num_layers], &activation_primes[num_layers]) != 0) {
+            fprintf(stderr, "Unknown activation %s\n", name);
+            return NULL;
+        }
+        num_neurons[num_layers++] = size;
+        p += consumed;
+    }
+    if (*p != '\0' || num_layers == 0) {
+        return NULL;
+    }
+    return mlp_init(num_layers, num_neurons, activations, activation_primes, cross_entropy, softmax_ce_loss_prime, 0.0f, input_size);
+}
+
+// constants are written as hex float literals, which round-trip exactly
+static void write_floats(FILE *f, const float *values, size_t n, const char *indent) {
+    for (size_t i = 0; i < n; i++) {
+        fprintf(f, "%s%af,%s", i % 8 == 0 ? indent : "", values[i], i % 8 == 7 || i == n - 1 ? "\n" : " ");
+    }
+}
+
+// y = activation(y) over n values, inline
+static void write_activation(FILE *f, int id, int n) {
+    switch (id) {
+    case ACTIVATION_RELU:
+        fprintf(f, "    for (int j = 0; j < %d; j++) {\n        y[j] = y[j] > 0 ? y[j] : 0.0f;\n    }\n", n);
+        break;
+    case ACTIVATION_LEAKY_RELU:
+        fprintf(f, "    for (int j = 0; j < %d; j++) {\n        y[j] = y[j] > 0 ? y[j] : %af * y[j];\n    }\n", n, LEAKY_RELU_SLOPE);
+        break;
+    case ACTIVATION_SIGMOID:
+        fprintf(f, "    for (int j = 0; j < %d; j++) {\n        y[j] = 1.0f / (1.0f + exp_approx(-y[j]));\n    }\n", n);
+        break;
+    case ACTIVATION_TANH:
+        fprintf(f, "    for (int j = 0; j < %d; j++) {\n        y[j] = tanh_approx(y[j]);\n    }\n", n);
+        break;
+    case ACTIVATION_SOFTMAX:
+        fprintf(f, "    float max = y[0], sum = 0.0f;\n"
+                   "    for (int j = 1; j < %d; j++) {\n        max = y[j] > max ? y[j] : max;\n    }\n"
+                   "    for (int j = 0; j < %d; j++) {\n        y[j] = exp_approx(y[j] - max);\n        sum += y[j];\n    }\n"
+                   "    for (int j = 0; j < %d; j++) {\n        y[j] *= 1.0f / sum;\n    }\n", n, n, n);
+        break;
+    }
+}
+
+// fast_expf and fast_tanhf from activation_kernels.h, with their constants written out
+static void write_math(FILE *f) {
+    fprintf(f, "static inline float exp_approx(float x) {\n"
+               "    if (x != x) {\n        return x;\n    }\n"
+               "    if (x < %af) {\n        return 0.0f;\n    }\n"
+               "    if (x > %af) {\n        x = %af;\n    }\n"
+               "    float t = x * %af;\n"
+               "    int n = (int)(t < 0 ? t - 0.5f : t + 0.5f);\n"
+               "    float r = x - n * %af - n * %af;\n"
+               "    float p = ((((%af * r + %af) * r + %af) * r + %af) * r + %af) * r + %af;\n"
+               "    p = p * r * r + r + 1.0f;\n"
+               "    uint32_t bits = (uint32_t)(n + 127) << 23;\n"
+               "    float scale;\n"
+               "    memcpy(&scale, &bits, sizeof(scale));\n"
+               "    return p * scale;\n}\n\n",
+            EXP_MIN, EXP_MAX, EXP_MAX, EXP_LOG2E, EXP_LN2_HI, EXP_LN2_LO, EXP_P0, EXP_P1, EXP_P2, EXP_P3, EXP_P4, EXP_P5);
+    fprintf(f, "static inline float tanh_approx(float x) {\n"
+               "    float a = x < 0 ? -x : x;\n"
+               "    if (a < %af) {\n"
+               "        float z = x * x;\n"
+               "        return x + x * z * ((((%af * z + %af) * z + %af) * z + %af) * z + %af);\n"
+               "    }\n"
+               "    float t = 1.0f - 2.0f / (exp_approx(2.0f * a) + 1.0f);\n"
+               "    return x < 0 ? -t : t;\n}\n\n",
+            TANH_SMALL, TANH_P0, TANH_P1, TANH_P2, TANH_P3, TANH_P4);
+}
+
+static int write_header(MLP *mlp, const char *name, const char *upper, int embed, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open file %s\n", path);
+        return -1;
+    }
+    Layer *output = mlp->layers[mlp->num_layers - 1];
+    fprintf(f, "// generated by specialize_model\n#ifndef %s_H\n#define %s_H\n\n", upper, upper);
+    fprintf(f, "#define %s_INPUT_SIZE %d\n#define %s_OUTPUT_SIZE %d\n\n", upper, mlp->input_size, upper, output->num_neurons);
+    fprintf(f, "typedef struct {\n");
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        fprintf(f, "    float w%d[%d][%d]; // %s\n    float b%d[%d];\n", i, layer->prev_num_neurons, layer->num_neurons,
+                activation_name(activation_id(layer->activation)), i, layer->num_neurons);
+    }
+    fprintf(f, "} %s_params;\n\n", name);
+    fprintf(f, "extern %s%s_params %s_weights;\n\n", embed ? "const " : "", name, name);
+    fprintf(f, "void %s_forward(const float *input, float *output);\n", name);
+    fprintf(f, "int %s_predict(const float *input);\n", name);
+    fprintf(f, "void %s_forward_batch(const float *input, int count, float *output);\n\n#endif\n", name);
+    int status = ferror(f) ? -1 : 0;
+    return fclose(f) != 0 ? -1 : status;
+}
+
+static int write_source(MLP *mlp, const char *name, int embed, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open file %s\n", path);
+        return -1;
+    }
+    int last = mlp->num_layers - 1;
+    fprintf(f, "// generated by specialize_model, do not edit\n#include<stdint.h>\n#include<string.h>\n#include\"%s.h\"\n\n", name);
+    write_math(f);
+
+    if (embed) {
+        fprintf(f, "const %s_params %s_weights = {\n", name, name);
+        for (int i = 0; i < mlp->num_layers; i++) {
+            Layer *layer = mlp->layers[i];
+            fprintf(f, "    {\n");
+            for (int k = 0; k < layer->prev_num_neurons; k++) {
+                fprintf(f, "        {\n");
+                write_floats(f, matrix_row(layer->weights, k), layer->num_neurons, "            ");
+                fprintf(f, "        },\n");
+            }
+            fprintf(f, "    },\n    {\n");
+            write_floats(f, layer->biases, layer->num_neurons, "        ");
+            fprintf(f, "    },\n");
+        }
+        fprintf(f, "};\n\n");
+    } else {
+        fprintf(f, "%s_params %s_weights;\n\n", name, name);
+    }
+
+    // one function per layer: y = x @ w + b over the non-zero inputs, then the activation
+    for (int i = 0; i < mlp->num_layers; i++) {
+        Layer *layer = mlp->layers[i];
+        int n = layer->num_neurons, k = layer->prev_num_neurons;
+        fprintf(f, "static inline void layer%d(const float *restrict x, float *restrict y, int activate) {\n", i);
+        fprintf(f, "    // the non-zero inputs are gathered first, without branching on them\n");
+        fprintf(f, "    int index[%d];\n    float value[%d];\n    int nnz = 0;\n", k, k);
+        fprintf(f, "    for (int k = 0; k < %d; k++) {\n        index[nnz] = k;\n        value[nnz] = x[k];\n"
+                   "        nnz += x[k] != 0.0f;\n    }\n", k);
+        // column blocks of SPECIALIZE_BLOCK, then one narrower block for the rest
+        for (int j0 = 0; j0 < n; j0 += SPECIALIZE_BLOCK) {
+            int width = n - j0 < SPECIALIZE_BLOCK ? n - j0 : SPECIALIZE_BLOCK;
+            if (j0 == 0 && n >= 2 * SPECIALIZE_BLOCK) {
+                // the full blocks share one loop
+                width = SPECIALIZE_BLOCK;
+                fprintf(f, "    for (int j0 = 0; j0 < %d; j0 += %d) {\n", n / SPECIALIZE_BLOCK * SPECIALIZE_BLOCK, width);
+                j0 = (n / SPECIALIZE_BLOCK - 1) * SPECIALIZE_BLOCK;
+            } else {
+                fprintf(f, "    {\n        const int j0 = %d;\n", j0);
+            }
+            fprintf(f, "        float acc[%d];\n", width);
+            fprintf(f, "        for (int j = 0; j < %d; j++) {\n            acc[j] = %s_weights.b%d[j0 + j];\n        }\n", width, name, i);
+            fprintf(f, "        for (int p = 0; p < nnz; p++) {\n            const float *w = %s_weights.w%d[index[p]] + j0;\n", name, i);
+            fprintf(f, "            for (int j = 0; j < %d; j++) {\n                acc[j] += value[p] * w[j];\n            }\n        }\n", width);
+            fprintf(f, "        for (int j = 0; j < %d; j++) {\n            y[j0 + j] = acc[j];\n        }\n    }\n", width);
+        }
+        fprintf(f, "    if (!activate) {\n        return;\n    }\n");
+        write_activation(f, activation_id(layer->activation), n);
+        fprintf(f, "}\n\n");
+    }
+
+    // hidden activations ping-pong through stack buffers sized for the widest hidden layer
+    int width = 1;
+    for (int i = 0; i < last; i++) {
+        width = mlp->layers[i]->num_neurons > width ? mlp->layers[i]->num_neurons : width;
+    }
+    fprintf(f, "static inline void forward(const float *restrict input, float *restrict output, int activate) {\n");
+    if (last > 0) {
+        fprintf(f, "    float h[2][%d];\n", width);
+    }
+    for (int i = 0; i <= last; i++) {
+        char x[32], y[32];
+        snprintf(x, sizeof(x), i == 0 ? "input" : "h[%d]", (i - 1) % 2);
+        snprintf(y, sizeof(y), i == last ? "output" : "h[%d]", i % 2);
+        fprintf(f, "    layer%d(%s, %s, %s);\n", i, x, y, i == last ? "activate" : "1");
+    }
+    fprintf(f, "}\n\n");
+
+    fprintf(f, "void %s_forward(const float *input, float *output) {\n    forward(input, output, 1);\n}\n\n", name);
+    fprintf(f, "// the argmax of the logits is the argmax of the output activation, which is skipped\n");
+    fprintf(f, "int %s_predict(const float *input) {\n    float logits[%d];\n    forward(input, logits, 0);\n", name,
+            mlp->layers[last]->num_neurons);
+    fprintf(f, "    int max_idx = 0;\n    for (int j = 1; j < %d; j++) {\n        max_idx = logits[j] > logits[max_idx] ? j : max_idx;\n    }\n"
+               "    return max_idx;\n}\n\n", mlp->layers[last]->num_neurons);
+    fprintf(f, "void %s_forward_batch(const float *input, int count, float *output) {\n"
+               "    for (int i = 0; i < count; i++) {\n        forward(input + (long)i * %d, output + (long)i * %d, 1);\n    }\n}\n",
+            name, mlp->input_size, mlp->layers[last]->num_neurons);
+    int status = ferror(f) ? -1 : 0;
+    return fclose(f) != 0 ? -1 : status;
+}
+
+int main(int argc, char **argv) {
+    const char *spec = NULL;
+    const char *positional[3] = { NULL, NULL, "." };
+    int num_positional = 0, seeded = 0;
+    unsigned int seed = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--spec") == 0 && i + 1 < argc) {
+            spec = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 10);
+            seeded = 1;
+        } else if (argv[i][0] != '-' && num_positional < (spec != NULL ? 2 : 3)) {
+            positional[num_positional++] = argv[i];
+        } else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    // with --spec the positional arguments are <name> [output_dir]
+    const char *checkpoint = spec == NULL ? positional[0] : NULL;
+    const char *name = spec == NULL ? positional[1] : positional[0];
+    const char *output_dir = spec == NULL ? positional[2] : (num_positional > 1 ? positional[1] : ".");
+    if (name == NULL || (spec == NULL && checkpoint == NULL)) {
+        fprintf(stderr, "Usage: %s <model.ckpt> <name> [output_dir]\n"
+                        "       %s --spec <layers> <name> [output_dir] [--seed S]\n", argv[0], argv[0]);
+        return 1;
+    }
+    int valid_name = !isdigit((unsigned char)name[0]);
+    for (const char *c = name; *c != '\0'; c++) {
+        valid_name &= islower((unsigned char)*c) || isdigit((unsigned char)*c) || *c == '_';
+    }
+    if (!valid_name) {
+        fprintf(stderr, "The name must be a lower-case C identifier, got %s\n", name);
+        return 1;
+    }
+
+    MLP *mlp = spec != NULL ? model_from_spec(spec) : mlp_load(checkpoint);
+    if (mlp == NULL) {
+        if (spec != NULL) {
+            fprintf(stderr, "Could not parse layer spec %s\n", spec);
+        }
+        return 1;
+    }
+    for (int i = 0; i < mlp->num_layers; i++) {
+        if (activation_id(mlp->layers[i]->activation) == 0) {
+            fprintf(stderr, "Layer %d has an activation that can not be generated\n", i);
+            return 1;
+        }
+    }
+    int embed = spec == NULL || seeded;
+    if (seeded) {
+        mlp_init_weights(mlp, seed);
+    }
+    char upper[256], header_path[4096], source_path[4096];
+    size_t length = strlen(name) < sizeof(upper) - 1 ? strlen(name) : sizeof(upper) - 1;
+    for (size_t i = 0; i < length; i++) {
+        upper[i] = toupper((unsigned char)name[i]);
+    }
+    upper[length] = '\0';
+    snprintf(header_path, sizeof(header_path), "%s/%s.h", output_dir, name);
+    snprintf(source_path, sizeof(source_path), "%s/%s.c", output_dir, name);
+    if (write_header(mlp, name, upper, embed, header_path) != 0 || write_source(mlp, name, embed, source_path) != 0) {
+        fprintf(stderr, "Could not write %s\n", source_path);
+        return 1;
+    }
+    size_t parameters = 0;
+    for (int i = 0; i < mlp->num_layers; i++) {
+        parameters += (size_t)(mlp->layers[i]->prev_num_neurons + 1) * mlp->layers[i]->num_neurons;
+    }
+    printf("Wrote %s and %s: %d layers, %zu parameters%s\n", header_path, source_path, mlp->num_layers, parameters,
+           embed ? " embedded" : ", weights to be filled by the caller");
+    mlp_free(mlp);
+    return 0;
+}
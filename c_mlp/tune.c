@@ -0,0 +1,350 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include<unistd.h>
+#include"tune.h"
+#include"mlp.h"
+#include"loader.h"
+
+// the cache is text, one configuration per line:
+// <layer sizes> <budget> <max batch> <kernel> <mc> <kc> <nc> <batch> <threads> <samples/s> <cpu model>
+#define TUNE_LINE_MAX 512
+
+static double elapsed_seconds(struct timespec start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+// a model of the same topology, optimizer and precision to time, so tuning leaves the real one untouched
+static MLP *tuning_copy(const MLP *mlp) {
+    int num_neurons[mlp->num_layers];
+    void (*activations[mlp->num_layers])(float*, float*, size_t);
+    void (*activation_primes[mlp->num_layers])(float*, float*, size_t);
+    for (int i = 0; i < mlp->num_layers; i++) {
+        num_neurons[i] = mlp->layers[i]->num_neurons;
+        activations[i] = mlp->layers[i]->activation;
+        activation_primes[i] = mlp->layers[i]->activation_prime;
+    }
+    MLP *copy = mlp_init(mlp->num_layers, num_neurons, activations, activation_primes, mlp->loss, mlp->loss_prime,
+                         mlp->learning_rate, mlp->input_size);
+    mlp_init_weights(copy, 1);
+    mlp_set_optimizer(copy, mlp->optimizer);
+    mlp_set_mixed_precision(copy, mlp->mixed_precision);
+    copy->accumulation_steps = mlp->accumulation_steps;
+    return copy;
+}
+
+/*
+    Bytes a configuration allocates on top of the parameters, gradients and optimizer state, which do
+    not depend on it: the training workspace, the DataLoader's two batch slots with their CSR copies,
+    and the GEMM packing buffers of every thread
+*/
+size_t tune_memory_bytes(const MLP *mlp, const TuneConfig *config) {
+    size_t batch = config->batch_size;
+    int outputs = mlp->layers[mlp->num_layers - 1]->num_neurons;
+    size_t slots = 2 * batch * (mlp->input_size + outputs) * sizeof(float);
+    slots += 2 * (size_t)(batch * mlp->input_size * SPARSE_MAX_DENSITY) * (sizeof(float) + sizeof(int));
+    // zero blocking fields are taken as the current kernel's, and a register tile of slack per buffer
+    GemmBlocking blocking = config->blocking, current = gemm_blocking();
+    blocking.mc = blocking.mc > 0 ? blocking.mc : current.mc;
+    blocking.kc = blocking.kc > 0 ? blocking.kc : current.kc;
+    blocking.nc = blocking.nc > 0 ? blocking.nc : current.nc;
+    size_t packing = ((size_t)blocking.mc + blocking.nc + 64) * blocking.kc * sizeof(float);
+    return mlp_workspace_bytes(mlp, config->batch_size) + slots + config->num_threads * packing;
+}
+
+/*
+    Training samples per second of the configuration, measured on a copy of the model
+    The copy trains on shuffled batches of the dataset the way train does: one warm-up step, then
+    TUNE_WINDOWS windows of at least TUNE_SECONDS each, of which the fastest counts. The process-wide
+    GEMM kernel and blocking are restored afterwards.
+    Returns 0 if the kernel is not available on this CPU or the dataset holds less than one batch.
+*/
+double tune_measure(const MLP *mlp, Dataset *dataset, const TuneConfig *config) {
+    if (dataset->num_samples < config->batch_size) {
+        return 0;
+    }
+    const char *previous_kernel = gemm_kernel_name();
+    GemmBlocking previous_blocking = gemm_blocking();
+    if (gemm_select_kernel(config->kernel) != 0) {
+        return 0;
+    }
+    gemm_set_blocking(config->blocking);
+    MLP *copy = tuning_copy(mlp);
+    mlp_set_num_threads(copy, config->num_threads);
+    mlp_reserve_workspace(copy, config->batch_size);
+    DataLoader *loader = loader_create(dataset, config->batch_size, 1, 1);
+
+    // the fastest of TUNE_WINDOWS timed windows, the one the rest of the machine disturbed least
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long samples = 0, steps = 0;
+    int window = -1; // -1 during the warm-up step
+    double seconds = 0, best = 0;
+    for (int epoch = 0, batches = 1; window < TUNE_WINDOWS && batches > 0; epoch++) {
+        loader_start_epoch(loader, epoch);
+        Matrix inputs, targets;
+        // an epoch without a batch would never end the windows
+        for (batches = 0; window < TUNE_WINDOWS && loader_next(loader, &inputs, &targets) > 0; batches++) {
+            mlp_compute_gradients_sparse(copy, inputs, loader_sparse_inputs(loader), targets);
+            mlp_apply_gradients(copy);
+            samples += inputs.rows;
+            steps++;
+            seconds = elapsed_seconds(start);
+            // the warm-up step grows the packing buffers and touches the workspace
+            if (window < 0 || (seconds >= TUNE_SECONDS && steps >= 3)) {
+                if (window >= 0 && samples / seconds > best) {
+                    best = samples / seconds;
+                }
+                window++;
+                samples = steps = 0;
+                clock_gettime(CLOCK_MONOTONIC, &start);
+            }
+        }
+    }
+
+    loader_free(loader);
+    mlp_free(copy);
+    gemm_select_kernel(previous_kernel);
+    gemm_set_blocking(previous_blocking);
+    return best;
+}
+
+// keeps the faster of the best configuration so far and the candidate, measuring the candidate
+static void try_config(const MLP *mlp, Dataset *dataset, size_t memory_budget, TuneConfig candidate, TuneConfig *best) {
+    if (tune_memory_bytes(mlp, &candidate) > memory_budget) {
+        return;
+    }
+    candidate.samples_per_second = tune_measure(mlp, dataset, &candidate);
+    if (candidate.samples_per_second > best->samples_per_second) {
+        *best = candidate;
+    }
+}
+
+/*
+    Finds the configuration that trains the model fastest on this host within memory_budget bytes
+    (see tune_memory_bytes), timing candidates on the dataset with tune_measure
+    First every kernel the CPU supports is tried with its default cache blocking and with mc and kc
+    halved and doubled, one thread at a batch of 64 (or the largest that fits). The fastest
+    then runs every power-of-two batch size from TUNE_MIN_BATCH to max_batch_size against thread
+    counts doubling up to the number of online cores. Batch size changes what training converges to as well
+    as its speed, max_batch_size is where the caller draws that line.
+    Returns -1 if nothing fits the budget or max_batch_size is below TUNE_MIN_BATCH. Takes about TUNE_WINDOWS * TUNE_SECONDS per candidate.
+*/
+int tune_search(const MLP *mlp, Dataset *dataset, size_t memory_budget, int max_batch_size, TuneConfig *config) {
+    const char *kernels[] = {"avx512", "avx2", "scalar"};
+    int num_kernels = sizeof(kernels) / sizeof(kernels[0]);
+    const char *previous_kernel = gemm_kernel_name();
+    GemmBlocking previous_blocking = gemm_blocking();
+    GemmBlocking defaults = { 0, 0, 0 };
+
+    if (max_batch_size < TUNE_MIN_BATCH) {
+        return -1;
+    }
+    TuneConfig best = { "", defaults, 0, 1, 0 };
+    int reference_batch = TUNE_MIN_BATCH;
+    while (reference_batch * 2 <= max_batch_size && reference_batch * 2 <= 64) {
+        reference_batch *= 2;
+    }
+    for (int i = 0; i < num_kernels; i++) {
+        if (gemm_select_kernel(kernels[i]) != 0) {
+            continue;
+        }
+        gemm_set_blocking(defaults);
+        GemmBlocking kernel_defaults = gemm_blocking();
+        for (int mc = kernel_defaults.mc / 2; mc <= 2 * kernel_defaults.mc; mc *= 2) {
+            for (int kc = kernel_defaults.kc / 2; kc <= 2 * kernel_defaults.kc; kc *= 2) {
+                // at the reference batch, or the largest below it that fits with this blocking
+                TuneConfig candidate = { "", { mc, kc, kernel_defaults.nc }, reference_batch, 1, 0 };
+                snprintf(candidate.kernel, sizeof(candidate.kernel), "%s", kernels[i]);
+                while (candidate.batch_size > TUNE_MIN_BATCH && tune_memory_bytes(mlp, &candidate) > memory_budget) {
+                    candidate.batch_size /= 2;
+                }
+                try_config(mlp, dataset, memory_budget, candidate, &best);
+            }
+        }
+    }
+    gemm_select_kernel(previous_kernel);
+    gemm_set_blocking(previous_blocking);
+
+    if (best.samples_per_second == 0) {
+        return -1;
+    }
+    // the host's cores, not default_num_threads: MLP_NUM_THREADS is what the search is there to replace
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int measured_batch = best.batch_size, max_threads = cores > 1 ? (int)cores : 1;
+    for (int batch = TUNE_MIN_BATCH; batch <= max_batch_size; batch *= 2) {
+        for (int threads = 1;; threads = threads * 2 < max_threads ? threads * 2 : max_threads) {
+            TuneConfig candidate = best;
+            candidate.batch_size = batch;
+            candidate.num_threads = threads;
+            if (batch != measured_batch || threads != 1) {
+                try_config(mlp, dataset, memory_budget, candidate, &best);
+            }
+            if (threads == max_threads) {
+                break;
+            }
+        }
+    }
+    *config = best;
+    return 0;
+}
+
+// makes the configuration current: GEMM kernel and blocking for the process, thread count for the model
+void tune_apply(MLP *mlp, const TuneConfig *config) {
+    if (gemm_select_kernel(config->kernel) != 0) {
+        fprintf(stderr, "tune_apply: kernel %s is not available, keeping %s\n", config->kernel, gemm_kernel_name());
+    }
+    gemm_set_blocking(config->blocking);
+    mlp_set_num_threads(mlp, config->num_threads);
+}
+
+/*
+    The per-host cache file: $MLP_TUNE_CACHE if set, else ~/.mlp_tune_<hostname>, so hosts sharing a
+    home directory keep separate results. Returns -1 if the path does not fit.
+*/
+int tune_cache_path(char *path, size_t size) {
+    const char *override = getenv("MLP_TUNE_CACHE");
+    if (override != NULL) {
+        return snprintf(path, size, "%s", override) < (int)size ? 0 : -1;
+    }
+    char host[256] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    const char *home = getenv("HOME");
+    return snprintf(path, size, "%s/.mlp_tune_%s", home != NULL ? home : ".", host) < (int)size ? 0 : -1;
+}
+
+// the CPU's model name, which also guards against a host name moving to other hardware
+static void cpu_model(char *model, size_t size) {
+    snprintf(model, size, "unknown");
+    FILE *file = fopen("/proc/cpuinfo", "r");
+    if (file == NULL) {
+        return;
+    }
+    char line[TUNE_LINE_MAX];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char *value = strchr(line, ':');
+        if (strncmp(line, "model name", 10) == 0 && value != NULL) {
+            value += strspn(value + 1, " ") + 1;
+            value[strcspn(value, "\n")] = '\0';
+            snprintf(model, size, "%s", value);
+            break;
+        }
+    }
+    fclose(file);
+}
+
+// layer sizes from the input to the output, e.g. 784-64-32-10, with -bf16 for mixed precision
+static void model_key(const MLP *mlp, char *key, size_t size) {
+    int length = snprintf(key, size, "%d", mlp->input_size);
+    for (int i = 0; i < mlp->num_layers && length < (int)size; i++) {
+        length += snprintf(key + length, size - length, "-%d", mlp->layers[i]->num_neurons);
+    }
+    if (mlp->mixed_precision && length < (int)size) {
+        snprintf(key + length, size - length, "-bf16");
+    }
+}
+
+// parses a cache line, returns 1 if it holds a configuration for this model, budget and CPU
+static int parse_line(const char *line, const char *key, size_t memory_budget, int max_batch_size, const char *cpu, TuneConfig *config) {
+    char line_key[128];
+    unsigned long long budget;
+    int max_batch, offset = 0;
+    if (sscanf(line, "%127s %llu %d %15s %d %d %d %d %d %lf %n", line_key, &budget, &max_batch, config->kernel, &config->blocking.mc,
+               &config->blocking.kc, &config->blocking.nc, &config->batch_size, &config->num_threads, &config->samples_per_second,
+               &offset) != 10 || offset == 0) {
+        return 0;
+    }
+    size_t cpu_length = strcspn(line + offset, "\n");
+    return strcmp(line_key, key) == 0 && budget == memory_budget && max_batch == max_batch_size && strlen(cpu) == cpu_length &&
+           strncmp(line + offset, cpu, cpu_length) == 0;
+}
+
+// looks up the model's configuration for this CPU, returns 0 if the cache has one, -1 otherwise
+int tune_cache_load(const char *path, const MLP *mlp, size_t memory_budget, int max_batch_size, TuneConfig *config) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char key[128], cpu[128], line[TUNE_LINE_MAX];
+    model_key(mlp, key, sizeof(key));
+    cpu_model(cpu, sizeof(cpu));
+    int found = 0;
+    TuneConfig entry;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (parse_line(line, key, memory_budget, max_batch_size, cpu, &entry)) {
+            *config = entry;
+            found = 1; // later lines win
+        }
+    }
+    fclose(file);
+    return found ? 0 : -1;
+}
+
+/*
+    Records the configuration, replacing an earlier one for the same model, budget and CPU
+    The file is rewritten to a temporary and renamed over the old one, so concurrent readers see
+    either version whole. Returns -1 on I/O errors.
+*/
+int tune_cache_store(const char *path, const MLP *mlp, size_t memory_budget, int max_batch_size, const TuneConfig *config) {
+    char key[128], cpu[128], line[TUNE_LINE_MAX], temporary[TUNE_LINE_MAX];
+    model_key(mlp, key, sizeof(key));
+    cpu_model(cpu, sizeof(cpu));
+    if (snprintf(temporary, sizeof(temporary), "%s.%d.tmp", path, (int)getpid()) >= (int)sizeof(temporary)) {
+        return -1;
+    }
+    FILE *out = fopen(temporary, "w");
+    if (out == NULL) {
+        return -1;
+    }
+    FILE *in = fopen(path, "r");
+    if (in != NULL) {
+        TuneConfig entry;
+        while (fgets(line, sizeof(line), in) != NULL) {
+            if (!parse_line(line, key, memory_budget, max_batch_size, cpu, &entry)) {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s %llu %d %s %d %d %d %d %d %.1f %s\n", key, (unsigned long long)memory_budget, max_batch_size, config->kernel,
+            config->blocking.mc, config->blocking.kc, config->blocking.nc, config->batch_size, config->num_threads,
+            config->samples_per_second, cpu);
+    if (fclose(out) != 0 || rename(temporary, path) != 0) {
+        unlink(temporary);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    Configures the model for training on this host: the cached configuration if there is one, else
+    the result of tune_search, which is then added to the cache
+    Parameters:
+    dataset: what the model will train on, candidates are timed on it
+    memory_budget: bytes the configuration may use, see tune_memory_bytes
+    max_batch_size: largest batch size to consider
+    cache_path: cache file, NULL for the per-host default of tune_cache_path
+    config: receives the configuration, which has been applied with tune_apply
+    Returns 1 if the configuration came from the cache, 0 if it was measured now (a cache that cannot
+    be written is not an error), -1 if nothing fits the budget.
+*/
+int mlp_autotune(MLP *mlp, Dataset *dataset, size_t memory_budget, int max_batch_size, const char *cache_path, TuneConfig *config) {
+    char path[TUNE_LINE_MAX];
+    if (cache_path == NULL && tune_cache_path(path, sizeof(path)) == 0) {
+        cache_path = path;
+    }
+    int cached = cache_path != NULL && tune_cache_load(cache_path, mlp, memory_budget, max_batch_size, config) == 0;
+    if (!cached) {
+        if (tune_search(mlp, dataset, memory_budget, max_batch_size, config) != 0) {
+            return -1;
+        }
+        if (cache_path != NULL && tune_cache_store(cache_path, mlp, memory_budget, max_batch_size, config) != 0) {
+            fprintf(stderr, "Could not write the tuning cache %s\n", cache_path);
+        }
+    }
+    tune_apply(mlp, config);
+    return cached;
+}
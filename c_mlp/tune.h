@@ -0,0 +1,36 @@
+#ifndef TUNE_H
+#define TUNE_H
+#include<stddef.h>
+#include"gemm.h"
+#include"dataset.h"
+
+typedef struct MLP MLP;
+
+// a candidate configuration is timed over TUNE_WINDOWS windows of at least TUNE_SECONDS each
+#define TUNE_SECONDS 0.03
+#define TUNE_WINDOWS 3
+#define TUNE_MIN_BATCH 16
+
+/*
+    A training configuration for one model on one host, see mlp_autotune
+    The kernel and blocking are process-wide GEMM settings, the thread count goes to the model's pool
+    and the batch size to the DataLoader.
+*/
+typedef struct {
+    char kernel[16];
+    GemmBlocking blocking;
+    int batch_size;
+    int num_threads;
+    double samples_per_second; // training throughput measured for the configuration
+} TuneConfig;
+
+size_t tune_memory_bytes(const MLP *mlp, const TuneConfig *config);
+double tune_measure(const MLP *mlp, Dataset *dataset, const TuneConfig *config);
+int tune_search(const MLP *mlp, Dataset *dataset, size_t memory_budget, int max_batch_size, TuneConfig *config);
+void tune_apply(MLP *mlp, const TuneConfig *config);
+int tune_cache_path(char *path, size_t size);
+int tune_cache_load(const char *path, const MLP *mlp, size_t memory_budget, int max_batch_size, TuneConfig *config);
+int tune_cache_store(const char *path, const MLP *mlp, size_t memory_budget, int max_batch_size, const TuneConfig *config);
+int mlp_autotune(MLP *mlp, Dataset *dataset, size_t memory_budget, int max_batch_size, const char *cache_path, TuneConfig *config);
+
+#endif